@@ -1204,6 +1204,31 @@ tape_save (const char * fname, uint16_t base_addr, uint16_t len, uint8_t save_da
     return rtc;
 }
 
+/*------------------------------------------------------------------------------------------------------------------------
+ * tape_load_at_end() - check if there are no more bytes to load on the current tape
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+uint8_t
+tape_load_at_end (void)
+{
+    int             ch;
+
+    if (! tape_load_fp)
+    {
+        return 1;
+    }
+
+    ch = getc (tape_load_fp);
+
+    if (ch == EOF)
+    {
+        return 1;
+    }
+
+    ungetc (ch, tape_load_fp);
+    return 0;
+}
+
 void
 tape_load_close (void)
 {
@@ -39,6 +39,7 @@
 extern uint8_t              tape_load (const char * fname, uint8_t tape_format, uint16_t base_addr, uint16_t maxlen, uint8_t load, uint8_t load_data);
 extern uint8_t              tape_save (const char * fname, uint16_t base_addr, uint16_t len, uint8_t save_data);
 extern void                 tape_load_close (void);
+extern uint8_t              tape_load_at_end (void);
 extern void                 tape_save_close (void);
 
 #endif // TAPE_H
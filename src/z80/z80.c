@@ -62,9 +62,21 @@ volatile uint32_t               uptime;
 #else // X11
 #include "lxx11.h"
 #endif
+#include <sys/mman.h>
+#include <fcntl.h>
 #include "lxmenu.h"
+#include "lxrom.h"
+#include "lxctrl.h"
+#include "lxrec.h"
+#include "lxcapture.h"
+#include "lxevdev.h"
+#include "lxtrace.h"
+#include "lxcoverage.h"
 volatile uint_fast8_t           steccy_exit = 0;
-static uint_fast8_t             update_display;
+static uint_fast8_t             update_display;                 // UPDATE_DISPLAY_xxx flags
+#define UPDATE_DISPLAY_FRAME    0x01                            // frame done
+#define UPDATE_DISPLAY_CTRL     0x02                            // input from control socket pending
+#define UPDATE_DISPLAY_REC      0x04                            // replayed events due
 #endif
 
 #define TRUE                    1
@@ -79,6 +91,52 @@ static uint_fast8_t             update_display;
 #else                                                               // no need to force inlining, any desktop PC is fast enough
 #define FORCE_INLINING          0
 #endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Block cache, needs write generations of RAM, see zxram.h
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define Z80_BLOCK_CACHE         ZX_RAM_WRITE_GEN
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Native code for hot blocks, only on x86-64 Linux, see z80_jit_compile()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#if Z80_BLOCK_CACHE == 1 && defined __x86_64__
+#define Z80_JIT                 1
+#include <sys/mman.h>
+#else
+#define Z80_JIT                 0
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Flag tables for 8 bit ADD/ADC/SUB/SBC/CP need 256 KB RAM, not on STM32
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#if defined STM32F4XX
+#define Z80_ALU_FLAG_TABLES     0
+#else
+#define Z80_ALU_FLAG_TABLES     1
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ROM hooks for the floating point calculator need double precision arithmetic of the host, not on STM32
+ * Verification of ROM hooks against the ROM needs two copies of the RAM, only Linux
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#if defined STM32F4XX
+#define Z80_ROM_HOOKS_CALC      0
+#define Z80_ROM_HOOKS_VERIFY    0
+#else
+#define Z80_ROM_HOOKS_CALC      1
+#include <math.h>
+#if defined FRAMEBUFFER || defined X11
+#define Z80_ROM_HOOKS_VERIFY    1
+#else
+#define Z80_ROM_HOOKS_VERIFY    0
+#endif
+#endif
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * Debugging
  *-------------------------------------------------------------------------------------------------------------------------------------------
@@ -107,12 +165,23 @@ uint_fast16_t                   z80_romsize;
  * ZX Spectrum system variables
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
+#define KSTATE                  23552                               // used in reading the keyboard, up to REPPER
+#define REPPER                  23562                               // delay between successive repeats of a key
+#define FLAGS                   23611                               // various flags to control the BASIC system
+#define TV_FLAG                 23612                               // flags associated with the television
+#define BORDCR                  23624                               // border colour, attributes of lower part of screen
+#define STKEND                  23653                               // address of start of spare space
+#define BREG                    23655                               // calculator's b register
+#define MEM                     23656                               // address of area used for calculator's memory
+#define FRAMES                  23672                               // 3 byte frame counter
 #define COORDS_X                23677                               // x coordinate of last point plotted
 #define COORDS_Y                23678                               // y coordinate of last point plotted
 #define P_FLAG                  23697                               // more flags
 
+#define ATTR_P                  23693                               // permanent current colours
 #define ATTR_T                  23695                               // temporary current colors, etc
 #define MASK_T                  23696                               // temporary mask, used for transparent colors
+#define MEMBOT_LEN              30                                  // length of calculator's memory area
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * STECCY Hooks
@@ -121,9 +190,27 @@ uint_fast16_t                   z80_romsize;
 #define STECCY_HOOK_ADDRESS     0x386E                              // free space in SINCLAIR ROM: 0x386E - 0x3CFF
 #define SERIAL_OUTPUT           0x3CFE
 #define SERIAL_INPUT            0x3CFF
-static int                      hooks_active = 0;
+static uint_fast8_t             hooks_active = 0;
 uint_fast8_t                    z80_user_cancelled_load;
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Known ROMs: ROM hooks replace ROM routines at fixed addresses, so they are only allowed for these images (FNV-1a 64 of the ROM file)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static const struct
+{
+    const char *                name;
+    uint64_t                    hash;
+} known_roms[] =
+{
+    { "48.rom",     0x0A927C36965E6E82ULL },
+    { "48u.rom",    0x8EC0A0D76C9A155CULL },
+    { "128.rom",    0x8DFE86023E7CFA66ULL },
+};
+
+static uint64_t                 rom_hash;                           // hash of loaded ROM
+static uint_fast8_t             rom_known;                          // flag: loaded ROM is one of known_roms[]
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * T-states in the upper 32KB RAM (no ULA access to RAM) or ROM
  *
@@ -199,6 +286,7 @@ uint_fast8_t                    z80_user_cancelled_load;
 #define SLEEP_MSEC                  10                                      // QT on PC
 #elif defined FRAMEBUFFER || defined X11
 #define SLEEP_USEC                  10000                                   // Linux
+#define MAX_LAG_USEC               100000                                   // Linux: give up catching up if more than 100 msec behind
 #elif defined (STM32F4XX)
 #endif
 
@@ -304,46 +392,96 @@ static uint8_t debug = 0;
 #define REG_IDX_IYL     11                                                  // index of reg IYL
 #define N_REGS          12                                                  // number of registers
 
-static uint8_t          z80_regs[N_REGS];                                   // main registers
-static uint8_t          z80_regs2[N_REGS];                                  // shadow registers
-
-#define REG_OFFSET_IX   (REG_IDX_IXH - REG_IDX_H)                           // = 4
-#define REG_OFFSET_IY   (REG_IDX_IYH - REG_IDX_H)                           // = 6
-
 #define REG_IDX_BC      0                                                   // index of reg pair BC
 #define REG_IDX_DE      1                                                   // index of reg pair DE
 #define REG_IDX_HL      2                                                   // index of reg pair HL
+#define REG_IDX_AF      3                                                   // index of reg pair AF
+#define REG_IDX_IX      4                                                   // index of reg pair IX
+#define REG_IDX_IY      5                                                   // index of reg pair IY
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Z80 register file
+ *
+ * The registers are stored as native 16 bit register pairs. z80_reg_byte[] maps the index of an 8 bit register to its byte, so that the
+ * high register (B, D, H, A, IXH, IYH) is the high byte of its pair on little and big endian hosts. A keeps index 7, which is needed to
+ * decode opcodes, and forms the pair AF with F at index 6.
+ *
+ * The main registers BC, DE, HL and AF are one 64 bit word, so EXX and EX AF,AF' swap one word.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_MASK_EXX    0xFFFFFFFFFFFF0000ULL                               // mask of BC, DE, HL in q[0]
+
+static const uint8_t    z80_reg_byte[N_REGS] = { 0, 1, 2, 3, 4, 5, 7, 6, 8, 9, 10, 11 };         // high byte first, A before F
+#else
+#define REG_MASK_EXX    0x0000FFFFFFFFFFFFULL                               // mask of BC, DE, HL in q[0]
+
+static const uint8_t    z80_reg_byte[N_REGS] = { 1, 0, 3, 2, 5, 4, 6, 7, 9, 8, 11, 10 };         // low byte first, F before A
+#endif
 
-#define reg_B           z80_regs[REG_IDX_B]                                 // content of reg B
-#define reg_C           z80_regs[REG_IDX_C]                                 // content of reg C
-#define reg_D           z80_regs[REG_IDX_D]                                 // content of reg D
-#define reg_E           z80_regs[REG_IDX_E]                                 // content of reg E
-#define reg_H           z80_regs[REG_IDX_H]                                 // content of reg H
-#define reg_L           z80_regs[REG_IDX_L]                                 // content of reg L
-#define reg_A           z80_regs[REG_IDX_A]                                 // content of reg A
-#define reg_F           z80_regs[REG_IDX_F]                                 // content of reg F
-#define reg_IXH         z80_regs[REG_IDX_IXH]                               // content of reg IXH
-#define reg_IXL         z80_regs[REG_IDX_IXL]                               // content of reg IXL
-#define reg_IYH         z80_regs[REG_IDX_IYH]                               // content of reg IYH
-#define reg_IYL         z80_regs[REG_IDX_IYL]                               // content of reg IYL
-
-#define reg_R(ridx)     z80_regs[ridx]                                      // indirect access to register
-
-#define reg_B2          z80_regs2[REG_IDX_B]                                // content of shadow reg B'
-#define reg_C2          z80_regs2[REG_IDX_C]                                // content of shadow reg C'
-#define reg_D2          z80_regs2[REG_IDX_D]                                // content of shadow reg D'
-#define reg_E2          z80_regs2[REG_IDX_E]                                // content of shadow reg E'
-#define reg_H2          z80_regs2[REG_IDX_H]                                // content of shadow reg H'
-#define reg_L2          z80_regs2[REG_IDX_L]                                // content of shadow reg L'
-#define reg_A2          z80_regs2[REG_IDX_A]                                // content of shadow reg A'
-#define reg_F2          z80_regs2[REG_IDX_F]                                // content of shadow reg F'
-
-#define reg_R2(ridx)    z80_regs2[ridx]                                     // indirect access to shadow register (not used)
-
-#define reg_BC          UINT16_T (((z80_regs[REG_IDX_BC << 1] << 8) | z80_regs[(REG_IDX_BC << 1) + 1]))     // content of reg pair BC
-#define reg_DE          UINT16_T (((z80_regs[REG_IDX_DE << 1] << 8) | z80_regs[(REG_IDX_DE << 1) + 1]))     // content of reg pair DE
-#define reg_HL          UINT16_T (((z80_regs[REG_IDX_HL << 1] << 8) | z80_regs[(REG_IDX_HL << 1) + 1]))     // content of reg pair HL
-#define reg_RR(rridx)   UINT16_T (((z80_regs[rridx << 1] << 8) | z80_regs[(rridx << 1) + 1]))               // indirect access to reg pair
+#define REG_BYTE(ridx)  (z80_reg_byte[ridx])                                // byte index of register
+
+#if defined __GNUC__
+#define Z80_CACHE_ALIGNED __attribute__((aligned(64)))
+#else
+#define Z80_CACHE_ALIGNED
+#endif
+
+typedef union
+{
+    uint8_t             b[16];                                              // 8 bit registers, index: REG_BYTE(ridx)
+    uint16_t            w[8];                                               // 16 bit register pairs, index: REG_IDX_BC ... REG_IDX_IY
+    uint64_t            q[2];                                               // q[0]: BC, DE, HL, AF, q[1]: IX, IY
+} Z80_REGS;
+
+typedef struct
+{
+    Z80_REGS            main;                                               // main registers
+    Z80_REGS            shadow;                                             // shadow registers (only BC, DE, HL, AF used)
+    uint16_t            sp;                                                 // stack pointer
+    uint16_t            pc;                                                 // program counter
+} Z80_REGFILE;
+
+static Z80_REGFILE      z80_regfile Z80_CACHE_ALIGNED;                      // register file, fits into one cache line
+
+#define reg_B           z80_regfile.main.b[REG_BYTE(REG_IDX_B)]             // content of reg B
+#define reg_C           z80_regfile.main.b[REG_BYTE(REG_IDX_C)]             // content of reg C
+#define reg_D           z80_regfile.main.b[REG_BYTE(REG_IDX_D)]             // content of reg D
+#define reg_E           z80_regfile.main.b[REG_BYTE(REG_IDX_E)]             // content of reg E
+#define reg_H           z80_regfile.main.b[REG_BYTE(REG_IDX_H)]             // content of reg H
+#define reg_L           z80_regfile.main.b[REG_BYTE(REG_IDX_L)]             // content of reg L
+#define reg_A           z80_regfile.main.b[REG_BYTE(REG_IDX_A)]             // content of reg A
+#define reg_F           z80_regfile.main.b[REG_BYTE(REG_IDX_F)]             // content of reg F
+#define reg_IXH         z80_regfile.main.b[REG_BYTE(REG_IDX_IXH)]           // content of reg IXH
+#define reg_IXL         z80_regfile.main.b[REG_BYTE(REG_IDX_IXL)]           // content of reg IXL
+#define reg_IYH         z80_regfile.main.b[REG_BYTE(REG_IDX_IYH)]           // content of reg IYH
+#define reg_IYL         z80_regfile.main.b[REG_BYTE(REG_IDX_IYL)]           // content of reg IYL
+
+#define reg_R(ridx)     z80_regfile.main.b[REG_BYTE(ridx)]                  // indirect access to register
+#define reg_IX_R(ridx)  (*((ridx) == REG_IDX_H ? &reg_IXH : (ridx) == REG_IDX_L ? &reg_IXL : &reg_R(ridx)))    // after prefix DD
+#define reg_IY_R(ridx)  (*((ridx) == REG_IDX_H ? &reg_IYH : (ridx) == REG_IDX_L ? &reg_IYL : &reg_R(ridx)))    // after prefix FD
+
+#define reg_B2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_B)]           // content of shadow reg B'
+#define reg_C2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_C)]           // content of shadow reg C'
+#define reg_D2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_D)]           // content of shadow reg D'
+#define reg_E2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_E)]           // content of shadow reg E'
+#define reg_H2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_H)]           // content of shadow reg H'
+#define reg_L2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_L)]           // content of shadow reg L'
+#define reg_A2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_A)]           // content of shadow reg A'
+#define reg_F2          z80_regfile.shadow.b[REG_BYTE(REG_IDX_F)]           // content of shadow reg F'
+
+#define reg_R2(ridx)    z80_regfile.shadow.b[REG_BYTE(ridx)]                // indirect access to shadow register (not used)
+
+#define reg_BC          z80_regfile.main.w[REG_IDX_BC]                      // content of reg pair BC
+#define reg_DE          z80_regfile.main.w[REG_IDX_DE]                      // content of reg pair DE
+#define reg_HL          z80_regfile.main.w[REG_IDX_HL]                      // content of reg pair HL
+#define reg_AF          z80_regfile.main.w[REG_IDX_AF]                      // content of reg pair AF
+#define reg_IX          z80_regfile.main.w[REG_IDX_IX]                      // content of reg pair IX
+#define reg_IY          z80_regfile.main.w[REG_IDX_IY]                      // content of reg pair IY
+#define reg_RR(rridx)   z80_regfile.main.w[rridx]                           // indirect access to reg pair
+
+#define reg_SP          z80_regfile.sp                                      // stack pointer
+#define reg_PC          z80_regfile.pc                                      // PC register
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * special Z80 registers
@@ -352,7 +490,6 @@ static uint8_t          z80_regs2[N_REGS];                                  // s
 static uint8_t          interrupt_mode = 0;                                 // current interrupt mode
 static uint8_t          reg_I;                                              // interrupt register
 static uint8_t          reg_R;                                              // refresh register, yet not used
-static uint16_t         reg_SP;                                             // stack pointer
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * Z80 register names - used by disassembler in debug mode
@@ -364,6 +501,14 @@ static const char *     z80_r_names[12] =
     "B", "C", "D", "E", "H", "L", "(HL)", "A", "IXH", "IXL", "IYH", "IYL",
 };
 
+static const char *     z80_r_names_ii[2][8] =                             // H and L after prefix DD resp. FD
+{
+    { "B", "C", "D", "E", "IXH", "IXL", "(HL)", "A" },
+    { "B", "C", "D", "E", "IYH", "IYL", "(HL)", "A" }
+};
+
+#define z80_r_name(ridx)    (ixflags ? z80_r_names_ii[0][ridx] : (iyflags ? z80_r_names_ii[1][ridx] : z80_r_names[ridx]))
+
 static const char *     z80_rr_names[6] =
 {
     "BC", "DE", "HL", "AF", "IX", "IY"
@@ -391,14 +536,14 @@ static const char *     z80_flagnames[16] =
 #define GET_IXL()           (reg_IXL)
 #define GET_IYH()           (reg_IYH)
 #define GET_IYL()           (reg_IYL)
-#define GET_R(ridx)         z80_regs[ridx]
+#define GET_R(ridx)         reg_R(ridx)
 
-#define GET_BC()            (UINT16_T (((reg_B << 8)   | reg_C)))
-#define GET_DE()            (UINT16_T (((reg_D << 8)   | reg_E)))
-#define GET_HL()            (UINT16_T (((reg_H << 8)   | reg_L)))
-#define GET_IX()            (UINT16_T (((reg_IXH << 8) | reg_IXL)))
-#define GET_IY()            (UINT16_T (((reg_IYH << 8) | reg_IYL)))
-#define GET_AF()            (UINT16_T (((reg_A << 8)   | reg_F)))
+#define GET_BC()            (reg_BC)
+#define GET_DE()            (reg_DE)
+#define GET_HL()            (reg_HL)
+#define GET_IX()            (reg_IX)
+#define GET_IY()            (reg_IY)
+#define GET_AF()            (reg_AF)
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * register access macros - set
@@ -416,29 +561,36 @@ static const char *     z80_flagnames[16] =
 #define SET_IXL(n)          do { reg_IXL = UINT8_T ((n)); } while (0)
 #define SET_IYH(n)          do { reg_IYH = UINT8_T ((n)); } while (0)
 #define SET_IYL(n)          do { reg_IYL = UINT8_T ((n)); } while (0)
-#define SET_R(ridx, n)      do { z80_regs[ridx] = UINT8_T ((n)); } while (0)
+#define SET_R(ridx, n)      do { reg_R(ridx) = UINT8_T ((n)); } while (0)
 
-#define SET_BC(nn)          do { reg_B   = UINT8_T (((nn) >> 8)), reg_C   = UINT8_T (((nn) & 0xFF)); } while (0)
-#define SET_DE(nn)          do { reg_D   = UINT8_T (((nn) >> 8)), reg_E   = UINT8_T (((nn) & 0xFF)); } while (0)
-#define SET_HL(nn)          do { reg_H   = UINT8_T (((nn) >> 8)), reg_L   = UINT8_T (((nn) & 0xFF)); } while (0)
-#define SET_AF(nn)          do { reg_A   = UINT8_T (((nn) >> 8)), reg_F   = UINT8_T (((nn) & 0xFF)); } while (0)
-#define SET_IX(nn)          do { reg_IXH = UINT8_T (((nn) >> 8)), reg_IXL = UINT8_T (((nn) & 0xFF)); } while (0)
-#define SET_IY(nn)          do { reg_IYH = UINT8_T (((nn) >> 8)), reg_IYL = UINT8_T (((nn) & 0xFF)); } while (0)
+#define SET_BC(nn)          do { reg_BC  = UINT16_T ((nn)); } while (0)
+#define SET_DE(nn)          do { reg_DE  = UINT16_T ((nn)); } while (0)
+#define SET_HL(nn)          do { reg_HL  = UINT16_T ((nn)); } while (0)
+#define SET_AF(nn)          do { reg_AF  = UINT16_T ((nn)); } while (0)
+#define SET_IX(nn)          do { reg_IX  = UINT16_T ((nn)); } while (0)
+#define SET_IY(nn)          do { reg_IY  = UINT16_T ((nn)); } while (0)
 
-#define SET_RR(rridx, nn)   do { z80_regs[rridx << 1] = UINT8_T (((nn) >> 8)), z80_regs[(rridx << 1) + 1] = UINT8_T (((nn) & 0xFF)); } while (0)
+#define SET_RR(rridx, nn)   do { reg_RR(rridx) = UINT16_T ((nn)); } while (0)
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * state variables used by Z80 emulator
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static uint16_t             cur_PC;                                         // current PC
-static uint16_t             reg_PC;                                         // PC register
 static uint8_t              iff1;                                           // interrupt flag #1
 static uint8_t              iff2;                                           // interrupt flag #2 (only for NMI)
 static uint8_t              ixflags;                                        // IX relevant opcode follows
 static uint8_t              iyflags;                                        // IY relevant opcode follows
 static uint8_t              last_ixiyflags;                                 // last state of ixflags / iyflags
 static uint32_t             clockcycles;                                    // clock cycles
+#if defined FRAMEBUFFER || defined X11
+static uint32_t             clockcycles_base;                               // clock cycles consumed by z80_idle_time()
+static uint32_t             lag_usec;                                       // how far emulation is behind real time
+uint_fast8_t                z80_unthrottled;                                // flag: never sleep, independent of turbo mode
+static uint_fast8_t         runahead_frames;                                // frames still to run ahead, 0: running the real frame
+static uint_fast8_t         runahead_backup_valid;                          // flag: RAM backup of run-ahead matches write generations
+static uint_fast8_t         trace_interrupt;                                // flag: interrupt accepted since last traced instruction
+#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * Z80 interrupts triggered by ZX spectrum ULA
@@ -450,6 +602,85 @@ static uint8_t              z80_interrupt           = 0;                    // f
 static volatile uint8_t     z80_do_pause            = 0;                    // flag: pause emulator
 #endif
 
+#if Z80_BLOCK_CACHE == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Port accesses in lockstep verification of the block cache, see z80_lockstep_run()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define Z80_LOCKSTEP_MAX_IO     32                                          // one port access per opcode of a block
+
+typedef struct
+{
+    uint8_t                 hi;                                             // upper byte of port address
+    uint8_t                 lo;                                             // lower byte of port address
+    uint8_t                 value;                                          // value read or written
+    uint8_t                 is_out;                                         // flag: OUT, else IN
+} Z80_LOCKSTEP_IO;
+
+static Z80_LOCKSTEP_IO *        lockstep_io;                                // log of port accesses, NULL: no logging
+static uint_fast8_t             lockstep_n_io;                              // number of logged port accesses
+static const Z80_LOCKSTEP_IO *  lockstep_replay;                            // port accesses to replay, NULL: access ports
+static uint_fast8_t             lockstep_n_replay;                          // number of port accesses to replay
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_lockstep_log_io() - log port access
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_lockstep_log_io (uint8_t hi, uint8_t lo, uint8_t value, uint8_t is_out)
+{
+    if (lockstep_n_io < Z80_LOCKSTEP_MAX_IO)
+    {
+        lockstep_io[lockstep_n_io].hi       = hi;
+        lockstep_io[lockstep_n_io].lo       = lo;
+        lockstep_io[lockstep_n_io].value    = value;
+        lockstep_io[lockstep_n_io].is_out   = is_out;
+        lockstep_n_io++;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_lockstep_in() - read port, in replay the value which the block cache has read
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+z80_lockstep_in (uint8_t hi, uint8_t lo)
+{
+    uint8_t     value;
+
+    if (! lockstep_replay)
+    {
+        value = zxio_in_port (hi, lo);
+    }
+    else if (lockstep_n_io < lockstep_n_replay && ! lockstep_replay[lockstep_n_io].is_out)
+    {
+        value = lockstep_replay[lockstep_n_io].value;
+    }
+    else
+    {
+        value = 0xFF;                                                       // no such IN: difference is reported later
+    }
+
+    z80_lockstep_log_io (hi, lo, value, FALSE);
+    return value;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_lockstep_out() - write port, in replay the port is not written again
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_lockstep_out (uint8_t hi, uint8_t lo, uint8_t value)
+{
+    if (! lockstep_replay)
+    {
+        zxio_out_port (hi, lo, value);
+    }
+
+    z80_lockstep_log_io (hi, lo, value, TRUE);
+}
+#endif // Z80_BLOCK_CACHE == 1
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * ZX spectrum tape variables
  *-------------------------------------------------------------------------------------------------------------------------------------------
@@ -497,6 +728,21 @@ static const uint8_t        parity_table[256] =                             // p
     1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 1, 0, 0, 1
 };
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Z80 flag tables, see z80_flags_init()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t              z80_flags_sz[256];                              // S, Z of result
+static uint8_t              z80_flags_szp[256];                             // S, Z, P of result
+static uint8_t              z80_flags_inc[256];                             // S, Z, H, V, N of result of INC
+static uint8_t              z80_flags_dec[256];                             // S, Z, H, V, N of result of DEC
+static uint_fast8_t         z80_flags_initialized;                          // flag: tables are initialized
+
+#if Z80_ALU_FLAG_TABLES == 1
+static uint8_t              z80_flags_add[2 * 256 * 256];                   // C, N, P/V, H, Z, S of ADD/ADC, index: carry << 16 | A << 8 | n
+static uint8_t              z80_flags_sub[2 * 256 * 256];                   // C, N, P/V, H, Z, S of SUB/SBC/CP, index: carry << 16 | A << 8 | n
+#endif
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * macros to handle clock cycles (T-states)
  *-------------------------------------------------------------------------------------------------------------------------------------------
@@ -706,14 +952,7 @@ set_flag_h_sub32 (uint16_t sub1, uint16_t sub2, uint8_t carry)
 static INLINE void
 set_flag_p (uint8_t value)
 {
-    if (parity_table[value])
-    {
-        SET_FLAG_PV();
-    }
-    else
-    {
-        RES_FLAG_PV();
-    }
+    reg_F = UINT8_T ((reg_F & ~FLAG_PV) | (parity_table[value] << FLAG_IDX_PV));
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -723,32 +962,7 @@ set_flag_p (uint8_t value)
 static INLINE void
 set_flags_c_z_s (uint16_t result16)
 {
-    if (result16 & 0x0100)
-    {
-        SET_FLAG_C();
-    }
-    else
-    {
-        RES_FLAG_C();
-    }
-
-    if (result16 & 0x00FF)
-    {
-        RES_FLAG_Z();
-    }
-    else
-    {
-        SET_FLAG_Z();
-    }
-
-    if (result16 & 0x0080)
-    {
-        SET_FLAG_S();
-    }
-    else
-    {
-        RES_FLAG_S();
-    }
+    reg_F = UINT8_T ((reg_F & ~(FLAG_C | FLAG_Z | FLAG_S)) | z80_flags_sz[result16 & 0xFF] | ((result16 >> 8) & FLAG_C));
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -758,23 +972,7 @@ set_flags_c_z_s (uint16_t result16)
 static INLINE void
 set_flags_z_s (uint16_t result16)
 {
-    if (result16 & 0x00FF)
-    {
-        RES_FLAG_Z();
-    }
-    else
-    {
-        SET_FLAG_Z();
-    }
-
-    if (result16 & 0x0080)
-    {
-        SET_FLAG_S();
-    }
-    else
-    {
-        RES_FLAG_S();
-    }
+    reg_F = UINT8_T ((reg_F & ~(FLAG_Z | FLAG_S)) | z80_flags_sz[result16 & 0xFF]);
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -829,6 +1027,152 @@ set_flags32_c_z_s (uint32_t result32)
     }
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * set_flags_add8 () - set flags of 8 bit addition: C, N, P/V, H, Z, S
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static INLINE void
+set_flags_add8 (uint8_t sum1, uint8_t sum2, uint8_t carry)
+{
+#if Z80_ALU_FLAG_TABLES == 1
+    reg_F = (reg_F & (FLAG_X1 | FLAG_X2)) | z80_flags_add[(carry << 16) | (sum1 << 8) | sum2];
+#else
+    uint16_t    result16;
+
+    result16 = UINT16_T (sum1 + sum2 + carry);
+    set_flag_h_add (sum1, sum2, carry);
+    set_flag_v_add (result16, sum1, sum2);
+    set_flags_c_z_s(result16);
+    RES_FLAG_N();
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * set_flags_sub8 () - set flags of 8 bit subtraction: C, N, P/V, H, Z, S
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static INLINE void
+set_flags_sub8 (uint8_t sub1, uint8_t sub2, uint8_t carry)
+{
+#if Z80_ALU_FLAG_TABLES == 1
+    reg_F = (reg_F & (FLAG_X1 | FLAG_X2)) | z80_flags_sub[(carry << 16) | (sub1 << 8) | sub2];
+#else
+    uint16_t    result16;
+
+    result16 = UINT16_T (sub1 - sub2 - carry);
+    set_flag_h_sub (sub1, sub2, carry);
+    set_flag_v_sub (result16, sub1, sub2);
+    set_flags_c_z_s(result16);
+    SET_FLAG_N();
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * set_flags_inc8 () - set flags of INC by result: N, P/V, H, Z, S
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static INLINE void
+set_flags_inc8 (uint8_t result)
+{
+    reg_F = (reg_F & (FLAG_C | FLAG_X1 | FLAG_X2)) | z80_flags_inc[result];
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * set_flags_dec8 () - set flags of DEC by result: N, P/V, H, Z, S
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static INLINE void
+set_flags_dec8 (uint8_t result)
+{
+    reg_F = (reg_F & (FLAG_C | FLAG_X1 | FLAG_X2)) | z80_flags_dec[result];
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * set_flags_logic8 () - set flags of AND/OR/XOR by result: C = 0, N = 0, P, Z, S and H as given
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static INLINE void
+set_flags_logic8 (uint8_t result, uint8_t flag_h)
+{
+    reg_F = (reg_F & (FLAG_X1 | FLAG_X2)) | z80_flags_szp[result] | flag_h;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_flags_init () - initialize flag tables
+ *
+ * The tables are calculated by the flag functions above, so they yield exactly the same flags.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_flags_init (void)
+{
+    uint16_t        result16;
+    uint_fast16_t   value;
+#if Z80_ALU_FLAG_TABLES == 1
+    uint_fast16_t   carry;
+    uint_fast16_t   op1;
+    uint_fast16_t   op2;
+    uint32_t        idx;
+#endif
+
+    if (z80_flags_initialized)
+    {
+        return;
+    }
+
+    for (value = 0; value < 256; value++)
+    {
+        z80_flags_sz[value]  = UINT8_T (((value & 0x80) ? FLAG_S : 0) | (value ? 0 : FLAG_Z));
+        z80_flags_szp[value] = UINT8_T (z80_flags_sz[value] | (parity_table[value] ? FLAG_PV : 0));
+
+        reg_F = 0;
+        set_flag_h_add (UINT8_T (value - 1), 1, 0);
+        set_flag_v_add (value, UINT8_T (value - 1), 1);
+        set_flags_z_s (value);
+        z80_flags_inc[value] = reg_F;
+
+        reg_F = 0;
+        set_flag_h_sub (UINT8_T (value + 1), 1, 0);
+        set_flag_v_sub (UINT16_T ((value + 1) - 1), UINT8_T (value + 1), 1);
+        set_flags_z_s (value);
+        SET_FLAG_N();
+        z80_flags_dec[value] = reg_F;
+    }
+
+#if Z80_ALU_FLAG_TABLES == 1
+    for (carry = 0; carry < 2; carry++)
+    {
+        for (op1 = 0; op1 < 256; op1++)
+        {
+            for (op2 = 0; op2 < 256; op2++)
+            {
+                idx = (carry << 16) | (op1 << 8) | op2;
+
+                reg_F = 0;
+                result16 = UINT16_T (op1 + op2 + carry);
+                set_flag_h_add (op1, op2, carry);
+                set_flag_v_add (result16, op1, op2);
+                set_flags_c_z_s (result16);
+                z80_flags_add[idx] = reg_F;
+
+                reg_F = 0;
+                result16 = UINT16_T (op1 - op2 - carry);
+                set_flag_h_sub (op1, op2, carry);
+                set_flag_v_sub (result16, op1, op2);
+                set_flags_c_z_s (result16);
+                SET_FLAG_N();
+                z80_flags_sub[idx] = reg_F;
+            }
+        }
+    }
+#else
+    (void) result16;
+#endif
+
+    reg_F = 0;
+    z80_flags_initialized = 1;
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * push16 () - push 16 bit value on stack
  *-------------------------------------------------------------------------------------------------------------------------------------------
@@ -881,11 +1225,8 @@ cmd_adc_a_n (void)
     ADD_CLOCKCYCLES(7);
     n = get_un ();
     result16 = UINT16_T (reg_A + n + (ISSET_FLAG_C()));
-    set_flag_h_add (reg_A, n, ISSET_FLAG_C());
-    set_flag_v_add (result16, reg_A, n);
+    set_flags_add8 (reg_A, n, ISSET_FLAG_C());
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    RES_FLAG_N();
     debug_printf ("ADC  A,%02Xh", n);
     reg_PC++;
 }
@@ -909,37 +1250,27 @@ static INLINE void
 cmd_adc_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("ADC  A,%s", z80_r_names[sridx]);
-    result16 = reg_A + reg_R(sridx) + (ISSET_FLAG_C());
-    set_flag_h_add (reg_A, reg_R(sridx), ISSET_FLAG_C());
-    set_flag_v_add (result16, reg_A, reg_R(sridx));
+    debug_printf ("ADC  A,%s", z80_r_name(sridx));
+    result16 = reg_A + *sreg + (ISSET_FLAG_C());
+    set_flags_add8 (reg_A, *sreg, ISSET_FLAG_C());
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    RES_FLAG_N();
     reg_PC++;
 }
 
@@ -990,11 +1321,8 @@ cmd_adc_a_ind_ii (void)
 
     value = zx_ram_get_8 (addr);
     result16 = reg_A + value + (ISSET_FLAG_C());
-    set_flag_h_add (reg_A, value, ISSET_FLAG_C());
-    set_flag_v_add (result16, reg_A, value);
+    set_flags_add8 (reg_A, value, ISSET_FLAG_C());
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    RES_FLAG_N();
     reg_PC++;
 }
 
@@ -1077,37 +1405,27 @@ static INLINE void
 cmd_add_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("ADD  A,%s", z80_r_names[sridx]);
-    result16 = reg_A + reg_R(sridx);
-    set_flag_h_add (reg_A, reg_R(sridx), 0);
-    set_flag_v_add (result16, reg_A, reg_R(sridx));
+    debug_printf ("ADD  A,%s", z80_r_name(sridx));
+    result16 = reg_A + *sreg;
+    set_flags_add8 (reg_A, *sreg, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    RES_FLAG_N();
     reg_PC++;
 }
 
@@ -1157,11 +1475,8 @@ cmd_add_a_ind_ii (void)
 
     value = zx_ram_get_8 (addr);
     result16 = reg_A + value;
-    set_flag_h_add (reg_A, value, 0);
-    set_flag_v_add (result16, reg_A, value);
+    set_flags_add8 (reg_A, value, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    RES_FLAG_N();
     reg_PC++;
 }
 
@@ -1188,11 +1503,8 @@ cmd_add_a_n (void)
     ADD_CLOCKCYCLES(7);
     n = get_un ();
     result16 = reg_A + n;
-    set_flag_h_add (reg_A, n, 0);
-    set_flag_v_add (result16, reg_A, n);
+    set_flags_add8 (reg_A, n, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    RES_FLAG_N();
     debug_printf ("ADD  %02Xh", n);
     reg_PC++;
 }
@@ -1368,38 +1680,27 @@ static INLINE void
 cmd_and_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("AND  A,%s", z80_r_names[sridx]);
-    result16 = reg_A & reg_R(sridx);
+    debug_printf ("AND  A,%s", z80_r_name(sridx));
+    result16 = reg_A & *sreg;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    SET_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, FLAG_H);
     reg_PC++;
 }
 
@@ -1450,11 +1751,7 @@ cmd_and_a_ind_ii (void)
     value = zx_ram_get_8 (addr);
     result16 = reg_A & value;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    SET_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, FLAG_H);
     reg_PC++;
 }
 
@@ -1482,11 +1779,7 @@ cmd_and_n (void)
     n = get_un ();
     result16 = reg_A & n;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    SET_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, FLAG_H);
     debug_printf ("AND  %02Xh", n);
     reg_PC++;
 }
@@ -1607,37 +1900,25 @@ cmd_ccf (void)
 static INLINE void
 cmd_cp_a_r (uint8_t sridx)
 {
-    uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("CP   A,%s", z80_r_names[sridx]);
-    result16 = reg_A - reg_R(sridx);
-    set_flag_h_sub (reg_A, reg_R(sridx), 0);
-    set_flag_v_sub (result16, reg_A, reg_R(sridx));
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
+    debug_printf ("CP   A,%s", z80_r_name(sridx));
+    set_flags_sub8 (reg_A, *sreg, 0);
     reg_PC++;
 }
 
@@ -1659,7 +1940,6 @@ cmd_cp_a_r (uint8_t sridx)
 static INLINE void
 cmd_cp_a_ind_ii (void)
 {
-    uint16_t    result16;
     uint16_t    addr;
     uint8_t     value;
     int8_t      d;
@@ -1686,11 +1966,7 @@ cmd_cp_a_ind_ii (void)
     }
 
     value = zx_ram_get_8 (addr);
-    result16 = reg_A - value;
-    set_flag_h_sub (reg_A, value, 0);
-    set_flag_v_sub (result16, reg_A, value);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
+    set_flags_sub8 (reg_A, value, 0);
     reg_PC++;
 }
 
@@ -1711,16 +1987,11 @@ cmd_cp_a_ind_ii (void)
 static INLINE void
 cmd_cp_a_n (void)
 {
-    uint16_t    result16;
     uint8_t n;
 
     ADD_CLOCKCYCLES(7);
     n = get_un ();
-    result16 = reg_A - n;
-    set_flag_h_sub (reg_A, n, 0);
-    set_flag_v_sub (result16, reg_A, n);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
+    set_flags_sub8 (reg_A, n, 0);
     debug_printf ("CP   %02Xh", n);
     reg_PC++;
 }
@@ -2111,8 +2382,7 @@ cmd_daa (void)
     }
 
     reg_A = UINT8_T (result16);
-    set_flags_z_s (result16);
-    set_flag_p (reg_A);
+    reg_F = UINT8_T ((reg_F & ~(FLAG_PV | FLAG_Z | FLAG_S)) | z80_flags_szp[reg_A]);
     debug_printf ("DAA");
     reg_PC++;
 }
@@ -2136,37 +2406,27 @@ static INLINE void
 cmd_dec_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    result16 = reg_R(sridx) - 1;
-    set_flag_h_sub (reg_R(sridx), 1, 0);
-    set_flag_v_sub (result16, reg_R(sridx), 1);
-    reg_R(sridx) = UINT8_T (result16);
-    set_flags_z_s(result16);
-    SET_FLAG_N();
-    debug_printf ("DEC  %s", z80_r_names[sridx]);
+    result16 = *sreg - 1;
+    *sreg = UINT8_T (result16);
+    set_flags_dec8 (UINT8_T (result16));
+    debug_printf ("DEC  %s", z80_r_name(sridx));
     reg_PC++;
 }
 
@@ -2216,11 +2476,8 @@ cmd_dec_ind_ii (void)
 
     ramval = zx_ram_get_8 (addr);
     result16 = ramval - 1;
-    set_flag_h_sub (ramval, 1, 0);
-    set_flag_v_sub (result16, ramval, 1);
     zx_ram_set_8 (addr, UINT8_T (result16));
-    set_flags_z_s(result16);
-    SET_FLAG_N();
+    set_flags_dec8 (UINT8_T (result16));
     reg_PC++;
 }
 
@@ -2377,18 +2634,12 @@ cmd_ei (void)
 static INLINE void
 cmd_ex_af_af (void)
 {
-    uint8_t reg_A_temp;
-    uint8_t reg_F_temp;
+    uint16_t    af;
 
     ADD_CLOCKCYCLES(4);
-
-    reg_A_temp = reg_A;
-    reg_F_temp = reg_F;
-
-    reg_A   = reg_A2;
-    reg_F   = reg_F2;
-    reg_A2  = reg_A_temp;
-    reg_F2  = reg_F_temp;
+    af                                  = reg_AF;
+    reg_AF                              = z80_regfile.shadow.w[REG_IDX_AF];
+    z80_regfile.shadow.w[REG_IDX_AF]    = af;
     debug_printf ("EX   AF,AF'");
     reg_PC++;
 }
@@ -2404,17 +2655,13 @@ cmd_ex_af_af (void)
 static INLINE void
 cmd_ex_de_hl (void)
 {
-    uint8_t     l;
-    uint8_t     h;
+    uint16_t    hl;
 
     ADD_CLOCKCYCLES(4);
 
-    l = reg_L;
-    h = reg_H;
-    reg_L = reg_E;
-    reg_H = reg_D;
-    reg_E = l;
-    reg_D = h;
+    hl      = reg_HL;
+    reg_HL  = reg_DE;
+    reg_DE  = hl;
     debug_printf ("EX   DE,HL");
     reg_PC++;
 }
@@ -2496,15 +2743,12 @@ cmd_ex_ind_sp_ii (void)
 static INLINE void
 cmd_exx (void)
 {
-    uint8_t temp;
+    uint64_t    diff;
 
     ADD_CLOCKCYCLES(4);
-    temp = reg_B; reg_B = reg_B2; reg_B2 = temp;
-    temp = reg_C; reg_C = reg_C2; reg_C2 = temp;
-    temp = reg_D; reg_D = reg_D2; reg_D2 = temp;
-    temp = reg_E; reg_E = reg_E2; reg_E2 = temp;
-    temp = reg_H; reg_H = reg_H2; reg_H2 = temp;
-    temp = reg_L; reg_L = reg_L2; reg_L2 = temp;
+    diff = (z80_regfile.main.q[0] ^ z80_regfile.shadow.q[0]) & REG_MASK_EXX;  // swap BC, DE, HL, keep AF
+    z80_regfile.main.q[0]   ^= diff;
+    z80_regfile.shadow.q[0] ^= diff;
 
     debug_printf ("EXX");
     reg_PC++;
@@ -2616,9 +2860,7 @@ cmd_in_r_ind_c (uint8_t ridx)
     ADD_CLOCKCYCLES(12);
     result16 = zxio_in_port (reg_B, reg_C);
     SET_R(ridx, result16);
-    set_flags_z_s(result16);
-    RES_FLAG_N();
-    set_flag_p(GET_R(ridx));
+    reg_F = UINT8_T ((reg_F & ~(FLAG_N | FLAG_PV | FLAG_Z | FLAG_S)) | z80_flags_szp[GET_R(ridx)]);
     reg_PC++;
     debug_printf ("IN   %s,(C)", z80_r_names[ridx]);
 }
@@ -2644,9 +2886,7 @@ cmd_in_ind_c (void)
 
     ADD_CLOCKCYCLES(12);
     result16 = zxio_in_port (reg_B, reg_C);
-    set_flags_z_s(result16);
-    RES_FLAG_N();
-    set_flag_p(UINT8_T (result16));
+    reg_F = UINT8_T ((reg_F & ~(FLAG_N | FLAG_PV | FLAG_Z | FLAG_S)) | z80_flags_szp[UINT8_T (result16)]);
     reg_PC++;
     debug_printf ("IN   (C)");
 }
@@ -2666,7 +2906,11 @@ cmd_in_a_ind_n (void)
 
     ADD_CLOCKCYCLES(11);
     n = get_un ();
+#if Z80_BLOCK_CACHE == 1
+    reg_A = lockstep_io ? z80_lockstep_in (reg_A, n) : zxio_in_port (reg_A, n);
+#else
     reg_A = zxio_in_port (reg_A, n);
+#endif
     reg_PC++;
     debug_printf ("IN   A,(%02Xh)", n);
 }
@@ -2690,37 +2934,27 @@ static INLINE void
 cmd_inc_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    result16 = reg_R(sridx) + 1;
-    set_flag_h_add (reg_R(sridx), 1, 0);
-    set_flag_v_add (result16, reg_R(sridx), 1);
-    reg_R(sridx) = UINT8_T (result16);
-    RES_FLAG_N();
-    set_flags_z_s(result16);
-    debug_printf ("INC  %s", z80_r_names[sridx]);
+    result16 = *sreg + 1;
+    *sreg = UINT8_T (result16);
+    set_flags_inc8 (UINT8_T (result16));
+    debug_printf ("INC  %s", z80_r_name(sridx));
     reg_PC++;
 }
 
@@ -2770,11 +3004,8 @@ cmd_inc_ind_ii (void)
 
     ramval = zx_ram_get_8 (addr);
     result16 = ramval + 1;
-    set_flag_h_add (ramval, 1, 0);
-    set_flag_v_add (result16, ramval, 1);
     zx_ram_set_8 (addr, UINT8_T (result16));
-    RES_FLAG_N();
-    set_flags_z_s(result16);
+    set_flags_inc8 (UINT8_T (result16));
     reg_PC++;
 }
 
@@ -3400,14 +3631,15 @@ cmd_ld_sp_nn (void)
 static INLINE void
 cmd_ld_r_n (uint8_t ridx)
 {
-    uint8_t n;
+    uint8_t *   rreg = &reg_R(ridx);
+    uint8_t     n;
 
     if (ixflags)
     {
         if (ridx == REG_IDX_H || ridx == REG_IDX_L)
         {
             ADD_CLOCKCYCLES(11);
-            ridx += REG_OFFSET_IX;
+            rreg = &reg_IX_R(ridx);
         }
     }
     else if (iyflags)
@@ -3415,7 +3647,7 @@ cmd_ld_r_n (uint8_t ridx)
         if (ridx == REG_IDX_H || ridx == REG_IDX_L)
         {
             ADD_CLOCKCYCLES(11);
-            ridx += REG_OFFSET_IY;
+            rreg = &reg_IY_R(ridx);
         }
     }
     else
@@ -3424,8 +3656,8 @@ cmd_ld_r_n (uint8_t ridx)
     }
 
     n = get_un ();
-    reg_R(ridx) = n;
-    debug_printf ("LD   %s,%02Xh", z80_r_names[ridx], n);
+    *rreg = n;
+    debug_printf ("LD   %s,%02Xh", z80_r_name(ridx), n);
     reg_PC++;
 }
 
@@ -3441,39 +3673,28 @@ cmd_ld_r_n (uint8_t ridx)
 static INLINE void
 cmd_ld_r_r (uint8_t tridx, uint8_t sridx)
 {
+    uint8_t *   treg = &reg_R(tridx);
+    uint8_t *   sreg = &reg_R(sridx);
+
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (tridx == REG_IDX_H || tridx == REG_IDX_L)
-        {
-            tridx += REG_OFFSET_IX;
-        }
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        treg = &reg_IX_R(tridx);
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (tridx == REG_IDX_H || tridx == REG_IDX_L)
-        {
-            tridx += REG_OFFSET_IY;
-        }
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        treg = &reg_IY_R(tridx);
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("LD   %s,%s", z80_r_names[tridx], z80_r_names[sridx]);
-    reg_R(tridx) = reg_R(sridx);
+    debug_printf ("LD   %s,%s", z80_r_name(tridx), z80_r_name(sridx));
+    *treg = *sreg;
     reg_PC++;
 }
 
@@ -4075,11 +4296,8 @@ cmd_neg (void)
     }
 
     result16 = 0 - reg_A;
-    set_flag_h_sub (0, reg_A, 0);
-    set_flag_v_sub (result16, 0, reg_A);
+    set_flags_sub8 (0, reg_A, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     reg_PC++;
 }
 
@@ -4118,38 +4336,27 @@ static INLINE void
 cmd_or_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("OR   A,%s", z80_r_names[sridx]);
-    result16 = reg_A | reg_R(sridx);
+    debug_printf ("OR   A,%s", z80_r_name(sridx));
+    result16 = reg_A | *sreg;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    RES_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, 0);
     reg_PC++;
 }
 
@@ -4200,11 +4407,7 @@ cmd_or_a_ind_ii (void)
     value = zx_ram_get_8 (addr);
     result16 = reg_A | value;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    RES_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, 0);
     reg_PC++;
 }
 
@@ -4232,11 +4435,7 @@ cmd_or_a_n (void)
     n = get_un ();
     result16 = reg_A | n;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    RES_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, 0);
     reg_PC++;
     debug_printf ("OR   A,%02Xh", n);
 }
@@ -4257,7 +4456,18 @@ cmd_out_ind_n_a (void)
     ADD_CLOCKCYCLES(11);
     n = get_un ();
 
+#if Z80_BLOCK_CACHE == 1
+    if (lockstep_io)
+    {
+        z80_lockstep_out (reg_B, n, reg_A);
+    }
+    else
+    {
+        zxio_out_port (reg_B, n, reg_A);
+    }
+#else
     zxio_out_port (reg_B, n, reg_A);
+#endif
     debug_printf ("OUT  (%02Xh),A", n);
     reg_PC++;
 }
@@ -4470,8 +4680,7 @@ cmd_pop_af (void)
     ADD_CLOCKCYCLES(10);
     debug_printf ("POP  AF");
     result16 = pop16();
-    reg_A = (result16 >> 8) & 0xFF;
-    reg_F = result16 & 0xFF;
+    SET_AF(result16);
     reg_PC++;
 }
 
@@ -4549,7 +4758,7 @@ cmd_push_af (void)
     uint16_t    result16;
 
     ADD_CLOCKCYCLES(11);
-    result16 = UINT16_T ((reg_A << 8) | reg_F);
+    result16 = GET_AF();
     debug_printf ("PUSH AF");
     push16(result16);
     reg_PC++;
@@ -5018,37 +5227,27 @@ static INLINE void
 cmd_sub_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("SUB  A,%s", z80_r_names[sridx]);
-    result16 = reg_A - reg_R(sridx);
-    set_flag_h_sub (reg_A, reg_R(sridx), 0);
-    set_flag_v_sub (result16, reg_A, reg_R(sridx));
+    debug_printf ("SUB  A,%s", z80_r_name(sridx));
+    result16 = reg_A - *sreg;
+    set_flags_sub8 (reg_A, *sreg, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     reg_PC++;
 }
 
@@ -5098,11 +5297,8 @@ cmd_sub_a_ind_ii (void)
 
     value = zx_ram_get_8 (addr);
     result16 = reg_A - value;
-    set_flag_h_sub (reg_A, value, 0);
-    set_flag_v_sub (result16, reg_A, value);
+    set_flags_sub8 (reg_A, value, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     reg_PC++;
 }
 
@@ -5125,37 +5321,27 @@ static INLINE void
 cmd_sbc_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("SBC  A,%s", z80_r_names[sridx]);
-    result16 = reg_A - reg_R(sridx) - (ISSET_FLAG_C());
-    set_flag_h_sub (reg_A, reg_R(sridx), ISSET_FLAG_C());
-    set_flag_v_sub (result16, reg_A, reg_R(sridx));
+    debug_printf ("SBC  A,%s", z80_r_name(sridx));
+    result16 = reg_A - *sreg - (ISSET_FLAG_C());
+    set_flags_sub8 (reg_A, *sreg, ISSET_FLAG_C());
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     reg_PC++;
 }
 
@@ -5205,11 +5391,8 @@ cmd_sbc_a_ind_ii (void)
 
     value = zx_ram_get_8 (addr);
     result16 = reg_A - value - (ISSET_FLAG_C());
-    set_flag_h_sub (reg_A, value, ISSET_FLAG_C());
-    set_flag_v_sub (result16, reg_A, value);
+    set_flags_sub8 (reg_A, value, ISSET_FLAG_C());
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     reg_PC++;
 }
 
@@ -5236,11 +5419,8 @@ cmd_sub_a_n (void)
     ADD_CLOCKCYCLES(7);
     n = get_un ();
     result16 = UINT16_T (reg_A - n);
-    set_flag_h_sub (reg_A, n, 0);
-    set_flag_v_sub (result16, reg_A, n);
+    set_flags_sub8 (reg_A, n, 0);
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     debug_printf ("SUB  A,%02Xh", UINT16_T (n));
     reg_PC++;
 }
@@ -5268,11 +5448,8 @@ cmd_sbc_a_n (void)
     ADD_CLOCKCYCLES(7);
     n = get_un ();
     result16 = UINT16_T (reg_A - n - (ISSET_FLAG_C()));
-    set_flag_h_sub (reg_A, n, ISSET_FLAG_C());
-    set_flag_v_sub (result16, reg_A, n);
+    set_flags_sub8 (reg_A, n, ISSET_FLAG_C());
     reg_A = UINT8_T (result16);
-    set_flags_c_z_s(result16);
-    SET_FLAG_N();
     debug_printf ("SBC  %02Xh", n);
     reg_PC++;
 }
@@ -5356,38 +5533,27 @@ static INLINE void
 cmd_xor_a_r (uint8_t sridx)
 {
     uint16_t    result16;
+    uint8_t *   sreg = &reg_R(sridx);
 
     if (ixflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IX;
-        }
+        sreg = &reg_IX_R(sridx);
     }
     else if (iyflags)
     {
         ADD_CLOCKCYCLES(8);
-
-        if (sridx == REG_IDX_H || sridx == REG_IDX_L)
-        {
-            sridx += REG_OFFSET_IY;
-        }
+        sreg = &reg_IY_R(sridx);
     }
     else
     {
         ADD_CLOCKCYCLES(4);
     }
 
-    debug_printf ("XOR  A,%s", z80_r_names[sridx]);
-    result16 = reg_A ^ reg_R(sridx);
+    debug_printf ("XOR  A,%s", z80_r_name(sridx));
+    result16 = reg_A ^ *sreg;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    RES_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, 0);
     reg_PC++;
 }
 
@@ -5438,11 +5604,7 @@ cmd_xor_a_ind_ii (void)
     value = zx_ram_get_8 (addr);
     result16 = reg_A ^ value;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    RES_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, 0);
     reg_PC++;
 }
 
@@ -5471,11 +5633,7 @@ cmd_xor_a_n (void)
     debug_printf ("XOR  A,%02Xh", n);
     result16 = reg_A ^ n;
     reg_A = UINT8_T (result16);
-    set_flags_z_s(result16);
-    RES_FLAG_C();
-    RES_FLAG_N();
-    RES_FLAG_H();
-    set_flag_p(reg_A);
+    set_flags_logic8 (reg_A, 0);
     reg_PC++;
 }
 
@@ -6177,1546 +6335,5411 @@ z80_extd (void)
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_reset() - reset Z80
+ * Traps
+ *
+ * Every address which needs special handling before its opcode is executed (tape traps, ROM hooks, STECCY hooks, breakpoints) is
+ * registered by z80_trap_add(). z80() only tests one bit per M1 cycle in z80_trap_bitmap. There is one bitmap for the memory
+ * configuration with the 48K BASIC ROM paged in and one for all other configurations. z80_trap_update() rebuilds both bitmaps if
+ * traps or settings change, z80_trap_select() selects the bitmap if ROM paging changes.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_reset (void)
-{
-    memset (z80_regs, 0, N_REGS);
-    memset (z80_regs2, 0, N_REGS);
+#define Z80_MAX_TRAPS           32                                          // max. number of traps
 
-    reg_SP                  = 0x0000;
-    reg_PC                  = 0x0000;
-    cur_PC                  = 0x0000;
-    iff1                    = 0;
-    ixflags                 = 0;
-    iyflags                 = 0;
-    last_ixiyflags          = 0;
-    interrupt_mode          = 0;
-    clockcycles             = 0;
+#if defined FRAMEBUFFER || defined X11
+static uint_fast8_t     boot_cache_wait;                                    // flag: cold boot running, wait for ready point, see Z80_TRAP_BOOT
+#endif
 
-    zx_border_color         = 0;
-    zx_ram_init (z80_romsize);
+typedef struct
+{
+    uint16_t        addr;                                                   // address
+    uint_fast8_t    flags;                                                  // Z80_TRAP_ROM48, Z80_TRAP_ROM_HOOKS, Z80_TRAP_STECCY
+    void            (*func)(void);                                          // callback
+} Z80_TRAP;
 
-    debug_printf ("RESET\n");
-}
+static Z80_TRAP         z80_traps[Z80_MAX_TRAPS];                           // registered traps
+static uint_fast8_t     z80_n_traps;                                        // number of registered traps
+static uint32_t         z80_trap_bitmaps[2][0x10000 / 32];                  // [0]: other, [1]: 48K BASIC ROM paged in
+static uint32_t *       z80_trap_bitmap = z80_trap_bitmaps[0];              // current bitmap
+static uint_fast8_t     z80_trap_rom48;                                     // flag: 48K BASIC ROM paged in
+
+#define Z80_TRAP_IS_SET(a)      (z80_trap_bitmap[(a) >> 5] & (1UL << ((a) & 0x1F)))
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_pause() - pause Z80 (toggle)
+ * Z80 block cache
+ *
+ * Straight-line code is decoded once into a block of instructions, keyed by bank and start address. Each instruction is stored with its
+ * handler and its operand (n, nn, destination of a relative jump or opcode after a DD/FD prefix), so the handlers of the most frequent
+ * instructions with immediate operands don't fetch them again. A block ends with the first instruction which changes the program flow
+ * or may switch memory banks, before an address with a trap (see z80_trap_add()), or before an instruction which crosses the end of a
+ * 256 byte page.
+ *
+ * Every write into the page of a block increments the write generation of this page (see zx_ram_set_8()). If the generation changes,
+ * the block is decoded again. Only instructions which may write into RAM are followed by a check of the generation, so self-modifying
+ * code stops the block after the writing instruction. Events are checked once per block: a block is only started if z80_idle_time()
+ * cannot get due before its end, see Z80_BLOCK_MAX_CLOCKCYCLES. Then z80_block_run() continues with the next block without returning
+ * to z80().
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#if defined QT_CORE_LIB
-void
-z80_pause (void)
+#if Z80_BLOCK_CACHE == 1
+
+#define Z80_BLOCK_CACHE_SIZE    4096                                        // number of cached blocks, must be a power of 2
+#define Z80_BLOCK_MAX_OPCODES   32                                          // max. number of instructions per block
+#define Z80_BLOCK_MAX_CLOCKCYCLES   (Z80_BLOCK_MAX_OPCODES * 23)            // max. T-states of a block, 23: e.g. SET b,(IX+d)
+
+typedef struct
 {
-    if (z80_do_pause)
-    {
-        z80_do_pause = 0;
-    }
-    else
-    {
-        z80_do_pause = 1;
-    }
-}
+    void            (*fn)(uint_fast16_t);                                   // handler, gets operand
+    uint16_t        operand;                                                // n, nn, destination of JR/DJNZ or opcode after DD/FD
+    uint8_t         opcode;                                                 // first byte of instruction
+    uint8_t         len;                                                    // length of instruction
+    uint8_t         check_gen;                                              // flag: may write into RAM, check write generation
+} Z80_BLOCK_INSN;
+
+typedef struct
+{
+    uint8_t *       bankptr;                                                // bank of block, NULL: unused
+    uint32_t *      genptr;                                                 // pointer to write generation of page
+    uint32_t        gen;                                                    // write generation while decoding
+    uint16_t        pc;                                                     // start address
+    uint8_t         n_insns;                                                // number of instructions, 0: not cacheable
+#if Z80_JIT == 1
+    uint16_t        hits;                                                   // number of executions, see Z80_JIT_THRESHOLD
+    void            (*code)(void);                                          // native code of block or NULL
+#endif
+    Z80_BLOCK_INSN  insns[Z80_BLOCK_MAX_OPCODES];                           // instructions
+} Z80_BLOCK;
+
+static Z80_BLOCK            z80_blocks[Z80_BLOCK_CACHE_SIZE];
+
+#if Z80_JIT == 1
+#define Z80_JIT_THRESHOLD       64                                          // executions of a block before it gets compiled
+#define Z80_JIT_CODE_SIZE       (4 * 1024 * 1024)                           // size of code buffer
+
+static uint8_t *            z80_jit_code;                                   // code buffer, NULL: not yet allocated
+static uint32_t             z80_jit_code_pos;                               // next free byte in code buffer
+static uint_fast8_t         z80_jit_failed;                                 // flag: no executable memory available
 #endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_leave_focus () - leave focus and enter menu
+ * z80_block_cache_flush() - invalidate all blocks, must be called if memory has been changed without zx_ram_set_8()
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#if defined STM32F4XX || defined FRAMEBUFFER || defined X11
-void
-z80_leave_focus (void)
+static void
+z80_block_cache_flush (void)
 {
-    z80_focus = FALSE;
+    memset (z80_blocks, 0, sizeof (z80_blocks));
+#if Z80_JIT == 1
+    z80_jit_code_pos = 0;
+#endif
+#if defined FRAMEBUFFER || defined X11
+    runahead_backup_valid = 0;                                              // same for the RAM backup of run-ahead
+#endif
 }
 
-void
-z80_enter_focus (void)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_cache_invalidate() - invalidate blocks which contain address or end before it, e.g. if a trap has been added or removed
+ *
+ * A block doesn't cross the end of a 256 byte page, so only blocks starting up to 256 bytes before addr are checked. Their native code
+ * stays in the code buffer until it gets flushed.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_cache_invalidate (uint16_t addr)
 {
-    z80_focus = TRUE;
+    Z80_BLOCK *     block;
+    uint_fast16_t   dist;
+    uint_fast16_t   len;
+    uint_fast8_t    n;
+    uint16_t        pc;
+
+    for (dist = 0; dist <= (1U << ZX_RAM_GEN_PAGE_SHIFT); dist++)
+    {
+        pc      = UINT16_T (addr - dist);
+        block   = z80_blocks + (pc & (Z80_BLOCK_CACHE_SIZE - 1));
+
+        if (block->bankptr && block->pc == pc)
+        {
+            for (len = 0, n = 0; n < block->n_insns; n++)
+            {
+                len += block->insns[n].len;
+            }
+
+            if (dist <= len)
+            {
+                block->bankptr = NULL;                                      // decode again
+            }
+        }
+    }
 }
-#endif
+
+#endif // Z80_BLOCK_CACHE == 1
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_next_turbo_mode () - set next turbo mode
+ * z80_trap_active() - check if trap is active in given memory configuration
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#if defined STM32F4XX || defined FRAMEBUFFER || defined X11
-void
-z80_next_turbo_mode (void)
+static uint_fast8_t
+z80_trap_active (Z80_TRAP * trap, uint_fast8_t rom48)
 {
-    z80_settings.turbo_mode++;
+    if ((trap->flags & Z80_TRAP_ROM48) && ! rom48)
+    {
+        return FALSE;
+    }
 
-    if (z80_settings.turbo_mode == 2)
+    if ((trap->flags & Z80_TRAP_ROM_HOOKS) && (! z80_settings.rom_hooks || ! rom_known))
     {
-        z80_settings.turbo_mode = 0;
+        return FALSE;
     }
 
-    z80_settings.rom_hooks = z80_settings.turbo_mode;
+    if ((trap->flags & Z80_TRAP_STECCY) && ! hooks_active)
+    {
+        return FALSE;
+    }
 
-#if defined STM32F4XX
-        zxscr_update_status ();
-#elif defined unix
-        menu_update_status ();
+    if ((trap->flags & Z80_TRAP_ROM_MATH) && ! z80_settings.rom_hooks_math)
+    {
+        return FALSE;
+    }
+
+#if defined FRAMEBUFFER || defined X11
+    if ((trap->flags & Z80_TRAP_BOOT) && ! boot_cache_wait)
+    {
+        return FALSE;
+    }
 #endif
+
+    return TRUE;
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_select() - select trap bitmap of current ROM paging
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
 void
-z80_set_turbo_mode (uint_fast8_t active)
+z80_trap_select (void)
 {
-    if (z80_settings.turbo_mode != active)
-    {
-        z80_settings.turbo_mode = active;
-#if defined STM32F4XX
-        zxscr_update_status ();
-#elif defined unix
-        menu_update_status ();
-#endif
-    }
-}
+    z80_trap_rom48 = ((z80_romsize == 0x4000 && steccy_bankptr[0] == steccy_rombankptr[0]) ||
+                      (z80_romsize == 0x8000 && steccy_bankptr[0] == steccy_rombankptr[1]));
 
-uint_fast8_t
-z80_get_turbo_mode (void)
-{
-    return z80_settings.turbo_mode;
+    z80_trap_bitmap = z80_trap_bitmaps[z80_trap_rom48];
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_update() - rebuild trap bitmaps
+ *
+ * Blocks end before trap addresses, so the blocks at all addresses whose bit has changed in one of the bitmaps are decoded again.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
 void
-z80_set_rom_hooks (uint_fast8_t active)
+z80_trap_update (void)
 {
-    if (z80_settings.rom_hooks != active)
-    {
-        z80_settings.rom_hooks = active;
-#if defined STM32F4XX
-        zxscr_update_status ();
-#elif defined unix
-        menu_update_status ();
+#if Z80_BLOCK_CACHE == 1
+    static uint32_t old_bitmaps[2][0x10000 / 32];
+    uint32_t        changed;
+    uint_fast16_t   word;
+    uint_fast8_t    bit;
+#endif
+    uint_fast8_t    rom48;
+    uint_fast8_t    idx;
+    uint16_t        addr;
+
+#if Z80_BLOCK_CACHE == 1
+    memcpy (old_bitmaps, z80_trap_bitmaps, sizeof (z80_trap_bitmaps));
 #endif
+    memset (z80_trap_bitmaps, 0, sizeof (z80_trap_bitmaps));
+
+    for (rom48 = 0; rom48 < 2; rom48++)
+    {
+        for (idx = 0; idx < z80_n_traps; idx++)
+        {
+            if (z80_trap_active (z80_traps + idx, rom48))
+            {
+                addr = z80_traps[idx].addr;
+                z80_trap_bitmaps[rom48][addr >> 5] |= 1UL << (addr & 0x1F);
+            }
+        }
+    }
+
+    z80_trap_select ();
+
+#if Z80_BLOCK_CACHE == 1
+    for (word = 0; word < 0x10000 / 32; word++)
+    {
+        changed = (old_bitmaps[0][word] ^ z80_trap_bitmaps[0][word]) | (old_bitmaps[1][word] ^ z80_trap_bitmaps[1][word]);
+
+        for (bit = 0; changed; bit++, changed >>= 1)
+        {
+            if (changed & 1)
+            {
+                z80_block_cache_invalidate (UINT16_T ((word << 5) | bit));
+            }
+        }
     }
+#endif
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_add() - register trap
+ *
+ * func is called before the opcode at addr is executed. It may change reg_PC.
+ * Returns FALSE if there are too many traps.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
 uint_fast8_t
-z80_get_rom_hooks (void)
+z80_trap_add (uint16_t addr, uint_fast8_t flags, void (*func)(void))
 {
-    return z80_settings.rom_hooks;
+    if (z80_n_traps >= Z80_MAX_TRAPS)
+    {
+        return FALSE;
+    }
+
+    z80_traps[z80_n_traps].addr     = addr;
+    z80_traps[z80_n_traps].flags    = flags;
+    z80_traps[z80_n_traps].func     = func;
+    z80_n_traps++;
+
+    z80_trap_update ();
+    return TRUE;
 }
-#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_get_poke_file () - get poke file name
+ * z80_trap_remove() - remove trap
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-char *
-z80_get_poke_file (void)
+void
+z80_trap_remove (uint16_t addr, void (*func)(void))
 {
-    if (poke_file_active)
+    uint_fast8_t    idx;
+
+    for (idx = 0; idx < z80_n_traps; idx++)
     {
-        return fname_poke_buf;
+        if (z80_traps[idx].addr == addr && z80_traps[idx].func == func)
+        {
+            z80_n_traps--;
+            memmove (z80_traps + idx, z80_traps + idx + 1, (z80_n_traps - idx) * sizeof (Z80_TRAP));
+            z80_trap_update ();
+            break;
+        }
     }
-    return (char *) 0;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_set_autostart() - set flag: autostart Basic programs
+ * z80_trap() - call callbacks of traps at address
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_set_autostart (uint8_t do_set)
+static void
+z80_trap (uint16_t addr)
 {
-    z80_settings.autostart = do_set;
+    void            (*funcs[Z80_MAX_TRAPS])(void);
+    uint_fast8_t    n_funcs = 0;
+    uint_fast8_t    idx;
+
+    for (idx = 0; idx < z80_n_traps; idx++)                                 // callbacks may add or remove traps, so collect them first
+    {
+        if (z80_traps[idx].addr == addr && z80_trap_active (z80_traps + idx, z80_trap_rom48))
+        {
+            funcs[n_funcs++] = z80_traps[idx].func;
+        }
+    }
+
+    for (idx = 0; idx < n_funcs; idx++)
+    {
+        (*funcs[idx]) ();
+    }
 }
 
+#if defined FRAMEBUFFER || defined X11
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_get_autostart() - get flag: autostart Basic programs
+ * Automatic turbo (Linux only)
+ *
+ * If AUTOTURBO is set, the emulator runs unthrottled with (nearly) no display updates while the ROM initializes the machine after a
+ * reset (RAM test etc. with interrupts disabled, so it ends with the first interrupt) and while a tape with more blocks is loaded. It
+ * falls back to real time as soon as the last block has been read or no block has been requested for AUTO_TURBO_TAPE_IDLE_CYCLES,
+ * e.g. if a multi-load game is waiting for the next level. The saved wall time is printed on stdout.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-uint8_t
-z80_get_autostart (void)
+#define AUTO_TURBO_BOOT             0x01                                    // reason: ROM initialization after reset
+#define AUTO_TURBO_TAPE             0x02                                    // reason: tape with more blocks
+#define AUTO_TURBO_BOOT_MAX_CYCLES  (10 * 100 * CLOCKCYCLES_PER_10_MSEC)    // give up after 10 emulated seconds without interrupt
+#define AUTO_TURBO_TAPE_IDLE_CYCLES ( 5 * 100 * CLOCKCYCLES_PER_10_MSEC)    // give up after 5 emulated seconds without tape block
+
+static uint_fast8_t         auto_turbo;                                     // active reasons, see AUTO_TURBO_xxx
+static const char *         auto_turbo_what;                                // reason which started automatic turbo
+static uint32_t             auto_turbo_start_cycles;
+static uint64_t             auto_turbo_start_usec;
+static uint32_t             auto_turbo_tape_cycles;                         // clock cycles at last tape block
+
+static uint64_t
+z80_auto_turbo_usec (void)
 {
-    return z80_settings.autostart;
+    struct timespec         ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return 1000000ULL * ts.tv_sec + ts.tv_nsec / 1000;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_get_path() - get path of files
+ * z80_auto_turbo_set () - activate automatic turbo for a reason
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#ifndef STM32F4XX
-char *
-z80_get_path (void)
+static void
+z80_auto_turbo_set (uint_fast8_t reason, const char * what)
 {
-    return z80_settings.path;
+    if (z80_settings.auto_turbo && ! (auto_turbo & reason))
+    {
+        if (! auto_turbo)
+        {
+            auto_turbo_what         = what;
+            auto_turbo_start_cycles = z80_get_clockcycles ();
+            auto_turbo_start_usec   = z80_auto_turbo_usec ();
+        }
+
+        auto_turbo |= reason;
+    }
 }
-#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * set_fname_rom_buf () - set file name of ROM file
+ * z80_auto_turbo_clear () - deactivate automatic turbo for a reason, report saved time if no reason is left
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-set_fname_rom_buf (const char * romfile)
+z80_auto_turbo_clear (uint_fast8_t reason)
 {
-#ifdef STM32F4XX
-    (void) strncpy (fname_rom_buf, romfile, sizeof (fname_rom_buf) - 1);
-#else
-    if (z80_settings.path[0])
+    if (auto_turbo & reason)
     {
-        if (snprintf (fname_rom_buf, sizeof (fname_rom_buf), "%s/%s", z80_settings.path, romfile) < 0)
+        auto_turbo &= ~reason;
+
+        if (! auto_turbo)
         {
-            return;
+            uint64_t    emulated_usec   = (uint64_t) (z80_get_clockcycles () - auto_turbo_start_cycles) * SLEEP_USEC / CLOCKCYCLES_PER_10_MSEC;
+            uint64_t    wall_usec       = z80_auto_turbo_usec () - auto_turbo_start_usec;
+
+            if (! z80_settings.turbo_mode && emulated_usec > wall_usec)
+            {
+                printf ("auto turbo: %s took %.2f sec instead of %.2f sec, saved %.2f sec\n", auto_turbo_what,
+                        wall_usec / 1e6, emulated_usec / 1e6, (emulated_usec - wall_usec) / 1e6);
+                fflush (stdout);
+            }
         }
     }
-    else
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_auto_turbo () - get flag: automatic turbo active
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+z80_get_auto_turbo (void)
+{
+    return auto_turbo ? 1 : 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Boot cache (Linux only)
+ *
+ * If BOOTCACHE is set, the state of the machine is saved at the ready point after a cold boot: when the ROM enters its loop waiting for
+ * the first key, i.e. the 48K ROM shows its copyright message or the 128K ROM its menu. The loops are found by traps at their addresses,
+ * see boot_cache_ready_points[], which only fire if the code there is the expected one. With other ROMs, the state is saved
+ * BOOT_CACHE_READY_INTERRUPTS interrupts after the first interrupt instead. The state is written next to the ROM file
+ * (e.g. 48.rom.boot) together with a hash of the ROM. Following starts and resets restore this state instead of running the ROM
+ * initialization again. If no key has been pressed, no tape and no snapshot has been loaded until the ready point, the state is
+ * the same as after a cold boot. z80_cold_boot forces a cold boot once and rewrites the cached state.
+ *
+ * The file is only a cache for the same binary: registers and RAM banks are written in host byte order.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define BOOT_CACHE_READY_INTERRUPTS 50                                      // fallback: 1 second after interrupts have been enabled
+#define BOOT_CACHE_MAGIC            "STECCYBOOT2"
+
+typedef struct
+{
+    char                    magic[12];
+    uint32_t                size;                                           // sizeof (BOOT_CACHE_STATE)
+    uint32_t                romsize;
+    uint64_t                romhash;
+    Z80_REGFILE             regfile;
+    uint32_t                clockcycles;
+    uint8_t                 iff1;
+    uint8_t                 iff2;
+    uint8_t                 interrupt_mode;
+    uint8_t                 reg_I;
+    uint8_t                 reg_R;
+    uint8_t                 border_color;
+    uint8_t                 port_7ffd;
+} BOOT_CACHE_STATE;
+
+uint_fast8_t                z80_cold_boot;                                  // flag: ignore boot cache once
+static uint_fast8_t         boot_cache_interrupts;                          // interrupts since cold boot
+static uint_fast8_t         boot_cache_inhibit;                             // flag: reset by snapshot load, don't use cache
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_boot_cache_init () - fill header of boot cache state and get file name, return 0 if boot cache is not possible
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_boot_cache_init (BOOT_CACHE_STATE * state, char * fname, size_t fname_size)
+{
+    if (z80_romsize == 0 || snprintf (fname, fname_size, "%s.boot", fname_rom_buf) >= (int) fname_size)
     {
-        (void) strncpy (fname_rom_buf, romfile, sizeof (fname_rom_buf) - 1);
+        return 0;
     }
-#endif
+
+    memset (state, 0, sizeof (BOOT_CACHE_STATE));
+    memcpy (state->magic, BOOT_CACHE_MAGIC, sizeof (state->magic));
+    state->size     = sizeof (BOOT_CACHE_STATE);
+    state->romsize  = z80_romsize;
+    state->romhash  = rom_hash;
+    return 1;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * load_rom() - load ROM data
+ * z80_boot_cache_save () - save state at ready point
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-load_rom (void)
+z80_boot_cache_save (void)
 {
-    FILE *      fp;
-    int         ch;
-
-    fp = fopen (fname_rom_buf, "rb");
+    BOOT_CACHE_STATE    state;
+    char                fname[sizeof (fname_rom_buf) + 5];
+    char                tmpname[sizeof (fname) + 4];
+    FILE *              fp;
+    uint_fast8_t        bank;
+    uint_fast8_t        ok;
 
-    if (fp)
+    if (! z80_boot_cache_init (&state, fname, sizeof (fname)))
     {
-        uint8_t *   p   = steccy_rombankptr[0];
-        z80_romsize     = 0x0000;
+        return;
+    }
 
-        while ((ch = getc (fp)) != EOF)
-        {
-            if (z80_romsize == 0x4000)
-            {
-                p = steccy_rombankptr[1];
-            }
+    state.regfile           = z80_regfile;
+    state.clockcycles       = clockcycles;
+    state.iff1              = iff1;
+    state.iff2              = iff2;
+    state.interrupt_mode    = interrupt_mode;
+    state.reg_I             = reg_I;
+    state.reg_R             = reg_R;
+    state.border_color      = zx_border_color;
+    state.port_7ffd         = zxio_7ffd_value;
 
-            *p++ = UINT8_T (ch);
-            z80_romsize++;
-        }
+    snprintf (tmpname, sizeof (tmpname), "%s.tmp", fname);              // write a temp file, then rename: never a partial cache
+    fp = fopen (tmpname, "wb");
 
-#if defined STM32F4XX
-        zxscr_update_status ();
-#elif defined unix
-        menu_update_status ();
-#endif
+    if (! fp)
+    {
+        return;
+    }
 
-        debug_printf ("ROM size: %04Xh\n", z80_romsize);
-        fclose (fp);
+    ok = fwrite (&state, sizeof (state), 1, fp) == 1;
 
-        if (z80_romsize == 0x4000 && ! memcmp (steccy_rombankptr[0] + STECCY_HOOK_ADDRESS, "STECCY", 6))
-        {
-            hooks_active = 1;
-        }
+    for (bank = 0; ok && bank < 8; bank++)
+    {
+        ok = fwrite (steccy_rambankptr[bank], STECCY_PAGE_SIZE, 1, fp) == 1;
     }
-    else
+
+    if (fclose (fp) != 0 || ! ok || rename (tmpname, fname) != 0)
     {
-        perror (fname_rom_buf);
-        return;
+        unlink (tmpname);
     }
 }
 
-#define SNAPSHOT_PAGE_SIZE      0x4000
-
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * snap_write_byte() - write a byte into snapshot file
+ * z80_boot_cache_restore () - restore state, return 1 if successful
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static void
-snap_write_byte (FILE * fp, uint8_t ch)
+static uint_fast8_t
+z80_boot_cache_restore (void)
 {
-    fputc (ch, fp);
+    static uint8_t      banks[8][STECCY_PAGE_SIZE];
+    BOOT_CACHE_STATE    expected;
+    BOOT_CACHE_STATE    state;
+    char                fname[sizeof (fname_rom_buf) + 5];
+    FILE *              fp;
+    uint_fast8_t        ok;
+
+    if (! z80_boot_cache_init (&expected, fname, sizeof (fname)))
+    {
+        return 0;
+    }
+
+    fp = fopen (fname, "rb");
+
+    if (! fp)
+    {
+        return 0;
+    }
+
+    ok = fread (&state, sizeof (state), 1, fp) == 1 &&
+         ! memcmp (state.magic, expected.magic, sizeof (state.magic)) &&
+         state.size == expected.size && state.romsize == expected.romsize && state.romhash == expected.romhash &&
+         fread (banks, sizeof (banks), 1, fp) == 1;
+    fclose (fp);
+
+    if (ok)
+    {
+        uint_fast8_t    bank;
+
+        for (bank = 0; bank < 8; bank++)
+        {
+            memcpy (steccy_rambankptr[bank], banks[bank], STECCY_PAGE_SIZE);
+        }
+
+        z80_regfile     = state.regfile;
+        clockcycles_base += clockcycles - state.clockcycles;            // keep z80_get_clockcycles() monotonic
+        clockcycles     = state.clockcycles;
+        iff1            = state.iff1;
+        iff2            = state.iff2;
+        interrupt_mode  = state.interrupt_mode;
+        reg_I           = state.reg_I;
+        reg_R           = state.reg_R;
+        zx_border_color = state.border_color;
+
+        if (z80_romsize != 0x4000)
+        {
+            zxio_out_port (0x7F, 0xFD, state.port_7ffd);                // adjust memory banks
+        }
+
+        z80_display_cached = 0;
+    }
+
+    return ok;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * snap_write_byte() - write a byte into snapshot file
+ * z80_boot_cache_set_wait () - start or stop waiting for the ready point, (de)activates the traps of boot_cache_ready_points[]
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-snap_write_word (FILE * fp, uint16_t w)
+z80_boot_cache_set_wait (uint_fast8_t wait)
 {
-    fputc (w & 0xFF, fp);
-    fputc ((w >> 8) & 0xFF, fp);
+    if (boot_cache_wait != wait)
+    {
+        boot_cache_wait         = wait;
+        boot_cache_interrupts   = 0;
+        z80_trap_update ();
+    }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * snap_write_uncompressed_page () - write snapshot page
+ * z80_boot_cache_ready () - ready point after cold boot reached, save state if no key has been pressed
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-snap_write_uncompressed_page (FILE * fp, uint8_t * steccy_ram_ptr)
+z80_boot_cache_ready (void)
 {
-    uint32_t    idx;
+    z80_boot_cache_set_wait (0);
 
-    for (idx = 0; idx < SNAPSHOT_PAGE_SIZE; idx++)
+    if (z80_settings.boot_cache && zxio_all_keys_released ())
     {
-        snap_write_byte (fp, *(steccy_ram_ptr + idx));
+        z80_boot_cache_save ();
     }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * snap_write_page() - write snapshot page
+ * Ready points: first instruction of the loop in which the ROM waits for the first key after boot
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static void
-snap_write_page (FILE * fp, uint8_t page_no)
+static const struct
 {
-    uint8_t * steccy_ram_ptr;
+    uint16_t                addr;
+    uint_fast8_t            flags;                                          // flags of trap
+    uint8_t                 code[4];                                        // expected code at addr
+} boot_cache_ready_points[] =
+{
+    { 0x10A8,   Z80_TRAP_BOOT | Z80_TRAP_ROM48, { 0xFD, 0xCB, 0x02, 0x5E } },  // 48K BASIC ROM: KEY-INPUT, called by the editor
+    { 0x3683,   Z80_TRAP_BOOT,                  { 0xCB, 0x6E, 0x28, 0xFC } },  // 128K ROM 0: menu waits for bit 5 of FLAGS
+};
 
-    snap_write_word (fp, 0xFFFF);                                           // 0xFFFF means: uncompressed 16K block
-    snap_write_byte (fp, page_no + 3);
+#define BOOT_CACHE_READY_POINTS     (sizeof (boot_cache_ready_points) / sizeof (boot_cache_ready_points[0]))
 
-    if (z80_romsize == 0x4000)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_boot_ready () - trap: ready point after cold boot if the expected code is at PC
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_boot_ready (void)
+{
+    uint_fast8_t    idx;
+    uint_fast8_t    n;
+
+    for (idx = 0; idx < BOOT_CACHE_READY_POINTS; idx++)
     {
-        switch (page_no)
+        if (boot_cache_ready_points[idx].addr == reg_PC)
         {
-            case 1:                                                         // 1 + 3 = 4: write 16K page 8000 - BFFFF
-            {
-                steccy_ram_ptr = steccy_rambankptr[2];                      // 8000 - BFFFF is bank 2
-                break;
-            }
-            case 2:                                                         // 2 + 3 = 5: write 16K page C000 - FFFFF
-            {
-                steccy_ram_ptr = steccy_rambankptr[0];                      // C000 - FFFFF is bank 0
-                break;
-            }
-            default:                                                        // 5 + 3 = 8: write 16K page 4000 - 7FFFF
+            for (n = 0; n < sizeof (boot_cache_ready_points[idx].code); n++)
             {
-                steccy_ram_ptr = steccy_rambankptr[5];                      // 4000 - 7FFFF is bank 5
-                break;
+                if (zx_ram_get_text (reg_PC + n) != boot_cache_ready_points[idx].code[n])
+                {
+                    return;                                                 // other ROM, wait for BOOT_CACHE_READY_INTERRUPTS
+                }
             }
+
+            z80_boot_cache_ready ();
+            return;
         }
     }
-    else
-    {
-        steccy_ram_ptr = steccy_rambankptr[page_no];
-    }
-
-    snap_write_uncompressed_page (fp, steccy_ram_ptr);
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * save_snapshot() - save snapshot
+ * Run-ahead (Linux only)
+ *
+ * If RUNAHEAD is set to n > 0, the input is read at the beginning of a frame, the state of the machine is saved and the next n frames
+ * are emulated with this input as fast as possible. Only the screen after the last of them is displayed, then the saved state is
+ * restored and the next frame is emulated again in real time. Games which react to a key press one or two frames later show the
+ * reaction immediately, at the cost of n additional emulated frames per displayed frame.
+ *
+ * The RAM is saved into a backup which is only updated for pages whose write generation has changed since the last update, and only
+ * pages written while running ahead are copied back. Run-ahead is inactive in turbo mode, during boot and while recording, replaying,
+ * capturing or being controlled by the control socket. A tape trap while running ahead cancels the remaining frames ahead.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static void
-save_snapshot (void)
+typedef struct
 {
-    FILE *      fp;
+    Z80_REGFILE             regfile;
+    uint32_t                clockcycles;
+    uint32_t                clockcycles_base;
+    uint16_t                cur_PC;
+    uint8_t                 iff1;
+    uint8_t                 iff2;
+    uint8_t                 ixflags;
+    uint8_t                 iyflags;
+    uint8_t                 last_ixiyflags;
+    uint8_t                 interrupt_mode;
+    uint8_t                 reg_I;
+    uint8_t                 reg_R;
+    uint8_t                 interrupt;
+    uint8_t                 border_color;
+    uint8_t                 port_7ffd;
+    uint8_t                 shadow_display;
+    uint8_t                 paging_disabled;
+    uint8_t                 user_cancelled_load;
+    uint8_t *               bankptr[4];
+    uint32_t *              bankgen[4];
+    uint8_t *               bankcov[4];
+} RUNAHEAD_STATE;
 
-    fp = fopen (snapshot_save_fname, "wb");
+static RUNAHEAD_STATE       runahead_state;
+static uint8_t              runahead_ram[8][STECCY_PAGE_SIZE];              // backup of RAM banks
+static uint32_t             runahead_gen[8][ZX_RAM_GEN_PAGES];              // write generations of backup
 
-    if (fp)
-    {
-        uint16_t    idx;
-        uint8_t     val;
-        uint8_t     flag = UINT8_T (((reg_R >> 7) & 0x01) | (zx_border_color << 1));
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_runahead_possible () - check if next frame may be run ahead
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_runahead_possible (void)
+{
+    return z80_settings.run_ahead && z80_focus && ! z80_settings.turbo_mode && ! auto_turbo && ! z80_unthrottled && ! boot_cache_wait &&
+           ! z80_settings.rom_hooks_verify && ! lxrec_mode && ! lxctrl_active && ! lxcapture_active && ! lxtrace_active &&
+           ! zx_ram_coverage && ! snapshot_save_valid && ! fname_load_snapshot_valid && ! steccy_exit;
+}
 
-        snap_write_byte (fp, reg_A);                            // 0 A
-        snap_write_byte (fp, reg_F);                            // 1 F
-        snap_write_byte (fp, reg_C);                            // 2 C
-        snap_write_byte (fp, reg_B);                            // 3 B
-        snap_write_byte (fp, reg_L);                            // 4 L
-        snap_write_byte (fp, reg_H);                            // 5 H
-        snap_write_word (fp, 0x0000);                           // 6+7 PC (snapshot version 3: write 0x0000)
-        snap_write_word (fp, reg_SP);                           // 8+9 stack pointer
-        snap_write_byte (fp, reg_I);                            // 10 Interrupt register
-        snap_write_byte (fp, reg_R & 0x7F);                     // 11 Refresh register (Bit 7 is not significant!)
-        snap_write_byte (fp, flag);                             // 12 Bit 0  : Bit 7 of the R-register
-                                                                //    Bit 1-3: Border colour
-                                                                //    Bit 4  : 1=Basic SamRom switched in
-                                                                //    Bit 5  : 1=Block of data is compressed (only version 1)
-                                                                //    Bit 6-7: No meaning
-        snap_write_byte (fp, reg_E);                            // 13 E
-        snap_write_byte (fp, reg_D);                            // 14 D
-        snap_write_byte (fp, reg_C2);                           // 15 C'
-        snap_write_byte (fp, reg_B2);                           // 16 B'
-        snap_write_byte (fp, reg_E2);                           // 17 E'
-        snap_write_byte (fp, reg_D2);                           // 18 D'
-        snap_write_byte (fp, reg_L2);                           // 19 L'
-        snap_write_byte (fp, reg_H2);                           // 20 H'
-        snap_write_byte (fp, reg_A2);                           // 21 A'
-        snap_write_byte (fp, reg_F2);                           // 22 F'
-        snap_write_byte (fp, reg_IYL);                          // 23 IYL
-        snap_write_byte (fp, reg_IYH);                          // 24 IYH
-        snap_write_byte (fp, reg_IXL);                          // 25 IXL
-        snap_write_byte (fp, reg_IXH);                          // 26 IXH
-        snap_write_byte (fp, iff1);                             // 27 IFF1
-        snap_write_byte (fp, iff2);                             // 28 IFF2
-        snap_write_byte (fp, interrupt_mode);                   // 29 Bit 0-1:  Interrupt mode (0, 1 or 2)
-                                                                //    Bit 2  :  1=Issue 2 emulation
-                                                                //    Bit 3  :  1=Double interrupt frequency
-                                                                //    Bit 4-5:  1=High video synchronisation
-                                                                //              3=Low video synchronisation
-                                                                //              0,2=Normal
-                                                                //    Bit 6-7:  0=Cursor/Protek/AGF joystick
-                                                                //              1=Kempston joystick
-                                                                //              2=Sinclair 2 Left joystick
-                                                                //              (or user defined, for version 3 .z80 files)
-                                                                //              3=Sinclair 2 Right joystick
-        uint16_t additional_header_len = 54;                    //    version 3 uses an additional header of 54 bytes
-        snap_write_word (fp, additional_header_len);            // 30+31 length of additional header following
-        snap_write_word (fp, reg_PC);                           // 32+33 PC
-        additional_header_len -= 2;                             // adjust len (-2 for PC already written)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_runahead_start () - save state and start running ahead
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_runahead_start (void)
+{
+    uint_fast8_t    bank;
+    uint_fast8_t    page;
 
-        for (idx = 0; idx < additional_header_len; idx++ )      // write empty additional header (52 bytes)
+    for (bank = 0; bank < 8; bank++)
+    {
+        for (page = 0; page < ZX_RAM_GEN_PAGES; page++)
         {
-            if (idx == 0)                                       // 34: hardware mode
+            if (! runahead_backup_valid || runahead_gen[bank][page] != steccy_rambankgen[bank][page])
             {
-                                                                // Value:          Meaning in v2           Meaning in v3
-                                                                // -----------------------------------------------------
-                                                                //  0             48k                     48k
-                                                                //  1             48k + If.1              48k + If.1
-                                                                //  2             SamRam                  SamRam
-                                                                //  3             128k                    48k + M.G.T.
-                                                                //  4             128k + If.1             128k
-                                                                //  5             -                       128k + If.1
-                                                                //  6             -                       128k + M.G.T.
-                if (z80_romsize == 0x4000)
-                {
-                    val = 0;
-                }
-                else
-                {
-                    val = 4;
-                }
+                memcpy (runahead_ram[bank] + (page << ZX_RAM_GEN_PAGE_SHIFT), steccy_rambankptr[bank] + (page << ZX_RAM_GEN_PAGE_SHIFT),
+                        1 << ZX_RAM_GEN_PAGE_SHIFT);
+                runahead_gen[bank][page] = steccy_rambankgen[bank][page];
             }
-            else if (idx == 2)                                  // 35: memory paging
-            {
-                                                                // If in SamRam mode, bitwise state of 74ls259.
-                                                                // For example, bit 6=1 after an OUT 31,13 (=2*6+1)
-                                                                // If in 128 mode, contains last OUT to 0x7ffd
-                                                                // If in Timex mode, contains last OUT to 0xf4
+        }
+    }
 
-                if (z80_romsize != 0x4000)                      // we are in 128K mode
-                {
-                    val = zxio_7ffd_value;
-                }
-                else
-                {
-                    val = 0;
-                }
-            }
-            else
-            {
-                val = 0;
-            }
+    runahead_backup_valid = 1;
 
-            snap_write_byte (fp, val);
-        }
+    runahead_state.regfile              = z80_regfile;
+    runahead_state.clockcycles          = clockcycles;
+    runahead_state.clockcycles_base     = clockcycles_base;
+    runahead_state.cur_PC               = cur_PC;
+    runahead_state.iff1                 = iff1;
+    runahead_state.iff2                 = iff2;
+    runahead_state.ixflags              = ixflags;
+    runahead_state.iyflags              = iyflags;
+    runahead_state.last_ixiyflags       = last_ixiyflags;
+    runahead_state.interrupt_mode       = interrupt_mode;
+    runahead_state.reg_I                = reg_I;
+    runahead_state.reg_R                = reg_R;
+    runahead_state.interrupt            = z80_interrupt;
+    runahead_state.border_color         = zx_border_color;
+    runahead_state.port_7ffd            = zxio_7ffd_value;
+    runahead_state.shadow_display       = zx_ram_shadow_display;
+    runahead_state.paging_disabled      = zx_ram_memory_paging_disabled;
+    runahead_state.user_cancelled_load  = z80_user_cancelled_load;
+    memcpy (runahead_state.bankptr, steccy_bankptr, sizeof (runahead_state.bankptr));
+    memcpy (runahead_state.bankgen, steccy_bankgen, sizeof (runahead_state.bankgen));
+    memcpy (runahead_state.bankcov, steccy_bankcov, sizeof (runahead_state.bankcov));
 
-        if (z80_romsize == 0x4000)
-        {
-            snap_write_page (fp, 1);                            // 1 + 3 = 4: write 16K page 8000 - BFFFF
-            snap_write_page (fp, 2);                            // 2 + 3 = 5: write 16K page C000 - FFFFF
-            snap_write_page (fp, 5);                            // 5 + 3 = 8: write 16K page 4000 - 7FFFF
-        }
-        else
-        {
-            uint_fast8_t    page;
+    runahead_frames = z80_settings.run_ahead;
+}
 
-            for (page = 0; page < 8; page++)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_runahead_restore () - restore state saved by z80_runahead_start ()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_runahead_restore (void)
+{
+    uint_fast8_t    bank;
+    uint_fast8_t    page;
+
+    for (bank = 0; bank < 8; bank++)
+    {
+        for (page = 0; page < ZX_RAM_GEN_PAGES; page++)
+        {
+            if (runahead_gen[bank][page] != steccy_rambankgen[bank][page])
             {
-                snap_write_page (fp, page);                     // write 8 x 16K pages
+                memcpy (steccy_rambankptr[bank] + (page << ZX_RAM_GEN_PAGE_SHIFT), runahead_ram[bank] + (page << ZX_RAM_GEN_PAGE_SHIFT),
+                        1 << ZX_RAM_GEN_PAGE_SHIFT);
+                steccy_rambankgen[bank][page]++;                            // invalidate cached blocks of this page
+                runahead_gen[bank][page] = steccy_rambankgen[bank][page];
             }
         }
+    }
 
-        fclose (fp);
+    z80_regfile                     = runahead_state.regfile;
+    clockcycles                     = runahead_state.clockcycles;
+    clockcycles_base                = runahead_state.clockcycles_base;
+    cur_PC                          = runahead_state.cur_PC;
+    iff1                            = runahead_state.iff1;
+    iff2                            = runahead_state.iff2;
+    ixflags                         = runahead_state.ixflags;
+    iyflags                         = runahead_state.iyflags;
+    last_ixiyflags                  = runahead_state.last_ixiyflags;
+    interrupt_mode                  = runahead_state.interrupt_mode;
+    reg_I                           = runahead_state.reg_I;
+    reg_R                           = runahead_state.reg_R;
+    z80_interrupt                   = runahead_state.interrupt;
+    zx_border_color                 = runahead_state.border_color;
+    zxio_7ffd_value                 = runahead_state.port_7ffd;
+    zx_ram_shadow_display           = runahead_state.shadow_display;
+    zx_ram_memory_paging_disabled   = runahead_state.paging_disabled;
+    z80_user_cancelled_load         = runahead_state.user_cancelled_load;
+    memcpy (steccy_bankptr, runahead_state.bankptr, sizeof (runahead_state.bankptr));
+    memcpy (steccy_bankgen, runahead_state.bankgen, sizeof (runahead_state.bankgen));
+    memcpy (steccy_bankcov, runahead_state.bankcov, sizeof (runahead_state.bankcov));
+    z80_trap_select ();                                                 // ROM paging may have changed
+
+    runahead_frames = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_runahead_trap () - check in tape traps: if running ahead, skip trap and stop running ahead at the next frame
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_runahead_trap (void)
+{
+    if (runahead_frames)
+    {
+        runahead_frames = 1;
+        return 1;
     }
+
+    return 0;
 }
+#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * snap_read_byte() - load a byte from snapshot file
+ * z80_reset() - reset Z80
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static uint8_t
-snap_read_byte (FILE * fp, uint8_t * chp)
+void
+z80_reset (void)
 {
-    int ch  = getc (fp);
+    z80_flags_init ();
 
-    if (ch == EOF)
+    memset (&z80_regfile, 0, sizeof (z80_regfile));
+
+    reg_SP                  = 0x0000;
+    reg_PC                  = 0x0000;
+    cur_PC                  = 0x0000;
+    iff1                    = 0;
+    ixflags                 = 0;
+    iyflags                 = 0;
+    last_ixiyflags          = 0;
+    interrupt_mode          = 0;
+#if defined FRAMEBUFFER || defined X11
+    clockcycles_base       += clockcycles;                  // keep z80_get_clockcycles() monotonic
+#endif
+    clockcycles             = 0;
+
+    zx_border_color         = 0;
+    zx_ram_init (z80_romsize);
+    z80_trap_select ();
+
+#if defined FRAMEBUFFER || defined X11
+    z80_auto_turbo_clear (AUTO_TURBO_BOOT | AUTO_TURBO_TAPE);
+    z80_boot_cache_set_wait (0);
+
+    if (z80_settings.boot_cache && ! boot_cache_inhibit && ! z80_cold_boot && z80_boot_cache_restore ())
     {
-        return 0;
+        debug_printf ("RESET: restored boot cache\n");
+    }
+    else
+    {
+        if (z80_settings.boot_cache && ! boot_cache_inhibit)
+        {
+            z80_boot_cache_set_wait (1);
+        }
+
+        z80_auto_turbo_set (AUTO_TURBO_BOOT, "boot");
     }
 
-    *chp = UINT8_T (ch);
-    return 1;
+    z80_cold_boot = 0;
+#endif
+
+#if Z80_BLOCK_CACHE == 1
+    z80_block_cache_flush ();
+#endif
+
+    debug_printf ("RESET\n");
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * snap_read_word() - load a word from snapshot file
+ * z80_pause() - pause Z80 (toggle)
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static uint8_t
-snap_read_word (FILE * fp, uint16_t * wp)
+#if defined QT_CORE_LIB
+void
+z80_pause (void)
 {
-    uint8_t     lo;
-    uint8_t     hi;
-    uint8_t     rtc;
-
-    if (snap_read_byte (fp, &lo) && snap_read_byte (fp, &hi))
+    if (z80_do_pause)
     {
-        *wp = UINT16_T (lo | (hi << 8));
-        rtc = 1;
+        z80_do_pause = 0;
     }
     else
     {
-        rtc = 0;
+        z80_do_pause = 1;
     }
-    return rtc;
 }
+#endif
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * load_snapshot() - load snapshot file
+ * z80_leave_focus () - leave focus and enter menu
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static void
-load_snapshot (void)
+#if defined STM32F4XX || defined FRAMEBUFFER || defined X11
+void
+z80_leave_focus (void)
 {
-    FILE *      fp;
+    z80_focus = FALSE;
+}
 
-    fp = fopen (fname_load_buf, "rb");
+void
+z80_enter_focus (void)
+{
+    z80_focus = TRUE;
+}
+#endif
 
-    if (fp)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_next_turbo_mode () - set next turbo mode
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#if defined STM32F4XX || defined FRAMEBUFFER || defined X11
+void
+z80_next_turbo_mode (void)
+{
+    z80_settings.turbo_mode++;
+
+    if (z80_settings.turbo_mode == 2)
     {
-        int         ch;
-        uint8_t     flag            = 0;
-        uint8_t     val             = 0;
-        uint8_t     dummy           = 0;
-        uint8_t     data_compressed = 0;
-        uint8_t *   steccy_ram_ptr;
-        uint8_t     version = 1;
+        z80_settings.turbo_mode = 0;
+    }
 
-        zxio_reset ();
+    z80_settings.rom_hooks = z80_settings.turbo_mode;
+    z80_trap_update ();
 
-        snap_read_byte (fp, &reg_A);                            // 0 A
-        snap_read_byte (fp, &reg_F);                            // 1 F
-        snap_read_byte (fp, &reg_C);                            // 2 C
-        snap_read_byte (fp, &reg_B);                            // 3 B
-        snap_read_byte (fp, &reg_L);                            // 4 L
-        snap_read_byte (fp, &reg_H);                            // 5 H
-        snap_read_word (fp, &reg_PC);                           // 6+7 PC (if PC = 0x0000, see below: snap version 2/3)
-        snap_read_word (fp, &reg_SP);                           // 8+9 stack pointer
-        snap_read_byte (fp, &reg_I);                            // 10 Interrupt register
-        snap_read_byte (fp, &dummy);                            // 11 Refresh register (Bit 7 is not significant!)
-        snap_read_byte (fp, &flag);                             // 12 Bit 0  : Bit 7 of the R-register
-                                                                //    Bit 1-3: Border colour
-                                                                //    Bit 4  : 1=Basic SamRom switched in
-                                                                //    Bit 5  : 1=Block of data is compressed
-                                                                //    Bit 6-7: No meaning
-        if (flag == 0xFF)                                       // if byte 12 is 255, it has to be regarded as being 1.
-        {
+#if defined STM32F4XX
+        zxscr_update_status ();
+#elif defined unix
+        menu_update_status ();
+#endif
+}
+
+void
+z80_set_turbo_mode (uint_fast8_t active)
+{
+    if (z80_settings.turbo_mode != active)
+    {
+        z80_settings.turbo_mode = active;
+#if defined STM32F4XX
+        zxscr_update_status ();
+#elif defined unix
+        menu_update_status ();
+#endif
+    }
+}
+
+uint_fast8_t
+z80_get_turbo_mode (void)
+{
+    return z80_settings.turbo_mode;
+}
+
+#if defined FRAMEBUFFER || defined X11
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_clockcycles () - get emulated clock cycles since start, wraps around after about 20 minutes
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+z80_get_clockcycles (void)
+{
+    return clockcycles_base + clockcycles;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_lag_usec () - get how many usec emulation was behind real time at the last 10 msec tick, 0 if in time or in turbo mode
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+z80_get_lag_usec (void)
+{
+    return lag_usec;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_registers () - get a copy of all registers
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_get_registers (Z80_REGISTERS * regs)
+{
+    regs->af    = GET_AF();
+    regs->bc    = reg_BC;
+    regs->de    = reg_DE;
+    regs->hl    = reg_HL;
+    regs->af_   = z80_regfile.shadow.w[REG_IDX_AF];
+    regs->bc_   = z80_regfile.shadow.w[REG_IDX_BC];
+    regs->de_   = z80_regfile.shadow.w[REG_IDX_DE];
+    regs->hl_   = z80_regfile.shadow.w[REG_IDX_HL];
+    regs->ix    = reg_IX;
+    regs->iy    = reg_IY;
+    regs->sp    = reg_SP;
+    regs->pc    = reg_PC;
+    regs->i     = reg_I;
+    regs->r     = reg_R;
+    regs->im    = interrupt_mode;
+    regs->iff1  = iff1;
+    regs->iff2  = iff2;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_set_registers () - set registers, e.g. to start code written into RAM, must be called between two instructions
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_set_registers (const Z80_REGISTERS * regs)
+{
+    SET_AF(regs->af);
+    reg_BC          = regs->bc;
+    reg_DE          = regs->de;
+    reg_HL          = regs->hl;
+    z80_regfile.shadow.w[REG_IDX_AF] = regs->af_;
+    z80_regfile.shadow.w[REG_IDX_BC] = regs->bc_;
+    z80_regfile.shadow.w[REG_IDX_DE] = regs->de_;
+    z80_regfile.shadow.w[REG_IDX_HL] = regs->hl_;
+    reg_IX          = regs->ix;
+    reg_IY          = regs->iy;
+    reg_SP          = regs->sp;
+    reg_PC          = regs->pc;
+    reg_I           = regs->i;
+    reg_R           = regs->r;
+    interrupt_mode  = regs->im;
+    iff1            = regs->iff1;
+    iff2            = regs->iff2;
+    ixflags         = 0;                                                    // no prefix pending
+    iyflags         = 0;
+    last_ixiyflags  = 0;
+    cur_PC          = reg_PC;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_rom_hash () - get FNV-1a 64 hash of loaded ROM
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint64_t
+z80_get_rom_hash (void)
+{
+    return rom_hash;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trace () - write trace record of instruction at PC
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trace (void)
+{
+    LXTRACE_RECORD *    rec = lxtrace_next (reg_PC);
+
+    if (rec)
+    {
+        rec->cycles     = z80_get_clockcycles ();
+        rec->pc         = reg_PC;
+        rec->sp         = reg_SP;
+        rec->af         = GET_AF();
+        rec->bc         = reg_BC;
+        rec->de         = reg_DE;
+        rec->hl         = reg_HL;
+        rec->ix         = reg_IX;
+        rec->iy         = reg_IY;
+        rec->opcode[0]  = zx_ram_get_text (reg_PC);
+        rec->opcode[1]  = zx_ram_get_text (UINT16_T (reg_PC + 1));
+        rec->opcode[2]  = zx_ram_get_text (UINT16_T (reg_PC + 2));
+        rec->opcode[3]  = zx_ram_get_text (UINT16_T (reg_PC + 3));
+        rec->port_7ffd  = zxio_7ffd_value;
+        rec->flags      = (iff1 ? LXTRACE_FLAG_IFF1 : 0) | (trace_interrupt ? LXTRACE_FLAG_INT : 0) | (interrupt_mode << LXTRACE_FLAG_IM_SHIFT);
+        rec->i          = reg_I;
+        rec->r          = reg_R;
+    }
+
+    trace_interrupt = 0;
+}
+#endif
+
+void
+z80_set_rom_hooks (uint_fast8_t active)
+{
+    if (z80_settings.rom_hooks != active)
+    {
+        z80_settings.rom_hooks = active;
+        z80_trap_update ();
+#if defined STM32F4XX
+        zxscr_update_status ();
+#elif defined unix
+        menu_update_status ();
+#endif
+    }
+}
+
+uint_fast8_t
+z80_get_rom_hooks (void)
+{
+    return z80_settings.rom_hooks;
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_poke_file () - get poke file name
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+char *
+z80_get_poke_file (void)
+{
+    if (poke_file_active)
+    {
+        return fname_poke_buf;
+    }
+    return (char *) 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_set_autostart() - set flag: autostart Basic programs
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_set_autostart (uint8_t do_set)
+{
+    z80_settings.autostart = do_set;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_autostart() - get flag: autostart Basic programs
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint8_t
+z80_get_autostart (void)
+{
+    return z80_settings.autostart;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_get_path() - get path of files
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef STM32F4XX
+char *
+z80_get_path (void)
+{
+    return z80_settings.path;
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * set_fname_rom_buf () - set file name of ROM file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+set_fname_rom_buf (const char * romfile)
+{
+#ifdef STM32F4XX
+    (void) strncpy (fname_rom_buf, romfile, sizeof (fname_rom_buf) - 1);
+#else
+    if (z80_settings.path[0])
+    {
+        if (snprintf (fname_rom_buf, sizeof (fname_rom_buf), "%s/%s", z80_settings.path, romfile) < 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        (void) strncpy (fname_rom_buf, romfile, sizeof (fname_rom_buf) - 1);
+    }
+#endif
+}
+
+#if defined FRAMEBUFFER || defined X11
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * load_rom_data() - copy ROM image into ROM banks
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+load_rom_data (const uint8_t * data, size_t size)
+{
+    if (size == 0 || size > 0x8000)
+    {
+        fprintf (stderr, "%s: invalid ROM size %zu\n", fname_rom_buf, size);
+        return FALSE;
+    }
+
+    memcpy (steccy_rombankptr[0], data, size < 0x4000 ? size : 0x4000);     // ROM banks are not contiguous
+
+    if (size > 0x4000)
+    {
+        memcpy (steccy_rombankptr[1], data + 0x4000, size - 0x4000);
+    }
+
+    z80_romsize = UINT16_T (size);
+    return TRUE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * load_rom_file() - load ROM file via mmap
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+load_rom_file (const char * fname)
+{
+    struct stat     st;
+    void *          data;
+    uint_fast8_t    rtc;
+    int             fd;
+
+    fd = open (fname, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return FALSE;
+    }
+
+    if (fstat (fd, &st) < 0 || st.st_size == 0 || st.st_size > 0x8000)
+    {
+        fprintf (stderr, "%s: invalid ROM size\n", fname);
+        close (fd);
+        return FALSE;
+    }
+
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (data == MAP_FAILED)
+    {
+        perror (fname);
+        return FALSE;
+    }
+
+    rtc = load_rom_data (data, st.st_size);
+    munmap (data, st.st_size);
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * load_rom_embedded() - load stock ROM compiled into the binary, selected by the base name of the ROM file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+load_rom_embedded (const char * fname)
+{
+    static const struct
+    {
+        const char *    name;
+        const uint8_t * start;
+        const uint8_t * end;
+    } embedded_roms[] =
+    {
+        { "48.rom",     lxrom_48,   lxrom_48_end    },
+        { "48u.rom",    lxrom_48u,  lxrom_48u_end   },
+        { "128.rom",    lxrom_128,  lxrom_128_end   },
+    };
+    const char *    basename = strrchr (fname, '/');
+    uint_fast8_t    idx;
+
+    basename = basename ? basename + 1 : fname;
+
+    for (idx = 0; idx < sizeof (embedded_roms) / sizeof (embedded_roms[0]); idx++)
+    {
+        if (! strcmp (basename, embedded_roms[idx].name))
+        {
+            debug_printf ("%s: using embedded ROM\n", fname);
+            return load_rom_data (embedded_roms[idx].start, embedded_roms[idx].end - embedded_roms[idx].start);
+        }
+    }
+
+    return FALSE;
+}
+#endif
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * load_rom() - load ROM data
+ *
+ * On Linux the ROM file is mapped into memory. If it does not exist, the stock ROM with the same name is taken from the binary.
+ * The hash of the ROM decides if it is a known ROM, see known_roms[].
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+load_rom (void)
+{
+    uint_fast16_t   idx;
+
+#if defined FRAMEBUFFER || defined X11
+    if (! load_rom_file (fname_rom_buf) && ! load_rom_embedded (fname_rom_buf))
+    {
+        perror (fname_rom_buf);
+        return;
+    }
+#else
+    FILE *      fp;
+    int         ch;
+
+    fp = fopen (fname_rom_buf, "rb");
+
+    if (! fp)
+    {
+        perror (fname_rom_buf);
+        return;
+    }
+
+    uint8_t *   p   = steccy_rombankptr[0];
+    z80_romsize     = 0x0000;
+
+    while ((ch = getc (fp)) != EOF)
+    {
+        if (z80_romsize == 0x4000)
+        {
+            p = steccy_rombankptr[1];
+        }
+
+        *p++ = UINT8_T (ch);
+        z80_romsize++;
+    }
+
+    fclose (fp);
+#endif
+
+#if defined STM32F4XX
+    zxscr_update_status ();
+#elif defined unix
+    menu_update_status ();
+#endif
+
+    debug_printf ("ROM size: %04Xh\n", z80_romsize);
+
+    rom_hash = 14695981039346656037ULL;                                 // FNV-1a 64
+
+    for (idx = 0; idx < z80_romsize; idx++)
+    {
+        rom_hash ^= steccy_rombankptr[idx >> 14][idx & 0x3FFF];
+        rom_hash *= 1099511628211ULL;
+    }
+
+    rom_known = FALSE;
+
+    for (idx = 0; idx < sizeof (known_roms) / sizeof (known_roms[0]); idx++)
+    {
+        if (rom_hash == known_roms[idx].hash)
+        {
+            debug_printf ("known ROM: %s\n", known_roms[idx].name);
+            rom_known = TRUE;
+            break;
+        }
+    }
+
+#if Z80_BLOCK_CACHE == 1
+    z80_block_cache_flush ();
+#endif
+
+    if (z80_romsize == 0x4000 && ! memcmp (steccy_rombankptr[0] + STECCY_HOOK_ADDRESS, "STECCY", 6))
+    {
+        hooks_active = 1;
+    }
+
+    z80_trap_update ();
+}
+
+#define SNAPSHOT_PAGE_SIZE      0x4000
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * snap_write_byte() - write a byte into snapshot file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+snap_write_byte (FILE * fp, uint8_t ch)
+{
+    fputc (ch, fp);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * snap_write_byte() - write a byte into snapshot file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+snap_write_word (FILE * fp, uint16_t w)
+{
+    fputc (w & 0xFF, fp);
+    fputc ((w >> 8) & 0xFF, fp);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * snap_write_uncompressed_page () - write snapshot page
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+snap_write_uncompressed_page (FILE * fp, uint8_t * steccy_ram_ptr)
+{
+    uint32_t    idx;
+
+    for (idx = 0; idx < SNAPSHOT_PAGE_SIZE; idx++)
+    {
+        snap_write_byte (fp, *(steccy_ram_ptr + idx));
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * snap_write_page() - write snapshot page
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+snap_write_page (FILE * fp, uint8_t page_no)
+{
+    uint8_t * steccy_ram_ptr;
+
+    snap_write_word (fp, 0xFFFF);                                           // 0xFFFF means: uncompressed 16K block
+    snap_write_byte (fp, page_no + 3);
+
+    if (z80_romsize == 0x4000)
+    {
+        switch (page_no)
+        {
+            case 1:                                                         // 1 + 3 = 4: write 16K page 8000 - BFFFF
+            {
+                steccy_ram_ptr = steccy_rambankptr[2];                      // 8000 - BFFFF is bank 2
+                break;
+            }
+            case 2:                                                         // 2 + 3 = 5: write 16K page C000 - FFFFF
+            {
+                steccy_ram_ptr = steccy_rambankptr[0];                      // C000 - FFFFF is bank 0
+                break;
+            }
+            default:                                                        // 5 + 3 = 8: write 16K page 4000 - 7FFFF
+            {
+                steccy_ram_ptr = steccy_rambankptr[5];                      // 4000 - 7FFFF is bank 5
+                break;
+            }
+        }
+    }
+    else
+    {
+        steccy_ram_ptr = steccy_rambankptr[page_no];
+    }
+
+    snap_write_uncompressed_page (fp, steccy_ram_ptr);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * save_snapshot() - save snapshot
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+save_snapshot (void)
+{
+    FILE *      fp;
+
+    fp = fopen (snapshot_save_fname, "wb");
+
+    if (fp)
+    {
+        uint16_t    idx;
+        uint8_t     val;
+        uint8_t     flag = UINT8_T (((reg_R >> 7) & 0x01) | (zx_border_color << 1));
+
+        snap_write_byte (fp, reg_A);                            // 0 A
+        snap_write_byte (fp, reg_F);                            // 1 F
+        snap_write_byte (fp, reg_C);                            // 2 C
+        snap_write_byte (fp, reg_B);                            // 3 B
+        snap_write_byte (fp, reg_L);                            // 4 L
+        snap_write_byte (fp, reg_H);                            // 5 H
+        snap_write_word (fp, 0x0000);                           // 6+7 PC (snapshot version 3: write 0x0000)
+        snap_write_word (fp, reg_SP);                           // 8+9 stack pointer
+        snap_write_byte (fp, reg_I);                            // 10 Interrupt register
+        snap_write_byte (fp, reg_R & 0x7F);                     // 11 Refresh register (Bit 7 is not significant!)
+        snap_write_byte (fp, flag);                             // 12 Bit 0  : Bit 7 of the R-register
+                                                                //    Bit 1-3: Border colour
+                                                                //    Bit 4  : 1=Basic SamRom switched in
+                                                                //    Bit 5  : 1=Block of data is compressed (only version 1)
+                                                                //    Bit 6-7: No meaning
+        snap_write_byte (fp, reg_E);                            // 13 E
+        snap_write_byte (fp, reg_D);                            // 14 D
+        snap_write_byte (fp, reg_C2);                           // 15 C'
+        snap_write_byte (fp, reg_B2);                           // 16 B'
+        snap_write_byte (fp, reg_E2);                           // 17 E'
+        snap_write_byte (fp, reg_D2);                           // 18 D'
+        snap_write_byte (fp, reg_L2);                           // 19 L'
+        snap_write_byte (fp, reg_H2);                           // 20 H'
+        snap_write_byte (fp, reg_A2);                           // 21 A'
+        snap_write_byte (fp, reg_F2);                           // 22 F'
+        snap_write_byte (fp, reg_IYL);                          // 23 IYL
+        snap_write_byte (fp, reg_IYH);                          // 24 IYH
+        snap_write_byte (fp, reg_IXL);                          // 25 IXL
+        snap_write_byte (fp, reg_IXH);                          // 26 IXH
+        snap_write_byte (fp, iff1);                             // 27 IFF1
+        snap_write_byte (fp, iff2);                             // 28 IFF2
+        snap_write_byte (fp, interrupt_mode);                   // 29 Bit 0-1:  Interrupt mode (0, 1 or 2)
+                                                                //    Bit 2  :  1=Issue 2 emulation
+                                                                //    Bit 3  :  1=Double interrupt frequency
+                                                                //    Bit 4-5:  1=High video synchronisation
+                                                                //              3=Low video synchronisation
+                                                                //              0,2=Normal
+                                                                //    Bit 6-7:  0=Cursor/Protek/AGF joystick
+                                                                //              1=Kempston joystick
+                                                                //              2=Sinclair 2 Left joystick
+                                                                //              (or user defined, for version 3 .z80 files)
+                                                                //              3=Sinclair 2 Right joystick
+        uint16_t additional_header_len = 54;                    //    version 3 uses an additional header of 54 bytes
+        snap_write_word (fp, additional_header_len);            // 30+31 length of additional header following
+        snap_write_word (fp, reg_PC);                           // 32+33 PC
+        additional_header_len -= 2;                             // adjust len (-2 for PC already written)
+
+        for (idx = 0; idx < additional_header_len; idx++ )      // write empty additional header (52 bytes)
+        {
+            if (idx == 0)                                       // 34: hardware mode
+            {
+                                                                // Value:          Meaning in v2           Meaning in v3
+                                                                // -----------------------------------------------------
+                                                                //  0             48k                     48k
+                                                                //  1             48k + If.1              48k + If.1
+                                                                //  2             SamRam                  SamRam
+                                                                //  3             128k                    48k + M.G.T.
+                                                                //  4             128k + If.1             128k
+                                                                //  5             -                       128k + If.1
+                                                                //  6             -                       128k + M.G.T.
+                if (z80_romsize == 0x4000)
+                {
+                    val = 0;
+                }
+                else
+                {
+                    val = 4;
+                }
+            }
+            else if (idx == 2)                                  // 35: memory paging
+            {
+                                                                // If in SamRam mode, bitwise state of 74ls259.
+                                                                // For example, bit 6=1 after an OUT 31,13 (=2*6+1)
+                                                                // If in 128 mode, contains last OUT to 0x7ffd
+                                                                // If in Timex mode, contains last OUT to 0xf4
+
+                if (z80_romsize != 0x4000)                      // we are in 128K mode
+                {
+                    val = zxio_7ffd_value;
+                }
+                else
+                {
+                    val = 0;
+                }
+            }
+            else
+            {
+                val = 0;
+            }
+
+            snap_write_byte (fp, val);
+        }
+
+        if (z80_romsize == 0x4000)
+        {
+            snap_write_page (fp, 1);                            // 1 + 3 = 4: write 16K page 8000 - BFFFF
+            snap_write_page (fp, 2);                            // 2 + 3 = 5: write 16K page C000 - FFFFF
+            snap_write_page (fp, 5);                            // 5 + 3 = 8: write 16K page 4000 - 7FFFF
+        }
+        else
+        {
+            uint_fast8_t    page;
+
+            for (page = 0; page < 8; page++)
+            {
+                snap_write_page (fp, page);                     // write 8 x 16K pages
+            }
+        }
+
+        fclose (fp);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * snap_read_byte() - load a byte from snapshot file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+snap_read_byte (FILE * fp, uint8_t * chp)
+{
+    int ch  = getc (fp);
+
+    if (ch == EOF)
+    {
+        return 0;
+    }
+
+    *chp = UINT8_T (ch);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * snap_read_word() - load a word from snapshot file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+snap_read_word (FILE * fp, uint16_t * wp)
+{
+    uint8_t     lo;
+    uint8_t     hi;
+    uint8_t     rtc;
+
+    if (snap_read_byte (fp, &lo) && snap_read_byte (fp, &hi))
+    {
+        *wp = UINT16_T (lo | (hi << 8));
+        rtc = 1;
+    }
+    else
+    {
+        rtc = 0;
+    }
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * load_snapshot() - load snapshot file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+load_snapshot (void)
+{
+    FILE *      fp;
+
+    fp = fopen (fname_load_buf, "rb");
+
+    if (fp)
+    {
+        int         ch;
+        uint8_t     flag            = 0;
+        uint8_t     val             = 0;
+        uint8_t     dummy           = 0;
+        uint8_t     data_compressed = 0;
+        uint8_t *   steccy_ram_ptr;
+        uint8_t     version = 1;
+
+#if defined FRAMEBUFFER || defined X11
+        boot_cache_inhibit = 1;                                 // snapshot overwrites the state anyway
+        zxio_reset ();
+        boot_cache_inhibit = 0;
+#else
+        zxio_reset ();
+#endif
+
+        snap_read_byte (fp, &reg_A);                            // 0 A
+        snap_read_byte (fp, &reg_F);                            // 1 F
+        snap_read_byte (fp, &reg_C);                            // 2 C
+        snap_read_byte (fp, &reg_B);                            // 3 B
+        snap_read_byte (fp, &reg_L);                            // 4 L
+        snap_read_byte (fp, &reg_H);                            // 5 H
+        snap_read_word (fp, &reg_PC);                           // 6+7 PC (if PC = 0x0000, see below: snap version 2/3)
+        snap_read_word (fp, &reg_SP);                           // 8+9 stack pointer
+        snap_read_byte (fp, &reg_I);                            // 10 Interrupt register
+        snap_read_byte (fp, &dummy);                            // 11 Refresh register (Bit 7 is not significant!)
+        snap_read_byte (fp, &flag);                             // 12 Bit 0  : Bit 7 of the R-register
+                                                                //    Bit 1-3: Border colour
+                                                                //    Bit 4  : 1=Basic SamRom switched in
+                                                                //    Bit 5  : 1=Block of data is compressed
+                                                                //    Bit 6-7: No meaning
+        if (flag == 0xFF)                                       // if byte 12 is 255, it has to be regarded as being 1.
+        {
             flag = 1;
         }
 
-        if (flag & (1<<5))
+        if (flag & (1<<5))
+        {
+            data_compressed = 1;
+            printf ("version 1: data_compressed=%d\n", data_compressed);
+            fflush (stdout);
+        }
+
+        zx_border_color = (flag >> 1) & 0x07;
+
+        snap_read_byte (fp, &reg_E);                            // 13 E
+        snap_read_byte (fp, &reg_D);                            // 14 D
+        snap_read_byte (fp, &reg_C2);                           // 15 C'
+        snap_read_byte (fp, &reg_B2);                           // 16 B'
+        snap_read_byte (fp, &reg_E2);                           // 17 E'
+        snap_read_byte (fp, &reg_D2);                           // 18 D'
+        snap_read_byte (fp, &reg_L2);                           // 19 L'
+        snap_read_byte (fp, &reg_H2);                           // 20 H'
+        snap_read_byte (fp, &reg_A2);                           // 21 A'
+        snap_read_byte (fp, &reg_F2);                           // 22 F'
+        snap_read_byte (fp, &reg_IYL);                          // 23 IYL
+        snap_read_byte (fp, &reg_IYH);                          // 24 IYH
+        snap_read_byte (fp, &reg_IXL);                          // 25 IXL
+        snap_read_byte (fp, &reg_IXH);                          // 26 IXH
+
+        snap_read_byte (fp, &val);                              // 27 IFF1
+
+        if (val)
+        {
+            iff1 = 1;
+        }
+        else
+        {
+            iff1 = 0;
+        }
+
+        snap_read_byte (fp, &iff2);                             // 28 IFF2
+        snap_read_byte (fp, &val);                              // 29 Bit 0-1:  Interrupt mode (0, 1 or 2)
+                                                                //    Bit 2  :  1=Issue 2 emulation
+                                                                //    Bit 3  :  1=Double interrupt frequency
+                                                                //    Bit 4-5:  1=High video synchronisation
+                                                                //              3=Low video synchronisation
+                                                                //              0,2=Normal
+                                                                //    Bit 6-7:  0=Cursor/Protek/AGF joystick
+                                                                //              1=Kempston joystick
+                                                                //              2=Sinclair 2 Left joystick
+                                                                //                (or user defined, for version 3 .z80 files)
+                                                                //              3=Sinclair 2 Right joystick
+
+        interrupt_mode = val & 0x03;
+        uint16_t    idx;
+
+        if (reg_PC == 0x0000)
+        {
+            uint16_t    additional_header_len;
+
+            snap_read_word (fp, &additional_header_len);        // 30+31 length of additional header following
+
+            if (additional_header_len == 23)
+            {
+                debug_printf ("snapshot version: 2\n");
+                version = 2;
+            }
+            else
+            {
+                debug_printf ("snapshot version: 3\n");
+                version = 3;
+            }
+
+            debug_printf ("additional_header_len=%d\n", additional_header_len);
+
+            snap_read_word (fp, &reg_PC);                       // 32+33 PC
+            additional_header_len -= 2;
+
+            for (idx = 0; idx < additional_header_len; idx++ )
+            {
+                snap_read_byte (fp, &val);
+
+                if (idx == 0)                                   // 34: hardware mode
+                {
+                                                                // Value:          Meaning in v2           Meaning in v3
+                                                                // -----------------------------------------------------
+                                                                //  0             48k                     48k
+                                                                //  1             48k + If.1              48k + If.1
+                                                                //  2             SamRam                  SamRam
+                                                                //  3             128k                    48k + M.G.T.
+                                                                //  4             128k + If.1             128k
+                                                                //  5             -                       128k + If.1
+                                                                //  6             -                       128k + M.G.T.
+                    if (val == 0 || val == 1)
+                    {
+                        if (z80_romsize != 0x4000)
+                        {
+                            debug_printf ("switching to machine: ZX48K\n");
+                            set_fname_rom_buf ("48.rom");
+                            load_rom ();
+                            zx_ram_init (z80_romsize);
+                        }
+                    }
+                    else if ((version == 2 && (val == 3 || val == 4)) ||
+                             (version == 3 && (val == 4 || val == 5)))
+                    {
+                        if (z80_romsize == 0x4000)
+                        {
+                            debug_printf ("switching to machine: ZX128K\n");
+                            set_fname_rom_buf ("128.rom");
+                            load_rom ();
+                            zx_ram_init (z80_romsize);
+                        }
+                    }
+                }
+                else if (idx == 2)                              // 35: memory paging
+                {
+                                                                // If in SamRam mode, bitwise state of 74ls259.
+                                                                // For example, bit 6=1 after an OUT 31,13 (=2*6+1)
+                                                                // If in 128 mode, contains last OUT to 0x7ffd
+                                                                // If in Timex mode, contains last OUT to 0xf4
+
+                    if (z80_romsize == 0x8000)                  // we are in 128K mode
+                    {
+                        zxio_out_port (0x7F, 0xFD, val);        // adjust memory banks
+                    }
+                }
+            }
+        }
+
+        if (version == 1)
+        {
+            uint32_t base_addr = ZX_RAM_BEGIN;
+
+            if (data_compressed)
+            {
+            }
+            else
+            {
+                for (idx = 0; idx < 49152; idx++)
+                {
+                    snap_read_byte (fp, &val);
+                    zx_ram_set_8(base_addr + idx, val);
+                }
+            }
+        }
+        else
+        {
+            uint8_t     factor      = 0;
+            uint16_t    data_len;
+            uint8_t     page_no     = 0;
+            uint16_t    pos;
+
+            do
+            {
+                snap_read_word (fp, &data_len);                         // 0+1 length of compressed data following
+                                                                        //     0xFFFF means 16384 bytes uncompressed
+                snap_read_byte (fp, &page_no);                          // 2   page number
+
+                if (data_len == 0xFFFF)
+                {
+                    data_compressed = 0;
+                    data_len = SNAPSHOT_PAGE_SIZE;
+                }
+                else
+                {
+                    data_compressed = 1;
+                }
+
+                if (z80_romsize == 0x4000)
+                {
+                    switch (page_no)
+                    {
+                        case 4:     steccy_ram_ptr = steccy_rambankptr[2];      break;          // 0x8000
+                        case 5:     steccy_ram_ptr = steccy_rambankptr[0];      break;          // 0xC000
+                        case 8:     steccy_ram_ptr = steccy_rambankptr[5];      break;          // 0x4000
+                        default:    steccy_ram_ptr = NULL;                      break;          // invalid page
+                    }
+
+                    debug_printf ("ZX48K: data_len=%d, page number=%d\n", data_len, page_no);
+                }
+                else
+                {
+                    steccy_ram_ptr = steccy_rambankptr[page_no - 3];
+                    debug_printf ("ZX128K: data_len=%d, page number=%d\n", data_len, page_no);
+                }
+
+                pos = 0;
+
+                for (idx = 0; idx < data_len; idx++)
+                {
+                    snap_read_byte (fp, &val);
+
+                    if (data_compressed)
+                    {
+                        if (val == 0xED)
+                        {
+                            snap_read_byte (fp, &val);
+                            idx++;
+
+                            if (val == 0xED)
+                            {
+                                int i;
+
+                                snap_read_byte (fp, &factor);                       // factor
+                                idx++;
+                                snap_read_byte (fp, &val);                          // value
+                                idx++;
+
+                                for (i = 0; i < factor; i++)
+                                {
+                                    steccy_ram_ptr[pos] = val;
+                                    pos++;
+                                }
+                            }
+                            else
+                            {
+                                steccy_ram_ptr[pos] = 0xED;
+                                pos++;
+                                steccy_ram_ptr[pos] = val;
+                                pos++;
+                            }
+                        }
+                        else
+                        {
+                            steccy_ram_ptr[pos] = val;
+                            pos++;
+                        }
+                    }
+                    else
+                    {
+                        steccy_ram_ptr[pos] = val;
+                        pos++;
+                    }
+                }
+
+                if ((ch = getc (fp)) != EOF)
+                {
+                    ungetc (ch, fp);
+                }
+            } while (ch != EOF);
+        }
+
+        cur_PC                  = reg_PC;
+        last_ixiyflags          = 0;
+        ixflags                 = 0;
+        iyflags                 = 0;
+#if defined FRAMEBUFFER || defined X11
+        clockcycles_base       += clockcycles;                          // keep z80_get_clockcycles() monotonic
+#endif
+        clockcycles             = 0;
+
+        fclose (fp);
+        z80_interrupt = 0;
+
+#if Z80_BLOCK_CACHE == 1
+        z80_block_cache_flush ();                                       // RAM has been written without zx_ram_set_8()
+#endif
+    }
+    else
+    {
+        perror (fname_rom_buf);
+        return;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * tape_prepare_load() - prepare LOAD Tape (at 0x0556 or later)
+ *
+ * Parameters:
+ * use_regs2 = 0    use_regs2 = 1
+ * IX               IX                  IX        - base address
+ * DE               DE                  DE        - length of data
+ * register F       register F'         Carry = 0 - verify
+ * register F       register F'         Carry = 1 - load
+ * register A       register A'         A=0x00    - header
+ * register A       register A'         A=0xFF    - data block
+ *
+ * Return values:
+ * Carry = 1 - OK
+ * Carry = 0 - ERROR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+tape_prepare_load (uint8_t use_regs2)
+{
+    uint16_t    base_addr   = GET_IX();                                 // base address
+    uint16_t    maxlen      = GET_DE();                                 // maximum length
+    uint8_t     load;                                                   // load or verify
+    uint8_t     load_data;                                              // load data or load header
+    uint8_t     rtc = 0;                                                // 1 = success, 0 = failure
+
+    if (use_regs2)
+    {
+        load        = (reg_F2 & FLAG_C) ? 1 : 0;                        // load or verify
+        load_data   = (reg_A2 != 0x00) ? 1 : 0;                         // load data or load header
+    }
+    else
+    {
+        load        = ISSET_FLAG_C() ? 1 : 0;                             // load or verify
+        load_data   = (reg_A != 0x00) ? 1 : 0;                          // load data or load header
+    }
+
+#ifdef DEBUG
+    uint8_t     req_type;
+    char        req_name[11];
+    uint16_t    req_len;
+
+    if (ram[reg_SP] + (ram[reg_SP + 1] << 8) == 0x771)                  // called from 0x0771
+    {
+        uint8_t *   ptr         = ram + base_addr - 0x11;               // pointer to requested data
+
+        req_type    = ptr[0];
+
+        if (ptr[1] == 0xFF)
+        {
+            req_name[0] = '\0';
+        }
+        else
+        {
+            int idx;
+            memcpy (req_name, ptr + 1, 10);
+            req_name[10] = '\0';
+
+            for (idx = 9; idx >= 0; idx--)
+            {
+                if (req_name[idx] == ' ')
+                {
+                    req_name[idx] = '\0';
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+
+        req_len = UINT16_T (ptr[11] + (ptr[12] << 8));
+
+        debug_printf ("req_type = %d\n", req_type);
+        debug_printf ("req_name = '%s'\n", req_name);
+        debug_printf ("req_len = %d\n", req_len);
+        debug_printf ("p1=%02X p2=%02X p3=%02X p4=%02X\n", ptr[13], ptr[14], ptr[15], ptr[16]);
+    }
+#endif
+
+    if (! z80_user_cancelled_load && ! fname_load_valid)
+    {
+        if (zxio_all_keys_released ())
+        {
+            char *  fname;
+
+            z80_user_cancelled_load = 1;
+
+#ifdef STM32F4XX
+            fname = menu_start_load ();
+
+            if (fname)
+            {
+                int             len;
+
+                poke_file_active = 0;
+                z80_user_cancelled_load = 0;
+                z80_set_fname_load (fname);
+
+                len = strlen (fname_load_buf) - 4;
+
+                if (len >= 0 && fname_load_buf[len] == '.')
+                {
+                    FILINFO fno;
+
+                    strcpy (fname_poke_buf, fname_load_buf);
+                    strcpy (fname_poke_buf + len, ".pok");
+                    // console_printf ("%s\r\n", fname_poke_buf);
+
+                    if (f_stat (fname_poke_buf, &fno) == FR_OK)
+                    {
+                        poke_file_active = 1;
+                    }
+                    else
+                    {
+                        fname_poke_buf[0] = '\0';
+                    }
+                }
+                else
+                {
+                    fname_poke_buf[0] = '\0';
+                }
+
+                rtc = tape_load (fname_load_buf, tape_load_format, base_addr, maxlen, load, load_data);
+#ifdef SSD1963
+                menu_redraw (poke_file_active);                                 // actualize menu entry "Poke"
+#endif
+            }
+#else
+            char            tmpbuf[2 * Z80_MAX_FILENAME_LEN + 2];               // +2: '/' and '\0'
+
+#if defined FRAMEBUFFER || defined X11
+            if (lxrec_mode == LXREC_REPLAY)
+            {
+                fname = (char *) lxrec_replay_load ();                          // complete path chosen while recording
+            }
+            else
+#endif
+            {
+                fname = menu_start_load (z80_settings.path);
+
+                if (fname)
+                {
+                    snprintf (tmpbuf, 2 * Z80_MAX_FILENAME_LEN + 1, "%s/%s", z80_settings.path, fname);
+                    fname = tmpbuf;
+                }
+            }
+
+            if (fname)
+            {
+                int             len;
+
+                poke_file_active = 0;
+                z80_user_cancelled_load = 0;
+                z80_set_fname_load (fname);
+
+                len = strlen (fname_load_buf) - 4;
+
+                if (len >= 0 && fname_load_buf[len] == '.')
+                {
+                    struct stat st;
+
+                    strcpy (fname_poke_buf, fname_load_buf);
+                    strcpy (fname_poke_buf + len, ".pok");
+
+                    if (stat (fname_poke_buf, &st) == 0)
+                    {
+                        poke_file_active = 1;
+                    }
+                    else
+                    {
+                        fname_poke_buf[0] = '\0';
+                    }
+                }
+                else
+                {
+                    fname_poke_buf[0] = '\0';
+                }
+
+                rtc = tape_load (fname_load_buf, tape_load_format, base_addr, maxlen, load, load_data);
+                menu_redraw (poke_file_active);                                 // actualize menu entry "Poke"
+            }
+#endif
+        }
+    }
+    else if (fname_load_valid)
+    {
+        z80_user_cancelled_load = 0;
+        rtc = tape_load (fname_load_buf, tape_load_format, base_addr, maxlen, load, load_data);
+
+        if (! rtc)
+        {
+            z80_close_fname_load ();                            // close tape fp, reset flags to force new LOAD by user
+        }
+    }
+
+    if (rtc)                                                    // successful
+    {
+        reg_D = 0;                                              // reset length
+        reg_E = 0;
+        SET_FLAG_C();                                           // set carry
+    }
+    else
+    {
+        RES_FLAG_C();
+    }
+
+#if defined FRAMEBUFFER || defined X11
+    z80_boot_cache_set_wait (0);                                // machine state is no longer the one after boot
+
+    if (rtc && ! tape_load_at_end ())                           // more blocks follow: load them in turbo
+    {
+        auto_turbo_tape_cycles = z80_get_clockcycles ();
+        z80_auto_turbo_set (AUTO_TURBO_TAPE, "tape load");
+    }
+    else                                                        // last block: back to real time after RET
+    {
+        z80_auto_turbo_clear (AUTO_TURBO_TAPE);
+    }
+#endif
+
+    reg_PC = pop16();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * tape_prepare_save() - prepare SAVE Tape (at 0x04C2):
+ *
+ * Parameters:
+ * IX        - base address
+ * DE        - length of data
+ * A=0x00    - header
+ * A=0xFF    - data block
+ *
+ * Return values:
+ * Carry = 1 - OK
+ * Carry = 0 - ERROR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+tape_prepare_save (void)
+{
+    uint16_t    base_addr   = GET_IX();                                 // base address
+    uint16_t    maxlen      = GET_DE();                                 // maximum length
+    uint8_t     save_data   = (reg_A == 0xFF) ? 1 : 0;                  // save data or save header
+
+#if defined FRAMEBUFFER || defined X11
+    if (z80_runahead_trap ())
+    {
+        return;
+    }
+#endif
+
+    if (fname_save_valid && tape_save (fname_save_buf, base_addr, maxlen, save_data))
+    {
+        SET_FLAG_C();
+    }
+    else
+    {
+        RES_FLAG_C();
+    }
+    reg_PC = pop16();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_set_fname_load () - set filename for LOAD Tape
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_set_fname_load (const char * fname)
+{
+    size_t len = strlen (fname);
+
+    if (len > 4)
+    {
+        len -= 4;
+
+        z80_close_fname_load ();
+
+        if (! strcasecmp (fname + len, ".tap"))
+        {
+            tape_load_format = TAPE_FORMAT_TAP;
+            strncpy (fname_load_buf, fname, Z80_MAX_FILENAME_LEN);
+            fname_load_valid = 1;
+        }
+        else if (! strcasecmp (fname + len, ".tzx"))
+        {
+            tape_load_format = TAPE_FORMAT_TZX;
+            strncpy (fname_load_buf, fname, Z80_MAX_FILENAME_LEN);
+            fname_load_valid = 1;
+        }
+        else if (! strcasecmp (fname + len, ".z80"))
+        {
+            tape_load_format = TAPE_FORMAT_Z80;
+            strncpy (fname_load_buf, fname, Z80_MAX_FILENAME_LEN);
+            fname_load_snapshot_valid = 1;
+        }
+    }
+
+#if defined FRAMEBUFFER || defined X11
+    lxrec_event (LXREC_EVENT_LOAD, fname);
+#endif
+}
+
+void
+z80_close_fname_load (void)
+{
+    fname_load_valid = FALSE;
+    fname_load_snapshot_valid = FALSE;
+    fname_load_buf[0] = '\0';
+    tape_load_close ();
+
+#if defined FRAMEBUFFER || defined X11
+    z80_auto_turbo_clear (AUTO_TURBO_TAPE);
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_load_rom () - load new rom
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_load_rom (const char * fname)
+{
+    if (strlen (fname) > 4)
+    {
+#ifdef QT_CORE_LIB  // TODO: QT includes complete path in fname
+        (void) strncpy (fname_rom_buf, fname, sizeof (fname_rom_buf) - 1);
+#else
+        set_fname_rom_buf (fname);
+#endif
+#if defined FRAMEBUFFER || defined X11
+        lxrec_event (LXREC_EVENT_ROM, fname);
+#endif
+        load_rom ();
+        zxio_reset ();
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_set_fname_save_snapshot() - Set save snapshot file name
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_set_fname_save_snapshot (const char * fname)
+{
+    strcpy (snapshot_save_fname, fname);
+    snapshot_save_valid = 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_set_fname_save() - set name of TZX file for SAVEing
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_set_fname_save (const char * fname)
+{
+    z80_close_fname_save ();
+
+    if (strlen (fname) > 4)
+    {
+        strncpy (fname_save_buf, fname, Z80_MAX_FILENAME_LEN);
+        fname_save_valid = 1;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_close_fname_save() - close TZX file for SAVEing
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+z80_close_fname_save (void)
+{
+    fname_save_valid    = 0;
+    fname_save_buf[0]   = '\0';
+    tape_save_close ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * serial_output () - output reg_A as character to UART
+ *
+ * STM32: USART 2 will be used
+ * QT:    stdout will be used
+ *
+ * See also: https://faqwiki.zxnet.co.uk/wiki/Channels_and_streams
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+serial_output (void)
+{
+    int ch = reg_A;
+
+    if (ch == 0x06)                                     // PRINT #4,"Hello": convert Sinclair TAB into ASCII TAB
+    {
+        ch = '\t';
+    }
+
+    if (ch == '\r')                                     // got CR
+    {
+#ifdef STM32F4XX
+        putchar ('\r');                                 // on STM32F4: convert it to CRNL
+#endif
+        putchar ('\n');                                 // on unix like systems or QT: convert it to NL
+    }
+    else
+    {
+        putchar (ch);
+    }
+
+    fflush (stdout);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * serial_input () - read a character from UART
+ *
+ * STM32: USART 2 will be used
+ * QT:    returns dummy characters "1234\r"
+ *
+ * If data is available, set reg_A to character and set carry flag.
+ * If data is not available, reset CARRY flag.
+ * If data is End-of-File, reset ZERO and CARRY flag.
+ * The basic command INPUT then results in a loop until Carry is set.
+ *
+ * A CR indicates end of input string. To avoid a bug, we should set bit 5 in TV_FLAG
+ *
+ * See also: https://faqwiki.zxnet.co.uk/wiki/Channels_and_streams
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define TV_FLAG     23612
+static void
+serial_input (void)
+{
+#ifdef STM32F4XX                                                // on STM32F4:
+    uint_fast8_t ch;
+
+    if (console_poll (&ch))                                     // poll character
+    {
+        reg_A = ch;                                             // store chac in register A
+        SET_FLAG_C();                                           // carry flag: indicate that character is available
+
+        if (reg_A == '\r')                                      // if char is a CR:
+        {
+            zx_ram_set_8(TV_FLAG, (1<<5));                      // ZX ROM bugfix: set only bit 5: clear screen on next command input
+        }
+    }
+    else
+    {
+        RES_FLAG_C();                                           // reset carry: indicate that no character available
+    }
+#else                                                           // on Linux/Unix/QT: receive dummy string "12345\r"
+    static uint8_t ch = '1';                                    // begin with '1'
+
+    reg_A = ch;                                                 // set character
+    SET_FLAG_C();                                               // indicate that character is available
+
+    if (ch == '5')                                              // we return only 1234, then CR
+    {
+        ch = '1';                                               // reset char to '1'
+        reg_A = '\r';
+        zx_ram_set_8(TV_FLAG, (1<<5));                          // ZX ROM bugfix: set only bit 5: clear screen on next command input
+    }
+    else
+    {
+        ch++;                                                   // next char: 2345
+    }
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_idle_time () - use idle time to do something other, or just wait
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static INLINE void
+z80_idle_time (void)
+{
+#ifdef QT_CORE_LIB                                              // QT: sleep 10 msec, set z80 interrupt flag every 20msec
+    if (clockcycles >= CLOCKCYCLES_PER_10_MSEC)
+    {
+        static int      cnt = 0;
+        static int      last_elapsed = 0;
+        static QTime    qtime;
+        int             elapsed = qtime.elapsed();
+
+        clockcycles -= CLOCKCYCLES_PER_10_MSEC;
+
+        if (elapsed - last_elapsed < SLEEP_MSEC)
+        {
+            QThread::msleep(static_cast<unsigned long> (SLEEP_MSEC - (elapsed - last_elapsed)));
+        }
+        else
+        {
+            QThread::msleep(SLEEP_MSEC);
+        }
+
+        last_elapsed = elapsed;
+        cnt++;
+
+        if (cnt == 2)                                           // interrupt every 20 msec
+        {
+            cnt = 0;
+            z80_interrupt = 1;
+        }
+    }
+
+#elif defined FRAMEBUFFER || defined X11                        // unix/linux: sleep 10 msec, set z80 interrupt flag every 20msec
+    if (clockcycles >= CLOCKCYCLES_PER_10_MSEC)
+    {
+        static int cnt = 0;
+        clockcycles -= CLOCKCYCLES_PER_10_MSEC;
+        clockcycles_base += CLOCKCYCLES_PER_10_MSEC;
+
+        struct timespec         elapsed;
+        static uint64_t         deadline_usec;                          // real time at which this tick is due
+        uint64_t                usec;
+        uint32_t                sleep_usec = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &elapsed);
+        usec = 1000000ULL * elapsed.tv_sec + (elapsed.tv_nsec / 1000);
+
+        if (auto_turbo)
+        {
+            uint32_t    cycles = z80_get_clockcycles ();
+
+            if (cycles - auto_turbo_start_cycles > AUTO_TURBO_BOOT_MAX_CYCLES)
+            {
+                z80_auto_turbo_clear (AUTO_TURBO_BOOT);
+            }
+
+            if (cycles - auto_turbo_tape_cycles > AUTO_TURBO_TAPE_IDLE_CYCLES)
+            {
+                z80_auto_turbo_clear (AUTO_TURBO_TAPE);
+            }
+        }
+
+        if (runahead_frames)
+        {
+            ;                                                           // running ahead: don't sleep, keep deadline of real frame
+        }
+        else if (! z80_settings.turbo_mode && ! auto_turbo && ! z80_unthrottled)
+        {
+            if (deadline_usec == 0 || usec > deadline_usec + MAX_LAG_USEC)   // first tick, after turbo or hopelessly late: resync
+            {
+                deadline_usec = usec;
+            }
+
+            deadline_usec += SLEEP_USEC;
+
+            if (usec < deadline_usec)
+            {
+                sleep_usec = deadline_usec - usec;
+                lag_usec = 0;
+            }
+            else
+            {
+                lag_usec = usec - deadline_usec;                        // behind: don't sleep, catch up instead
+            }
+        }
+        else
+        {
+            deadline_usec = 0;
+            lag_usec = 0;
+        }
+
+        if (lxctrl_active)
+        {
+            if (lxctrl_wait (sleep_usec))                               // sleep, but wake up on input from control socket
+            {
+                update_display |= UPDATE_DISPLAY_CTRL;
+            }
+        }
+        else if (sleep_usec)
+        {
+            usleep (sleep_usec);
+        }
+
+        if (lxevdev_active)                                             // next slice stands for the 10 msec before its deadline
+        {
+            lxevdev_tick (z80_get_clockcycles (), (deadline_usec && ! runahead_frames) ? deadline_usec - SLEEP_USEC : 0);
+        }
+
+        if (lxrec_mode && lxrec_tick ())
+        {
+            update_display |= UPDATE_DISPLAY_REC;
+        }
+
+        cnt++;
+
+        if (cnt == 2)                                                   // interrupt every 20 msec
+        {
+            cnt = 0;
+            z80_interrupt = 1;
+            update_display |= UPDATE_DISPLAY_FRAME;                     // only if FRAMEBUFFER or X11
+        }
+    }
+
+#elif defined STM32F4XX                                                 // STM32: handle devices, set z80 interrupt flag every 20msec
+
+    static int  cnt = 0;
+    uint32_t    clockcycles_per_200_usec = CLOCKCYCLES_PER_200_USEC;
+
+    if (! (cnt % 4))
+    {
+        clockcycles_per_200_usec--;                                     // 75% = 672, 25% = 671 => (75*672 + 25*671) / 2 => 67175 / 2 = 33587
+    }
+
+    if (clockcycles >= clockcycles_per_200_usec)
+    {
+        clockcycles -= clockcycles_per_200_usec;
+
+        static uint32_t     last_uptime;                                // in units of 20us
+        uint32_t            stop_time = last_uptime + 10;               // 200 usec (10 * 20us) later...
+
+        if (z80_settings.keyboard & KEYBOARD_ZX)                        // use idle time to call ZX keyboard statemachine
+        {
+            zxkbd_poll ();
+        }
+
+        if (z80_settings.keyboard & KEYBOARD_USB)                       // use dle time to call USB statemachine
+        {
+            usb_hid_host_process (FALSE);
+        }
+
+        if (joystick_is_online)                                         // use idle time to call joystick statemachine
+        {
+            if (joystick_state == JOYSTICK_STATE_IDLE)                  // joystick is idle, start new transmission
+            {
+                static uint32_t jcnt = 0;
+                jcnt++;
+
+                if (jcnt == 100)                                        // 100 * 200usec = 20msec
+                {
+                    jcnt = 0;
+                    joystick_start_transmission ();                     // start a transmission only every 20msec
+                }
+            }
+            else                                                        // joystick ist busy, try to check if transmission finished
+            {
+                (void) joystick_finished_transmission (TRUE);           // ignore rtc, just read in joystick values
+            }
+        }
+
+        if (z80_settings.turbo_mode)                                    // turbo mode
+        {
+            uptime = stop_time;                                         // skip pause time
+        }
+        else
+        {
+            while (uptime < stop_time)                                  // wait until stop_time reached
+            {
+                // wait
+            }
+        }
+
+        last_uptime = uptime;                                           // restore last uptime
+
+        cnt++;
+
+        if (cnt == CLOCKCYCLES_COUNT_200_USEC)                          // Z80 interrupt every 20 msec
+        {
+            cnt = 0;
+            z80_interrupt = 1;
+        }
+    }
+#else
+#error "unexpected platform"
+#endif
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_po_attr (void) - ROM hook: set attribute for pixel address given by HL
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zx_rom_po_attr (void)
+{
+    reg_H >>= 3;                                                    // get attribute address from
+    reg_H &= 0x03;                                                  // screen pixel address
+    reg_H |= 0x58;
+
+    uint16_t    attr_addr   = (reg_H << 8) | reg_L;
+    uint8_t     attr        = zx_ram_get_8(attr_addr);
+    uint8_t     attr_t      = zx_ram_get_8(ATTR_T);                 // get ATTR_T
+    uint8_t     mask_t      = zx_ram_get_8(MASK_T);                 // get MASK_T
+    uint8_t     p_flag      = zx_ram_get_8(P_FLAG);                 // get P_FLAG
+
+    attr ^= attr_t;
+    attr &= mask_t;
+    attr ^= attr_t;
+
+    if (p_flag & (1 << 6))
+    {
+        attr &= 0xC7;
+
+        if (! (attr & (1 << 2)))
+        {
+            attr ^= 0x38;
+        }
+    }
+
+    if (p_flag & (1 << 4))
+    {
+        attr &= 0xF8;
+
+        if (! (attr & (1 << 5)))
+        {
+            attr ^= 0x07;
+        }
+    }
+
+    zx_ram_set_8(attr_addr, attr);
+
+    reg_DE  = (mask_t << 8) | attr_t;                               // registers as left by PO-ATTR
+    reg_A   = attr;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_plot_sub (void) - ROM hook: plot
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zx_rom_plot_sub (void)
+{
+    uint8_t x   = reg_C;
+    uint8_t y   = reg_B;
+
+    // printf ("PLOT %d,%d\n", x, y);
+
+    zx_ram_set_8 (COORDS_X, x);                                     // LD (COORDS),BC
+    zx_ram_set_8 (COORDS_Y, y);
+
+    y = 175 - y;                                                    // y = 0 is at bottom of screen
+
+    // 2 calculate address:
+    // 15   14  13  12  11  10  9   8   7   6   5   4   3   2   1   0
+    // 0    1   0   Y7  Y6  Y2  Y1  Y0  Y5  Y4  Y3  X7  X6  X5  X4  X3
+
+    uint16_t addr = ZX_SPECTRUM_DISPLAY_START_ADDRESS   |           // base address
+                    ((y & 0xC0) << 5)                   |           // Y7 Y6
+                    ((y & 0x07) << 8)                   |           // Y2 Y1 Y0
+                    ((y & 0x38) << 2)                   |           // Y5 Y4 Y3
+                    ((x & 0xF8) >> 3);                              // X7 X6 X5 X4
+
+    uint8_t v       = zx_ram_get_8(addr);
+    uint8_t p_flag  = zx_ram_get_8(P_FLAG);                         // get P_FLAG
+
+    if (p_flag & 0x01)                                              // Bit 0 set: OVER 1
+    {
+        if (! (p_flag & (1 << 2)))                                  // Bit 2 not set: not INVERSE 1
+        {
+            v ^= (1 << (7 - (x & 0x07)));                           // OVER 1: set Pixel if reset and vice versa
+        }
+    }
+    else
+    {
+        if (p_flag & (1 << 2))                                      // Bit 2 set: INVERSE 1
+        {
+            v &= ~(1 << (7 - (x & 0x07)));                          // INVERSE 1: set pixel to paper color
+        }
+        else
+        {
+            v |= (1 << (7 - (x & 0x07)));                           // NORMAL: set pixel to ink color
+        }
+    }
+
+    zx_ram_set_8(addr, v);
+
+    reg_H = addr >> 8;
+    reg_L = addr & 0xFF;
+    zx_rom_po_attr ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_draw_line_3 (void) - ROM hook: draw line
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zx_rom_draw_line_3 (void)
+{
+    int         x0  = zx_ram_get_8 (COORDS_X);                  // start x
+    int         y0  = zx_ram_get_8 (COORDS_Y);                  // start y
+    int         x   = reg_C;                                    // ABS x
+    int         y   = reg_B;                                    // ABS Y
+    int         dx  = (reg_E == 0xFF) ? -1 : 1;                 // SGN x: 0x01 = positive, 0xFF = negative
+    int         dy  = (reg_D == 0xFF) ? -1 : 1;                 // SGN y: 0x01 = positive, 0xFF = negative
+    int         ddx;
+    int         ddy;
+    int         ix;
+    int         iy;
+
+    // printf ("x0=%d y0=%d x=%d y=%d dx=%d dy=%d\n", x0, y0, x, y, dx, dy);
+
+    int         h;
+    int         n;
+    int         b;
+    int         i;
+    int         l;
+
+    if (x >= y)
+    {
+        if (x + y == 0)
         {
-            data_compressed = 1;
-            printf ("version 1: data_compressed=%d\n", data_compressed);
-            fflush (stdout);
+            return;
+        }
+
+        l = y;
+        b = x;
+        ddx = dx;
+        ddy = 0;
+    }
+    else
+    {
+        l = x;
+        b = y;
+        ddx = 0;
+        ddy = dy;
+    }
+
+    h = b;
+    i = b / 2;
+
+    for (n = b; n > 0; n--)
+    {
+        i += l;
+
+        if (i < h)
+        {
+            ix = ddx;
+            iy = ddy;
+        }
+        else
+        {
+            i -= h;
+            ix = dx;
+            iy = dy;
+        }
+
+        y0 += iy;
+
+        if (y0 < 0 || y0 > 175)
+        {
+            return;
+        }
+
+        x0 += ix;
+
+        if (x0 < 0 || x0 > 255)
+        {
+            return;
+        }
+
+        reg_C = x0;
+        reg_B = y0;
+        zx_rom_plot_sub ();
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_char_row_addr (row) - get screen address of first pixel line of character row
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint16_t
+zx_rom_char_row_addr (uint_fast8_t row)
+{
+    return ZX_SPECTRUM_DISPLAY_START_ADDRESS | ((row & 0x18) << 8) | ((row & 0x07) << 5);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_cl_line (void) - ROM hook: CL-LINE, clear bottom B lines of the display
+ *
+ * Returns FALSE if the ROM has to do the work.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_cl_line (void)
+{
+    uint_fast8_t    lines = reg_B;
+    uint_fast8_t    row;
+    uint_fast8_t    pixel_line;
+    uint_fast8_t    col;
+    uint16_t        addr;
+    uint8_t         attr;
+
+    if (lines == 0 || lines > 24)
+    {
+        return FALSE;
+    }
+
+    for (row = 24 - lines; row < 24; row++)
+    {
+        addr = zx_rom_char_row_addr (row);
+
+        for (pixel_line = 0; pixel_line < 8; pixel_line++)
+        {
+            for (col = 0; col < 32; col++)
+            {
+                zx_ram_set_8 (addr + col, 0x00);
+            }
+
+            addr += 0x100;
+        }
+    }
+
+    if (zx_ram_get_8 (TV_FLAG) & 0x01)                              // lower part of screen: use BORDCR
+    {
+        attr = zx_ram_get_8 (BORDCR);
+    }
+    else
+    {
+        attr = zx_ram_get_8 (ATTR_P);
+    }
+
+    for (addr = ZX_SPECTRUM_ATTRIBUTES_START_ADDR + (24 - lines) * 32; addr < ZX_SPECTRUM_ATTRIBUTES_START_ADDR + 24 * 32; addr++)
+    {
+        zx_ram_set_8 (addr, attr);
+    }
+
+    reg_A   = attr;                                                 // registers as left by the LDIR of CL-LINE
+    reg_C   = 0x21;
+    reg_DE  = ZX_SPECTRUM_ATTRIBUTES_START_ADDR + 24 * 32;
+    reg_HL  = ZX_SPECTRUM_ATTRIBUTES_START_ADDR + 24 * 32 - 1;
+    return TRUE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_cl_scroll (void) - ROM hook: CL-SCROLL, scroll bottom B lines of the display up into the line above, clear bottom line
+ *
+ * Returns FALSE if the ROM has to do the work.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_cl_scroll (void)
+{
+    uint_fast8_t    lines = reg_B;
+    uint_fast8_t    row;
+    uint_fast8_t    pixel_line;
+    uint_fast8_t    col;
+    uint16_t        from;
+    uint16_t        to;
+
+    if (lines == 0 || lines > 23)
+    {
+        return FALSE;
+    }
+
+    for (row = 24 - lines; row < 24; row++)
+    {
+        from    = zx_rom_char_row_addr (row);
+        to      = zx_rom_char_row_addr (row - 1);
+
+        for (pixel_line = 0; pixel_line < 8; pixel_line++)
+        {
+            for (col = 0; col < 32; col++)
+            {
+                zx_ram_set_8 (to + col, zx_ram_get_8 (from + col));
+            }
+
+            from    += 0x100;
+            to      += 0x100;
+        }
+
+        from    = ZX_SPECTRUM_ATTRIBUTES_START_ADDR + row * 32;
+
+        for (col = 0; col < 32; col++)
+        {
+            zx_ram_set_8 (from - 32 + col, zx_ram_get_8 (from + col));
+        }
+    }
+
+    reg_B = 1;                                                      // CL-SCROLL continues with CL-LINE for the bottom line
+    return zx_rom_cl_line ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_pr_all_2 (void) - ROM hook: PR-ALL-2, print character bitmap at DE into screen address HL
+ *
+ * Returns FALSE if the ROM has to do the work, e.g. if the printer is in use.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_pr_all_2 (void)
+{
+    uint16_t        scr_addr    = reg_HL;
+    uint16_t        chr_addr    = reg_DE;
+    uint8_t         p_flag;
+    uint8_t         over_mask;
+    uint8_t         inverse_mask;
+    uint8_t         v = 0;
+    uint_fast8_t    pixel_line;
+
+    if (zx_ram_get_8 (FLAGS) & 0x02)                                // printer in use
+    {
+        return FALSE;
+    }
+
+    p_flag          = zx_ram_get_8 (P_FLAG);
+    over_mask       = (p_flag & 0x01) ? 0xFF : 0x00;                // OVER 1: keep pixels on screen
+    inverse_mask    = (p_flag & 0x04) ? 0xFF : 0x00;                // INVERSE 1: invert character
+
+    for (pixel_line = 0; pixel_line < 8; pixel_line++)
+    {
+        v = (zx_ram_get_8 (scr_addr) & over_mask) ^ zx_ram_get_8 (chr_addr) ^ inverse_mask;
+        zx_ram_set_8 (scr_addr, v);
+        scr_addr += 0x100;
+        chr_addr++;
+    }
+
+    reg_A2  = v;                                                    // AF' holds the last byte, see EX AF,AF' in PR-ALL-5
+    reg_F2  = (reg_F2 & (FLAG_X1 | FLAG_X2)) | z80_flags_szp[v];
+
+    scr_addr    = reg_HL;
+    reg_HL      = reg_HL + 0x0700;                                  // last pixel line of character cell
+    zx_rom_po_attr ();
+
+    reg_HL      = scr_addr + 1;                                     // next print position
+    reg_C--;
+    reg_F       = (reg_F & (FLAG_X1 | FLAG_X2)) | z80_flags_dec[reg_C];
+    return TRUE;
+}
+
+#if Z80_ROM_HOOKS_CALC == 1
+#define ZX_ROM_CALC_TRIG_MAX    (2.0 * 3.14159265358979323846 * 256.0)  // SIN/COS: above, the argument reduction of the ROM loses bits
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_get (addr, valuep) - get 5 byte floating point number or small integer from calculator stack
+ *
+ * Returns FALSE if the value has no valid representation.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_get (uint16_t addr, double * valuep)
+{
+    uint8_t     exponent = zx_ram_get_8 (addr);
+    uint8_t     sign = zx_ram_get_8 (addr + 1);
+    uint32_t    mantissa;
+
+    if (exponent == 0)                                              // small integer: 0x00, sign, low byte, high byte, 0x00
+    {
+        mantissa = zx_ram_get_8 (addr + 2) | (zx_ram_get_8 (addr + 3) << 8);
+
+        if (sign == 0x00)
+        {
+            *valuep = mantissa;
+        }
+        else if (sign == 0xFF && mantissa != 0)
+        {
+            *valuep = (double) mantissa - 65536.0;
+        }
+        else
+        {
+            return FALSE;
+        }
+    }
+    else                                                            // floating point: exponent + 128, 4 byte mantissa, sign in bit 7
+    {
+        mantissa = ((uint32_t) (sign | 0x80) << 24) | ((uint32_t) zx_ram_get_8 (addr + 2) << 16) |
+                   (zx_ram_get_8 (addr + 3) << 8) | zx_ram_get_8 (addr + 4);
+
+        *valuep = ldexp ((double) mantissa, exponent - 128 - 32);
+
+        if (sign & 0x80)
+        {
+            *valuep = -*valuep;
+        }
+    }
+
+    return TRUE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_set (addr, value) - store value as 5 byte floating point number on calculator stack
+ *
+ * Returns FALSE on overflow or underflow, then nothing is stored.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_set (uint16_t addr, double value)
+{
+    uint8_t     sign = 0x00;
+    uint64_t    mantissa;
+    int         exponent;
+
+    if (value == 0.0)
+    {
+        zx_ram_set_8 (addr, 0x00);
+        zx_ram_set_8 (addr + 1, 0x00);
+        zx_ram_set_8 (addr + 2, 0x00);
+        zx_ram_set_8 (addr + 3, 0x00);
+        zx_ram_set_8 (addr + 4, 0x00);
+        return TRUE;
+    }
+
+    if (value < 0.0)
+    {
+        sign    = 0x80;
+        value   = -value;
+    }
+
+    mantissa = (uint64_t) (ldexp (frexp (value, &exponent), 32) + 0.5);    // 0.5 <= frexp() < 1, round to 32 bits
+
+    if (mantissa == 0x100000000ULL)
+    {
+        mantissa >>= 1;
+        exponent++;
+    }
+
+    if (exponent + 128 < 1 || exponent + 128 > 255)
+    {
+        return FALSE;
+    }
+
+    zx_ram_set_8 (addr, exponent + 128);
+    zx_ram_set_8 (addr + 1, ((mantissa >> 24) & 0x7F) | sign);
+    zx_ram_set_8 (addr + 2, (mantissa >> 16) & 0xFF);
+    zx_ram_set_8 (addr + 3, (mantissa >> 8) & 0xFF);
+    zx_ram_set_8 (addr + 4, mantissa & 0xFF);
+    return TRUE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_mantissa (value, exponentp) - get 32 bit mantissa and exponent of value, value = mantissa * 2^(exponent - 32)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+zx_rom_calc_mantissa (double value, int * exponentp)
+{
+    return (uint32_t) ldexp (fabs (frexp (value, exponentp)), 32);     // exact, the values have at most 32 significant bits
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_multiply (void) - ROM hook: calculator multiply, HL = first operand, DE = second operand
+ *
+ * Returns FALSE if the ROM has to do the work, e.g. on overflow.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_multiply (void)
+{
+    uint8_t     sign1;
+    uint8_t     sign2;
+    uint16_t    value1;
+    uint16_t    value2;
+    uint32_t    product;
+    uint64_t    mantissa;
+    int         exponent1;
+    int         exponent2;
+    uint_fast8_t negative;
+    double      v1;
+    double      v2;
+
+    if (zx_ram_get_8 (reg_HL) == 0 && zx_ram_get_8 (reg_DE) == 0)  // both small integers
+    {
+        sign1   = zx_ram_get_8 (reg_HL + 1);
+        sign2   = zx_ram_get_8 (reg_DE + 1);
+        value1  = zx_ram_get_16 (reg_HL + 2);
+        value2  = zx_ram_get_16 (reg_DE + 2);
+
+        if ((sign1 == 0x00 || sign1 == 0xFF) && (sign2 == 0x00 || sign2 == 0xFF))
+        {
+            if (sign1)                                              // INT-FETCH: get absolute values
+            {
+                value1 = UINT16_T (-value1);
+            }
+
+            if (sign2)
+            {
+                value2 = UINT16_T (-value2);
+            }
+
+            product = (uint32_t) value1 * value2;
+
+            if (product <= 0xFFFF)                                  // else continue with floating point, see MULT-OFLW
+            {
+                sign1 ^= sign2;
+
+                if (product == 0)
+                {
+                    sign1 = 0x00;
+                }
+
+                if (sign1)                                          // INT-STORE: store two's complement
+                {
+                    product = UINT16_T (-product);
+                }
+
+                zx_ram_set_8 (reg_HL, 0x00);
+                zx_ram_set_8 (reg_HL + 1, sign1);
+                zx_ram_set_8 (reg_HL + 2, product & 0xFF);
+                zx_ram_set_8 (reg_HL + 3, product >> 8);
+                zx_ram_set_8 (reg_HL + 4, 0x00);
+                return TRUE;
+            }
         }
+    }
 
-        zx_border_color = (flag >> 1) & 0x07;
+    if (! zx_rom_calc_get (reg_HL, &v1) || ! zx_rom_calc_get (reg_DE, &v2))
+    {
+        return FALSE;
+    }
 
-        snap_read_byte (fp, &reg_E);                            // 13 E
-        snap_read_byte (fp, &reg_D);                            // 14 D
-        snap_read_byte (fp, &reg_C2);                           // 15 C'
-        snap_read_byte (fp, &reg_B2);                           // 16 B'
-        snap_read_byte (fp, &reg_E2);                           // 17 E'
-        snap_read_byte (fp, &reg_D2);                           // 18 D'
-        snap_read_byte (fp, &reg_L2);                           // 19 L'
-        snap_read_byte (fp, &reg_H2);                           // 20 H'
-        snap_read_byte (fp, &reg_A2);                           // 21 A'
-        snap_read_byte (fp, &reg_F2);                           // 22 F'
-        snap_read_byte (fp, &reg_IYL);                          // 23 IYL
-        snap_read_byte (fp, &reg_IYH);                          // 24 IYH
-        snap_read_byte (fp, &reg_IXL);                          // 25 IXL
-        snap_read_byte (fp, &reg_IXH);                          // 26 IXH
+    if (v1 == 0.0 || v2 == 0.0)
+    {
+        return zx_rom_calc_set (reg_HL, 0.0);
+    }
 
-        snap_read_byte (fp, &val);                              // 27 IFF1
+    mantissa    = (uint64_t) zx_rom_calc_mantissa (v1, &exponent1) * zx_rom_calc_mantissa (v2, &exponent2);   // 2^62 <= product < 2^64
 
-        if (val)
+    if (mantissa < 0x8000000000000000ULL)
+    {
+        mantissa <<= 1;
+        exponent1--;
+    }
+
+    mantissa = (mantissa >> 32) + ((mantissa >> 31) & 1);                   // round with the next bit like the ROM
+
+    if (mantissa == 0x100000000ULL)
+    {
+        mantissa >>= 1;
+        exponent1++;
+    }
+
+    negative    = (v1 < 0.0) != (v2 < 0.0);
+    v1          = ldexp ((double) mantissa, exponent1 + exponent2 - 32);  // exact, no rounding in zx_rom_calc_set()
+
+    if (negative)
+    {
+        v1 = -v1;
+    }
+
+    return zx_rom_calc_set (reg_HL, v1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_division (void) - ROM hook: calculator division, HL = first operand, DE = second operand
+ *
+ * The mantissas are divided as integers like in the ROM: it calculates 33 bits of the quotient and rounds with the last one only if the
+ * first one is set, else the quotient is truncated.
+ * Returns FALSE if the ROM has to do the work, e.g. on division by zero.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_division (void)
+{
+    double      v1;
+    double      v2;
+    uint64_t    quotient;
+    int         exponent1;
+    int         exponent2;
+    uint_fast8_t negative;
+
+    if (! zx_rom_calc_get (reg_HL, &v1) || ! zx_rom_calc_get (reg_DE, &v2) || v2 == 0.0)
+    {
+        return FALSE;
+    }
+
+    negative = (v1 < 0.0) != (v2 < 0.0);
+
+    if (v1 == 0.0)
+    {
+        return zx_rom_calc_set (reg_HL, 0.0);
+    }
+
+    quotient    = ((uint64_t) zx_rom_calc_mantissa (v1, &exponent1) << 32) / zx_rom_calc_mantissa (v2, &exponent2); // 2^31 < quotient < 2^33
+
+    if (quotient >= 0x100000000ULL)
+    {
+        quotient = (quotient >> 1) + (quotient & 1);
+        exponent1++;
+
+        if (quotient == 0x100000000ULL)
         {
-            iff1 = 1;
+            quotient >>= 1;
+            exponent1++;
         }
-        else
+    }
+
+    v1 = ldexp ((double) quotient, exponent1 - exponent2 - 32);         // exact, no rounding in zx_rom_calc_set()
+
+    if (negative)
+    {
+        v1 = -v1;
+    }
+
+    return zx_rom_calc_set (reg_HL, v1);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_sin (void) - ROM hook: calculator SIN, HL = operand
+ *
+ * Returns FALSE if |operand| > 2 * PI * 2^8, the result of the ROM differs too much from the exact one.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_sin (void)
+{
+    double      v;
+
+    if (! zx_rom_calc_get (reg_HL, &v) || fabs (v) > ZX_ROM_CALC_TRIG_MAX)
+    {
+        return FALSE;
+    }
+
+    return zx_rom_calc_set (reg_HL, sin (v));
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_cos (void) - ROM hook: calculator COS, HL = operand
+ *
+ * Returns FALSE if |operand| > 2 * PI * 2^8, see zx_rom_calc_sin().
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_cos (void)
+{
+    double      v;
+
+    if (! zx_rom_calc_get (reg_HL, &v) || fabs (v) > ZX_ROM_CALC_TRIG_MAX)
+    {
+        return FALSE;
+    }
+
+    return zx_rom_calc_set (reg_HL, cos (v));
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zx_rom_calc_sqr (void) - ROM hook: calculator SQR, HL = operand
+ *
+ * Returns FALSE if the ROM has to report an invalid argument.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+zx_rom_calc_sqr (void)
+{
+    double      v;
+
+    if (! zx_rom_calc_get (reg_HL, &v) || v < 0.0)
+    {
+        return FALSE;
+    }
+
+    if (v == 0.0)                                                   // SQR 0 leaves the operand untouched
+    {
+        return TRUE;
+    }
+
+    return zx_rom_calc_set (reg_HL, sqrt (v));
+}
+#endif // Z80_ROM_HOOKS_CALC == 1
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_opcode() - execute opcode
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#if Z80_BLOCK_CACHE == 1                                                    // z80_block_op_XX() need their own copy with constant opcode
+#define OPCODE_INLINE           inline __attribute__((always_inline))
+#else
+#define OPCODE_INLINE           INLINE
+#endif
+
+static OPCODE_INLINE void
+z80_opcode (uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case 0x00:  cmd_nop ();                             break;          // NOP
+        case 0x01:  cmd_ld_rr_nn (REG_IDX_BC);              break;          // LD BC,nn
+        case 0x02:  cmd_ld_ind_rr_a (REG_IDX_BC);           break;          // LD (BC),A
+        case 0x03:  cmd_inc_rr (REG_IDX_BC);                break;          // INC BC
+        case 0x04:  cmd_inc_r (REG_IDX_B);                  break;          // INC B
+        case 0x05:  cmd_dec_r (REG_IDX_B);                  break;          // DEC B
+        case 0x06:  cmd_ld_r_n (REG_IDX_B);                 break;          // LD B,n
+        case 0x07:  cmd_rlca ();                            break;          // RLCA
+        case 0x08:  cmd_ex_af_af ();                        break;          // EX AF,AF'
+        case 0x09:  cmd_add_ii_rr (REG_IDX_BC);             break;          // ADD HL,BC / ADD IX,BC / ADD IY,BC
+        case 0x0A:  cmd_ld_a_ind_rr (REG_IDX_BC);           break;          // LD A,(BC)
+        case 0x0B:  cmd_dec_rr (REG_IDX_BC);                break;          // DEC BC
+        case 0x0C:  cmd_inc_r (REG_IDX_C);                  break;          // INC C
+        case 0x0D:  cmd_dec_r (REG_IDX_C);                  break;          // DEC C
+        case 0x0E:  cmd_ld_r_n (REG_IDX_C);                 break;          // LD C,n
+        case 0x0F:  cmd_rrca ();                            break;          // RRCA
+
+        case 0x10:  cmd_djnz ();                            break;          // DJNZ n
+        case 0x11:  cmd_ld_rr_nn (REG_IDX_DE);              break;          // LD DE,nn
+        case 0x12:  cmd_ld_ind_rr_a (REG_IDX_DE);           break;          // LD (DE),A
+        case 0x13:  cmd_inc_rr (REG_IDX_DE);                break;          // INC DE
+        case 0x14:  cmd_inc_r (REG_IDX_D);                  break;          // INC D
+        case 0x15:  cmd_dec_r (REG_IDX_D);                  break;          // DEC D
+        case 0x16:  cmd_ld_r_n (REG_IDX_D);                 break;          // LD D,n
+        case 0x17:  cmd_rla ();                             break;          // RLA
+        case 0x18:  cmd_jr ();                              break;          // JR n
+        case 0x19:  cmd_add_ii_rr (REG_IDX_DE);             break;          // ADD HL,DE / ADD IX,DE / ADD IY,DE
+        case 0x1A:  cmd_ld_a_ind_rr (REG_IDX_DE);           break;          // LD A,(DE)
+        case 0x1B:  cmd_dec_rr (REG_IDX_DE);                break;          // DEC DE
+        case 0x1C:  cmd_inc_r (REG_IDX_E);                  break;          // INC E
+        case 0x1D:  cmd_dec_r (REG_IDX_E);                  break;          // DEC E
+        case 0x1E:  cmd_ld_r_n (REG_IDX_E);                 break;          // LD E,n
+        case 0x1F:  cmd_rra ();                             break;          // RRA
+
+        case 0x20:  cmd_jr_cond (COND_NZ);                  break;          // JR NZ,n
+        case 0x21:  cmd_ld_ii_nn ();                        break;          // LD HL,nn / LD IX,nn / LD IY,nn
+        case 0x22:  cmd_ld_ind_nn_hl ();                    break;          // LD (nn),HL
+        case 0x23:  cmd_inc_ii ();                          break;          // INC HL / INC IX / INC IY
+        case 0x24:  cmd_inc_r (REG_IDX_H);                  break;          // INC H
+        case 0x25:  cmd_dec_r (REG_IDX_H);                  break;          // DEC H / DEC IXH / DEC IYH
+        case 0x26:  cmd_ld_r_n (REG_IDX_H);                 break;          // LD H,n / LD IXH,n / LD IYH,n
+        case 0x27:  cmd_daa ();                             break;          // DAA
+        case 0x28:  cmd_jr_cond (COND_Z);                   break;          // JR Z,n
+        case 0x29:  cmd_add_ii_ii();                        break;          // ADD HL,HL
+        case 0x2A:  cmd_ld_ii_ind_nn ();                    break;          // LD HL,(nn)
+        case 0x2B:  cmd_dec_ii ();                          break;          // DEC HL / DEC IX / DEC IY
+        case 0x2C:  cmd_inc_r (REG_IDX_L);                  break;          // INC L / INC IXL / INC IYL
+        case 0x2D:  cmd_dec_r (REG_IDX_L);                  break;          // DEC L / DEC IXL / DEC IYL
+        case 0x2E:  cmd_ld_r_n (REG_IDX_L);                 break;          // LD L,n / LD IXL,n / LD IYL,n
+        case 0x2F:  cmd_cpl ();                             break;          // CPL
+
+        case 0x30:  cmd_jr_cond (COND_NC);                  break;          // JR NC,n
+        case 0x31:  cmd_ld_sp_nn ();                        break;          // LD SP,nn
+        case 0x32:  cmd_ld_ind_nn_a ();                     break;          // LD (nn),A
+        case 0x33:  cmd_inc_sp ();                          break;          // INC SP
+        case 0x34:  cmd_inc_ind_ii ();                      break;          // INC (HL) / INC (IX + d) / INC (IY + d)
+        case 0x35:  cmd_dec_ind_ii ();                      break;          // DEC (HL) / DEC (IX + d) / DEC (IY + d)
+        case 0x36:  cmd_ld_ind_ii_n ();                     break;          // LD (HL),n / LD (IX + d),n / LD (IY + d),n
+        case 0x37:  cmd_scf ();                             break;          // SCF
+        case 0x38:  cmd_jr_cond (COND_C);                   break;          // JR C,n
+        case 0x39:  cmd_add_ii_sp();                        break;          // ADD HL,SP
+        case 0x3A:  cmd_ld_a_ind_nn ();                     break;          // LD A,(nn)
+        case 0x3B:  cmd_dec_sp ();                          break;          // DEC SP
+        case 0x3C:  cmd_inc_r (REG_IDX_A);                  break;          // INC A
+        case 0x3D:  cmd_dec_r (REG_IDX_A);                  break;          // DEC A
+        case 0x3E:  cmd_ld_r_n (REG_IDX_A);                 break;          // LD A,n
+        case 0x3F:  cmd_ccf ();                             break;          // CCF
+
+        case 0x40:                                                          // LD B,B
+        case 0x41:                                                          // LD B,C
+        case 0x42:                                                          // LD B,D
+        case 0x43:                                                          // LD B,E
+        case 0x44:                                                          // LD B,H
+        case 0x45:                                                          // LD B,L
+        case 0x47:  cmd_ld_r_r (REG_IDX_B, opcode & 0x07);  break;          // LD B,A
+        case 0x46:  cmd_ld_r_ind_ii (REG_IDX_B);            break;          // LD B,(HL)
+
+        case 0x48:                                                          // LD C,B
+        case 0x49:                                                          // LD C,C
+        case 0x4A:                                                          // LD C,D
+        case 0x4B:                                                          // LD C,E
+        case 0x4C:                                                          // LD C,H
+        case 0x4D:                                                          // LD C,L
+        case 0x4F:  cmd_ld_r_r (REG_IDX_C, opcode & 0x07);  break;          // LD C,A
+        case 0x4E:  cmd_ld_r_ind_ii (REG_IDX_C);            break;          // LD C,(HL)
+
+        case 0x50:                                                          // LD D,B
+        case 0x51:                                                          // LD D,C
+        case 0x52:                                                          // LD D,D
+        case 0x53:                                                          // LD D,E
+        case 0x54:                                                          // LD D,H
+        case 0x55:                                                          // LD D,L
+        case 0x57:  cmd_ld_r_r (REG_IDX_D, opcode & 0x07);  break;          // LD D,A
+        case 0x56:  cmd_ld_r_ind_ii (REG_IDX_D);            break;          // LD D,(HL)
+
+        case 0x58:                                                          // LD E,B
+        case 0x59:                                                          // LD E,C
+        case 0x5A:                                                          // LD E,D
+        case 0x5B:                                                          // LD E,E
+        case 0x5C:                                                          // LD E,H
+        case 0x5D:                                                          // LD E,L
+        case 0x5F:  cmd_ld_r_r (REG_IDX_E, opcode & 0x07);  break;          // LD E,A
+        case 0x5E:  cmd_ld_r_ind_ii (REG_IDX_E);            break;          // LD E,(HL)
+
+        case 0x60:                                                          // LD H,B
+        case 0x61:                                                          // LD H,C
+        case 0x62:                                                          // LD H,D
+        case 0x63:                                                          // LD H,E
+        case 0x64:                                                          // LD H,H
+        case 0x65:                                                          // LD H,L
+        case 0x67:  cmd_ld_r_r (REG_IDX_H, opcode & 0x07);  break;          // LD H,A
+        case 0x66:  cmd_ld_r_ind_ii (REG_IDX_H);            break;          // LD H,(HL)
+
+        case 0x68:                                                          // LD L,B
+        case 0x69:                                                          // LD L,C
+        case 0x6A:                                                          // LD L,D
+        case 0x6B:                                                          // LD L,E
+        case 0x6C:                                                          // LD L,H
+        case 0x6D:                                                          // LD L,L
+        case 0x6F:  cmd_ld_r_r (REG_IDX_L, opcode & 0x07);  break;          // LD L,A
+        case 0x6E:  cmd_ld_r_ind_ii (REG_IDX_L);            break;          // LD L,(HL)
+
+        case 0x70:                                                          // LD (HL),B
+        case 0x71:                                                          // LD (HL),C
+        case 0x72:                                                          // LD (HL),D
+        case 0x73:                                                          // LD (HL),E
+        case 0x74:                                                          // LD (HL),H
+        case 0x75:                                                          // LD (HL),L
+        case 0x77:  cmd_ld_ind_ii_r (opcode & 0x07);        break;          // LD (HL),A
+        case 0x76:  cmd_halt ();                            break;          // HALT
+
+        case 0x78:                                                          // LD A,B
+        case 0x79:                                                          // LD A,C
+        case 0x7A:                                                          // LD A,D
+        case 0x7B:                                                          // LD A,E
+        case 0x7C:                                                          // LD A,H
+        case 0x7D:                                                          // LD A,L
+        case 0x7F:  cmd_ld_r_r (REG_IDX_A, opcode & 0x07);  break;          // LD A,A
+        case 0x7E:  cmd_ld_r_ind_ii (REG_IDX_A);            break;          // LD A,(HL)
+
+        case 0x80:                                                          // ADD A,B
+        case 0x81:                                                          // ADD A,C
+        case 0x82:                                                          // ADD A,D
+        case 0x83:                                                          // ADD A,E
+        case 0x84:                                                          // ADD A,H
+        case 0x85:                                                          // ADD A,L
+        case 0x87:  cmd_add_a_r (opcode & 0x07);            break;          // ADD A,A
+        case 0x86:  cmd_add_a_ind_ii ();                    break;          // ADD A,(HL)
+
+        case 0x88:                                                          // ADC A,B
+        case 0x89:                                                          // ADC A,C
+        case 0x8A:                                                          // ADC A,D
+        case 0x8B:                                                          // ADC A,E
+        case 0x8C:                                                          // ADC A,H
+        case 0x8D:                                                          // ADC A,L
+        case 0x8F:  cmd_adc_a_r (opcode & 0x07);            break;          // ADC A,A
+        case 0x8E:  cmd_adc_a_ind_ii ();                    break;          // ADC A,(HL)
+
+        case 0x90:                                                          // SUB A,B
+        case 0x91:                                                          // SUB A,C
+        case 0x92:                                                          // SUB A,D
+        case 0x93:                                                          // SUB A,E
+        case 0x94:                                                          // SUB A,H
+        case 0x95:                                                          // SUB A,L
+        case 0x97:  cmd_sub_a_r (opcode & 0x07);            break;          // SUB A,A
+        case 0x96:  cmd_sub_a_ind_ii ();                    break;          // SUB A,(HL)
+
+        case 0x98:                                                          // SBC A,B
+        case 0x99:                                                          // SBC A,C
+        case 0x9A:                                                          // SBC A,D
+        case 0x9B:                                                          // SBC A,E
+        case 0x9C:                                                          // SBC A,H
+        case 0x9D:                                                          // SBC A,L
+        case 0x9F:  cmd_sbc_a_r (opcode & 0x07);            break;          // SBC A,A
+        case 0x9E:  cmd_sbc_a_ind_ii ();                    break;          // SBC A,(HL)
+
+        case 0xA0:                                                          // AND A,B
+        case 0xA1:                                                          // AND A,C
+        case 0xA2:                                                          // AND A,D
+        case 0xA3:                                                          // AND A,E
+        case 0xA4:                                                          // AND A,H
+        case 0xA5:                                                          // AND A,L
+        case 0xA7:  cmd_and_a_r (opcode & 0x07);            break;          // AND A,A
+        case 0xA6:  cmd_and_a_ind_ii ();                    break;          // AND A,(HL)
+
+        case 0xA8:                                                          // XOR A,B
+        case 0xA9:                                                          // XOR A,C
+        case 0xAA:                                                          // XOR A,D
+        case 0xAB:                                                          // XOR A,E
+        case 0xAC:                                                          // XOR A,H
+        case 0xAD:                                                          // XOR A,L
+        case 0xAF:  cmd_xor_a_r (opcode & 0x07);            break;          // XOR A,A
+        case 0xAE:  cmd_xor_a_ind_ii ();                    break;          // XOR A,(HL)
+
+        case 0xB0:                                                          // OR A,B
+        case 0xB1:                                                          // OR A,C
+        case 0xB2:                                                          // OR A,D
+        case 0xB3:                                                          // OR A,E
+        case 0xB4:                                                          // OR A,H
+        case 0xB5:                                                          // OR A,L
+        case 0xB7:  cmd_or_a_r (opcode & 0x07);             break;          // OR A,A
+        case 0xB6:  cmd_or_a_ind_ii ();                     break;          // OR A,(HL)
+
+        case 0xB8:                                                          // CP A,B
+        case 0xB9:                                                          // CP A,C
+        case 0xBA:                                                          // CP A,D
+        case 0xBB:                                                          // CP A,E
+        case 0xBC:                                                          // CP A,H
+        case 0xBD:                                                          // CP A,L
+        case 0xBF:  cmd_cp_a_r (opcode & 0x07);             break;          // CP A,A
+        case 0xBE:  cmd_cp_a_ind_ii ();                     break;          // CP A,(HL)
+
+        case 0xC0:  cmd_ret_cond (COND_NZ);                 break;          // RET NZ
+        case 0xC1:  cmd_pop_rr (REG_IDX_BC);                break;          // POP BC
+        case 0xC2:  cmd_jp_cond (COND_NZ);                  break;          // JP NZ,nn
+        case 0xC3:  cmd_jp_nn ();                           break;          // JP nn
+        case 0xC4:  cmd_call_cond (COND_NZ);                break;          // CALL NZ,nn
+        case 0xC5:  cmd_push_rr (REG_IDX_BC);               break;          // PUSH BC
+        case 0xC6:  cmd_add_a_n();                          break;          // ADD A,n
+        case 0xC7:  cmd_rst (0x0000);                       break;          // RST 00h
+        case 0xC8:  cmd_ret_cond (COND_Z);                  break;          // RET Z
+        case 0xC9:  cmd_ret ();                             break;          // RET
+        case 0xCA:  cmd_jp_cond (COND_Z);                   break;          // JP Z,nn
+        case 0xCB:  z80_bits ();                            break;          // BITS
+        case 0xCC:  cmd_call_cond (COND_Z);                 break;          // CALL Z,nn
+        case 0xCD:  cmd_call ();                            break;          // CALL nn
+        case 0xCE:  cmd_adc_a_n();                          break;          // ADC A,n
+        case 0xCF:  cmd_rst (0x0008);                       break;          // RST 08h
+
+        case 0xD0:  cmd_ret_cond (COND_NC);                 break;          // RET NC
+        case 0xD1:  cmd_pop_rr (REG_IDX_DE);                break;          // POP DE
+        case 0xD2:  cmd_jp_cond (COND_NC);                  break;          // JP NC,nn
+        case 0xD3:  cmd_out_ind_n_a ();                     break;          // OUT (n),A
+        case 0xD4:  cmd_call_cond (COND_NC);                break;          // CALL NC,nn
+        case 0xD5:  cmd_push_rr (REG_IDX_DE);               break;          // PUSH DE
+        case 0xD6:  cmd_sub_a_n ();                         break;          // SUB A,n
+        case 0xD7:  cmd_rst (0x0010);                       break;          // RST 10h
+        case 0xD8:  cmd_ret_cond (COND_C);                  break;          // RET C
+        case 0xD9:  cmd_exx ();                             break;          // EXX
+        case 0xDA:  cmd_jp_cond (COND_C);                   break;          // JP C,nn
+        case 0xDB:  cmd_in_a_ind_n ();                      break;          // IN A,(n)
+        case 0xDC:  cmd_call_cond (COND_C);                 break;          // CALL C,nn
+        case 0xDD:  cmd_ixflags ();                         break;          // IXFLAGS
+        case 0xDE:  cmd_sbc_a_n ();                         break;          // SBC A,n
+        case 0xDF:  cmd_rst (0x0018);                       break;          // RST 18h
+
+        case 0xE0:  cmd_ret_cond (COND_PO);                 break;          // RET PO
+        case 0xE1:  cmd_pop_ii ();                          break;          // POP HL / POP IX / POP IY
+        case 0xE2:  cmd_jp_cond (COND_PO);                  break;          // JP PO,nn
+        case 0xE3:  cmd_ex_ind_sp_ii ();                    break;          // EX (SP),HL / EX (SP),IX / EX (SP),IY
+        case 0xE4:  cmd_call_cond (COND_PO);                break;          // CALL PO,nn
+        case 0xE5:  cmd_push_ii ();                         break;          // PUSH HL / PUSH IX / PUSH IY
+        case 0xE6:  cmd_and_n ();                           break;          // AND n
+        case 0xE7:  cmd_rst (0x0020);                       break;          // RST 20h
+        case 0xE8:  cmd_ret_cond (COND_PE);                 break;          // RET PE
+        case 0xE9:  cmd_jp_ind_ii ();                       break;          // JP (HL) / JP (IX) / JP (IY)
+        case 0xEA:  cmd_jp_cond (COND_PE);                  break;          // JP PE,nn
+        case 0xEB:  cmd_ex_de_hl ();                        break;          // EX DE,HL
+        case 0xEC:  cmd_call_cond (COND_PE);                break;          // CALL PE,nn
+        case 0xED:  z80_extd();                             break;          // EXTD
+        case 0xEE:  cmd_xor_a_n ();                         break;          // XOR n
+        case 0xEF:  cmd_rst (0x0028);                       break;          // RST 28h
+
+        case 0xF0:  cmd_ret_cond (COND_P);                  break;          // RET P
+        case 0xF1:  cmd_pop_af ();                          break;          // POP AF
+        case 0xF2:  cmd_jp_cond (COND_P);                   break;          // JP P,nn
+        case 0xF3:  cmd_di ();                              break;          // DI
+        case 0xF4:  cmd_call_cond (COND_P);                 break;          // CALL P,nn
+        case 0xF5:  cmd_push_af ();                         break;          // PUSH AF
+        case 0xF6:  cmd_or_a_n ();                          break;          // OR A,n
+        case 0xF7:  cmd_rst (0x0030);                       break;          // RST 30h
+        case 0xF8:  cmd_ret_cond (COND_M);                  break;          // RET M
+        case 0xF9:  cmd_ld_sp_ii ();                        break;          // LD SP,HL / LD SP,IX / LD SP,IY
+        case 0xFA:  cmd_jp_cond (COND_M);                   break;          // JP M,nn
+        case 0xFB:  cmd_ei ();                              break;          // EI
+        case 0xFC:  cmd_call_cond (COND_M);                 break;          // CALL M,nn
+        case 0xFD:  cmd_iyflags ();                         break;          // IYFLAGS
+        case 0xFE:  cmd_cp_a_n ();                          break;          // CP A,n
+        case 0xFF:  cmd_rst (0x0038);                       break;          // RST 38h
+        default:
         {
-            iff1 = 0;
+            printf ("z80: Unhandled opcode: %02X PC=%04X\n", opcode, cur_PC);
+            fflush (stdout);
         }
+    }
+}
 
-        snap_read_byte (fp, &iff2);                             // 28 IFF2
-        snap_read_byte (fp, &val);                              // 29 Bit 0-1:  Interrupt mode (0, 1 or 2)
-                                                                //    Bit 2  :  1=Issue 2 emulation
-                                                                //    Bit 3  :  1=Double interrupt frequency
-                                                                //    Bit 4-5:  1=High video synchronisation
-                                                                //              3=Low video synchronisation
-                                                                //              0,2=Normal
-                                                                //    Bit 6-7:  0=Cursor/Protek/AGF joystick
-                                                                //              1=Kempston joystick
-                                                                //              2=Sinclair 2 Left joystick
-                                                                //                (or user defined, for version 3 .z80 files)
-                                                                //              3=Sinclair 2 Right joystick
+#if Z80_BLOCK_CACHE == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Handlers of the block cache
+ *
+ * The handlers z80_block_op_XX() are generated from z80_opcode() with a constant opcode, which is always inlined, so the compiler reduces
+ * each of them to a single case of the opcode switch. The handlers below them get their immediate operand from the decoded block. They
+ * are only used for instructions without DD/FD prefix and add the same T-states and flags as the interpreter.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define Z80_BLOCK_OP(h,l)       static void z80_block_op_##h##l (uint_fast16_t operand) { (void) operand; z80_opcode (0x##h##l); }
+#define Z80_BLOCK_OPS(h)        Z80_BLOCK_OP(h,0) Z80_BLOCK_OP(h,1) Z80_BLOCK_OP(h,2) Z80_BLOCK_OP(h,3) \
+                                Z80_BLOCK_OP(h,4) Z80_BLOCK_OP(h,5) Z80_BLOCK_OP(h,6) Z80_BLOCK_OP(h,7) \
+                                Z80_BLOCK_OP(h,8) Z80_BLOCK_OP(h,9) Z80_BLOCK_OP(h,A) Z80_BLOCK_OP(h,B) \
+                                Z80_BLOCK_OP(h,C) Z80_BLOCK_OP(h,D) Z80_BLOCK_OP(h,E) Z80_BLOCK_OP(h,F)
+#define Z80_BLOCK_OP_PTRS(h)    z80_block_op_##h##0, z80_block_op_##h##1, z80_block_op_##h##2, z80_block_op_##h##3, \
+                                z80_block_op_##h##4, z80_block_op_##h##5, z80_block_op_##h##6, z80_block_op_##h##7, \
+                                z80_block_op_##h##8, z80_block_op_##h##9, z80_block_op_##h##A, z80_block_op_##h##B, \
+                                z80_block_op_##h##C, z80_block_op_##h##D, z80_block_op_##h##E, z80_block_op_##h##F
+
+Z80_BLOCK_OPS(0) Z80_BLOCK_OPS(1) Z80_BLOCK_OPS(2) Z80_BLOCK_OPS(3)
+Z80_BLOCK_OPS(4) Z80_BLOCK_OPS(5) Z80_BLOCK_OPS(6) Z80_BLOCK_OPS(7)
+Z80_BLOCK_OPS(8) Z80_BLOCK_OPS(9) Z80_BLOCK_OPS(A) Z80_BLOCK_OPS(B)
+Z80_BLOCK_OPS(C) Z80_BLOCK_OPS(D) Z80_BLOCK_OPS(E) Z80_BLOCK_OPS(F)
+
+static void                 (* const z80_block_ops[256])(uint_fast16_t) =
+{
+    Z80_BLOCK_OP_PTRS(0), Z80_BLOCK_OP_PTRS(1), Z80_BLOCK_OP_PTRS(2), Z80_BLOCK_OP_PTRS(3),
+    Z80_BLOCK_OP_PTRS(4), Z80_BLOCK_OP_PTRS(5), Z80_BLOCK_OP_PTRS(6), Z80_BLOCK_OP_PTRS(7),
+    Z80_BLOCK_OP_PTRS(8), Z80_BLOCK_OP_PTRS(9), Z80_BLOCK_OP_PTRS(A), Z80_BLOCK_OP_PTRS(B),
+    Z80_BLOCK_OP_PTRS(C), Z80_BLOCK_OP_PTRS(D), Z80_BLOCK_OP_PTRS(E), Z80_BLOCK_OP_PTRS(F)
+};
+
+#define Z80_BLOCK_LD_R_N(r)     static void z80_block_ld_##r##_n (uint_fast16_t operand) \
+                                { ADD_CLOCKCYCLES(7); reg_##r = UINT8_T (operand); reg_PC += 2; }
+#define Z80_BLOCK_LD_RR_NN(rr)  static void z80_block_ld_##rr##_nn (uint_fast16_t operand) \
+                                { ADD_CLOCKCYCLES(10); SET_RR(REG_IDX_##rr, operand); reg_PC += 3; }
+#define Z80_BLOCK_JR_COND(c,f)  static void z80_block_jr_##c (uint_fast16_t operand) \
+                                { if (f) { ADD_CLOCKCYCLES(12); reg_PC = UINT16_T (operand); } else { ADD_CLOCKCYCLES(7); reg_PC += 2; } }
+
+Z80_BLOCK_LD_R_N(A)         Z80_BLOCK_LD_R_N(B)         Z80_BLOCK_LD_R_N(C)         Z80_BLOCK_LD_R_N(D)
+Z80_BLOCK_LD_R_N(E)         Z80_BLOCK_LD_R_N(H)         Z80_BLOCK_LD_R_N(L)
+Z80_BLOCK_LD_RR_NN(BC)      Z80_BLOCK_LD_RR_NN(DE)      Z80_BLOCK_LD_RR_NN(HL)
+Z80_BLOCK_JR_COND(nz, ! ISSET_FLAG_Z())                 Z80_BLOCK_JR_COND(z, ISSET_FLAG_Z())
+Z80_BLOCK_JR_COND(nc, ! ISSET_FLAG_C())                 Z80_BLOCK_JR_COND(c, ISSET_FLAG_C())
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_ld_sp_nn() - LD SP,nn
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_ld_sp_nn (uint_fast16_t operand)
+{
+    ADD_CLOCKCYCLES(10);
+    reg_SP = UINT16_T (operand);
+    reg_PC += 3;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_jp_nn() - JP nn
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_jp_nn (uint_fast16_t operand)
+{
+    ADD_CLOCKCYCLES(10);
+    reg_PC = UINT16_T (operand);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_jr() - JR n, operand is the destination
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_jr (uint_fast16_t operand)
+{
+    ADD_CLOCKCYCLES(12);
+    reg_PC = UINT16_T (operand);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_djnz() - DJNZ n, operand is the destination
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_djnz (uint_fast16_t operand)
+{
+    reg_B--;
+
+    if (reg_B)
+    {
+        ADD_CLOCKCYCLES(13);
+        reg_PC = UINT16_T (operand);
+    }
+    else
+    {
+        ADD_CLOCKCYCLES(8);
+        reg_PC += 2;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_add_a_n() - ADD A,n
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_add_a_n (uint_fast16_t operand)
+{
+    uint8_t n = UINT8_T (operand);
+
+    ADD_CLOCKCYCLES(7);
+    set_flags_add8 (reg_A, n, 0);
+    reg_A = UINT8_T (reg_A + n);
+    reg_PC += 2;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_cp_a_n() - CP A,n
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_cp_a_n (uint_fast16_t operand)
+{
+    ADD_CLOCKCYCLES(7);
+    set_flags_sub8 (reg_A, UINT8_T (operand), 0);
+    reg_PC += 2;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_ixflags() - DD prefix and following opcode, resets the prefix like z80()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_ixflags (uint_fast16_t operand)
+{
+    cmd_ixflags ();
+    (*z80_block_ops[operand]) (0);
+    ixflags         = 0;
+    last_ixiyflags  = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_iyflags() - FD prefix and following opcode, resets the prefix like z80()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_iyflags (uint_fast16_t operand)
+{
+    cmd_iyflags ();
+    (*z80_block_ops[operand]) (0);
+    iyflags         = 0;
+    last_ixiyflags  = 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_opcode_len() - get length of unprefixed opcode
+ *
+ * Return values:
+ *   0      opcode cannot be cached (prefix)
+ *   1-3    length of instruction
+ *
+ * *is_last is set if the instruction must terminate the block, *writes if it may write into RAM. The length of the last instruction
+ * is needed, too, because its operand is stored in the block and must not be in the next page.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_block_opcode_len (uint8_t opcode, uint_fast8_t * is_last, uint_fast8_t * writes)
+{
+    *is_last    = FALSE;
+    *writes     = FALSE;
+
+    switch (opcode)
+    {
+        case 0xCB:                                                          // BITS
+        case 0xDD:                                                          // IXFLAGS
+        case 0xED:                                                          // EXTD
+        case 0xFD:                                                          // IYFLAGS
+            return 0;
+
+        case 0x76:                                                          // HALT
+        case 0xC9:                                                          // RET
+        case 0xE9:                                                          // JP (HL)
+        case 0xFB:                                                          // EI - interrupt may be pending
+            *is_last = TRUE;
+            return 1;
+
+        case 0x10:                                                          // DJNZ n
+        case 0x18:                                                          // JR n
+        case 0xD3:                                                          // OUT (n),A - may switch memory banks
+            *is_last = TRUE;
+            return 2;
+
+        case 0xC3:                                                          // JP nn
+            *is_last = TRUE;
+            return 3;
+
+        case 0x02:                                                          // LD (BC),A
+        case 0x12:                                                          // LD (DE),A
+        case 0x34:                                                          // INC (HL)
+        case 0x35:                                                          // DEC (HL)
+        case 0x70:                                                          // LD (HL),r
+        case 0x71:
+        case 0x72:
+        case 0x73:
+        case 0x74:
+        case 0x75:
+        case 0x77:
+        case 0xE3:                                                          // EX (SP),HL
+            *writes = TRUE;
+            return 1;
+
+        case 0x22:                                                          // LD (nn),HL
+        case 0x32:                                                          // LD (nn),A
+            *writes = TRUE;
+            return 3;
+
+        case 0x36:                                                          // LD (HL),n
+            *writes = TRUE;
+            return 2;
+
+        case 0xCD:                                                          // CALL nn
+            *is_last    = TRUE;
+            *writes     = TRUE;
+            return 3;
+    }
+
+    if ((opcode & 0xC7) == 0xC0)                                            // RET cc
+    {
+        *is_last = TRUE;
+        return 1;
+    }
+
+    if ((opcode & 0xE7) == 0x20)                                            // JR cc,n
+    {
+        *is_last = TRUE;
+        return 2;
+    }
+
+    if ((opcode & 0xC7) == 0xC2)                                            // JP cc,nn
+    {
+        *is_last = TRUE;
+        return 3;
+    }
+
+    if ((opcode & 0xC7) == 0xC4)                                            // CALL cc,nn
+    {
+        *is_last    = TRUE;
+        *writes     = TRUE;
+        return 3;
+    }
+
+    if ((opcode & 0xC7) == 0xC7)                                            // RST n
+    {
+        *is_last    = TRUE;
+        *writes     = TRUE;
+        return 1;
+    }
+
+    if ((opcode & 0xCF) == 0xC5)                                            // PUSH rr
+    {
+        *writes = TRUE;
+        return 1;
+    }
+
+    if ((opcode & 0xC7) == 0x06 ||                                          // LD r,n
+        (opcode & 0xC7) == 0xC6 ||                                          // ADD/ADC/SUB/SBC/AND/XOR/OR/CP n
+        opcode == 0xDB)                                                     // IN A,(n)
+    {
+        return 2;
+    }
+
+    if ((opcode & 0xCF) == 0x01 ||                                          // LD rr,nn
+        (opcode & 0xE7) == 0x22)                                            // LD HL,(nn) / LD A,(nn)
+    {
+        return 3;
+    }
+
+    return 1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_extd_len() - get length of ED prefixed instruction, return values see z80_block_opcode_len()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_block_extd_len (uint8_t opcode, uint_fast8_t * is_last, uint_fast8_t * writes)
+{
+    *is_last    = FALSE;
+    *writes     = FALSE;
 
-        interrupt_mode = val & 0x03;
-        uint16_t    idx;
+    if (opcode >= 0x40 && opcode <= 0x7F)
+    {
+        if (opcode == 0x77 || opcode == 0x7F)                               // invalid, interpreter prints message
+        {
+            return 0;
+        }
 
-        if (reg_PC == 0x0000)
+        if ((opcode & 0x07) == 0x01 || (opcode & 0x07) == 0x05)             // OUT (C),r may switch memory banks, RETN/RETI
         {
-            uint16_t    additional_header_len;
+            *is_last = TRUE;
+        }
+        else if ((opcode & 0x07) == 0x03)                                   // LD (nn),rr / LD rr,(nn)
+        {
+            *writes = ! (opcode & 0x08);
+            return 4;
+        }
 
-            snap_read_word (fp, &additional_header_len);        // 30+31 length of additional header following
+        *writes = (opcode == 0x67 || opcode == 0x6F);                       // RRD, RLD
+        return 2;
+    }
 
-            if (additional_header_len == 23)
+    switch (opcode)
+    {
+        case 0xA0:                                                          // LDI
+        case 0xA2:                                                          // INI
+        case 0xA8:                                                          // LDD
+        case 0xAA:                                                          // IND
+            *writes = TRUE;
+            return 2;
+
+        case 0xA1:                                                          // CPI
+        case 0xA9:                                                          // CPD
+            return 2;
+
+        case 0xA3:                                                          // OUTI - may switch memory banks
+        case 0xAB:                                                          // OUTD
+        case 0xB0:                                                          // LDIR, ... - repeated by setting PC back
+        case 0xB1:
+        case 0xB2:
+        case 0xB3:
+        case 0xB8:
+        case 0xB9:
+        case 0xBA:
+        case 0xBB:
+            *is_last    = TRUE;
+            *writes     = TRUE;
+            return 2;
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_insn_len() - get length of instruction at addr, return values see z80_block_opcode_len()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_block_insn_len (uint16_t addr, uint_fast8_t * is_last, uint_fast8_t * writes)
+{
+    uint8_t         opcode  = zx_ram_get_text (addr);
+    uint8_t         next    = zx_ram_get_text (UINT16_T (addr + 1));
+    uint_fast8_t    len;
+
+    switch (opcode)
+    {
+        case 0xCB:
+            *is_last    = FALSE;
+            *writes     = (next & 0x07) == 0x06 && (next & 0xC0) != 0x40;    // RLC ... SET (HL), not BIT
+            return 2;
+
+        case 0xED:
+            return z80_block_extd_len (next, is_last, writes);
+
+        case 0xDD:
+        case 0xFD:
+            if (next == 0xCB)                                               // DD CB d op
             {
-                debug_printf ("snapshot version: 2\n");
-                version = 2;
+                *is_last    = FALSE;
+                *writes     = (zx_ram_get_text (UINT16_T (addr + 3)) & 0xC0) != 0x40;
+                return 4;
             }
-            else
+
+            len = z80_block_opcode_len (next, is_last, writes);             // 0 for DD/ED/FD after prefix
+
+            if (len && next != 0x76 &&
+                (next == 0x34 || next == 0x35 || next == 0x36 ||            // INC/DEC/LD (IX+d)
+                 (next >= 0x40 && next <= 0xBF && ((next & 0x07) == 0x06 || (next & 0xF8) == 0x70))))
             {
-                debug_printf ("snapshot version: 3\n");
-                version = 3;
+                len++;                                                      // displacement d
             }
 
-            debug_printf ("additional_header_len=%d\n", additional_header_len);
+            return len ? len + 1 : 0;
+    }
 
-            snap_read_word (fp, &reg_PC);                       // 32+33 PC
-            additional_header_len -= 2;
+    return z80_block_opcode_len (opcode, is_last, writes);
+}
 
-            for (idx = 0; idx < additional_header_len; idx++ )
-            {
-                snap_read_byte (fp, &val);
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_block_decode() - decode block at address pc
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_block_decode (Z80_BLOCK * block, uint16_t pc)
+{
+    Z80_BLOCK_INSN *    insn;
+    uint16_t            addr    = pc;
+    uint_fast8_t        n       = 0;
+    uint_fast8_t        len;
+    uint_fast8_t        is_last;
+    uint_fast8_t        writes;
+    uint8_t             opcode;
+    uint8_t             next;
+
+    block->bankptr  = steccy_bankptr[pc >> 14];
+    block->genptr   = zx_ram_gen_ptr (pc);
+    block->gen      = *block->genptr;
+    block->pc       = pc;
+#if Z80_JIT == 1
+    block->hits     = 0;
+    block->code     = NULL;
+#endif
 
-                if (idx == 0)                                   // 34: hardware mode
-                {
-                                                                // Value:          Meaning in v2           Meaning in v3
-                                                                // -----------------------------------------------------
-                                                                //  0             48k                     48k
-                                                                //  1             48k + If.1              48k + If.1
-                                                                //  2             SamRam                  SamRam
-                                                                //  3             128k                    48k + M.G.T.
-                                                                //  4             128k + If.1             128k
-                                                                //  5             -                       128k + If.1
-                                                                //  6             -                       128k + M.G.T.
-                    if (val == 0 || val == 1)
-                    {
-                        if (z80_romsize != 0x4000)
-                        {
-                            debug_printf ("switching to machine: ZX48K\n");
-                            set_fname_rom_buf ("48.rom");
-                            load_rom ();
-                            zx_ram_init (z80_romsize);
-                        }
-                    }
-                    else if ((version == 2 && (val == 3 || val == 4)) ||
-                             (version == 3 && (val == 4 || val == 5)))
-                    {
-                        if (z80_romsize == 0x4000)
-                        {
-                            debug_printf ("switching to machine: ZX128K\n");
-                            set_fname_rom_buf ("128.rom");
-                            load_rom ();
-                            zx_ram_init (z80_romsize);
-                        }
-                    }
-                }
-                else if (idx == 2)                              // 35: memory paging
-                {
-                                                                // If in SamRam mode, bitwise state of 74ls259.
-                                                                // For example, bit 6=1 after an OUT 31,13 (=2*6+1)
-                                                                // If in 128 mode, contains last OUT to 0x7ffd
-                                                                // If in Timex mode, contains last OUT to 0xf4
+    while (n < Z80_BLOCK_MAX_OPCODES && ! Z80_TRAP_IS_SET (addr))
+    {
+        len = z80_block_insn_len (addr, &is_last, &writes);
 
-                    if (z80_romsize == 0x8000)                  // we are in 128K mode
-                    {
-                        zxio_out_port (0x7F, 0xFD, val);        // adjust memory banks
-                    }
-                }
-            }
+        if (! len || ((addr + len - 1) >> ZX_RAM_GEN_PAGE_SHIFT) != (pc >> ZX_RAM_GEN_PAGE_SHIFT))
+        {
+            break;                                                          // not cacheable or operand in next page
         }
 
-        if (version == 1)
+        opcode  = zx_ram_get_text (addr);
+        next    = zx_ram_get_text (UINT16_T (addr + 1));
+
+        if ((opcode == 0xDD || opcode == 0xFD) && Z80_TRAP_IS_SET (UINT16_T (addr + 1)))
         {
-            uint32_t base_addr = ZX_RAM_BEGIN;
+            break;
+        }
 
-            if (data_compressed)
-            {
-            }
-            else
-            {
-                for (idx = 0; idx < 49152; idx++)
-                {
-                    snap_read_byte (fp, &val);
-                    zx_ram_set_8(base_addr + idx, val);
-                }
-            }
+        insn            = block->insns + n++;
+        insn->fn        = z80_block_ops[opcode];
+        insn->operand   = (len == 3) ? UINT16_T (next | (zx_ram_get_text (UINT16_T (addr + 2)) << 8)) : next;
+        insn->opcode    = opcode;
+        insn->len       = UINT8_T (len);
+        insn->check_gen = writes && ! is_last;
+
+        switch (opcode)
+        {
+            case 0x01:  insn->fn = z80_block_ld_BC_nn;                      break;
+            case 0x11:  insn->fn = z80_block_ld_DE_nn;                      break;
+            case 0x21:  insn->fn = z80_block_ld_HL_nn;                      break;
+            case 0x31:  insn->fn = z80_block_ld_sp_nn;                      break;
+            case 0x06:  insn->fn = z80_block_ld_B_n;                        break;
+            case 0x0E:  insn->fn = z80_block_ld_C_n;                        break;
+            case 0x16:  insn->fn = z80_block_ld_D_n;                        break;
+            case 0x1E:  insn->fn = z80_block_ld_E_n;                        break;
+            case 0x26:  insn->fn = z80_block_ld_H_n;                        break;
+            case 0x2E:  insn->fn = z80_block_ld_L_n;                        break;
+            case 0x3E:  insn->fn = z80_block_ld_A_n;                        break;
+            case 0xC6:  insn->fn = z80_block_add_a_n;                       break;
+            case 0xFE:  insn->fn = z80_block_cp_a_n;                        break;
+            case 0xC3:  insn->fn = z80_block_jp_nn;                         break;
+            case 0xDD:  insn->fn = z80_block_ixflags;   insn->operand = next;   break;
+            case 0xFD:  insn->fn = z80_block_iyflags;   insn->operand = next;   break;
+
+            case 0x10:  insn->fn = z80_block_djnz;                          break;
+            case 0x18:  insn->fn = z80_block_jr;                            break;
+            case 0x20:  insn->fn = z80_block_jr_nz;                         break;
+            case 0x28:  insn->fn = z80_block_jr_z;                          break;
+            case 0x30:  insn->fn = z80_block_jr_nc;                         break;
+            case 0x38:  insn->fn = z80_block_jr_c;                          break;
         }
-        else
+
+        if (opcode == 0x10 || (opcode & 0xE7) == 0x20 || opcode == 0x18)
         {
-            uint8_t     factor      = 0;
-            uint16_t    data_len;
-            uint8_t     page_no     = 0;
-            uint16_t    pos;
+            insn->operand = UINT16_T (addr + 2 + INT8_T (next));            // destination of JR/DJNZ
+        }
 
-            do
-            {
-                snap_read_word (fp, &data_len);                         // 0+1 length of compressed data following
-                                                                        //     0xFFFF means 16384 bytes uncompressed
-                snap_read_byte (fp, &page_no);                          // 2   page number
+        if (is_last)
+        {
+            break;
+        }
 
-                if (data_len == 0xFFFF)
-                {
-                    data_compressed = 0;
-                    data_len = SNAPSHOT_PAGE_SIZE;
-                }
-                else
-                {
-                    data_compressed = 1;
-                }
+        addr += len;
+    }
 
-                if (z80_romsize == 0x4000)
-                {
-                    switch (page_no)
-                    {
-                        case 4:     steccy_ram_ptr = steccy_rambankptr[2];      break;          // 0x8000
-                        case 5:     steccy_ram_ptr = steccy_rambankptr[0];      break;          // 0xC000
-                        case 8:     steccy_ram_ptr = steccy_rambankptr[5];      break;          // 0x4000
-                        default:    steccy_ram_ptr = NULL;                      break;          // invalid page
-                    }
+    block->n_insns = n;
+}
 
-                    debug_printf ("ZX48K: data_len=%d, page number=%d\n", data_len, page_no);
-                }
-                else
-                {
-                    steccy_ram_ptr = steccy_rambankptr[page_no - 3];
-                    debug_printf ("ZX128K: data_len=%d, page number=%d\n", data_len, page_no);
-                }
+#if Z80_JIT == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Z80 JIT
+ *
+ * A block which has been executed Z80_JIT_THRESHOLD times is translated into x86-64 machine code. Instructions which don't change flags
+ * are translated directly: LD r,r', LD r,n, LD rr,nn, INC/DEC rr, EX DE,HL, EXX, LD SP,HL, NOP and, as last instruction of a block,
+ * JP nn, JP (HL), JR, JR cc and DJNZ. 8 bit arithmetic and logic with register or immediate operand and INC/DEC r are translated, too:
+ * they get their flags from the same tables as the interpreter (see z80_flags_init()). T-states and PC of consecutive translated instructions are added resp. stored only once, before
+ * the next handler call and at the end of the block. All other instructions call their handler of the block cache with the operand,
+ * so T-states, flags and interrupt timing are exactly the same as in the interpreter. After instructions which may write into RAM,
+ * the native code checks the write generation of the block. Events are checked by z80_block_run() before the block is started.
+ *
+ * Blocks are keyed by bank, so a bank switch via port 0x7FFD selects other blocks. If a block is decoded again (write generation
+ * changed), its native code is dropped. If the code buffer is full, the whole block cache is flushed.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define Z80_JIT_MAX_BLOCK_SIZE  (12 + Z80_BLOCK_MAX_OPCODES * 64 + 64)      // prologue + max. 64 bytes per instruction + exits
 
-                pos = 0;
+#define Z80_JIT_OFS(r)          UINT8_T ((uint8_t *) &(r) - (uint8_t *) &z80_regfile)  // offset of register in z80_regfile
 
-                for (idx = 0; idx < data_len; idx++)
-                {
-                    snap_read_byte (fp, &val);
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_bytes() - emit x86-64 machine code
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_bytes (uint8_t * p, const uint8_t * bytes, uint_fast8_t len)
+{
+    memcpy (p, bytes, len);
+    return p + len;
+}
 
-                    if (data_compressed)
-                    {
-                        if (val == 0xED)
-                        {
-                            snap_read_byte (fp, &val);
-                            idx++;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_imm64() - emit MOV r64,imm64
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_imm64 (uint8_t * p, uint8_t reg_code, const void * value)
+{
+    uint64_t    imm = (uint64_t) (uintptr_t) value;
 
-                            if (val == 0xED)
-                            {
-                                int i;
+    *p++ = 0x48;                                                            // REX.W
+    *p++ = 0xB8 + reg_code;                                                 // MOV r64,imm64
+    memcpy (p, &imm, 8);
+    return p + 8;
+}
 
-                                snap_read_byte (fp, &factor);                       // factor
-                                idx++;
-                                snap_read_byte (fp, &val);                          // value
-                                idx++;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_rbx() - emit instruction with operand [RBX+ofs], RBX points to z80_regfile
+ *
+ * prefix:  0x66 for 16 bit operand, 0 for none
+ * opcode:  one or two bytes (0x0F xx)
+ * reg:     register code or opcode extension in ModRM
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_rbx (uint8_t * p, uint8_t prefix, uint16_t opcode, uint8_t reg, uint8_t ofs)
+{
+    if (prefix)
+    {
+        *p++ = prefix;
+    }
 
-                                for (i = 0; i < factor; i++)
-                                {
-                                    steccy_ram_ptr[pos] = val;
-                                    pos++;
-                                }
-                            }
-                            else
-                            {
-                                steccy_ram_ptr[pos] = 0xED;
-                                pos++;
-                                steccy_ram_ptr[pos] = val;
-                                pos++;
-                            }
-                        }
-                        else
-                        {
-                            steccy_ram_ptr[pos] = val;
-                            pos++;
-                        }
-                    }
-                    else
-                    {
-                        steccy_ram_ptr[pos] = val;
-                        pos++;
-                    }
-                }
+    if (opcode > 0xFF)
+    {
+        *p++ = UINT8_T (opcode >> 8);
+    }
 
-                if ((ch = getc (fp)) != EOF)
-                {
-                    ungetc (ch, fp);
-                }
-            } while (ch != EOF);
-        }
+    *p++ = UINT8_T (opcode);
+    *p++ = UINT8_T (0x43 | (reg << 3));                                     // ModRM: [RBX+disp8]
+    *p++ = ofs;
+    return p;
+}
 
-        cur_PC                  = reg_PC;
-        last_ixiyflags          = 0;
-        ixflags                 = 0;
-        iyflags                 = 0;
-        clockcycles             = 0;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_copy8() - emit copy of 8 bit register: MOVZX EAX,BYTE [RBX+src]; MOV [RBX+dst],AL
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_copy8 (uint8_t * p, uint8_t dst, uint8_t src)
+{
+    p = z80_jit_emit_rbx (p, 0, 0x0FB6, 0, src);
+    return z80_jit_emit_rbx (p, 0, 0x88, 0, dst);
+}
 
-        fclose (fp);
-        z80_interrupt = 0;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_swap16() - emit exchange of two 16 bit registers via AX and CX
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_swap16 (uint8_t * p, uint8_t a, uint8_t b)
+{
+    p = z80_jit_emit_rbx (p, 0, 0x0FB7, 0, a);                              // MOVZX EAX,WORD [RBX+a]
+    p = z80_jit_emit_rbx (p, 0, 0x0FB7, 1, b);                              // MOVZX ECX,WORD [RBX+b]
+    p = z80_jit_emit_rbx (p, 0x66, 0x89, 1, a);                             // MOV [RBX+a],CX
+    return z80_jit_emit_rbx (p, 0x66, 0x89, 0, b);                          // MOV [RBX+b],AX
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_sync() - emit update of clockcycles and PC for translated instructions
+ *
+ * pc < 0x10000: store pc into reg_PC
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_sync (uint8_t * p, uint32_t cycles, uint32_t pc)
+{
+    if (cycles)
+    {
+        p = z80_jit_emit_imm64 (p, 0, &clockcycles);                        // MOV RAX,&clockcycles
+        *p++ = 0x81;                                                        // ADD DWORD [RAX],cycles
+        *p++ = 0x00;
+        memcpy (p, &cycles, 4);
+        p += 4;
     }
-    else
+
+    if (pc < 0x10000)
     {
-        perror (fname_rom_buf);
-        return;
+        p = z80_jit_emit_rbx (p, 0x66, 0xC7, 0, Z80_JIT_OFS (reg_PC));      // MOV WORD [RBX+pc],imm16
+        *p++ = UINT8_T (pc);
+        *p++ = UINT8_T (pc >> 8);
     }
+
+    return p;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * tape_prepare_load() - prepare LOAD Tape (at 0x0556 or later)
- *
- * Parameters:
- * use_regs2 = 0    use_regs2 = 1
- * IX               IX                  IX        - base address
- * DE               DE                  DE        - length of data
- * register F       register F'         Carry = 0 - verify
- * register F       register F'         Carry = 1 - load
- * register A       register A'         A=0x00    - header
- * register A       register A'         A=0xFF    - data block
+ * z80_jit_emit_exit() - emit update of clockcycles and PC, then return
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_exit (uint8_t * p, uint32_t cycles, uint32_t pc)
+{
+    static const uint8_t    epilogue[]  = { 0x5B, 0xC3 };                   // POP RBX; RET
+
+    p = z80_jit_emit_sync (p, cycles, pc);
+    return z80_jit_emit_bytes (p, epilogue, sizeof (epilogue));
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_branch() - emit conditional branch at end of block
  *
- * Return values:
- * Carry = 1 - OK
- * Carry = 0 - ERROR
+ * Jcc (jcc: 0x74 JZ, 0x75 JNZ) jumps to the taken path. Both paths add their T-states to the pending ones and return.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-tape_prepare_load (uint8_t use_regs2)
+static uint8_t *
+z80_jit_emit_branch (uint8_t * p, uint8_t jcc, uint32_t cycles, uint32_t cycles_taken, uint16_t pc_taken, uint32_t cycles_not_taken,
+                     uint16_t pc_not_taken)
 {
-    uint16_t    base_addr   = GET_IX();                                 // base address
-    uint16_t    maxlen      = GET_DE();                                 // maximum length
-    uint8_t     load;                                                   // load or verify
-    uint8_t     load_data;                                              // load data or load header
-    uint8_t     rtc = 0;                                                // 1 = success, 0 = failure
+    uint8_t *   jmp;
 
-    if (use_regs2)
-    {
-        load        = (reg_F2 & FLAG_C) ? 1 : 0;                        // load or verify
-        load_data   = (reg_A2 != 0x00) ? 1 : 0;                         // load data or load header
-    }
-    else
-    {
-        load        = ISSET_FLAG_C() ? 1 : 0;                             // load or verify
-        load_data   = (reg_A != 0x00) ? 1 : 0;                          // load data or load header
-    }
+    *p++    = jcc;
+    jmp     = p++;
+    p       = z80_jit_emit_exit (p, cycles + cycles_not_taken, pc_not_taken);
+    *jmp    = UINT8_T (p - (jmp + 1));
+    return z80_jit_emit_exit (p, cycles + cycles_taken, pc_taken);
+}
 
-#ifdef DEBUG
-    uint8_t     req_type;
-    char        req_name[11];
-    uint16_t    req_len;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_set_f() - emit F = (F & keep) | EDX, uses ECX
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_set_f (uint8_t * p, uint8_t keep)
+{
+    p       = z80_jit_emit_rbx (p, 0, 0x0FB6, 1, Z80_JIT_OFS (reg_F));      // MOVZX ECX,BYTE [RBX+F]
+    *p++    = 0x83;                                                         // AND ECX,keep
+    *p++    = 0xE1;
+    *p++    = keep;
+    *p++    = 0x09;                                                         // OR ECX,EDX
+    *p++    = 0xD1;
+    return z80_jit_emit_rbx (p, 0, 0x88, 1, Z80_JIT_OFS (reg_F));           // MOV [RBX+F],CL
+}
 
-    if (ram[reg_SP] + (ram[reg_SP + 1] << 8) == 0x771)                  // called from 0x0771
-    {
-        uint8_t *   ptr         = ram + base_addr - 0x11;               // pointer to requested data
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_alu8() - emit ADD/ADC/SUB/SBC/AND/XOR/OR/CP A,ECX with the flag tables, see set_flags_add8() and set_flags_logic8()
+ *
+ * op:  bits 3-5 of opcode, 0 = ADD ... 7 = CP
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_alu8 (uint8_t * p, uint_fast8_t op)
+{
+    static const uint8_t    idx_a_n[]   = { 0x89, 0xC6, 0xC1, 0xE6, 0x08, 0x09, 0xCE };       // MOV ESI,EAX; SHL ESI,8; OR ESI,ECX
+    static const uint8_t    carry[]     = { 0x83, 0xE2, 0x01 };                             // AND EDX,1 (FLAG_C)
+    static const uint8_t    carry_idx[] = { 0xC1, 0xE2, 0x10, 0x09, 0xD6 };                 // SHL EDX,16; OR ESI,EDX
+    static const uint8_t    logic[3][2] = { { 0x21, 0xC8 }, { 0x31, 0xC8 }, { 0x09, 0xC8 } }; // AND/XOR/OR EAX,ECX
+    static const uint8_t    ld_flags[]  = { 0x0F, 0xB6, 0x14, 0x32 };                       // MOVZX EDX,BYTE [RDX+RSI]
+    static const uint8_t    ld_szp[]    = { 0x0F, 0xB6, 0x14, 0x02 };                       // MOVZX EDX,BYTE [RDX+RAX]
+    uint_fast8_t            is_sub      = (op == 2 || op == 3 || op == 7);
 
-        req_type    = ptr[0];
+    p = z80_jit_emit_rbx (p, 0, 0x0FB6, 0, Z80_JIT_OFS (reg_A));            // MOVZX EAX,BYTE [RBX+A]
 
-        if (ptr[1] == 0xFF)
+    if (op >= 4 && op <= 6)                                                 // AND, XOR, OR
+    {
+        p       = z80_jit_emit_bytes (p, logic[op - 4], 2);
+        p       = z80_jit_emit_rbx (p, 0, 0x88, 0, Z80_JIT_OFS (reg_A));    // MOV [RBX+A],AL
+        p       = z80_jit_emit_imm64 (p, 2, z80_flags_szp);                 // MOV RDX,z80_flags_szp
+        p       = z80_jit_emit_bytes (p, ld_szp, sizeof (ld_szp));
+
+        if (op == 4)
         {
-            req_name[0] = '\0';
+            *p++ = 0x83;                                                    // OR EDX,FLAG_H
+            *p++ = 0xCA;
+            *p++ = FLAG_H;
         }
-        else
-        {
-            int idx;
-            memcpy (req_name, ptr + 1, 10);
-            req_name[10] = '\0';
 
-            for (idx = 9; idx >= 0; idx--)
-            {
-                if (req_name[idx] == ' ')
-                {
-                    req_name[idx] = '\0';
-                }
-                else
-                {
-                    break;
-                }
-            }
-        }
+        return z80_jit_emit_set_f (p, FLAG_X1 | FLAG_X2);
+    }
 
-        req_len = UINT16_T (ptr[11] + (ptr[12] << 8));
+    p = z80_jit_emit_bytes (p, idx_a_n, sizeof (idx_a_n));                 // index: A << 8 | n
 
-        debug_printf ("req_type = %d\n", req_type);
-        debug_printf ("req_name = '%s'\n", req_name);
-        debug_printf ("req_len = %d\n", req_len);
-        debug_printf ("p1=%02X p2=%02X p3=%02X p4=%02X\n", ptr[13], ptr[14], ptr[15], ptr[16]);
+    if (op == 1 || op == 3)                                                 // ADC, SBC
+    {
+        p = z80_jit_emit_rbx (p, 0, 0x0FB6, 2, Z80_JIT_OFS (reg_F));        // MOVZX EDX,BYTE [RBX+F]
+        p = z80_jit_emit_bytes (p, carry, sizeof (carry));
     }
-#endif
 
-    if (! z80_user_cancelled_load && ! fname_load_valid)
+    if (op != 7)
     {
-        if (zxio_all_keys_released ())
-        {
-            char *  fname;
-
-            z80_user_cancelled_load = 1;
+        *p++ = is_sub ? 0x29 : 0x01;                                        // SUB/ADD EAX,ECX
+        *p++ = 0xC8;
+    }
 
-#ifdef STM32F4XX
-            fname = menu_start_load ();
+    if (op == 1 || op == 3)
+    {
+        *p++ = is_sub ? 0x29 : 0x01;                                        // SUB/ADD EAX,EDX
+        *p++ = 0xD0;
+        p = z80_jit_emit_bytes (p, carry_idx, sizeof (carry_idx));          // index |= carry << 16
+    }
 
-            if (fname)
-            {
-                int             len;
+    if (op != 7)
+    {
+        p = z80_jit_emit_rbx (p, 0, 0x88, 0, Z80_JIT_OFS (reg_A));          // MOV [RBX+A],AL
+    }
 
-                poke_file_active = 0;
-                z80_user_cancelled_load = 0;
-                z80_set_fname_load (fname);
+    p = z80_jit_emit_imm64 (p, 2, is_sub ? z80_flags_sub : z80_flags_add);  // MOV RDX,table
+    p = z80_jit_emit_bytes (p, ld_flags, sizeof (ld_flags));
+    return z80_jit_emit_set_f (p, FLAG_X1 | FLAG_X2);
+}
 
-                len = strlen (fname_load_buf) - 4;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_incdec8() - emit INC r / DEC r, see set_flags_inc8() and set_flags_dec8()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_incdec8 (uint8_t * p, uint8_t ofs, uint_fast8_t is_dec)
+{
+    static const uint8_t    ld_flags[]  = { 0x0F, 0xB6, 0x14, 0x02 };       // MOVZX EDX,BYTE [RDX+RAX]
 
-                if (len >= 0 && fname_load_buf[len] == '.')
-                {
-                    FILINFO fno;
+    p       = z80_jit_emit_rbx (p, 0, 0x0FB6, 0, ofs);                      // MOVZX EAX,BYTE [RBX+r]
+    *p++    = 0xFF;                                                         // INC EAX / DEC EAX
+    *p++    = is_dec ? 0xC8 : 0xC0;
+    *p++    = 0x0F;                                                         // MOVZX EAX,AL
+    *p++    = 0xB6;
+    *p++    = 0xC0;
+    p       = z80_jit_emit_rbx (p, 0, 0x88, 0, ofs);                        // MOV [RBX+r],AL
+    p       = z80_jit_emit_imm64 (p, 2, is_dec ? z80_flags_dec : z80_flags_inc);   // MOV RDX,table
+    p       = z80_jit_emit_bytes (p, ld_flags, sizeof (ld_flags));
+    return z80_jit_emit_set_f (p, FLAG_C | FLAG_X1 | FLAG_X2);
+}
 
-                    strcpy (fname_poke_buf, fname_load_buf);
-                    strcpy (fname_poke_buf + len, ".pok");
-                    // console_printf ("%s\r\n", fname_poke_buf);
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_native() - translate instruction without handler call
+ *
+ * Return values:
+ *   NULL   instruction must call its handler
+ *   else   end of emitted code, *cycles updated. If *done is set, the emitted code returns (last instruction of block).
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_native (uint8_t * p, const Z80_BLOCK_INSN * insn, uint16_t pc, uint32_t * cycles, uint_fast8_t * done)
+{
+    const uint8_t           rr_ofs[4]   = { Z80_JIT_OFS (reg_BC), Z80_JIT_OFS (reg_DE), Z80_JIT_OFS (reg_HL), Z80_JIT_OFS (reg_SP) };
+    uint8_t                 opcode      = insn->opcode;
+    uint16_t                next        = UINT16_T (pc + insn->len);
+    uint_fast8_t            dst         = (opcode >> 3) & 0x07;
+    uint_fast8_t            src         = opcode & 0x07;
 
-                    if (f_stat (fname_poke_buf, &fno) == FR_OK)
-                    {
-                        poke_file_active = 1;
-                    }
-                    else
-                    {
-                        fname_poke_buf[0] = '\0';
-                    }
-                }
-                else
-                {
-                    fname_poke_buf[0] = '\0';
-                }
+    *done = FALSE;
 
-                rtc = tape_load (fname_load_buf, tape_load_format, base_addr, maxlen, load, load_data);
-#ifdef SSD1963
-                menu_redraw (poke_file_active);                                 // actualize menu entry "Poke"
-#endif
-            }
-#else
-            fname = menu_start_load (z80_settings.path);
+    if (opcode >= 0x40 && opcode <= 0x7F && dst != REG_IND_HL_POS && src != REG_IND_HL_POS)    // LD r,r'
+    {
+        if (dst != src)
+        {
+            p = z80_jit_emit_copy8 (p, Z80_JIT_OFS (reg_R(dst)), Z80_JIT_OFS (reg_R(src)));
+        }
 
-            if (fname)
-            {
-                char            tmpbuf[2 * Z80_MAX_FILENAME_LEN + 2];           // +2: '/' and '\0'
-                int             len;
+        *cycles += 4;
+        return p;
+    }
 
-                poke_file_active = 0;
-                z80_user_cancelled_load = 0;
-                snprintf (tmpbuf, 2 * Z80_MAX_FILENAME_LEN + 1, "%s/%s", z80_settings.path, fname);
-                z80_set_fname_load (tmpbuf);
+    if ((opcode & 0xC7) == 0x06 && dst != REG_IND_HL_POS)                   // LD r,n
+    {
+        p       = z80_jit_emit_rbx (p, 0, 0xC6, 0, Z80_JIT_OFS (reg_R(dst)));
+        *p++    = UINT8_T (insn->operand);
+        *cycles += 7;
+        return p;
+    }
 
-                len = strlen (fname_load_buf) - 4;
+    if ((opcode & 0xCF) == 0x01)                                            // LD rr,nn
+    {
+        p       = z80_jit_emit_rbx (p, 0x66, 0xC7, 0, rr_ofs[opcode >> 4]);
+        *p++    = UINT8_T (insn->operand);
+        *p++    = UINT8_T (insn->operand >> 8);
+        *cycles += 10;
+        return p;
+    }
 
-                if (len >= 0 && fname_load_buf[len] == '.')
-                {
-                    struct stat st;
+    if ((opcode & 0xC7) == 0x03)                                            // INC rr / DEC rr
+    {
+        p       = z80_jit_emit_rbx (p, 0x66, 0xFF, (opcode & 0x08) ? 1 : 0, rr_ofs[opcode >> 4]);
+        *cycles += 6;
+        return p;
+    }
 
-                    strcpy (fname_poke_buf, fname_load_buf);
-                    strcpy (fname_poke_buf + len, ".pok");
+    if (opcode >= 0x80 && opcode <= 0xBF && src != REG_IND_HL_POS)          // ADD/ADC/SUB/SBC/AND/XOR/OR/CP r
+    {
+        p = z80_jit_emit_rbx (p, 0, 0x0FB6, 1, Z80_JIT_OFS (reg_R(src)));  // MOVZX ECX,BYTE [RBX+r]
+        p = z80_jit_emit_alu8 (p, dst);
+        *cycles += 4;
+        return p;
+    }
 
-                    if (stat (fname_poke_buf, &st) == 0)
-                    {
-                        poke_file_active = 1;
-                    }
-                    else
-                    {
-                        fname_poke_buf[0] = '\0';
-                    }
-                }
-                else
-                {
-                    fname_poke_buf[0] = '\0';
-                }
+    if ((opcode & 0xC7) == 0xC6)                                            // ADD/ADC/SUB/SBC/AND/XOR/OR/CP n
+    {
+        *p++ = 0xB9;                                                        // MOV ECX,n
+        *p++ = UINT8_T (insn->operand);
+        *p++ = 0x00;
+        *p++ = 0x00;
+        *p++ = 0x00;
+        p = z80_jit_emit_alu8 (p, dst);
+        *cycles += 7;
+        return p;
+    }
 
-                rtc = tape_load (fname_load_buf, tape_load_format, base_addr, maxlen, load, load_data);
-                menu_redraw (poke_file_active);                                 // actualize menu entry "Poke"
-            }
-#endif
-        }
+    if ((opcode & 0xC6) == 0x04 && dst != REG_IND_HL_POS)                   // INC r / DEC r
+    {
+        p = z80_jit_emit_incdec8 (p, Z80_JIT_OFS (reg_R(dst)), opcode & 0x01);
+        *cycles += 4;
+        return p;
     }
-    else if (fname_load_valid)
+
+    switch (opcode)
     {
-        z80_user_cancelled_load = 0;
-        rtc = tape_load (fname_load_buf, tape_load_format, base_addr, maxlen, load, load_data);
+        case 0x00:                                                          // NOP
+            *cycles += 4;
+            return p;
+
+        case 0xEB:                                                          // EX DE,HL
+            p = z80_jit_emit_swap16 (p, Z80_JIT_OFS (reg_DE), Z80_JIT_OFS (reg_HL));
+            *cycles += 4;
+            return p;
+
+        case 0xD9:                                                          // EXX
+            p = z80_jit_emit_swap16 (p, Z80_JIT_OFS (reg_BC), Z80_JIT_OFS (z80_regfile.shadow.w[REG_IDX_BC]));
+            p = z80_jit_emit_swap16 (p, Z80_JIT_OFS (reg_DE), Z80_JIT_OFS (z80_regfile.shadow.w[REG_IDX_DE]));
+            p = z80_jit_emit_swap16 (p, Z80_JIT_OFS (reg_HL), Z80_JIT_OFS (z80_regfile.shadow.w[REG_IDX_HL]));
+            *cycles += 4;
+            return p;
+
+        case 0xF9:                                                          // LD SP,HL
+            p = z80_jit_emit_rbx (p, 0, 0x0FB7, 0, Z80_JIT_OFS (reg_HL));   // MOVZX EAX,WORD [RBX+HL]
+            p = z80_jit_emit_rbx (p, 0x66, 0x89, 0, Z80_JIT_OFS (reg_SP));  // MOV [RBX+SP],AX
+            *cycles += 6;
+            return p;
+
+        case 0xC3:                                                          // JP nn
+            *done = TRUE;
+            return z80_jit_emit_exit (p, *cycles + 10, insn->operand);
+
+        case 0x18:                                                          // JR n
+            *done = TRUE;
+            return z80_jit_emit_exit (p, *cycles + 12, insn->operand);
+
+        case 0xE9:                                                          // JP (HL)
+            *done = TRUE;
+            p = z80_jit_emit_rbx (p, 0, 0x0FB7, 0, Z80_JIT_OFS (reg_HL));   // MOVZX EAX,WORD [RBX+HL]
+            p = z80_jit_emit_rbx (p, 0x66, 0x89, 0, Z80_JIT_OFS (reg_PC));  // MOV [RBX+PC],AX
+            return z80_jit_emit_exit (p, *cycles + 4, 0x10000);
+
+        case 0x10:                                                          // DJNZ n
+            *done = TRUE;
+            p = z80_jit_emit_rbx (p, 0, 0xFE, 1, Z80_JIT_OFS (reg_B));      // DEC BYTE [RBX+B]
+            return z80_jit_emit_branch (p, 0x75, *cycles, 13, insn->operand, 8, next);
+
+        case 0x20:                                                          // JR NZ,n
+        case 0x28:                                                          // JR Z,n
+        case 0x30:                                                          // JR NC,n
+        case 0x38:                                                          // JR C,n
+            *done = TRUE;
+            p = z80_jit_emit_rbx (p, 0, 0xF6, 0, Z80_JIT_OFS (reg_F));      // TEST BYTE [RBX+F],mask
+            *p++ = (opcode & 0x10) ? FLAG_C : FLAG_Z;
+            return z80_jit_emit_branch (p, (opcode & 0x08) ? 0x75 : 0x74, *cycles, 12, insn->operand, 7, next);
+    }
+
+    return (uint8_t *) 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_jit_emit_block() - emit native code of block
+ *
+ *          PUSH    RBX
+ *          MOV     RBX,&z80_regfile
+ *          ...                                 ; translated instructions
+ *          ADD     clockcycles,pending         ; before each handler call
+ *          MOV     reg_PC,pc
+ *          MOV     EDI,operand
+ *          CALL    handler
+ *          CMP     *genptr,gen                 ; only if instruction may write into RAM
+ *          JE      next
+ *          POP     RBX
+ *          RET
+ *  next:   ...
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+z80_jit_emit_block (uint8_t * p, Z80_BLOCK * block)
+{
+    static const uint8_t    call_rax[]  = { 0xFF, 0xD0 };                   // CALL RAX
+    static const uint8_t    je_2[]      = { 0x74, 0x02 };                   // JE over epilogue
+    static const uint8_t    epilogue[]  = { 0x5B, 0xC3 };                   // POP RBX; RET
+    const Z80_BLOCK_INSN *  insn;
+    uint8_t *               q;
+    uint32_t                cycles      = 0;                                // T-states of translated instructions not yet added
+    uint_fast8_t            pc_dirty    = FALSE;                            // flag: reg_PC not yet stored
+    uint_fast8_t            done        = FALSE;
+    uint_fast8_t            idx;
+    uint16_t                pc          = block->pc;
+    uint32_t                imm;
 
-        if (! rtc)
+    *p++    = 0x53;                                                         // PUSH RBX, aligns stack to 16 bytes
+    p       = z80_jit_emit_imm64 (p, 3, &z80_regfile);                      // MOV RBX,&z80_regfile
+
+    for (idx = 0; idx < block->n_insns && ! done; idx++)
+    {
+        insn    = block->insns + idx;
+        q       = z80_jit_emit_native (p, insn, pc, &cycles, &done);
+
+        if (q)
         {
-            z80_close_fname_load ();                            // close tape fp, reset flags to force new LOAD by user
+            p           = q;
+            pc_dirty    = TRUE;
+        }
+        else
+        {
+            p           = z80_jit_emit_sync (p, cycles, pc_dirty ? pc : 0x10000);
+            cycles      = 0;
+            pc_dirty    = FALSE;
+
+            imm     = insn->operand;
+            *p++    = 0xBF;                                                 // MOV EDI,operand
+            memcpy (p, &imm, 4);
+            p      += 4;
+            p       = z80_jit_emit_imm64 (p, 0, (const void *) insn->fn);   // MOV RAX,handler
+            p       = z80_jit_emit_bytes (p, call_rax, sizeof (call_rax));
+
+            if (insn->check_gen)
+            {
+                p       = z80_jit_emit_imm64 (p, 0, block->genptr);         // MOV RAX,genptr
+                *p++    = 0x81;                                             // CMP DWORD [RAX],gen
+                *p++    = 0x38;
+                memcpy (p, &block->gen, 4);
+                p      += 4;
+                p       = z80_jit_emit_bytes (p, je_2, sizeof (je_2));
+                p       = z80_jit_emit_bytes (p, epilogue, sizeof (epilogue));
+            }
         }
-    }
 
-    if (rtc)                                                    // successful
-    {
-        reg_D = 0;                                              // reset length
-        reg_E = 0;
-        SET_FLAG_C();                                           // set carry
+        pc = UINT16_T (pc + insn->len);
     }
-    else
+
+    if (! done)
     {
-        RES_FLAG_C();
+        p = z80_jit_emit_exit (p, cycles, pc_dirty ? pc : 0x10000);
     }
-    reg_PC = pop16();
+
+    return p;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * tape_prepare_save() - prepare SAVE Tape (at 0x04C2):
- *
- * Parameters:
- * IX        - base address
- * DE        - length of data
- * A=0x00    - header
- * A=0xFF    - data block
+ * z80_jit_compile() - translate block into native code
  *
  * Return values:
- * Carry = 1 - OK
- * Carry = 0 - ERROR
+ *   TRUE   block translated or left to the block cache
+ *   FALSE  code buffer was full and the block cache has been flushed, caller must decode the block again
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-tape_prepare_save (void)
+static uint_fast8_t
+z80_jit_compile (Z80_BLOCK * block)
 {
-    uint16_t    base_addr   = GET_IX();                                 // base address
-    uint16_t    maxlen      = GET_DE();                                 // maximum length
-    uint8_t     save_data   = (reg_A == 0xFF) ? 1 : 0;                  // save data or save header
+    uint8_t *   start;
+    uint8_t *   end;
 
-    if (fname_save_valid && tape_save (fname_save_buf, base_addr, maxlen, save_data))
+    if (! z80_jit_code)
     {
-        SET_FLAG_C();
+        void * mem = mmap (NULL, Z80_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (mem == MAP_FAILED)
+        {
+            perror ("z80: jit");
+            z80_jit_failed = TRUE;
+            return TRUE;
+        }
+
+        z80_jit_code = (uint8_t *) mem;
     }
-    else
+
+    if (z80_jit_code_pos + Z80_JIT_MAX_BLOCK_SIZE > Z80_JIT_CODE_SIZE)
     {
-        RES_FLAG_C();
+        z80_block_cache_flush ();                                                   // code buffer full, start again
+        return FALSE;
     }
-    reg_PC = pop16();
+
+    start   = z80_jit_code + z80_jit_code_pos;
+    end     = z80_jit_emit_block (start, block);
+
+    __builtin___clear_cache ((char *) start, (char *) end);
+
+    z80_jit_code_pos    = UINT32_T ((end - z80_jit_code + 15) & ~15);
+    block->code         = (void (*)(void)) (void *) start;
+    return TRUE;
 }
+#endif // Z80_JIT == 1
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_set_fname_load () - set filename for LOAD Tape
+ * z80_block_run() - execute cached block at PC
+ *
+ * If chain is set, the following blocks are executed, too, until z80_idle_time() may get due, an interrupt is pending or a trap is
+ * reached. Requests of other threads (menu, snapshots, exit) are handled by z80() at the latest after 10 msec.
+ *
+ * Return values:
+ *   TRUE   block executed
+ *   FALSE  no block available, caller must interpret the instruction
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_set_fname_load (const char * fname)
+static uint_fast8_t
+z80_block_run (uint_fast8_t chain)
 {
-    size_t len = strlen (fname);
+    Z80_BLOCK *             block;
+    const Z80_BLOCK_INSN *  insn;
+    const Z80_BLOCK_INSN *  end;
+    uint_fast8_t            rtc = FALSE;
 
-    if (len > 4)
+    while (clockcycles < CLOCKCYCLES_PER_10_MSEC - Z80_BLOCK_MAX_CLOCKCYCLES)   // else z80_idle_time() may get due inside the block
     {
-        len -= 4;
+        block = z80_blocks + (reg_PC & (Z80_BLOCK_CACHE_SIZE - 1));
 
-        z80_close_fname_load ();
+        if (block->pc != reg_PC || block->bankptr != steccy_bankptr[reg_PC >> 14] || block->gen != *block->genptr)
+        {
+            z80_block_decode (block, reg_PC);
+        }
 
-        if (! strcasecmp (fname + len, ".tap"))
+        if (block->n_insns == 0)
         {
-            tape_load_format = TAPE_FORMAT_TAP;
-            strncpy (fname_load_buf, fname, Z80_MAX_FILENAME_LEN);
-            fname_load_valid = 1;
+            break;
         }
-        else if (! strcasecmp (fname + len, ".tzx"))
+
+        rtc = TRUE;
+
+#if Z80_JIT == 1
+        if (z80_settings.jit && ! block->code && ++block->hits == Z80_JIT_THRESHOLD && ! z80_jit_failed && ! z80_jit_compile (block))
         {
-            tape_load_format = TAPE_FORMAT_TZX;
-            strncpy (fname_load_buf, fname, Z80_MAX_FILENAME_LEN);
-            fname_load_valid = 1;
+            continue;                                                       // block cache flushed, decode again
         }
-        else if (! strcasecmp (fname + len, ".z80"))
+
+        if (z80_settings.jit && block->code)
         {
-            tape_load_format = TAPE_FORMAT_Z80;
-            strncpy (fname_load_buf, fname, Z80_MAX_FILENAME_LEN);
-            fname_load_snapshot_valid = 1;
+            block->code ();
+        }
+        else
+#endif
+        {
+            for (insn = block->insns, end = insn + block->n_insns; insn < end; insn++)
+            {
+                cur_PC = reg_PC;
+                (*insn->fn) (insn->operand);
+
+                if (insn->check_gen && block->gen != *block->genptr)
+                {
+                    break;                                                  // code modified
+                }
+            }
+        }
+
+        if (! chain || (iff1 && z80_interrupt) || Z80_TRAP_IS_SET (reg_PC))
+        {
+            break;
         }
     }
+
+    return rtc;
 }
 
-void
-z80_close_fname_load (void)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * Lockstep verification of block cache and JIT
+ *
+ * If VERIFYBLOCKS is set in the INI file (only Linux), every block is executed twice from the same state: first by the block cache or
+ * the JIT, then instruction by instruction by the interpreter as in z80(). Before the interpreter runs, the writes of the block into RAM
+ * are undone (see zx_ram_write_log) and registers, T-states and memory banks are restored. The interpreter gets the values which the
+ * block has read from ports and doesn't write the ports again. It stops when it has consumed the same T-states as the block.
+ *
+ * Then registers, flags, interrupt flags, T-states, the written addresses with their values and the port accesses are compared. At the
+ * first divergence, both results are printed on stdout and the emulation stops. Otherwise the state is the same as without verification.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
 {
-    fname_load_valid = FALSE;
-    fname_load_snapshot_valid = FALSE;
-    fname_load_buf[0] = '\0';
-    tape_load_close ();
+    Z80_REGFILE             regs;                                           // registers, flags calculated
+    uint8_t                 iff1;
+    uint8_t                 iff2;
+    uint32_t                cycles;                                         // z80_get_clockcycles() after execution
+    uint_fast32_t           n_writes;                                       // number of writes into RAM
+    ZX_RAM_WRITE            writes[ZX_RAM_WRITE_LOG_SIZE];                  // writes into RAM
+    uint8_t                 values[ZX_RAM_WRITE_LOG_SIZE];                  // value at written address after execution
+    uint_fast8_t            n_io;                                           // number of port accesses
+    Z80_LOCKSTEP_IO         io[Z80_LOCKSTEP_MAX_IO];                        // port accesses
+} Z80_LOCKSTEP_RESULT;
+
+typedef struct
+{
+    uint8_t *               bankptr[4];
+    uint32_t *              bankgen[4];
+    uint8_t *               bankcov[4];
+    uint8_t                 port_7ffd;
+    uint_fast8_t            shadow_display;
+    uint_fast8_t            paging_disabled;
+} Z80_LOCKSTEP_BANKS;
+
+static Z80_LOCKSTEP_RESULT  lockstep_block;                                 // result of block cache or JIT
+static Z80_LOCKSTEP_RESULT  lockstep_interp;                                // result of interpreter
+uint_fast8_t                z80_lockstep_failed;                            // flag: divergence found
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_lockstep_save_banks() - save paged memory banks, only OUT (n),A at the end of a block can change them
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_lockstep_save_banks (Z80_LOCKSTEP_BANKS * banks)
+{
+    memcpy (banks->bankptr, steccy_bankptr, sizeof (banks->bankptr));
+    memcpy (banks->bankgen, steccy_bankgen, sizeof (banks->bankgen));
+    memcpy (banks->bankcov, steccy_bankcov, sizeof (banks->bankcov));
+    banks->port_7ffd        = zxio_7ffd_value;
+    banks->shadow_display   = zx_ram_shadow_display;
+    banks->paging_disabled  = zx_ram_memory_paging_disabled;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_load_rom () - load new rom
+ * z80_lockstep_restore_banks() - restore paged memory banks
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_load_rom (const char * fname)
+static void
+z80_lockstep_restore_banks (const Z80_LOCKSTEP_BANKS * banks)
 {
-    if (strlen (fname) > 4)
-    {
-#ifdef QT_CORE_LIB  // TODO: QT includes complete path in fname
-        (void) strncpy (fname_rom_buf, fname, sizeof (fname_rom_buf) - 1);
-#else
-        set_fname_rom_buf (fname);
-#endif
-        load_rom ();
-        zxio_reset ();
-    }
+    memcpy (steccy_bankptr, banks->bankptr, sizeof (banks->bankptr));
+    memcpy (steccy_bankgen, banks->bankgen, sizeof (banks->bankgen));
+    memcpy (steccy_bankcov, banks->bankcov, sizeof (banks->bankcov));
+    zxio_7ffd_value                 = banks->port_7ffd;
+    zx_ram_shadow_display           = banks->shadow_display;
+    zx_ram_memory_paging_disabled   = banks->paging_disabled;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_set_fname_save_snapshot() - Set save snapshot file name
+ * z80_lockstep_begin() - start logging of RAM writes and port accesses
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_set_fname_save_snapshot (const char * fname)
+static void
+z80_lockstep_begin (Z80_LOCKSTEP_RESULT * result)
 {
-    strcpy (snapshot_save_fname, fname);
-    snapshot_save_valid = 1;
+    zx_ram_write_log        = result->writes;
+    zx_ram_write_log_len    = 0;
+    lockstep_io             = result->io;
+    lockstep_n_io           = 0;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_set_fname_save() - set name of TZX file for SAVEing
+ * z80_lockstep_end() - stop logging, store result
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_set_fname_save (const char * fname)
+static void
+z80_lockstep_end (Z80_LOCKSTEP_RESULT * result)
 {
-    z80_close_fname_save ();
+    uint_fast32_t   idx;
 
-    if (strlen (fname) > 4)
+    result->regs        = z80_regfile;
+    result->iff1        = iff1;
+    result->iff2        = iff2;
+    result->cycles      = z80_get_clockcycles ();
+    result->n_writes    = zx_ram_write_log_len;
+    result->n_io        = lockstep_n_io;
+
+    for (idx = 0; idx < result->n_writes; idx++)
     {
-        strncpy (fname_save_buf, fname, Z80_MAX_FILENAME_LEN);
-        fname_save_valid = 1;
+        result->values[idx] = *result->writes[idx].ptr;
     }
+
+    zx_ram_write_log    = (ZX_RAM_WRITE *) 0;
+    lockstep_io         = (Z80_LOCKSTEP_IO *) 0;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_close_fname_save() - close TZX file for SAVEing
+ * z80_lockstep_equal() - compare result of block with result of interpreter
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-z80_close_fname_save (void)
+static uint_fast8_t
+z80_lockstep_equal (const Z80_LOCKSTEP_RESULT * a, const Z80_LOCKSTEP_RESULT * b)
 {
-    fname_save_valid    = 0;
-    fname_save_buf[0]   = '\0';
-    tape_save_close ();
+    uint_fast32_t   idx;
+
+    if (a->regs.main.q[0] != b->regs.main.q[0] || a->regs.main.q[1] != b->regs.main.q[1] ||
+        a->regs.shadow.q[0] != b->regs.shadow.q[0] || a->regs.sp != b->regs.sp || a->regs.pc != b->regs.pc ||
+        a->iff1 != b->iff1 || a->iff2 != b->iff2 || a->cycles != b->cycles || a->n_writes != b->n_writes || a->n_io != b->n_io)
+    {
+        return FALSE;
+    }
+
+    for (idx = 0; idx < a->n_writes; idx++)
+    {
+        if (a->writes[idx].addr != b->writes[idx].addr || a->values[idx] != b->values[idx])
+        {
+            return FALSE;
+        }
+    }
+
+    return memcmp (a->io, b->io, a->n_io * sizeof (Z80_LOCKSTEP_IO)) == 0;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * serial_output () - output reg_A as character to UART
- *
- * STM32: USART 2 will be used
- * QT:    stdout will be used
- *
- * See also: https://faqwiki.zxnet.co.uk/wiki/Channels_and_streams
+ * z80_lockstep_print() - print result
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-serial_output (void)
+z80_lockstep_print (const char * name, const Z80_LOCKSTEP_RESULT * result, uint32_t start_cycles)
 {
-    int ch = reg_A;
+    const Z80_REGS *    r = &result->regs.main;
+    const Z80_REGS *    s = &result->regs.shadow;
+    uint8_t             f = UINT8_T (r->w[REG_IDX_AF]);
+    uint_fast32_t       idx;
 
-    if (ch == 0x06)                                     // PRINT #4,"Hello": convert Sinclair TAB into ASCII TAB
-    {
-        ch = '\t';
-    }
+    printf ("%-7s AF=%04X BC=%04X DE=%04X HL=%04X AF'=%04X BC'=%04X DE'=%04X HL'=%04X IX=%04X IY=%04X SP=%04X PC=%04X\n", name,
+            r->w[REG_IDX_AF], r->w[REG_IDX_BC], r->w[REG_IDX_DE], r->w[REG_IDX_HL],
+            s->w[REG_IDX_AF], s->w[REG_IDX_BC], s->w[REG_IDX_DE], s->w[REG_IDX_HL],
+            r->w[REG_IDX_IX], r->w[REG_IDX_IY], result->regs.sp, result->regs.pc);
+    printf ("        flags=%c%c%c%c%c%c%c%c IFF1=%u IFF2=%u T=+%lu\n",
+            (f & FLAG_S) ? 'S' : '-', (f & FLAG_Z) ? 'Z' : '-', (f & FLAG_X2) ? '5' : '-', (f & FLAG_H) ? 'H' : '-',
+            (f & FLAG_X1) ? '3' : '-', (f & FLAG_PV) ? 'P' : '-', (f & FLAG_N) ? 'N' : '-', (f & FLAG_C) ? 'C' : '-',
+            result->iff1, result->iff2, (unsigned long) (result->cycles - start_cycles));
+    printf ("        writes:");
 
-    if (ch == '\r')                                     // got CR
+    for (idx = 0; idx < result->n_writes; idx++)
     {
-#ifdef STM32F4XX
-        putchar ('\r');                                 // on STM32F4: convert it to CRNL
-#endif
-        putchar ('\n');                                 // on unix like systems or QT: convert it to NL
+        printf (" %04X=%02X", result->writes[idx].addr, result->values[idx]);
     }
-    else
+
+    printf ("\n        ports:");
+
+    for (idx = 0; idx < result->n_io; idx++)
     {
-        putchar (ch);
+        printf (" %s %02X%02X=%02X", result->io[idx].is_out ? "OUT" : "IN", result->io[idx].hi, result->io[idx].lo, result->io[idx].value);
     }
 
-    fflush (stdout);
+    printf ("\n");
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * serial_input () - read a character from UART
- *
- * STM32: USART 2 will be used
- * QT:    returns dummy characters "1234\r"
+ * z80_lockstep_run() - execute cached block at PC, then the same instructions by the interpreter, compare the results
  *
- * If data is available, set reg_A to character and set carry flag.
- * If data is not available, reset CARRY flag.
- * If data is End-of-File, reset ZERO and CARRY flag.
- * The basic command INPUT then results in a loop until Carry is set.
- *
- * A CR indicates end of input string. To avoid a bug, we should set bit 5 in TV_FLAG
- *
- * See also: https://faqwiki.zxnet.co.uk/wiki/Channels_and_streams
+ * Return values:
+ *   TRUE   block executed
+ *   FALSE  no block available, caller must interpret the instruction
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#define TV_FLAG     23612
-static void
-serial_input (void)
+static uint_fast8_t
+z80_lockstep_run (void)
 {
-#ifdef STM32F4XX                                                // on STM32F4:
-    uint_fast8_t ch;
+    Z80_REGFILE         regs;
+    Z80_LOCKSTEP_BANKS  banks_before;
+    Z80_LOCKSTEP_BANKS  banks_after;
+    uint8_t             save_iff1           = iff1;
+    uint8_t             save_iff2           = iff2;
+    uint32_t            save_clockcycles    = clockcycles;
+    uint32_t            save_base           = clockcycles_base;
+    uint32_t            block_clockcycles;
+    uint32_t            block_base;
+    uint32_t            start_cycles        = z80_get_clockcycles ();
+    uint_fast32_t       idx;
+    uint_fast8_t        n_opcodes           = 0;
+    uint8_t             opcode;
 
-    if (console_poll (&ch))                                     // poll character
+    regs = z80_regfile;
+    z80_lockstep_save_banks (&banks_before);
+
+    z80_lockstep_begin (&lockstep_block);
+
+    if (! z80_block_run (FALSE))
     {
-        reg_A = ch;                                             // store chac in register A
-        SET_FLAG_C();                                           // carry flag: indicate that character is available
+        z80_lockstep_end (&lockstep_block);
+        return FALSE;
+    }
 
-        if (reg_A == '\r')                                      // if char is a CR:
-        {
-            zx_ram_set_8(TV_FLAG, (1<<5));                      // ZX ROM bugfix: set only bit 5: clear screen on next command input
-        }
+    z80_lockstep_end (&lockstep_block);
+    z80_lockstep_save_banks (&banks_after);
+    block_clockcycles   = clockcycles;                                      // z80_idle_time() may have moved cycles to base
+    block_base          = clockcycles_base;
+
+    for (idx = lockstep_block.n_writes; idx-- > 0; )                        // undo writes in reverse order
+    {
+        *lockstep_block.writes[idx].ptr = lockstep_block.writes[idx].old_value;
     }
-    else
+
+    z80_regfile = regs;
+    iff1                = save_iff1;
+    iff2                = save_iff2;
+    clockcycles         = save_clockcycles;
+    clockcycles_base    = save_base;
+    z80_lockstep_restore_banks (&banks_before);
+
+    lockstep_replay     = lockstep_block.io;
+    lockstep_n_replay   = lockstep_block.n_io;
+    z80_lockstep_begin (&lockstep_interp);
+
+    while (((int32_t) (z80_get_clockcycles () - lockstep_block.cycles) < 0 || ixflags || iyflags) && n_opcodes < 2 * Z80_BLOCK_MAX_OPCODES)
     {
-        RES_FLAG_C();                                           // reset carry: indicate that no character available
+        cur_PC = reg_PC;
+        opcode = zx_ram_get_text (reg_PC);
+        z80_opcode (opcode);
+        n_opcodes++;
+
+        if (ixflags || iyflags)                                             // prefix as in z80()
+        {
+            if (last_ixiyflags)
+            {
+                ixflags = 0;
+                iyflags = 0;
+                last_ixiyflags = 0;
+            }
+            else
+            {
+                last_ixiyflags = 1;
+            }
+        }
     }
-#else                                                           // on Linux/Unix/QT: receive dummy string "12345\r"
-    static uint8_t ch = '1';                                    // begin with '1'
 
-    reg_A = ch;                                                 // set character
-    SET_FLAG_C();                                               // indicate that character is available
+    z80_lockstep_end (&lockstep_interp);
+    lockstep_replay = (Z80_LOCKSTEP_IO *) 0;
 
-    if (ch == '5')                                              // we return only 1234, then CR
+    if (z80_lockstep_equal (&lockstep_block, &lockstep_interp))
     {
-        ch = '1';                                               // reset char to '1'
-        reg_A = '\r';
-        zx_ram_set_8(TV_FLAG, (1<<5));                          // ZX ROM bugfix: set only bit 5: clear screen on next command input
+        clockcycles         = block_clockcycles;
+        clockcycles_base    = block_base;
+        z80_lockstep_restore_banks (&banks_after);                          // interpreter has not written ports
     }
     else
     {
-        ch++;                                                   // next char: 2345
+        printf ("lockstep: block at %04X diverges from interpreter after %u instructions, code:", regs.pc, (unsigned int) n_opcodes);
+
+        for (idx = 0; idx < 8; idx++)
+        {
+            printf (" %02X", zx_ram_get_text (UINT16_T (regs.pc + idx)));
+        }
+
+        printf ("\n");
+        z80_lockstep_print ("block", &lockstep_block, start_cycles);
+        z80_lockstep_print ("interp", &lockstep_interp, start_cycles);
+        fflush (stdout);
+
+        z80_lockstep_failed = TRUE;
+        steccy_exit         = 1;
     }
-#endif
+
+    return TRUE;
 }
 
+#endif // Z80_BLOCK_CACHE == 1
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * z80_idle_time () - use idle time to do something other, or just wait
+ * z80_trap_tape_load() - trap: tape loader in 48K ROM
+ *
+ * Official tape loader address is 0x0556, but some games call DI; EX AF,AF' on their own and jump to 0x055A or 0x562
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-static INLINE void
-z80_idle_time (void)
+static void
+z80_trap_tape_load (void)
 {
-#ifdef QT_CORE_LIB                                              // QT: sleep 10 msec, set z80 interrupt flag every 20msec
-    if (clockcycles >= CLOCKCYCLES_PER_10_MSEC)
+#if defined FRAMEBUFFER || defined X11
+    if (z80_runahead_trap ())
     {
-        static int      cnt = 0;
-        static int      last_elapsed = 0;
-        static QTime    qtime;
-        int             elapsed = qtime.elapsed();
+        return;
+    }
+#endif
+    tape_prepare_load (1);
+}
 
-        clockcycles -= CLOCKCYCLES_PER_10_MSEC;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * ROM hooks
+ *
+ * A trap callback of a ROM hook calls z80_rom_hook_begin(), the native implementation and then z80_rom_hook_end() with the address of a
+ * RET instruction, so that the Z80 returns to the caller of the ROM routine.
+ *
+ * If VERIFYHOOKS is set in the INI file (only Linux), every native implementation is checked against the ROM: z80_rom_hook_begin() saves
+ * the state, z80_rom_hook_end() saves the result of the native implementation and restores the state, then the ROM executes the routine.
+ * When the ROM returns to the caller, the registers given by the compare mask and the RAM are compared with the result of the native
+ * implementation. Differences are printed on stdout, the result of the ROM is kept.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define Z80_HOOK_CMP_A          0x0001                                      // compare A
+#define Z80_HOOK_CMP_F          0x0002                                      // compare F
+#define Z80_HOOK_CMP_BC         0x0004                                      // compare BC
+#define Z80_HOOK_CMP_DE         0x0008                                      // compare DE
+#define Z80_HOOK_CMP_HL         0x0010                                      // compare HL
+#define Z80_HOOK_CMP_A2         0x0020                                      // compare A'
+#define Z80_HOOK_CMP_F2         0x0040                                      // compare F'
+#define Z80_HOOK_CMP_HL2        0x0080                                      // compare HL'
+#define Z80_HOOK_CMP_CALC       0x0100                                      // ignore work areas of calculator
 
-        if (elapsed - last_elapsed < SLEEP_MSEC)
-        {
-            QThread::msleep(static_cast<unsigned long> (SLEEP_MSEC - (elapsed - last_elapsed)));
-        }
-        else
-        {
-            QThread::msleep(SLEEP_MSEC);
-        }
+#if Z80_ROM_HOOKS_VERIFY == 1
+#define Z80_HOOK_IGNORE_STACK   128                                         // ignore bytes below stack pointer
 
-        last_elapsed = elapsed;
-        cnt++;
+typedef struct
+{
+    Z80_REGFILE     regs;                                                   // registers
+    uint8_t         ram[0xC000];                                            // RAM 0x4000 - 0xFFFF
+} Z80_HOOK_STATE;
 
-        if (cnt == 2)                                           // interrupt every 20 msec
+static Z80_HOOK_STATE   z80_hook_before;                                    // state before ROM hook
+static Z80_HOOK_STATE   z80_hook_native;                                    // state after native implementation
+static const char *     z80_hook_name;                                      // name of ROM hook in verification, nullptr if none
+static uint_fast16_t    z80_hook_cmp;                                       // compare mask of ROM hook in verification
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_save() - save registers and RAM
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_rom_hook_save (Z80_HOOK_STATE * state)
+{
+    uint32_t    addr;
+
+    state->regs = z80_regfile;
+
+    for (addr = ZX_RAM_BEGIN; addr < 0x10000; addr++)
+    {
+        state->ram[addr - ZX_RAM_BEGIN] = zx_ram_get_8 (addr);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_restore() - restore registers and RAM
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_rom_hook_restore (Z80_HOOK_STATE * state)
+{
+    uint32_t    addr;
+
+    z80_regfile = state->regs;
+
+    for (addr = ZX_RAM_BEGIN; addr < 0x10000; addr++)
+    {
+        if (zx_ram_get_8 (addr) != state->ram[addr - ZX_RAM_BEGIN])
         {
-            cnt = 0;
-            z80_interrupt = 1;
+            zx_ram_set_8 (addr, state->ram[addr - ZX_RAM_BEGIN]);
         }
     }
+}
 
-#elif defined FRAMEBUFFER || defined X11                        // unix/linux: sleep 10 msec, set z80 interrupt flag every 20msec
-    if (clockcycles >= CLOCKCYCLES_PER_10_MSEC)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_ignore() - check if RAM address may differ between ROM and native implementation
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_rom_hook_ignore (uint16_t addr)
+{
+    uint16_t    stkend;
+    uint16_t    mem;
+
+    if ((addr >= KSTATE && addr <= REPPER) || addr == FLAGS || (addr >= FRAMES && addr < FRAMES + 3))       // written by interrupt
     {
-        static int cnt = 0;
-        clockcycles -= CLOCKCYCLES_PER_10_MSEC;
+        return TRUE;
+    }
 
-        struct timespec         elapsed;
-        static unsigned long    last_usec;
-        unsigned long           usec;
+    if (addr < reg_SP && addr + Z80_HOOK_IGNORE_STACK >= reg_SP)                                        // return addresses, pushed values
+    {
+        return TRUE;
+    }
 
-        clock_gettime(CLOCK_REALTIME, &elapsed);
-        usec = 1000000 * elapsed.tv_sec + (elapsed.tv_nsec / 1000);
+    if (z80_hook_cmp & Z80_HOOK_CMP_CALC)
+    {
+        stkend  = reg_DE;                                                   // new STKEND, sysvar is set after return
+        mem     = zx_ram_get_16 (MEM);
 
-        if (! z80_settings.turbo_mode)
+        if (addr == BREG || (addr >= mem && addr < mem + MEMBOT_LEN) || (addr >= stkend && addr < stkend + 0x100))
         {
-            if (usec - last_usec < SLEEP_USEC)
-            {
-                usleep (SLEEP_USEC - (usec - last_usec));
-            }
-            else
-            {
-                usleep (SLEEP_USEC);
-            }
+            return TRUE;
         }
+    }
 
-        last_usec = usec;
-        cnt++;
+    return FALSE;
+}
 
-        if (cnt == 2)                                                   // interrupt every 20 msec
-        {
-            cnt = 0;
-            z80_interrupt = 1;
-            update_display = 1;                                         // only if FRAMEBUFFER or X11
-        }
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_compare_reg() - compare register
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_rom_hook_compare_reg (const char * name, uint16_t rom, uint16_t native)
+{
+    if (rom != native)
+    {
+        printf ("ROM hook %s: %s differs, ROM: %04X, native: %04X\n", z80_hook_name, name, rom, native);
     }
+}
 
-#elif defined STM32F4XX                                                 // STM32: handle devices, set z80 interrupt flag every 20msec
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_compare() - compare result of ROM with result of native implementation
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_rom_hook_compare (void)
+{
+    Z80_REGFILE *   native = &z80_hook_native.regs;
+    uint32_t        addr;
+    uint_fast16_t   differences = 0;
+    uint8_t         value;
 
-    static int  cnt = 0;
-    uint32_t    clockcycles_per_200_usec = CLOCKCYCLES_PER_200_USEC;
+    if (z80_hook_cmp & Z80_HOOK_CMP_A)
+    {
+        z80_rom_hook_compare_reg ("A", reg_A, native->main.b[REG_BYTE(REG_IDX_A)]);
+    }
 
-    if (! (cnt % 4))
+    if (z80_hook_cmp & Z80_HOOK_CMP_F)
     {
-        clockcycles_per_200_usec--;                                     // 75% = 672, 25% = 671 => (75*672 + 25*671) / 2 => 67175 / 2 = 33587
+        z80_rom_hook_compare_reg ("F", reg_F, native->main.b[REG_BYTE(REG_IDX_F)]);
     }
 
-    if (clockcycles >= clockcycles_per_200_usec)
+    if (z80_hook_cmp & Z80_HOOK_CMP_BC)
     {
-        clockcycles -= clockcycles_per_200_usec;
+        z80_rom_hook_compare_reg ("BC", reg_BC, native->main.w[REG_IDX_BC]);
+    }
 
-        static uint32_t     last_uptime;                                // in units of 20us
-        uint32_t            stop_time = last_uptime + 10;               // 200 usec (10 * 20us) later...
+    if (z80_hook_cmp & Z80_HOOK_CMP_DE)
+    {
+        z80_rom_hook_compare_reg ("DE", reg_DE, native->main.w[REG_IDX_DE]);
+    }
 
-        if (z80_settings.keyboard & KEYBOARD_ZX)                        // use idle time to call ZX keyboard statemachine
-        {
-            zxkbd_poll ();
-        }
+    if (z80_hook_cmp & Z80_HOOK_CMP_HL)
+    {
+        z80_rom_hook_compare_reg ("HL", reg_HL, native->main.w[REG_IDX_HL]);
+    }
 
-        if (z80_settings.keyboard & KEYBOARD_USB)                       // use dle time to call USB statemachine
-        {
-            usb_hid_host_process (FALSE);
-        }
+    if (z80_hook_cmp & Z80_HOOK_CMP_A2)
+    {
+        z80_rom_hook_compare_reg ("A'", reg_A2, native->shadow.b[REG_BYTE(REG_IDX_A)]);
+    }
 
-        if (joystick_is_online)                                         // use idle time to call joystick statemachine
-        {
-            if (joystick_state == JOYSTICK_STATE_IDLE)                  // joystick is idle, start new transmission
-            {
-                static uint32_t jcnt = 0;
-                jcnt++;
+    if (z80_hook_cmp & Z80_HOOK_CMP_F2)
+    {
+        z80_rom_hook_compare_reg ("F'", reg_F2, native->shadow.b[REG_BYTE(REG_IDX_F)]);
+    }
 
-                if (jcnt == 100)                                        // 100 * 200usec = 20msec
-                {
-                    jcnt = 0;
-                    joystick_start_transmission ();                     // start a transmission only every 20msec
-                }
-            }
-            else                                                        // joystick ist busy, try to check if transmission finished
-            {
-                (void) joystick_finished_transmission (TRUE);           // ignore rtc, just read in joystick values
-            }
-        }
+    if (z80_hook_cmp & Z80_HOOK_CMP_HL2)
+    {
+        z80_rom_hook_compare_reg ("HL'", z80_regfile.shadow.w[REG_IDX_HL], native->shadow.w[REG_IDX_HL]);
+    }
 
-        if (z80_settings.turbo_mode)                                    // turbo mode
-        {
-            uptime = stop_time;                                         // skip pause time
-        }
-        else
+    z80_rom_hook_compare_reg ("IX", reg_IX, native->main.w[REG_IDX_IX]);
+    z80_rom_hook_compare_reg ("IY", reg_IY, native->main.w[REG_IDX_IY]);
+
+    for (addr = ZX_RAM_BEGIN; addr < 0x10000; addr++)
+    {
+        value = zx_ram_get_8 (addr);
+
+        if (value != z80_hook_native.ram[addr - ZX_RAM_BEGIN] && ! z80_rom_hook_ignore (addr))
         {
-            while (uptime < stop_time)                                  // wait until stop_time reached
+            if (differences < 8)
             {
-                // wait
+                printf ("ROM hook %s: RAM %04X differs, ROM: %02X, native: %02X\n", z80_hook_name, (unsigned int) addr,
+                        value, z80_hook_native.ram[addr - ZX_RAM_BEGIN]);
             }
+
+            differences++;
         }
+    }
 
-        last_uptime = uptime;                                           // restore last uptime
+    if (differences >= 8)
+    {
+        printf ("ROM hook %s: %u bytes of RAM differ\n", z80_hook_name, (unsigned int) differences);
+    }
 
-        cnt++;
+    fflush (stdout);
+}
 
-        if (cnt == CLOCKCYCLES_COUNT_200_USEC)                          // Z80 interrupt every 20 msec
-        {
-            cnt = 0;
-            z80_interrupt = 1;
-        }
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_rom_hook_verify() - trap: return address of ROM hook in verification
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_rom_hook_verify (void)
+{
+    if (z80_hook_name && reg_SP == z80_hook_native.regs.sp)                 // else recursive call of the routine, not yet returned
+    {
+        z80_trap_remove (reg_PC, z80_trap_rom_hook_verify);
+        z80_rom_hook_compare ();
+        z80_hook_name = nullptr;
     }
-#else
-#error "unexpected platform"
-#endif
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * zx_rom_po_attr (void) - ROM hook: set attribute for pixel address given by HL
+ * z80_rom_hook_cancel() - cancel verification of ROM hook, e.g. if the ROM reported an error instead of returning to the caller
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-zx_rom_po_attr (void)
+static void
+z80_rom_hook_cancel (void)
 {
-    reg_H >>= 3;                                                    // get attribute address from
-    reg_H &= 0x03;                                                  // screen pixel address
-    reg_H |= 0x58;
-
-    uint16_t    attr_addr   = (reg_H << 8) | reg_L;
-    uint8_t     attr        = zx_ram_get_8(attr_addr);
-    uint8_t     attr_t      = zx_ram_get_8(ATTR_T);                 // get ATTR_T
-    uint8_t     mask_t      = zx_ram_get_8(MASK_T);                 // get MASK_T
-    uint8_t     p_flag      = zx_ram_get_8(P_FLAG);                 // get P_FLAG
-
-    attr ^= attr_t;
-    attr &= mask_t;
-    attr ^= attr_t;
-
-    if (p_flag & (1 << 6))
+    if (z80_hook_name)
     {
-        attr &= 0xC7;
+        z80_trap_remove (z80_hook_native.regs.pc, z80_trap_rom_hook_verify);
+        z80_hook_name = nullptr;
+    }
+}
+#endif // Z80_ROM_HOOKS_VERIFY == 1
 
-        if (! (attr & (1 << 2)))
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_begin() - start ROM hook
+ *
+ * Returns FALSE if the ROM has to execute the routine, because another ROM hook is being verified.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+z80_rom_hook_begin (void)
+{
+#if Z80_ROM_HOOKS_VERIFY == 1
+    if (z80_settings.rom_hooks_verify)
+    {
+        if (z80_hook_name)
         {
-            attr ^= 0x38;
+            if (reg_SP <= z80_hook_native.regs.sp)                          // ROM of hook in verification is still running
+            {
+                return FALSE;
+            }
+
+            printf ("ROM hook %s: ROM did not return, not verified\n", z80_hook_name);
+            z80_rom_hook_cancel ();
         }
+
+        z80_rom_hook_save (&z80_hook_before);
     }
+#endif
+    return TRUE;
+}
 
-    if (p_flag & (1 << 4))
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_rom_hook_end() - end ROM hook, continue at RET instruction ret_pc
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_rom_hook_end (uint16_t ret_pc, uint_fast16_t cmp, const char * name)
+{
+#if Z80_ROM_HOOKS_VERIFY == 1
+    if (z80_settings.rom_hooks_verify)
     {
-        attr &= 0xF8;
+        reg_PC = zx_ram_get_16 (reg_SP);                                    // state after RET of native implementation
+        reg_SP += 2;
+        z80_rom_hook_save (&z80_hook_native);
+        z80_rom_hook_restore (&z80_hook_before);                            // let ROM execute the routine
 
-        if (! (attr & (1 << 5)))
+        if (z80_trap_add (z80_hook_native.regs.pc, 0, z80_trap_rom_hook_verify))
         {
-            attr ^= 0x07;
+            z80_hook_name   = name;
+            z80_hook_cmp    = cmp;
         }
+        return;
     }
-
-    zx_ram_set_8(attr_addr, attr);
+#else
+    (void) cmp;
+    (void) name;
+#endif
+    reg_PC = ret_pc;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * zx_rom_plot_sub (void) - ROM hook: plot
+ * z80_trap_plot_sub() - trap: PLOT_SUB, return via RET of PO_ATTR
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-zx_rom_plot_sub (void)
+static void
+z80_trap_plot_sub (void)
 {
-    uint8_t x   = reg_C;
-    uint8_t y   = reg_B;
-
-    // printf ("PLOT %d,%d\n", x, y);
-
-    zx_ram_set_8 (COORDS_X, x);                                     // LD (COORDS),BC
-    zx_ram_set_8 (COORDS_Y, y);
-
-    y = 175 - y;                                                    // y = 0 is at bottom of screen
+    if (z80_rom_hook_begin ())
+    {
+        zx_rom_plot_sub ();
+        z80_rom_hook_end (0x0C09, Z80_HOOK_CMP_A | Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL, "PLOT-SUB");
+    }
+}
 
-    // 2 calculate address:
-    // 15   14  13  12  11  10  9   8   7   6   5   4   3   2   1   0
-    // 0    1   0   Y7  Y6  Y2  Y1  Y0  Y5  Y4  Y3  X7  X6  X5  X4  X3
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_po_attr() - trap: PO_ATTR, return via RET of PO_ATTR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_po_attr (void)
+{
+    if (z80_rom_hook_begin ())
+    {
+        zx_rom_po_attr ();
+        z80_rom_hook_end (0x0C09, Z80_HOOK_CMP_A | Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL, "PO-ATTR");
+    }
+}
 
-    uint16_t addr = ZX_SPECTRUM_DISPLAY_START_ADDRESS   |           // base address
-                    ((y & 0xC0) << 5)                   |           // Y7 Y6
-                    ((y & 0x07) << 8)                   |           // Y2 Y1 Y0
-                    ((y & 0x38) << 2)                   |           // Y5 Y4 Y3
-                    ((x & 0xF8) >> 3);                              // X7 X6 X5 X4
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_draw_line_3() - trap: DRAW_LINE + 3, return via RET of DRAW_LINE
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_draw_line_3 (void)
+{
+    if (z80_rom_hook_begin ())
+    {
+        zx_rom_draw_line_3 ();
+        z80_rom_hook_end (0x24F6, 0, "DRAW-LINE");
+    }
+}
 
-    uint8_t v       = zx_ram_get_8(addr);
-    uint8_t p_flag  = zx_ram_get_8(P_FLAG);                         // get P_FLAG
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_cl_line() - trap: CL-LINE, return via RET of CL-LINE
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_cl_line (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_cl_line ())
+    {
+        z80_rom_hook_end (0x0E87, Z80_HOOK_CMP_A | Z80_HOOK_CMP_BC | Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL, "CL-LINE");
+    }
+}
 
-    if (p_flag & 0x01)                                              // Bit 0 set: OVER 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_cl_scroll() - trap: CL-SCROLL, return via RET of CL-LINE
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_cl_scroll (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_cl_scroll ())
     {
-        if (! (p_flag & (1 << 2)))                                  // Bit 2 not set: not INVERSE 1
-        {
-            v ^= (1 << (7 - (x & 0x07)));                           // OVER 1: set Pixel if reset and vice versa
-        }
+        z80_rom_hook_end (0x0E87, Z80_HOOK_CMP_A | Z80_HOOK_CMP_BC | Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL, "CL-SCROLL");
     }
-    else
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_pr_all_2() - trap: PR-ALL-2 (after PO-SCR), return via RET of PR-ALL
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_pr_all_2 (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_pr_all_2 ())
     {
-        if (p_flag & (1 << 2))                                      // Bit 2 set: INVERSE 1
-        {
-            v &= ~(1 << (7 - (x & 0x07)));                          // INVERSE 1: set pixel to paper color
-        }
-        else
-        {
-            v |= (1 << (7 - (x & 0x07)));                           // NORMAL: set pixel to ink color
-        }
+        z80_rom_hook_end (0x0BD2, Z80_HOOK_CMP_A | Z80_HOOK_CMP_F | Z80_HOOK_CMP_BC | Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL |
+                                  Z80_HOOK_CMP_A2 | Z80_HOOK_CMP_F2, "PR-ALL");
     }
+}
 
-    zx_ram_set_8(addr, v);
+#if Z80_ROM_HOOKS_CALC == 1
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_calc_multiply() - trap: calculator multiply, return via RET of HL-MULT
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_calc_multiply (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_calc_multiply ())
+    {
+        z80_rom_hook_end (0x30BF, Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL | Z80_HOOK_CMP_HL2 | Z80_HOOK_CMP_CALC, "multiply");
+    }
+}
 
-    reg_H = addr >> 8;
-    reg_L = addr & 0xFF;
-    zx_rom_po_attr ();
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_calc_division() - trap: calculator division, return via RET of HL-MULT
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_calc_division (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_calc_division ())
+    {
+        z80_rom_hook_end (0x30BF, Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL | Z80_HOOK_CMP_HL2 | Z80_HOOK_CMP_CALC, "division");
+    }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * zx_rom_draw_line_3 (void) - ROM hook: draw line
+ * z80_trap_calc_sin() - trap: calculator SIN, return via RET of HL-MULT
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-zx_rom_draw_line_3 (void)
+static void
+z80_trap_calc_sin (void)
 {
-    int         x0  = zx_ram_get_8 (COORDS_X);                  // start x
-    int         y0  = zx_ram_get_8 (COORDS_Y);                  // start y
-    int         x   = reg_C;                                    // ABS x
-    int         y   = reg_B;                                    // ABS Y
-    int         dx  = (reg_E == 0xFF) ? -1 : 1;                 // SGN x: 0x01 = positive, 0xFF = negative
-    int         dy  = (reg_D == 0xFF) ? -1 : 1;                 // SGN y: 0x01 = positive, 0xFF = negative
-    int         ddx;
-    int         ddy;
-    int         ix;
-    int         iy;
-
-    // printf ("x0=%d y0=%d x=%d y=%d dx=%d dy=%d\n", x0, y0, x, y, dx, dy);
-
-    int         h;
-    int         n;
-    int         b;
-    int         i;
-    int         l;
-
-    if (x >= y)
+    if (z80_rom_hook_begin () && zx_rom_calc_sin ())
     {
-        if (x + y == 0)
-        {
-            return;
-        }
-
-        l = y;
-        b = x;
-        ddx = dx;
-        ddy = 0;
+        z80_rom_hook_end (0x30BF, Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL | Z80_HOOK_CMP_HL2 | Z80_HOOK_CMP_CALC, "SIN");
     }
-    else
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_calc_cos() - trap: calculator COS, return via RET of HL-MULT
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_calc_cos (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_calc_cos ())
     {
-        l = x;
-        b = y;
-        ddx = 0;
-        ddy = dy;
+        z80_rom_hook_end (0x30BF, Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL | Z80_HOOK_CMP_HL2 | Z80_HOOK_CMP_CALC, "COS");
     }
+}
 
-    h = b;
-    i = b / 2;
-
-    for (n = b; n > 0; n--)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_calc_sqr() - trap: calculator SQR, return via RET of HL-MULT
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_calc_sqr (void)
+{
+    if (z80_rom_hook_begin () && zx_rom_calc_sqr ())
     {
-        i += l;
-
-        if (i < h)
-        {
-            ix = ddx;
-            iy = ddy;
-        }
-        else
-        {
-            i -= h;
-            ix = dx;
-            iy = dy;
-        }
-
-        y0 += iy;
-
-        if (y0 < 0 || y0 > 175)
-        {
-            return;
-        }
+        z80_rom_hook_end (0x30BF, Z80_HOOK_CMP_DE | Z80_HOOK_CMP_HL | Z80_HOOK_CMP_HL2 | Z80_HOOK_CMP_CALC, "SQR");
+    }
+}
+#endif // Z80_ROM_HOOKS_CALC == 1
 
-        x0 += ix;
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * z80_trap_init() - register standard traps
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+z80_trap_init (void)
+{
+#if defined FRAMEBUFFER || defined X11
+    uint_fast8_t    idx;
+#endif
 
-        if (x0 < 0 || x0 > 255)
-        {
-            return;
-        }
+    z80_trap_add (0x0562,           Z80_TRAP_ROM48,                                             z80_trap_tape_load);
+    z80_trap_add (0x04C2,           Z80_TRAP_ROM48,                                             tape_prepare_save);
+    z80_trap_add (0x22E5,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_plot_sub);
+    z80_trap_add (0x0BDB,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_po_attr);
+    z80_trap_add (0x24BA,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_draw_line_3);
+    z80_trap_add (0x0E44,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_cl_line);
+    z80_trap_add (0x0E00,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_cl_scroll);
+    z80_trap_add (0x0B99,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_pr_all_2);
+#if Z80_ROM_HOOKS_CALC == 1
+    z80_trap_add (0x30CA,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_calc_multiply);
+    z80_trap_add (0x31AF,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS,                        z80_trap_calc_division);
+    z80_trap_add (0x37B5,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS | Z80_TRAP_ROM_MATH,    z80_trap_calc_sin);
+    z80_trap_add (0x37AA,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS | Z80_TRAP_ROM_MATH,    z80_trap_calc_cos);
+    z80_trap_add (0x384A,           Z80_TRAP_ROM48 | Z80_TRAP_ROM_HOOKS | Z80_TRAP_ROM_MATH,    z80_trap_calc_sqr);
+#endif
+    z80_trap_add (SERIAL_OUTPUT,    Z80_TRAP_STECCY,                                            serial_output);
+    z80_trap_add (SERIAL_INPUT,     Z80_TRAP_STECCY,                                            serial_input);
 
-        reg_C = x0;
-        reg_B = y0;
-        zx_rom_plot_sub ();
+#if defined FRAMEBUFFER || defined X11
+    for (idx = 0; idx < BOOT_CACHE_READY_POINTS; idx++)
+    {
+        z80_trap_add (boot_cache_ready_points[idx].addr, boot_cache_ready_points[idx].flags, z80_trap_boot_ready);
     }
+#endif
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -7743,12 +11766,68 @@ z80 (void)
 #elif defined FRAMEBUFFER || defined X11
         if (update_display)
         {
+            uint_fast8_t    flags = update_display;
+
             update_display = 0;
-            zxscr_update_display ();
+
+            if ((flags & UPDATE_DISPLAY_FRAME) && runahead_frames)
+            {
+                if (--runahead_frames == 0)
+                {
+                    zxscr_update_display ();                                // display the frame ahead ...
+                    z80_runahead_restore ();                                // ... and emulate the real one
+                }
+            }
+            else if (flags & UPDATE_DISPLAY_FRAME)
+            {
+                if (lxrec_mode)
+                {
+                    lxrec_frame ();                                         // before menu or control socket change anything
+                }
+
+                if (lxtrace_active)
+                {
+                    lxtrace_frame ();
+                }
+
+                if (zx_ram_coverage)
+                {
+                    lxcoverage_frame ();
+                }
+
+                if (! z80_runahead_possible ())
+                {
+                    zxscr_update_display ();
+                }
 
 #if defined X11
-            x11_event ();
+                x11_event ();
 #endif
+                if (lxevdev_active)
+                {
+                    lxevdev_apply ();                                       // events not yet seen by a port read
+                }
+
+                if (lxctrl_active)
+                {
+                    lxctrl_frame ();
+                }
+
+                if (z80_runahead_possible ())                               // check again: input may have changed settings
+                {
+                    z80_runahead_start ();
+                }
+            }
+
+            if (flags & UPDATE_DISPLAY_CTRL)
+            {
+                lxctrl_service ();
+            }
+
+            if (flags & UPDATE_DISPLAY_REC)
+            {
+                lxrec_sync ();
+            }
         }
 
         if (steccy_exit)
@@ -7775,6 +11854,15 @@ z80 (void)
                 z80_interrupt = 0;
                 iff1 = 0;
 
+#if defined FRAMEBUFFER || defined X11
+                if (auto_turbo & AUTO_TURBO_BOOT)                       // first interrupt: ROM has initialized the machine
+                {
+                    z80_auto_turbo_clear (AUTO_TURBO_BOOT);
+                }
+
+                trace_interrupt = 1;
+#endif
+
                 if (zx_ram_get_8(reg_PC) == 0x76)                           // sleeping on HALT
                 {
                     reg_PC++;
@@ -7793,30 +11881,18 @@ z80 (void)
                     ADD_CLOCKCYCLES (19);
                     reg_PC = zx_ram_get_16 (vector_addr);
                 }
-            }
 
-            if (reg_PC < ZX_SPECTRUM_DISPLAY_START_ADDRESS &&
-                ((z80_romsize == 0x4000 && steccy_bankptr[0] == steccy_rombankptr[0]) ||
-                 (z80_romsize == 0x8000 && steccy_bankptr[0] == steccy_rombankptr[1])))                 // we are in 48K ROM
-            {
-                if (reg_PC == 0x0562)           // official tape loader address is 0x0556,
-                {                               // but some games call DI; EX AF,AF' on their own and jump to 0x055A or 0x562
-                    tape_prepare_load (1);
-                }
-                else if (reg_PC == 0x4C2)
+#if defined FRAMEBUFFER || defined X11
+                if (boot_cache_wait && ++boot_cache_interrupts == BOOT_CACHE_READY_INTERRUPTS)     // no ready point found, e.g. other ROM
                 {
-                    tape_prepare_save ();
+                    z80_boot_cache_ready ();
                 }
+#endif
+            }
 
-                if (z80_settings.rom_hooks)
-                {
-                    switch (reg_PC)
-                    {
-                        case 0x22E5:    zx_rom_plot_sub ();     reg_PC = 0x0C09; break; // PLOT_SUB (RET from PO_ATTR!)
-                        case 0x0BDB:    zx_rom_po_attr ();      reg_PC = 0x0C09; break; // PO_ATTR  (RET from PO_ATTR)
-                        case 0x24BA:    zx_rom_draw_line_3 ();  reg_PC = 0x24F6; break; // DRAW_LINE + 3 (RET from DRAW_LINE)
-                    }
-                }
+            if (Z80_TRAP_IS_SET (reg_PC))
+            {
+                z80_trap (reg_PC);
             }
 
 #if defined QT_CORE_LIB
@@ -7825,7 +11901,7 @@ z80 (void)
                 QThread::msleep(10);
             }
 #elif defined FRAMEBUFFER || defined X11
-            if (! z80_focus)
+            if (! z80_focus && ! runahead_frames)                           // keyboard thread: open menu in real frame
             {
                 menu (z80_settings.path, poke_file_active);
                 z80_focus = TRUE;
@@ -7862,6 +11938,12 @@ z80 (void)
                 debug = save_debug;
                 save_debug = 0;
             }
+#endif
+#if defined FRAMEBUFFER || defined X11
+            if (lxtrace_active)
+            {
+                z80_trace ();
+            }
 #endif
             debug_printf ("\r\nPC=%04X SP=%04X [%02X%02X]  ", reg_PC, reg_SP, ram[reg_SP + 1], ram[reg_SP]);
             debug_printf ("%02X %02X %02X %02X   ", ram[reg_PC], ram[reg_PC + 1], ram[reg_PC + 2], ram[reg_PC + 3]);
@@ -7870,304 +11952,17 @@ z80 (void)
             debug_printf ("S=%d Z=%d C=%d PV=%d  ", ISSET_FLAG_S() ? 1 : 0, ISSET_FLAG_Z() ? 1 : 0, ISSET_FLAG_C() ? 1 : 0, ISSET_FLAG_PV() ? 1 : 0);
         }
 
-        opcode = zx_ram_get_text (reg_PC);
-
-        if (hooks_active)
+#if Z80_BLOCK_CACHE == 1
+        if ((z80_settings.block_cache || z80_settings.jit) && ! ixflags && ! iyflags && ! lxtrace_active && ! zx_ram_coverage &&
+            (z80_settings.block_verify ? z80_lockstep_run () : z80_block_run (TRUE)))
         {
-            switch (reg_PC)
-            {
-                case SERIAL_OUTPUT: serial_output (); break;
-                case SERIAL_INPUT:  serial_input (); break;
-            }
+            continue;
         }
+#endif
 
-        switch (opcode)
-        {
-            case 0x00:  cmd_nop ();                             break;          // NOP
-            case 0x01:  cmd_ld_rr_nn (REG_IDX_BC);              break;          // LD BC,nn
-            case 0x02:  cmd_ld_ind_rr_a (REG_IDX_BC);           break;          // LD (BC),A
-            case 0x03:  cmd_inc_rr (REG_IDX_BC);                break;          // INC BC
-            case 0x04:  cmd_inc_r (REG_IDX_B);                  break;          // INC B
-            case 0x05:  cmd_dec_r (REG_IDX_B);                  break;          // DEC B
-            case 0x06:  cmd_ld_r_n (REG_IDX_B);                 break;          // LD B,n
-            case 0x07:  cmd_rlca ();                            break;          // RLCA
-            case 0x08:  cmd_ex_af_af ();                        break;          // EX AF,AF'
-            case 0x09:  cmd_add_ii_rr (REG_IDX_BC);             break;          // ADD HL,BC / ADD IX,BC / ADD IY,BC
-            case 0x0A:  cmd_ld_a_ind_rr (REG_IDX_BC);           break;          // LD A,(BC)
-            case 0x0B:  cmd_dec_rr (REG_IDX_BC);                break;          // DEC BC
-            case 0x0C:  cmd_inc_r (REG_IDX_C);                  break;          // INC C
-            case 0x0D:  cmd_dec_r (REG_IDX_C);                  break;          // DEC C
-            case 0x0E:  cmd_ld_r_n (REG_IDX_C);                 break;          // LD C,n
-            case 0x0F:  cmd_rrca ();                            break;          // RRCA
-
-            case 0x10:  cmd_djnz ();                            break;          // DJNZ n
-            case 0x11:  cmd_ld_rr_nn (REG_IDX_DE);              break;          // LD DE,nn
-            case 0x12:  cmd_ld_ind_rr_a (REG_IDX_DE);           break;          // LD (DE),A
-            case 0x13:  cmd_inc_rr (REG_IDX_DE);                break;          // INC DE
-            case 0x14:  cmd_inc_r (REG_IDX_D);                  break;          // INC D
-            case 0x15:  cmd_dec_r (REG_IDX_D);                  break;          // DEC D
-            case 0x16:  cmd_ld_r_n (REG_IDX_D);                 break;          // LD D,n
-            case 0x17:  cmd_rla ();                             break;          // RLA
-            case 0x18:  cmd_jr ();                              break;          // JR n
-            case 0x19:  cmd_add_ii_rr (REG_IDX_DE);             break;          // ADD HL,DE / ADD IX,DE / ADD IY,DE
-            case 0x1A:  cmd_ld_a_ind_rr (REG_IDX_DE);           break;          // LD A,(DE)
-            case 0x1B:  cmd_dec_rr (REG_IDX_DE);                break;          // DEC DE
-            case 0x1C:  cmd_inc_r (REG_IDX_E);                  break;          // INC E
-            case 0x1D:  cmd_dec_r (REG_IDX_E);                  break;          // DEC E
-            case 0x1E:  cmd_ld_r_n (REG_IDX_E);                 break;          // LD E,n
-            case 0x1F:  cmd_rra ();                             break;          // RRA
-
-            case 0x20:  cmd_jr_cond (COND_NZ);                  break;          // JR NZ,n
-            case 0x21:  cmd_ld_ii_nn ();                        break;          // LD HL,nn / LD IX,nn / LD IY,nn
-            case 0x22:  cmd_ld_ind_nn_hl ();                    break;          // LD (nn),HL
-            case 0x23:  cmd_inc_ii ();                          break;          // INC HL / INC IX / INC IY
-            case 0x24:  cmd_inc_r (REG_IDX_H);                  break;          // INC H
-            case 0x25:  cmd_dec_r (REG_IDX_H);                  break;          // DEC H / DEC IXH / DEC IYH
-            case 0x26:  cmd_ld_r_n (REG_IDX_H);                 break;          // LD H,n / LD IXH,n / LD IYH,n
-            case 0x27:  cmd_daa ();                             break;          // DAA
-            case 0x28:  cmd_jr_cond (COND_Z);                   break;          // JR Z,n
-            case 0x29:  cmd_add_ii_ii();                        break;          // ADD HL,HL
-            case 0x2A:  cmd_ld_ii_ind_nn ();                    break;          // LD HL,(nn)
-            case 0x2B:  cmd_dec_ii ();                          break;          // DEC HL / DEC IX / DEC IY
-            case 0x2C:  cmd_inc_r (REG_IDX_L);                  break;          // INC L / INC IXL / INC IYL
-            case 0x2D:  cmd_dec_r (REG_IDX_L);                  break;          // DEC L / DEC IXL / DEC IYL
-            case 0x2E:  cmd_ld_r_n (REG_IDX_L);                 break;          // LD L,n / LD IXL,n / LD IYL,n
-            case 0x2F:  cmd_cpl ();                             break;          // CPL
-
-            case 0x30:  cmd_jr_cond (COND_NC);                  break;          // JR NC,n
-            case 0x31:  cmd_ld_sp_nn ();                        break;          // LD SP,nn
-            case 0x32:  cmd_ld_ind_nn_a ();                     break;          // LD (nn),A
-            case 0x33:  cmd_inc_sp ();                          break;          // INC SP
-            case 0x34:  cmd_inc_ind_ii ();                      break;          // INC (HL) / INC (IX + d) / INC (IY + d)
-            case 0x35:  cmd_dec_ind_ii ();                      break;          // DEC (HL) / DEC (IX + d) / DEC (IY + d)
-            case 0x36:  cmd_ld_ind_ii_n ();                     break;          // LD (HL),n / LD (IX + d),n / LD (IY + d),n
-            case 0x37:  cmd_scf ();                             break;          // SCF
-            case 0x38:  cmd_jr_cond (COND_C);                   break;          // JR C,n
-            case 0x39:  cmd_add_ii_sp();                        break;          // ADD HL,SP
-            case 0x3A:  cmd_ld_a_ind_nn ();                     break;          // LD A,(nn)
-            case 0x3B:  cmd_dec_sp ();                          break;          // DEC SP
-            case 0x3C:  cmd_inc_r (REG_IDX_A);                  break;          // INC A
-            case 0x3D:  cmd_dec_r (REG_IDX_A);                  break;          // DEC A
-            case 0x3E:  cmd_ld_r_n (REG_IDX_A);                 break;          // LD A,n
-            case 0x3F:  cmd_ccf ();                             break;          // CCF
-
-            case 0x40:                                                          // LD B,B
-            case 0x41:                                                          // LD B,C
-            case 0x42:                                                          // LD B,D
-            case 0x43:                                                          // LD B,E
-            case 0x44:                                                          // LD B,H
-            case 0x45:                                                          // LD B,L
-            case 0x47:  cmd_ld_r_r (REG_IDX_B, opcode & 0x07);  break;          // LD B,A
-            case 0x46:  cmd_ld_r_ind_ii (REG_IDX_B);            break;          // LD B,(HL)
-
-            case 0x48:                                                          // LD C,B
-            case 0x49:                                                          // LD C,C
-            case 0x4A:                                                          // LD C,D
-            case 0x4B:                                                          // LD C,E
-            case 0x4C:                                                          // LD C,H
-            case 0x4D:                                                          // LD C,L
-            case 0x4F:  cmd_ld_r_r (REG_IDX_C, opcode & 0x07);  break;          // LD C,A
-            case 0x4E:  cmd_ld_r_ind_ii (REG_IDX_C);            break;          // LD C,(HL)
-
-            case 0x50:                                                          // LD D,B
-            case 0x51:                                                          // LD D,C
-            case 0x52:                                                          // LD D,D
-            case 0x53:                                                          // LD D,E
-            case 0x54:                                                          // LD D,H
-            case 0x55:                                                          // LD D,L
-            case 0x57:  cmd_ld_r_r (REG_IDX_D, opcode & 0x07);  break;          // LD D,A
-            case 0x56:  cmd_ld_r_ind_ii (REG_IDX_D);            break;          // LD D,(HL)
-
-            case 0x58:                                                          // LD E,B
-            case 0x59:                                                          // LD E,C
-            case 0x5A:                                                          // LD E,D
-            case 0x5B:                                                          // LD E,E
-            case 0x5C:                                                          // LD E,H
-            case 0x5D:                                                          // LD E,L
-            case 0x5F:  cmd_ld_r_r (REG_IDX_E, opcode & 0x07);  break;          // LD E,A
-            case 0x5E:  cmd_ld_r_ind_ii (REG_IDX_E);            break;          // LD E,(HL)
-
-            case 0x60:                                                          // LD H,B
-            case 0x61:                                                          // LD H,C
-            case 0x62:                                                          // LD H,D
-            case 0x63:                                                          // LD H,E
-            case 0x64:                                                          // LD H,H
-            case 0x65:                                                          // LD H,L
-            case 0x67:  cmd_ld_r_r (REG_IDX_H, opcode & 0x07);  break;          // LD H,A
-            case 0x66:  cmd_ld_r_ind_ii (REG_IDX_H);            break;          // LD H,(HL)
-
-            case 0x68:                                                          // LD L,B
-            case 0x69:                                                          // LD L,C
-            case 0x6A:                                                          // LD L,D
-            case 0x6B:                                                          // LD L,E
-            case 0x6C:                                                          // LD L,H
-            case 0x6D:                                                          // LD L,L
-            case 0x6F:  cmd_ld_r_r (REG_IDX_L, opcode & 0x07);  break;          // LD L,A
-            case 0x6E:  cmd_ld_r_ind_ii (REG_IDX_L);            break;          // LD L,(HL)
-
-            case 0x70:                                                          // LD (HL),B
-            case 0x71:                                                          // LD (HL),C
-            case 0x72:                                                          // LD (HL),D
-            case 0x73:                                                          // LD (HL),E
-            case 0x74:                                                          // LD (HL),H
-            case 0x75:                                                          // LD (HL),L
-            case 0x77:  cmd_ld_ind_ii_r (opcode & 0x07);        break;          // LD (HL),A
-            case 0x76:  cmd_halt ();                            break;          // HALT
-
-            case 0x78:                                                          // LD A,B
-            case 0x79:                                                          // LD A,C
-            case 0x7A:                                                          // LD A,D
-            case 0x7B:                                                          // LD A,E
-            case 0x7C:                                                          // LD A,H
-            case 0x7D:                                                          // LD A,L
-            case 0x7F:  cmd_ld_r_r (REG_IDX_A, opcode & 0x07);  break;          // LD A,A
-            case 0x7E:  cmd_ld_r_ind_ii (REG_IDX_A);            break;          // LD A,(HL)
-
-            case 0x80:                                                          // ADD A,B
-            case 0x81:                                                          // ADD A,C
-            case 0x82:                                                          // ADD A,D
-            case 0x83:                                                          // ADD A,E
-            case 0x84:                                                          // ADD A,H
-            case 0x85:                                                          // ADD A,L
-            case 0x87:  cmd_add_a_r (opcode & 0x07);            break;          // ADD A,A
-            case 0x86:  cmd_add_a_ind_ii ();                    break;          // ADD A,(HL)
-
-            case 0x88:                                                          // ADC A,B
-            case 0x89:                                                          // ADC A,C
-            case 0x8A:                                                          // ADC A,D
-            case 0x8B:                                                          // ADC A,E
-            case 0x8C:                                                          // ADC A,H
-            case 0x8D:                                                          // ADC A,L
-            case 0x8F:  cmd_adc_a_r (opcode & 0x07);            break;          // ADC A,A
-            case 0x8E:  cmd_adc_a_ind_ii ();                    break;          // ADC A,(HL)
-
-            case 0x90:                                                          // SUB A,B
-            case 0x91:                                                          // SUB A,C
-            case 0x92:                                                          // SUB A,D
-            case 0x93:                                                          // SUB A,E
-            case 0x94:                                                          // SUB A,H
-            case 0x95:                                                          // SUB A,L
-            case 0x97:  cmd_sub_a_r (opcode & 0x07);            break;          // SUB A,A
-            case 0x96:  cmd_sub_a_ind_ii ();                    break;          // SUB A,(HL)
-
-            case 0x98:                                                          // SBC A,B
-            case 0x99:                                                          // SBC A,C
-            case 0x9A:                                                          // SBC A,D
-            case 0x9B:                                                          // SBC A,E
-            case 0x9C:                                                          // SBC A,H
-            case 0x9D:                                                          // SBC A,L
-            case 0x9F:  cmd_sbc_a_r (opcode & 0x07);            break;          // SBC A,A
-            case 0x9E:  cmd_sbc_a_ind_ii ();                    break;          // SBC A,(HL)
-
-            case 0xA0:                                                          // AND A,B
-            case 0xA1:                                                          // AND A,C
-            case 0xA2:                                                          // AND A,D
-            case 0xA3:                                                          // AND A,E
-            case 0xA4:                                                          // AND A,H
-            case 0xA5:                                                          // AND A,L
-            case 0xA7:  cmd_and_a_r (opcode & 0x07);            break;          // AND A,A
-            case 0xA6:  cmd_and_a_ind_ii ();                    break;          // AND A,(HL)
-
-            case 0xA8:                                                          // XOR A,B
-            case 0xA9:                                                          // XOR A,C
-            case 0xAA:                                                          // XOR A,D
-            case 0xAB:                                                          // XOR A,E
-            case 0xAC:                                                          // XOR A,H
-            case 0xAD:                                                          // XOR A,L
-            case 0xAF:  cmd_xor_a_r (opcode & 0x07);            break;          // XOR A,A
-            case 0xAE:  cmd_xor_a_ind_ii ();                    break;          // XOR A,(HL)
-
-            case 0xB0:                                                          // OR A,B
-            case 0xB1:                                                          // OR A,C
-            case 0xB2:                                                          // OR A,D
-            case 0xB3:                                                          // OR A,E
-            case 0xB4:                                                          // OR A,H
-            case 0xB5:                                                          // OR A,L
-            case 0xB7:  cmd_or_a_r (opcode & 0x07);             break;          // OR A,A
-            case 0xB6:  cmd_or_a_ind_ii ();                     break;          // OR A,(HL)
-
-            case 0xB8:                                                          // CP A,B
-            case 0xB9:                                                          // CP A,C
-            case 0xBA:                                                          // CP A,D
-            case 0xBB:                                                          // CP A,E
-            case 0xBC:                                                          // CP A,H
-            case 0xBD:                                                          // CP A,L
-            case 0xBF:  cmd_cp_a_r (opcode & 0x07);             break;          // CP A,A
-            case 0xBE:  cmd_cp_a_ind_ii ();                     break;          // CP A,(HL)
-
-            case 0xC0:  cmd_ret_cond (COND_NZ);                 break;          // RET NZ
-            case 0xC1:  cmd_pop_rr (REG_IDX_BC);                break;          // POP BC
-            case 0xC2:  cmd_jp_cond (COND_NZ);                  break;          // JP NZ,nn
-            case 0xC3:  cmd_jp_nn ();                           break;          // JP nn
-            case 0xC4:  cmd_call_cond (COND_NZ);                break;          // CALL NZ,nn
-            case 0xC5:  cmd_push_rr (REG_IDX_BC);               break;          // PUSH BC
-            case 0xC6:  cmd_add_a_n();                          break;          // ADD A,n
-            case 0xC7:  cmd_rst (0x0000);                       break;          // RST 00h
-            case 0xC8:  cmd_ret_cond (COND_Z);                  break;          // RET Z
-            case 0xC9:  cmd_ret ();                             break;          // RET
-            case 0xCA:  cmd_jp_cond (COND_Z);                   break;          // JP Z,nn
-            case 0xCB:  z80_bits ();                            break;          // BITS
-            case 0xCC:  cmd_call_cond (COND_Z);                 break;          // CALL Z,nn
-            case 0xCD:  cmd_call ();                            break;          // CALL nn
-            case 0xCE:  cmd_adc_a_n();                          break;          // ADC A,n
-            case 0xCF:  cmd_rst (0x0008);                       break;          // RST 08h
-
-            case 0xD0:  cmd_ret_cond (COND_NC);                 break;          // RET NC
-            case 0xD1:  cmd_pop_rr (REG_IDX_DE);                break;          // POP DE
-            case 0xD2:  cmd_jp_cond (COND_NC);                  break;          // JP NC,nn
-            case 0xD3:  cmd_out_ind_n_a ();                     break;          // OUT (n),A
-            case 0xD4:  cmd_call_cond (COND_NC);                break;          // CALL NC,nn
-            case 0xD5:  cmd_push_rr (REG_IDX_DE);               break;          // PUSH DE
-            case 0xD6:  cmd_sub_a_n ();                         break;          // SUB A,n
-            case 0xD7:  cmd_rst (0x0010);                       break;          // RST 10h
-            case 0xD8:  cmd_ret_cond (COND_C);                  break;          // RET C
-            case 0xD9:  cmd_exx ();                             break;          // EXX
-            case 0xDA:  cmd_jp_cond (COND_C);                   break;          // JP C,nn
-            case 0xDB:  cmd_in_a_ind_n ();                      break;          // IN A,(n)
-            case 0xDC:  cmd_call_cond (COND_C);                 break;          // CALL C,nn
-            case 0xDD:  cmd_ixflags ();                         break;          // IXFLAGS
-            case 0xDE:  cmd_sbc_a_n ();                         break;          // SBC A,n
-            case 0xDF:  cmd_rst (0x0018);                       break;          // RST 18h
-
-            case 0xE0:  cmd_ret_cond (COND_PO);                 break;          // RET PO
-            case 0xE1:  cmd_pop_ii ();                          break;          // POP HL / POP IX / POP IY
-            case 0xE2:  cmd_jp_cond (COND_PO);                  break;          // JP PO,nn
-            case 0xE3:  cmd_ex_ind_sp_ii ();                    break;          // EX (SP),HL / EX (SP),IX / EX (SP),IY
-            case 0xE4:  cmd_call_cond (COND_PO);                break;          // CALL PO,nn
-            case 0xE5:  cmd_push_ii ();                         break;          // PUSH HL / PUSH IX / PUSH IY
-            case 0xE6:  cmd_and_n ();                           break;          // AND n
-            case 0xE7:  cmd_rst (0x0020);                       break;          // RST 20h
-            case 0xE8:  cmd_ret_cond (COND_PE);                 break;          // RET PE
-            case 0xE9:  cmd_jp_ind_ii ();                       break;          // JP (HL) / JP (IX) / JP (IY)
-            case 0xEA:  cmd_jp_cond (COND_PE);                  break;          // JP PE,nn
-            case 0xEB:  cmd_ex_de_hl ();                        break;          // EX DE,HL
-            case 0xEC:  cmd_call_cond (COND_PE);                break;          // CALL PE,nn
-            case 0xED:  z80_extd();                             break;          // EXTD
-            case 0xEE:  cmd_xor_a_n ();                         break;          // XOR n
-            case 0xEF:  cmd_rst (0x0028);                       break;          // RST 28h
-
-            case 0xF0:  cmd_ret_cond (COND_P);                  break;          // RET P
-            case 0xF1:  cmd_pop_af ();                          break;          // POP AF
-            case 0xF2:  cmd_jp_cond (COND_P);                   break;          // JP P,nn
-            case 0xF3:  cmd_di ();                              break;          // DI
-            case 0xF4:  cmd_call_cond (COND_P);                 break;          // CALL P,nn
-            case 0xF5:  cmd_push_af ();                         break;          // PUSH AF
-            case 0xF6:  cmd_or_a_n ();                          break;          // OR A,n
-            case 0xF7:  cmd_rst (0x0030);                       break;          // RST 30h
-            case 0xF8:  cmd_ret_cond (COND_M);                  break;          // RET M
-            case 0xF9:  cmd_ld_sp_ii ();                        break;          // LD SP,HL / LD SP,IX / LD SP,IY
-            case 0xFA:  cmd_jp_cond (COND_M);                   break;          // JP M,nn
-            case 0xFB:  cmd_ei ();                              break;          // EI
-            case 0xFC:  cmd_call_cond (COND_M);                 break;          // CALL M,nn
-            case 0xFD:  cmd_iyflags ();                         break;          // IYFLAGS
-            case 0xFE:  cmd_cp_a_n ();                          break;          // CP A,n
-            case 0xFF:  cmd_rst (0x0038);                       break;          // RST 38h
-            default:
-            {
-                printf ("z80: Unhandled opcode: %02X PC=%04X\n", opcode, cur_PC);
-                fflush (stdout);
-            }
-        }
+        zx_ram_cov_exec (reg_PC);
+        opcode = zx_ram_get_text (reg_PC);
+        z80_opcode (opcode);
 
         if (ixflags || iyflags)
         {
@@ -8207,6 +12002,15 @@ load_ini_file (void)
     z80_settings.keyboard           = KEYBOARD_NONE;
     z80_settings.orientation        = 0;
     z80_settings.rgb_order          = 0;
+    z80_settings.block_cache        = 0;
+    z80_settings.jit                = 0;
+    z80_settings.display_scale      = 200;
+    z80_settings.display_filter     = DISPLAY_FILTER_NONE;
+    z80_settings.display_scanlines  = 0;
+    z80_settings.frame_skip         = 4;
+    z80_settings.auto_turbo         = 1;
+    z80_settings.boot_cache         = 1;
+    z80_settings.run_ahead          = 0;
 
 #ifdef DEBUG
     QByteArray      ba = QDir::currentPath().toLocal8Bit();
@@ -8323,6 +12127,133 @@ load_ini_file (void)
                     {
                         z80_settings.rgb_order = atoi (p) % 2;
                     }
+                    else if (! strcasecmp (buf, "JIT"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.jit = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.jit = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "BLOCKCACHE"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.block_cache = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.block_cache = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "VERIFYBLOCKS"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.block_verify = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.block_verify = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "MATHHOOKS"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.rom_hooks_math = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.rom_hooks_math = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "VERIFYHOOKS"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.rom_hooks_verify = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.rom_hooks_verify = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "SCALE"))
+                    {
+                        if (! strcasecmp (p, "AUTO"))
+                        {
+                            z80_settings.display_scale = 0;
+                        }
+                        else if (atof (p) > 0)
+                        {
+                            z80_settings.display_scale = UINT16_T (atof (p) * 100 + 0.5);
+                        }
+                    }
+                    else if (! strcasecmp (buf, "FILTER"))
+                    {
+                        if (! strcasecmp (p, "SCALE2X"))
+                        {
+                            z80_settings.display_filter = DISPLAY_FILTER_SCALE2X;
+                        }
+                        else if (! strcasecmp (p, "SCALE3X"))
+                        {
+                            z80_settings.display_filter = DISPLAY_FILTER_SCALE3X;
+                        }
+                        else if (! strcasecmp (p, "NONE"))
+                        {
+                            z80_settings.display_filter = DISPLAY_FILTER_NONE;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "SCANLINES"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.display_scanlines = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.display_scanlines = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "FRAMESKIP"))
+                    {
+                        z80_settings.frame_skip = UINT_FAST8_T (atoi (p));
+                    }
+                    else if (! strcasecmp (buf, "BOOTCACHE"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.boot_cache = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.boot_cache = 0;
+                        }
+                    }
+                    else if (! strcasecmp (buf, "RUNAHEAD"))
+                    {
+                        int frames = atoi (p);
+
+                        if (frames >= 0 && frames <= RUNAHEAD_MAX_FRAMES)
+                        {
+                            z80_settings.run_ahead = UINT_FAST8_T (frames);
+                        }
+                    }
+                    else if (! strcasecmp (buf, "AUTOTURBO"))
+                    {
+                        if (! strcasecmp (p, "YES"))
+                        {
+                            z80_settings.auto_turbo = 1;
+                        }
+                        else if (! strcasecmp (p, "NO"))
+                        {
+                            z80_settings.auto_turbo = 0;
+                        }
+                    }
                 }
             }
         }
@@ -8358,6 +12289,7 @@ zx_spectrum (int argc, char **argv)
     QApplication app(argc, argv);
 
     load_ini_file ();
+    z80_trap_init ();
     set_fname_rom_buf (z80_settings.romfile);
     load_rom ();
     zxio_reset ();
@@ -8378,10 +12310,23 @@ void
 zx_spectrum (void)
 {
     load_ini_file ();
+    z80_trap_init ();
     set_fname_rom_buf (z80_settings.romfile);
     load_rom ();
     zxio_reset ();
+    lxrec_begin ();
     menu_init ();
+    lxrec_sync ();
+
+#if Z80_JIT == 0
+    if (z80_settings.jit)                                                       // no native code generator for this CPU, e.g. AArch64
+    {
+        fprintf (stderr, "JIT is only available on x86-64, using block cache\n");
+        z80_settings.jit            = 0;
+        z80_settings.block_cache    = 1;
+    }
+#endif
+
     z80 ();
 }
 
@@ -8391,6 +12336,7 @@ void
 zx_spectrum (void)
 {
     load_ini_file ();
+    z80_trap_init ();
     set_fname_rom_buf (z80_settings.romfile);
     load_rom ();
     zxio_reset ();
@@ -119,6 +119,14 @@
 #define KEYBOARD_USB            0x02
 #define KEYBOARD_ZX             0x04
 
+// possible values for display filter (Linux only):
+#define DISPLAY_FILTER_NONE     0
+#define DISPLAY_FILTER_SCALE2X  1
+#define DISPLAY_FILTER_SCALE3X  2
+
+// max. value of run_ahead (Linux only):
+#define RUNAHEAD_MAX_FRAMES     2
+
 typedef struct
 {
 #ifndef STM32F4XX
@@ -132,6 +140,18 @@ typedef struct
     uint8_t                     orientation;                                    // orientation
     uint_fast8_t                turbo_mode;                                     // flag: turbo mode
     uint_fast8_t                rom_hooks;                                      // flag: ROM hooks active
+    uint_fast8_t                block_cache;                                    // flag: execute cached blocks (Linux only)
+    uint_fast8_t                jit;                                            // flag: compile hot blocks (Linux x86-64 only)
+    uint_fast8_t                rom_hooks_math;                                 // flag: ROM hooks calculate SIN, COS, SQR by the host (Linux only)
+    uint_fast8_t                rom_hooks_verify;                               // flag: verify ROM hooks against the ROM (Linux only)
+    uint_fast8_t                block_verify;                                   // flag: verify block cache/JIT against interpreter (Linux only)
+    uint16_t                    display_scale;                                  // display scale in percent, 0 = fit to screen (Linux only)
+    uint_fast8_t                display_filter;                                 // pixel-art filter, see DISPLAY_FILTER_xxx (Linux only)
+    uint_fast8_t                display_scanlines;                              // flag: darken last line of every ZX row (Linux only)
+    uint_fast8_t                frame_skip;                                     // max. frames not presented in a row if too slow (Linux only)
+    uint_fast8_t                auto_turbo;                                     // flag: turbo while booting and loading tapes (Linux only)
+    uint_fast8_t                boot_cache;                                     // flag: restore cached state after boot (Linux only)
+    uint_fast8_t                run_ahead;                                      // frames to run ahead of the displayed frame (Linux only)
 } Z80_SETTINGS;
 
 extern Z80_SETTINGS             z80_settings;
@@ -148,6 +168,9 @@ extern volatile uint32_t        uptime;                                 // uptim
 extern volatile                 uint_fast8_t steccy_exit;
 extern uint_fast8_t             steccy_uses_x11;
 extern uint_fast8_t             z80_display_cached;
+extern uint_fast8_t             z80_cold_boot;
+extern uint_fast8_t             z80_unthrottled;
+extern uint_fast8_t             z80_lockstep_failed;
 #endif
 
 /*------------------------------------------------------------------------------------------------------------------------
@@ -173,6 +196,43 @@ extern void             z80 (void);
 
 extern uint_fast8_t     z80_user_cancelled_load;
 
+/*------------------------------------------------------------------------------------------------------------------------
+ * Traps: callbacks called before the opcode at an address is executed
+ *------------------------------------------------------------------------------------------------------------------------
+*/
+#define Z80_TRAP_ROM48          0x01                                    // only if 48K BASIC ROM is paged in
+#define Z80_TRAP_ROM_HOOKS      0x02                                    // only if ROM hooks are active
+#define Z80_TRAP_STECCY         0x04                                    // only if STECCY ROM with hooks is loaded
+#define Z80_TRAP_BOOT           0x08                                    // only while the boot cache waits for the ready point
+#define Z80_TRAP_ROM_MATH       0x10                                    // only if MATHHOOKS is set
+
+#if defined FRAMEBUFFER || defined X11
+/*------------------------------------------------------------------------------------------------------------------------
+ * Register snapshot, see z80_get_registers()
+ *------------------------------------------------------------------------------------------------------------------------
+*/
+typedef struct
+{
+    uint16_t            af;
+    uint16_t            bc;
+    uint16_t            de;
+    uint16_t            hl;
+    uint16_t            af_;                                            // shadow registers
+    uint16_t            bc_;
+    uint16_t            de_;
+    uint16_t            hl_;
+    uint16_t            ix;
+    uint16_t            iy;
+    uint16_t            sp;
+    uint16_t            pc;
+    uint8_t             i;
+    uint8_t             r;
+    uint8_t             im;                                             // interrupt mode
+    uint8_t             iff1;
+    uint8_t             iff2;
+} Z80_REGISTERS;
+#endif
+
 /*------------------------------------------------------------------------------------------------------------------------
  * Public functions
  *------------------------------------------------------------------------------------------------------------------------
@@ -186,8 +246,20 @@ extern void             z80_next_display_rgb_order (void);
 extern void             z80_next_turbo_mode (void);
 extern void             z80_set_turbo_mode (uint_fast8_t active);
 extern uint_fast8_t     z80_get_turbo_mode (void);
+#if defined FRAMEBUFFER || defined X11
+extern uint32_t         z80_get_clockcycles (void);
+extern uint32_t         z80_get_lag_usec (void);
+extern uint_fast8_t     z80_get_auto_turbo (void);
+extern void             z80_get_registers (Z80_REGISTERS * regs);
+extern void             z80_set_registers (const Z80_REGISTERS * regs);
+extern uint64_t         z80_get_rom_hash (void);
+#endif
 extern void             z80_set_rom_hooks (uint_fast8_t active);
 extern uint_fast8_t     z80_get_rom_hooks (void);
+extern uint_fast8_t     z80_trap_add (uint16_t addr, uint_fast8_t flags, void (*func)(void));
+extern void             z80_trap_remove (uint16_t addr, void (*func)(void));
+extern void             z80_trap_update (void);
+extern void             z80_trap_select (void);
 extern char *           z80_get_poke_file (void);
 extern void             z80_load_rom (const char * fname);
 extern void             z80_set_fname_load (const char * fname);
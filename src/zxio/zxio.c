@@ -42,6 +42,10 @@
 #include "i2c.h"
 #endif
 #include "zxkbd.h"
+#elif defined FRAMEBUFFER || defined X11
+#include "lxcapture.h"
+#include "lxrec.h"
+#include "lxevdev.h"
 #endif
 
 /*------------------------------------------------------------------------------------------------------------------------
@@ -198,6 +202,11 @@ zxio_out_port (uint8_t hi, uint8_t lo, uint8_t value)
                 last_speaker_value = 0;
             }
         }
+#elif defined FRAMEBUFFER || defined X11
+        if (lxcapture_active)
+        {
+            lxcapture_speaker (value & ZX_SPEAKER_MASK);
+        }
 #endif
     }
     else if (lo == STECCY_LO_PORT)                                          // lo = 0111 1111
@@ -236,6 +245,12 @@ zxio_out_port (uint8_t hi, uint8_t lo, uint8_t value)
             }
 #endif
             steccy_bankptr[3] = steccy_rambankptr[value & 0x07];
+#if ZX_RAM_WRITE_GEN == 1
+            steccy_bankgen[3] = steccy_rambankgen[value & 0x07];
+#endif
+#if ZX_RAM_COVERAGE == 1
+            steccy_bankcov[3] = steccy_rambankcov[value & 0x07];
+#endif
 
             if (value & 0x08)
             {
@@ -267,6 +282,12 @@ zxio_out_port (uint8_t hi, uint8_t lo, uint8_t value)
                 }
 #endif
                 steccy_bankptr[0] = steccy_rombankptr[1];                   // ROM 1
+#if ZX_RAM_WRITE_GEN == 1
+                steccy_bankgen[0] = steccy_rombankgen[1];
+#endif
+#if ZX_RAM_COVERAGE == 1
+                steccy_bankcov[0] = steccy_rombankcov[1];
+#endif
             }
             else
             {
@@ -277,6 +298,12 @@ zxio_out_port (uint8_t hi, uint8_t lo, uint8_t value)
                 }
 #endif
                 steccy_bankptr[0] = steccy_rombankptr[0];                   // ROM 0
+#if ZX_RAM_WRITE_GEN == 1
+                steccy_bankgen[0] = steccy_rombankgen[0];
+#endif
+#if ZX_RAM_COVERAGE == 1
+                steccy_bankcov[0] = steccy_rombankcov[0];
+#endif
             }
 
             if (value & 0x20)
@@ -286,6 +313,8 @@ zxio_out_port (uint8_t hi, uint8_t lo, uint8_t value)
 #endif
                 zx_ram_memory_paging_disabled = 1;                          // disable memory paging until reset
             }
+
+            z80_trap_select ();                                             // ROM paging may have changed
         }
 
     }
@@ -298,12 +327,25 @@ zxio_out_port (uint8_t hi, uint8_t lo, uint8_t value)
 uint8_t
 zxio_in_port (uint8_t hi, uint8_t lo)
 {
-    uint8_t rtc = 0xFF;
+    const uint8_t * matrix  = kmatrix;
+    uint8_t         rtc     = 0xFF;
 
     if (lo == ZX_KEYBOARD_PORT)
     {
         hi = ~hi;
 
+#if defined FRAMEBUFFER || defined X11
+        if (lxevdev_active)
+        {
+            lxevdev_apply ();                                               // input events due at this clock cycle
+        }
+
+        if (lxrec_mode)
+        {
+            matrix = lxrec_input (kmatrix, kempston_value);                 // recorded or replayed input
+        }
+#endif
+
 #ifdef STM32F4XX
         if (z80_settings.keyboard & KEYBOARD_ZX)                            // get row value of ZX keyboard
         {
@@ -318,14 +360,14 @@ zxio_in_port (uint8_t hi, uint8_t lo)
         }
 #endif
 
-        if (hi & 0x01) { rtc &= kmatrix[0]; }                               // get row value of USB/PS2 keyboard (inverted ORed)
-        if (hi & 0x02) { rtc &= kmatrix[1]; }                               // code unrolled for more speed
-        if (hi & 0x04) { rtc &= kmatrix[2]; }
-        if (hi & 0x08) { rtc &= kmatrix[3]; }
-        if (hi & 0x10) { rtc &= kmatrix[4]; }
-        if (hi & 0x20) { rtc &= kmatrix[5]; }
-        if (hi & 0x40) { rtc &= kmatrix[6]; }
-        if (hi & 0x80) { rtc &= kmatrix[7]; }
+        if (hi & 0x01) { rtc &= matrix[0]; }                                // get row value of USB/PS2 keyboard (inverted ORed)
+        if (hi & 0x02) { rtc &= matrix[1]; }                                // code unrolled for more speed
+        if (hi & 0x04) { rtc &= matrix[2]; }
+        if (hi & 0x08) { rtc &= matrix[3]; }
+        if (hi & 0x10) { rtc &= matrix[4]; }
+        if (hi & 0x20) { rtc &= matrix[5]; }
+        if (hi & 0x40) { rtc &= matrix[6]; }
+        if (hi & 0x80) { rtc &= matrix[7]; }
 
         if (z80_user_cancelled_load)
         {
@@ -337,7 +379,21 @@ zxio_in_port (uint8_t hi, uint8_t lo)
     }
     else if (lo == KEMPSTON_PORT)
     {
+#if defined FRAMEBUFFER || defined X11
+        if (lxevdev_active)
+        {
+            lxevdev_apply ();                                               // input events due at this clock cycle
+        }
+#endif
+
         rtc = kempston_value;
+
+#if defined FRAMEBUFFER || defined X11
+        if (lxrec_mode)
+        {
+            rtc = lxrec_input (kmatrix, kempston_value)[ZX_KBD_ROWS];       // recorded or replayed input
+        }
+#endif
     }
     else if (lo == STECCY_LO_PORT)                                          // lo = 0111 1111
     {
@@ -419,9 +475,19 @@ zxio_release_key (uint8_t kb_idx)
 uint_fast8_t
 zxio_all_keys_released (void)
 {
-    uint_fast8_t    mask = kmatrix[0] & kmatrix[1] & kmatrix[2] & kmatrix[3] & kmatrix[4] & kmatrix[5] & kmatrix[6] & kmatrix[7];
+    const uint8_t * matrix = kmatrix;
+    uint_fast8_t    mask;
     uint_fast8_t    rtc = 0;
 
+#if defined FRAMEBUFFER || defined X11
+    if (lxrec_mode)
+    {
+        matrix = lxrec_input (kmatrix, kempston_value);                     // recorded or replayed input
+    }
+#endif
+
+    mask = matrix[0] & matrix[1] & matrix[2] & matrix[3] & matrix[4] & matrix[5] & matrix[6] & matrix[7];
+
     if (mask == 0xFF)
     {
         rtc = 1;
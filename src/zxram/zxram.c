@@ -153,6 +153,61 @@ uint8_t *               steccy_rambankptr[8] =                          // ptr t
 
 uint8_t *               steccy_bankptr[4];                              // 4 banks active
 
+#if ZX_RAM_WRITE_GEN == 1
+static uint32_t         steccy_gen[10 * ZX_RAM_GEN_PAGES];              // write generations: 2 ROM + 8 RAM banks
+
+uint32_t *              steccy_rombankgen[2] =                          // write generations of 2 ROM banks
+{
+    steccy_gen + 0 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 1 * ZX_RAM_GEN_PAGES
+};
+
+uint32_t *              steccy_rambankgen[8] =                          // write generations of 8 RAM banks
+{
+    steccy_gen + 2 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 3 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 4 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 5 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 6 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 7 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 8 * ZX_RAM_GEN_PAGES,
+    steccy_gen + 9 * ZX_RAM_GEN_PAGES
+};
+
+uint32_t *              steccy_bankgen[4];                              // write generations of 4 active banks
+#endif
+
+#if ZX_RAM_COVERAGE == 1
+static uint8_t          steccy_cov[10 * STECCY_PAGE_SIZE];              // coverage: 2 ROM + 8 RAM banks
+
+uint_fast8_t            zx_ram_coverage;
+
+uint8_t *               steccy_rombankcov[2] =                          // coverage of 2 ROM banks
+{
+    steccy_cov + 0 * STECCY_PAGE_SIZE,
+    steccy_cov + 1 * STECCY_PAGE_SIZE
+};
+
+uint8_t *               steccy_rambankcov[8] =                          // coverage of 8 RAM banks
+{
+    steccy_cov + 2 * STECCY_PAGE_SIZE,
+    steccy_cov + 3 * STECCY_PAGE_SIZE,
+    steccy_cov + 4 * STECCY_PAGE_SIZE,
+    steccy_cov + 5 * STECCY_PAGE_SIZE,
+    steccy_cov + 6 * STECCY_PAGE_SIZE,
+    steccy_cov + 7 * STECCY_PAGE_SIZE,
+    steccy_cov + 8 * STECCY_PAGE_SIZE,
+    steccy_cov + 9 * STECCY_PAGE_SIZE
+};
+
+uint8_t *               steccy_bankcov[4];                              // coverage of 4 active banks
+#endif
+
+#if ZX_RAM_WRITE_GEN == 1
+ZX_RAM_WRITE *          zx_ram_write_log;                               // log of writes, NULL: no logging
+uint_fast32_t           zx_ram_write_log_len;                           // number of logged writes
+#endif
+
 uint_fast8_t            zx_ram_shadow_display = 0;
 uint_fast8_t            zx_ram_memory_paging_disabled;
 
@@ -168,6 +223,13 @@ zx_ram_get_8 (uint16_t addr)
 
     val = *(steccy_bankptr[addr >> 14] + (addr & 0x3FFF));
 
+#if ZX_RAM_COVERAGE == 1
+    if (zx_ram_coverage)
+    {
+        *zx_ram_cov_ptr(addr) |= ZX_RAM_COV_READ;
+    }
+#endif
+
     debug_printf (" ; %04X[%02X]", addr, val);
     return val;
 }
@@ -177,7 +239,7 @@ zx_ram_get_8 (uint16_t addr)
  * zx_ram_set_8 () - store 8 bit value into RAM
  *------------------------------------------------------------------------------------------------------------------------
  */
-#if defined QT_CORE_LIB || defined DEBUG
+#ifdef DEBUG
 void
 zx_ram_set_8 (uint16_t addr, uint8_t value)
 {
@@ -185,34 +247,17 @@ zx_ram_set_8 (uint16_t addr, uint8_t value)
 
     if (addr >= ZX_RAM_BEGIN)
     {
-#ifdef QT_CORE_LIB
-        if (addr < ZX_SPECTRUM_ATTRIBUTES_START_ADDR)
-        {
-            while (video_ram_blocked_at == addr)
-            {
-                // wait
-            }
-            video_ram_changed = 1;
-        }
-        else if (addr < ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR)
-        {
-            while (attr_ram_blocked)
-            {
-                // wait
-            }
-            video_ram_changed = 1;
-        }
-#else
         if (addr < ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR)
         {
             video_ram_changed = 1;
         }
-#endif
 
         uint8_t * ptr = steccy_bankptr[addr >> 14] + (addr & 0x3FFF);
+        zx_ram_bump_gen (addr);
+        zx_ram_cov_write (addr);
+        zx_ram_log_write (addr);
         *ptr = value;
     }
-#ifdef DEBUG
     else
     {
         static uint32_t called;
@@ -226,7 +271,6 @@ zx_ram_set_8 (uint16_t addr, uint8_t value)
             }
         }
     }
-#endif
 }
 #endif
 
@@ -242,6 +286,20 @@ zx_ram_init (uint_fast16_t romsize)
     steccy_bankptr[2]       = steccy_rambankptr[2];
     steccy_bankptr[3]       = steccy_rambankptr[0];
 
+#if ZX_RAM_WRITE_GEN == 1
+    steccy_bankgen[0]       = steccy_rombankgen[0];
+    steccy_bankgen[1]       = steccy_rambankgen[5];
+    steccy_bankgen[2]       = steccy_rambankgen[2];
+    steccy_bankgen[3]       = steccy_rambankgen[0];
+#endif
+
+#if ZX_RAM_COVERAGE == 1
+    steccy_bankcov[0]       = steccy_rombankcov[0];
+    steccy_bankcov[1]       = steccy_rambankcov[5];
+    steccy_bankcov[2]       = steccy_rambankcov[2];
+    steccy_bankcov[3]       = steccy_rambankcov[0];
+#endif
+
     zx_ram_shadow_display   = 0;
 
     if (romsize == 0x4000)
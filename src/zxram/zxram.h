@@ -48,6 +48,99 @@ extern uint8_t *                    steccy_bankptr[4];
 extern uint_fast8_t                 zx_ram_shadow_display;
 extern uint_fast8_t                 zx_ram_memory_paging_disabled;
 
+/*------------------------------------------------------------------------------------------------------------------------
+ * Write generations: each 256 byte page of a ROM/RAM bank has a counter which is incremented on every write into
+ * that page. The Z80 block cache compares it to detect modified (self-modifying) code.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#if defined FRAMEBUFFER || defined X11
+#define ZX_RAM_WRITE_GEN            1
+#else
+#define ZX_RAM_WRITE_GEN            0
+#endif
+
+#if ZX_RAM_WRITE_GEN == 1
+#define ZX_RAM_GEN_PAGE_SHIFT       8                                                       // one generation per 256 bytes
+#define ZX_RAM_GEN_PAGES            (STECCY_PAGE_SIZE >> ZX_RAM_GEN_PAGE_SHIFT)             // 64 generations per bank
+
+extern uint32_t *                   steccy_rombankgen[2];                                   // write generations of 2 ROM banks
+extern uint32_t *                   steccy_rambankgen[8];                                   // write generations of 8 RAM banks
+extern uint32_t *                   steccy_bankgen[4];                                      // write generations of 4 active banks
+
+#define zx_ram_gen_ptr(a)           (steccy_bankgen[(a) >> 14] + (((a) & 0x3FFF) >> ZX_RAM_GEN_PAGE_SHIFT))
+#define zx_ram_bump_gen(a)          do { (*zx_ram_gen_ptr(a))++; } while (0)
+#else
+#define zx_ram_bump_gen(a)
+#endif
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * Coverage: if zx_ram_coverage is set, each byte of a ROM/RAM bank has a flag byte which records whether an opcode was
+ * fetched from it, data was read from or written into it, and whether it was written after an opcode was fetched
+ * from it (self-modifying code). Operand bytes are fetched like opcodes, but are not marked.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define ZX_RAM_COVERAGE             ZX_RAM_WRITE_GEN
+
+#if ZX_RAM_COVERAGE == 1
+#define ZX_RAM_COV_EXEC             0x01                                                    // opcode fetched
+#define ZX_RAM_COV_READ             0x02                                                    // data read
+#define ZX_RAM_COV_WRITE            0x04                                                    // data written
+#define ZX_RAM_COV_SMC              0x08                                                    // written after executed, must be EXEC << 3
+
+extern uint_fast8_t                 zx_ram_coverage;                                        // flag: maintain coverage
+extern uint8_t *                    steccy_rombankcov[2];                                   // coverage of 2 ROM banks
+extern uint8_t *                    steccy_rambankcov[8];                                   // coverage of 8 RAM banks
+extern uint8_t *                    steccy_bankcov[4];                                      // coverage of 4 active banks
+
+#define zx_ram_cov_ptr(a)           (steccy_bankcov[(a) >> 14] + ((a) & 0x3FFF))
+#define zx_ram_cov_exec(a)          do { if (zx_ram_coverage) { *zx_ram_cov_ptr(a) |= ZX_RAM_COV_EXEC; } } while (0)
+#define zx_ram_cov_write(a)         do { if (zx_ram_coverage) { uint8_t * c_ = zx_ram_cov_ptr(a); *c_ |= ZX_RAM_COV_WRITE | ((*c_ & ZX_RAM_COV_EXEC) << 3); } } while (0)
+
+static inline uint8_t
+zx_ram_get_8_cov (uint16_t addr)
+{
+    *zx_ram_cov_ptr(addr) |= ZX_RAM_COV_READ;
+    return *(steccy_bankptr[addr >> 14] + (addr & 0x3FFF));
+}
+#else
+#define zx_ram_cov_exec(a)
+#define zx_ram_cov_write(a)
+#endif
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * Write log: if zx_ram_write_log is set, every write into RAM appends the address and the old value, so that the writes
+ * can be compared and undone. Used by the lockstep verification of the block cache, see z80.c.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#if ZX_RAM_WRITE_GEN == 1
+#define ZX_RAM_WRITE_LOG_SIZE       (0x10000 + 64)                                          // LDIR/LDDR at end of block: 64K, others: 2 bytes
+
+typedef struct
+{
+    uint8_t *                       ptr;                                                    // written byte in bank
+    uint16_t                        addr;                                                   // Z80 address
+    uint8_t                         old_value;                                              // value before write
+} ZX_RAM_WRITE;
+
+extern ZX_RAM_WRITE *               zx_ram_write_log;                                       // log, NULL: no logging
+extern uint_fast32_t                zx_ram_write_log_len;                                   // number of logged writes
+
+#define zx_ram_log_write(a)                                               \
+do                                                                        \
+{                                                                         \
+    if (zx_ram_write_log && zx_ram_write_log_len < ZX_RAM_WRITE_LOG_SIZE) \
+    {                                                                     \
+        ZX_RAM_WRITE * w_ = zx_ram_write_log + zx_ram_write_log_len++;    \
+                                                                          \
+        w_->ptr         = steccy_bankptr[(a) >> 14] + ((a) & 0x3FFF);     \
+        w_->addr        = (a);                                            \
+        w_->old_value   = *w_->ptr;                                       \
+    }                                                                     \
+} while (0)
+#else
+#define zx_ram_log_write(a)
+#endif
+
 /*------------------------------------------------------------------------------------------------------------------------
  * zx_ram_get_text () - get 8 bit program text from RAM
  *------------------------------------------------------------------------------------------------------------------------
@@ -60,6 +153,8 @@ extern uint_fast8_t                 zx_ram_memory_paging_disabled;
  */
 #ifdef DEBUG
 uint8_t                             zx_ram_get_8 (uint16_t addr);
+#elif ZX_RAM_COVERAGE == 1
+#define zx_ram_get_8(a)             (zx_ram_coverage ? zx_ram_get_8_cov (a) : (*(steccy_bankptr[(a) >> 14] + ((a) & 0x3FFF))))
 #else
 #define zx_ram_get_8(a)             (*(steccy_bankptr[(a) >> 14] + ((a) & 0x3FFF)))
 #endif
@@ -80,7 +175,7 @@ uint8_t                             zx_ram_get_8 (uint16_t addr);
  * zx_ram_set_8 () - store 8 bit value into RAM
  *------------------------------------------------------------------------------------------------------------------------
  */
-#if defined QT_CORE_LIB || defined DEBUG
+#ifdef DEBUG
 extern void                         zx_ram_set_8 (uint16_t addr, uint8_t value);
 #else
 #define zx_ram_set_8(a,v)                                               \
@@ -93,6 +188,9 @@ do                                                                      \
             video_ram_changed = 1;                                      \
         }                                                               \
                                                                         \
+        zx_ram_bump_gen(a);                                             \
+        zx_ram_cov_write(a);                                            \
+        zx_ram_log_write(a);                                            \
         (*(steccy_bankptr[(a) >> 14] + ((a) & 0x3FFF))) = (v);          \
     }                                                                   \
 } while (0)
@@ -42,8 +42,6 @@ static MyWidget *                   myw;
 #endif
 
 #ifdef QT_CORE_LIB
-volatile uint16_t           video_ram_blocked_at    = 0x0000;               // address of video ram currently blocked
-volatile uint8_t            attr_ram_blocked        = 0;                    // flag: attribute ram currently blocked
 volatile uint8_t            video_ram_changed       = 1;                    // flag: video ram changed
 #else
 uint8_t                     video_ram_changed       = 1;                    // flag: video ram changed
@@ -55,6 +53,33 @@ uint8_t                     video_ram_changed       = 1;                    // f
  */
 uint8_t                     zx_border_color;                                // current border color
 
+#if defined FRAMEBUFFER || defined X11
+/*------------------------------------------------------------------------------------------------------------------------
+ * ZX Spectrum colors as 0x00RRGGBB, used by Linux display and capture
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+const uint32_t              zxscr_rgbvalues[16] =
+{
+    0x00000000,                                                             // black
+    0x000000F0,                                                             // blue
+    0x00F00000,                                                             // red
+    0x00F000F0,                                                             // magenta
+    0x0000F000,                                                             // green
+    0x0000F0F0,                                                             // cyan
+    0x00F0F000,                                                             // yellow
+    0x00F0F0F0,                                                             // white
+
+    0x00000000,                                                             // black
+    0x000000FF,                                                             // blue
+    0x00FF0000,                                                             // red
+    0x00FF00FF,                                                             // magenta
+    0x0000FF00,                                                             // green
+    0x0000FFFF,                                                             // cyan
+    0x00FFFF00,                                                             // yellow
+    0x00FFFFFF,                                                             // white
+};
+#endif
+
 /*------------------------------------------------------------------------------------------------------------------------
  * ZX Spectrum colors
  *------------------------------------------------------------------------------------------------------------------------
@@ -170,8 +195,6 @@ zxscr_update_display (void)
         return;
     }
 
-    attr_ram_blocked = 1;
-
     addr = ZX_SPECTRUM_DISPLAY_START_ADDRESS;
 
     for (r = 0; r < ZX_SPECTRUM_DISPLAY_ROWS; r++)
@@ -186,8 +209,6 @@ zxscr_update_display (void)
             uint16_t    mask = 0x80;
             uint16_t    idx;
 
-            video_ram_blocked_at = addr;
-
             value   = zx_ram_get_screen_8(addr);
             attr    = zx_ram_get_screen_8(attr_addr);
 
@@ -253,9 +274,7 @@ zxscr_update_display (void)
         }
     }
 
-    video_ram_blocked_at = 0x000;
     memcpy (shadow_attr,  zx_ram_screen_addr(ZX_SPECTRUM_ATTRIBUTES_START_ADDR), 768);
-    attr_ram_blocked = 0;
     called = 1;
 }
 
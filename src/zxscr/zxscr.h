@@ -63,8 +63,6 @@
 #define INK_MASK                (0x07)
 
 #ifdef QT_CORE_LIB
-extern volatile uint16_t        video_ram_blocked_at;                       // address of video ram currently blocked
-extern volatile uint8_t         attr_ram_blocked;                           // flag: attribute ram currently blocked
 extern volatile uint8_t         video_ram_changed;                          // flag: video ram changed
 #else
 extern uint8_t                  video_ram_changed;                          // flag: video ram changed
@@ -90,6 +88,10 @@ extern uint_fast8_t             zxscr_display_cached;
 
 extern uint8_t                  zx_border_color;                            // current border color - 3 bits used
 
+#if defined FRAMEBUFFER || defined X11
+extern const uint32_t           zxscr_rgbvalues[16];                        // colors as 0x00RRGGBB
+#endif
+
 #ifdef QT_CORE_LIB
 extern void                     zxscr_init_display (void);
 #endif
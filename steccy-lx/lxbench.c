@@ -0,0 +1,590 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxbench.c - per-instruction-class microbenchmarks
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "z80.h"
+#include "zxscr.h"
+#include "zxram.h"
+#include "lxbench.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * For every group of opcodes a loop is written into RAM: LXBENCH_REPEAT copies of a short body, followed by JP to the
+ * start. All registers used as pointers are reloaded or restored within the body, so every pass takes the same number
+ * of T-states. The loop runs through the normal z80() dispatch - interpreter, block cache or JIT, as selected - while
+ * interrupts are disabled:
+ *
+ *   1. a trap at the start of the loop measures the T-states of one pass and is removed again
+ *   2. LXBENCH_WARMUP_FRAMES frames fill the block cache
+ *   3. LXBENCH_SAMPLES samples of LXBENCH_SAMPLE_FRAMES frames each are timed with CLOCK_MONOTONIC
+ *
+ * The executed instructions of a sample are the emulated T-states divided by the T-states of a pass, times the
+ * instructions of a pass. Each repetition of LDIR, CPIR and DJNZ counts as one instruction. The time per frame includes
+ * the per-frame work of the emulator (keyboard, sound, display callback), so the results are comparable between builds
+ * and cores rather than absolute costs of single opcodes.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define LXBENCH_CODE_ADDR           0x8000                                  // loop
+#define LXBENCH_SUB_ADDR            0x8F00                                  // RET for CALL
+#define LXBENCH_DATA_ADDR           0x9000                                  // HL, IX = +0x100, IY = +0x200
+#define LXBENCH_DATA_SIZE           0x0300
+#define LXBENCH_STACK_ADDR          0xFE00
+#define LXBENCH_REPEAT              8                                       // copies of the body per pass
+#define LXBENCH_WARMUP_FRAMES       10
+#define LXBENCH_SAMPLES             10
+#define LXBENCH_SAMPLE_FRAMES       50
+#define LXBENCH_MAX_CAL_FRAMES      50                                      // loop must be reached within 1 second
+
+#define LO(a)                       ((a) & 0xFF)
+#define HI(a)                       (((a) >> 8) & 0xFF)
+
+#define BENCH_STATE_IDLE            0
+#define BENCH_STATE_LOAD            1
+#define BENCH_STATE_CALIBRATE       2
+#define BENCH_STATE_WARMUP          3
+#define BENCH_STATE_SAMPLE          4
+
+typedef struct
+{
+    const char *                    name;
+    void                            (*body)(void);                          // emit one copy of the body
+} BENCH_GROUP;
+
+typedef struct
+{
+    const char *                    core;
+    uint64_t                        instructions;                           // executed in all samples
+    double                          mean_ns;                                // nsec per instruction
+    double                          stddev_ns;
+    double                          min_ns;
+    double                          max_ns;
+} BENCH_RESULT;
+
+static void                         bench_alu8 (void);
+static void                         bench_alu16 (void);
+static void                         bench_cb (void);
+static void                         bench_index (void);
+static void                         bench_block (void);
+static void                         bench_jump (void);
+static void                         bench_io (void);
+
+static const BENCH_GROUP            groups[] =
+{
+    { "alu8",   bench_alu8  },
+    { "alu16",  bench_alu16 },
+    { "cb",     bench_cb    },
+    { "index",  bench_index },
+    { "block",  bench_block },
+    { "jump",   bench_jump  },
+    { "io",     bench_io    },
+};
+
+#define N_GROUPS                    (sizeof (groups) / sizeof (groups[0]))
+
+static FILE *                       bench_fp;
+static uint_fast8_t                 bench_json;                             // flag: JSON, else CSV
+static uint_fast8_t                 bench_state;
+static uint_fast8_t                 bench_failed;
+static uint_fast8_t                 group_idx;
+static uint32_t                     frames;                                 // frames in current state
+
+static uint16_t                     emit_addr;
+static uint32_t                     emit_insns;                             // instructions of emitted code
+
+static uint32_t                     pass_insns;                             // instructions of one pass
+static uint32_t                     pass_cycles;                            // T-states of one pass
+static uint_fast8_t                 n_hits;
+static uint32_t                     hit_cycles[2];
+
+static struct timespec              sample_start;
+static uint32_t                     sample_cycles;
+static uint_fast8_t                 n_samples;
+static double                       sample_ns[LXBENCH_SAMPLES];
+static uint64_t                     sample_insns;
+
+static BENCH_RESULT                 results[N_GROUPS];
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_emit - write instruction bytes at emit_addr, n_exec: how often the instruction is executed
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_emit (uint_fast8_t n_exec, uint_fast8_t len, ...)
+{
+    va_list         ap;
+    uint_fast8_t    i;
+
+    va_start (ap, len);
+
+    for (i = 0; i < len; i++)
+    {
+        zx_ram_set_8(emit_addr, (uint8_t) va_arg (ap, int));
+        emit_addr++;
+    }
+
+    va_end (ap);
+    emit_insns += n_exec;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * group bodies
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_alu8 (void)
+{
+    bench_emit (1, 1, 0x80);                                                // ADD A,B
+    bench_emit (1, 1, 0x89);                                                // ADC A,C
+    bench_emit (1, 1, 0x92);                                                // SUB D
+    bench_emit (1, 1, 0x9B);                                                // SBC A,E
+    bench_emit (1, 1, 0xA4);                                                // AND H
+    bench_emit (1, 1, 0xAD);                                                // XOR L
+    bench_emit (1, 1, 0xB0);                                                // OR B
+    bench_emit (1, 1, 0xB9);                                                // CP C
+    bench_emit (1, 1, 0x3C);                                                // INC A
+    bench_emit (1, 1, 0x05);                                                // DEC B
+    bench_emit (1, 2, 0xC6, 0x11);                                          // ADD A,11h
+    bench_emit (1, 2, 0xFE, 0x22);                                          // CP 22h
+    bench_emit (1, 1, 0x86);                                                // ADD A,(HL)
+}
+
+static void
+bench_alu16 (void)
+{
+    bench_emit (1, 1, 0x09);                                                // ADD HL,BC
+    bench_emit (1, 1, 0x19);                                                // ADD HL,DE
+    bench_emit (1, 1, 0x03);                                                // INC BC
+    bench_emit (1, 1, 0x1B);                                                // DEC DE
+    bench_emit (1, 1, 0x23);                                                // INC HL
+    bench_emit (1, 1, 0x2B);                                                // DEC HL
+    bench_emit (1, 2, 0xED, 0x4A);                                          // ADC HL,BC
+    bench_emit (1, 2, 0xED, 0x52);                                          // SBC HL,DE
+    bench_emit (1, 1, 0x33);                                                // INC SP
+    bench_emit (1, 1, 0x3B);                                                // DEC SP
+}
+
+static void
+bench_cb (void)
+{
+    bench_emit (1, 2, 0xCB, 0x00);                                          // RLC B
+    bench_emit (1, 2, 0xCB, 0x39);                                          // SRL C
+    bench_emit (1, 2, 0xCB, 0x5A);                                          // BIT 3,D
+    bench_emit (1, 2, 0xCB, 0xEB);                                          // SET 5,E
+    bench_emit (1, 2, 0xCB, 0xAB);                                          // RES 5,E
+    bench_emit (1, 2, 0xCB, 0x17);                                          // RL A
+    bench_emit (1, 2, 0xCB, 0x27);                                          // SLA A
+    bench_emit (1, 2, 0xCB, 0x7E);                                          // BIT 7,(HL)
+    bench_emit (1, 2, 0xCB, 0xC6);                                          // SET 0,(HL)
+    bench_emit (1, 2, 0xCB, 0x86);                                          // RES 0,(HL)
+}
+
+static void
+bench_index (void)
+{
+    bench_emit (1, 3, 0xDD, 0x7E, 0x01);                                    // LD A,(IX+1)
+    bench_emit (1, 3, 0xDD, 0x86, 0x02);                                    // ADD A,(IX+2)
+    bench_emit (1, 3, 0xFD, 0x77, 0x03);                                    // LD (IY+3),A
+    bench_emit (1, 3, 0xDD, 0x34, 0x04);                                    // INC (IX+4)
+    bench_emit (1, 3, 0xFD, 0x46, 0x05);                                    // LD B,(IY+5)
+    bench_emit (1, 2, 0xDD, 0x23);                                          // INC IX
+    bench_emit (1, 2, 0xDD, 0x2B);                                          // DEC IX
+    bench_emit (1, 2, 0xFD, 0xE5);                                          // PUSH IY
+    bench_emit (1, 2, 0xFD, 0xE1);                                          // POP IY
+    bench_emit (1, 4, 0xDD, 0xCB, 0x06, 0x4E);                              // BIT 1,(IX+6)
+    bench_emit (1, 4, 0xFD, 0xCB, 0x07, 0xD6);                              // SET 2,(IY+7)
+    bench_emit (1, 4, 0xFD, 0xCB, 0x07, 0x96);                              // RES 2,(IY+7)
+}
+
+static void
+bench_block (void)
+{
+    bench_emit (1, 3, 0x21, LO(LXBENCH_DATA_ADDR), HI(LXBENCH_DATA_ADDR));  // LD HL,data
+    bench_emit (1, 3, 0x11, LO(LXBENCH_DATA_ADDR + 0x80), HI(LXBENCH_DATA_ADDR + 0x80)); // LD DE,data+80h
+    bench_emit (1, 3, 0x01, 0x08, 0x00);                                    // LD BC,8
+    bench_emit (8, 2, 0xED, 0xB0);                                          // LDIR
+    bench_emit (1, 3, 0x21, LO(LXBENCH_DATA_ADDR), HI(LXBENCH_DATA_ADDR));  // LD HL,data
+    bench_emit (1, 3, 0x01, 0x08, 0x00);                                    // LD BC,8
+    bench_emit (1, 2, 0x3E, 0xFF);                                          // LD A,FFh: data is 00, no match
+    bench_emit (8, 2, 0xED, 0xB1);                                          // CPIR
+    bench_emit (1, 2, 0xED, 0xA0);                                          // LDI
+    bench_emit (1, 2, 0xED, 0xA8);                                          // LDD
+    bench_emit (1, 2, 0xED, 0xA1);                                          // CPI
+}
+
+static void
+bench_jump (void)
+{
+    bench_emit (1, 3, 0xC3, LO(emit_addr + 3), HI(emit_addr + 3));         // JP next
+    bench_emit (1, 2, 0x18, 0x00);                                          // JR next
+    bench_emit (2, 3, 0xCD, LO(LXBENCH_SUB_ADDR), HI(LXBENCH_SUB_ADDR));    // CALL sub, RET
+    bench_emit (1, 3, 0x21, LO(emit_addr + 4), HI(emit_addr + 4));         // LD HL,next of JP (HL)
+    bench_emit (1, 1, 0xE9);                                                // JP (HL)
+    bench_emit (1, 2, 0x06, 0x04);                                          // LD B,4
+    bench_emit (4, 2, 0x10, 0xFE);                                          // DJNZ $
+    bench_emit (1, 1, 0xAF);                                                // XOR A
+    bench_emit (1, 2, 0x20, 0x00);                                          // JR NZ,next: not taken
+    bench_emit (1, 2, 0x28, 0x00);                                          // JR Z,next: taken
+}
+
+static void
+bench_io (void)
+{
+    bench_emit (1, 2, 0x3E, 0x7F);                                          // LD A,7Fh
+    bench_emit (1, 2, 0xDB, 0xFE);                                          // IN A,(FEh)
+    bench_emit (1, 2, 0xE6, 0x07);                                          // AND 7
+    bench_emit (1, 2, 0xD3, 0xFE);                                          // OUT (FEh),A
+    bench_emit (1, 2, 0xED, 0x78);                                          // IN A,(C), BC = FEFEh
+    bench_emit (1, 2, 0xE6, 0x07);                                          // AND 7
+    bench_emit (1, 2, 0xED, 0x79);                                          // OUT (C),A
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_core - get name of active core
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static const char *
+bench_core (void)
+{
+    if (z80_settings.jit)
+    {
+        return "jit";
+    }
+
+    return z80_settings.block_cache ? "block" : "interp";
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_trap - trap at start of loop: remember T-states of two passes
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_trap (void)
+{
+    if (n_hits < 2)
+    {
+        hit_cycles[n_hits++] = z80_get_clockcycles ();
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_load - write loop of group into RAM and jump to it
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_load (void)
+{
+    Z80_REGISTERS   regs;
+    uint16_t        addr;
+    uint_fast8_t    r;
+
+    for (addr = LXBENCH_DATA_ADDR; addr < LXBENCH_DATA_ADDR + LXBENCH_DATA_SIZE; addr++)
+    {
+        zx_ram_set_8(addr, 0x00);
+    }
+
+    emit_addr = LXBENCH_SUB_ADDR;
+    bench_emit (0, 1, 0xC9);                                                // RET
+
+    emit_addr   = LXBENCH_CODE_ADDR;
+    emit_insns  = 0;
+
+    for (r = 0; r < LXBENCH_REPEAT; r++)
+    {
+        (*groups[group_idx].body) ();
+    }
+
+    bench_emit (1, 3, 0xC3, LO(LXBENCH_CODE_ADDR), HI(LXBENCH_CODE_ADDR));  // JP start
+    pass_insns = emit_insns;
+
+    memset (&regs, 0, sizeof (regs));
+    regs.bc     = 0xFEFE;                                                   // port of IN A,(C) and OUT (C),A
+    regs.hl     = LXBENCH_DATA_ADDR;
+    regs.ix     = LXBENCH_DATA_ADDR + 0x100;
+    regs.iy     = LXBENCH_DATA_ADDR + 0x200;
+    regs.sp     = LXBENCH_STACK_ADDR;
+    regs.pc     = LXBENCH_CODE_ADDR;
+    regs.im     = 1;                                                        // interrupts stay disabled: iff1 = 0
+    z80_set_registers (&regs);
+
+    n_hits = 0;
+    z80_trap_add (LXBENCH_CODE_ADDR, 0, bench_trap);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_sample_begin - start timing of a sample
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_sample_begin (void)
+{
+    clock_gettime (CLOCK_MONOTONIC, &sample_start);
+    sample_cycles = z80_get_clockcycles ();
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_sample_end - stop timing of a sample, store nsec per instruction
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_sample_end (void)
+{
+    struct timespec now;
+    double          ns;
+    double          insns;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    ns      = (double) (now.tv_sec - sample_start.tv_sec) * 1e9 + (double) (now.tv_nsec - sample_start.tv_nsec);
+    insns   = (double) (uint32_t) (z80_get_clockcycles () - sample_cycles) / pass_cycles * pass_insns;
+
+    sample_ns[n_samples++]  = ns / insns;
+    sample_insns           += (uint64_t) (insns + 0.5);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_result - calculate statistics of the samples of the current group
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_result (void)
+{
+    BENCH_RESULT *  res = results + group_idx;
+    double          sum = 0;
+    double          sq  = 0;
+    uint_fast8_t    i;
+
+    res->core           = bench_core ();
+    res->instructions   = sample_insns;
+    res->min_ns         = sample_ns[0];
+    res->max_ns         = sample_ns[0];
+
+    for (i = 0; i < n_samples; i++)
+    {
+        sum += sample_ns[i];
+
+        if (res->min_ns > sample_ns[i])
+        {
+            res->min_ns = sample_ns[i];
+        }
+
+        if (res->max_ns < sample_ns[i])
+        {
+            res->max_ns = sample_ns[i];
+        }
+    }
+
+    res->mean_ns = sum / n_samples;
+
+    for (i = 0; i < n_samples; i++)
+    {
+        sq += (sample_ns[i] - res->mean_ns) * (sample_ns[i] - res->mean_ns);
+    }
+
+    res->stddev_ns = n_samples > 1 ? sqrt (sq / (n_samples - 1)) : 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * bench_write - write results as CSV or JSON
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+bench_write (uint_fast8_t n_results)
+{
+    uint_fast8_t    i;
+
+    if (bench_json)
+    {
+        fprintf (bench_fp, "[\n");
+    }
+    else
+    {
+        fprintf (bench_fp, "group,core,samples,instructions,mean_ns,stddev_ns,min_ns,max_ns\n");
+    }
+
+    for (i = 0; i < n_results; i++)
+    {
+        BENCH_RESULT * res = results + i;
+
+        if (bench_json)
+        {
+            fprintf (bench_fp, "  {\"group\": \"%s\", \"core\": \"%s\", \"samples\": %u, \"instructions\": %llu, "
+                     "\"mean_ns\": %.3f, \"stddev_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f}%s\n",
+                     groups[i].name, res->core, LXBENCH_SAMPLES, (unsigned long long) res->instructions,
+                     res->mean_ns, res->stddev_ns, res->min_ns, res->max_ns, i + 1 < n_results ? "," : "");
+        }
+        else
+        {
+            fprintf (bench_fp, "%s,%s,%u,%llu,%.3f,%.3f,%.3f,%.3f\n",
+                     groups[i].name, res->core, LXBENCH_SAMPLES, (unsigned long long) res->instructions,
+                     res->mean_ns, res->stddev_ns, res->min_ns, res->max_ns);
+        }
+    }
+
+    if (bench_json)
+    {
+        fprintf (bench_fp, "]\n");
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxbench_frame - called every frame instead of the display update
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxbench_frame (void)
+{
+    frames++;
+
+    switch (bench_state)
+    {
+        case BENCH_STATE_LOAD:
+        {
+            bench_load ();
+            frames      = 0;
+            bench_state = BENCH_STATE_CALIBRATE;
+            break;
+        }
+        case BENCH_STATE_CALIBRATE:
+        {
+            if (n_hits == 2)
+            {
+                z80_trap_remove (LXBENCH_CODE_ADDR, bench_trap);            // flushes block cache, see z80_trap_update()
+                pass_cycles = hit_cycles[1] - hit_cycles[0];
+                frames      = 0;
+                bench_state = BENCH_STATE_WARMUP;
+            }
+            else if (frames >= LXBENCH_MAX_CAL_FRAMES)
+            {
+                fprintf (stderr, "bench: loop of group %s not reached\n", groups[group_idx].name);
+                z80_trap_remove (LXBENCH_CODE_ADDR, bench_trap);
+                bench_failed    = 1;
+                bench_state     = BENCH_STATE_IDLE;
+                steccy_exit     = 1;
+            }
+            break;
+        }
+        case BENCH_STATE_WARMUP:
+        {
+            if (frames >= LXBENCH_WARMUP_FRAMES)
+            {
+                n_samples       = 0;
+                sample_insns    = 0;
+                frames          = 0;
+                bench_state     = BENCH_STATE_SAMPLE;
+                bench_sample_begin ();
+            }
+            break;
+        }
+        case BENCH_STATE_SAMPLE:
+        {
+            if (frames >= LXBENCH_SAMPLE_FRAMES)
+            {
+                bench_sample_end ();
+                frames = 0;
+
+                if (n_samples < LXBENCH_SAMPLES)
+                {
+                    bench_sample_begin ();
+                }
+                else
+                {
+                    bench_result ();
+                    group_idx++;
+
+                    if (group_idx < N_GROUPS)
+                    {
+                        bench_state = BENCH_STATE_LOAD;
+                    }
+                    else
+                    {
+                        bench_state = BENCH_STATE_IDLE;
+                        steccy_exit = 1;
+                    }
+                }
+            }
+            break;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxbench_start - open result file and start with first group at next frame, "-": CSV on stdout
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxbench_start (const char * fname)
+{
+    size_t  len = strlen (fname);
+
+    if (! strcmp (fname, "-"))
+    {
+        bench_fp = stdout;
+    }
+    else
+    {
+        bench_fp = fopen (fname, "w");
+
+        if (! bench_fp)
+        {
+            perror (fname);
+            return -1;
+        }
+
+        bench_json = (len > 5 && ! strcmp (fname + len - 5, ".json"));
+    }
+
+    group_idx       = 0;
+    bench_failed    = 0;
+    bench_state     = BENCH_STATE_LOAD;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxbench_stop - write results of finished groups, returns -1 if not all groups were measured
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxbench_stop (void)
+{
+    if (! bench_fp)
+    {
+        return 0;
+    }
+
+    bench_write (group_idx);
+
+    if (bench_fp != stdout)
+    {
+        fclose (bench_fp);
+    }
+
+    bench_fp    = (FILE *) 0;
+    bench_state = BENCH_STATE_IDLE;
+    return (bench_failed || group_idx < N_GROUPS) ? -1 : 0;
+}
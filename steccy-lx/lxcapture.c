@@ -0,0 +1,503 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxcapture.c - capture of frames and audio into Y4M and WAV files
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "z80.h"
+#include "zxscr.h"
+#include "zxram.h"
+#include "lxdisplay.h"
+#include "lxcapture.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * The emulation thread copies screen memory, border color and the speaker changes of every 50 Hz frame into a slot of a
+ * bounded single producer/single consumer ring. A writer thread converts the slots into YUV 4:4:4 (Y4M) and 16 bit PCM
+ * (WAV). If the ring is full, the frame is dropped and counted. The writer repeats the last frame for dropped frames,
+ * so that video and audio stay in sync.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define CAPTURE_SLOTS               128                                     // must be a power of 2
+#define CAPTURE_MAX_EVENTS          4096                                    // max speaker changes per frame
+#define CAPTURE_FPS                 50
+#define CAPTURE_SAMPLE_RATE         44100
+#define CAPTURE_SAMPLES_PER_FRAME   (CAPTURE_SAMPLE_RATE / CAPTURE_FPS)     // 882
+#define CAPTURE_AMPLITUDE           8192                                    // speaker high: +8192, low: -8192
+#define CAPTURE_SCREEN_SIZE         6912                                    // pixels + attributes
+#define CAPTURE_WAV_HEADER_SIZE     44
+
+typedef struct
+{
+    uint32_t                seq;                                            // frame number
+    uint32_t                start_cycles;                                   // clock cycles at start of frame
+    uint32_t                end_cycles;                                     // clock cycles at end of frame
+    uint8_t                 start_level;                                    // speaker level at start of frame
+    uint8_t                 border_color;
+    uint8_t                 inverse;                                        // flag: flash attributes inverted
+    uint16_t                n_events;
+    uint32_t                events[CAPTURE_MAX_EVENTS];                     // clock cycles << 1 | level
+    uint8_t                 screen[CAPTURE_SCREEN_SIZE];
+} CAPTURE_SLOT;
+
+volatile uint_fast8_t       lxcapture_active;
+
+static CAPTURE_SLOT *       slots;
+static atomic_uint          slots_head;                                     // written by emulation thread only
+static atomic_uint          slots_tail;                                     // written by writer thread only
+static sem_t                slots_sem;                                      // counts filled slots
+static atomic_int           writer_stop;
+static pthread_t            writer_tid;
+
+static FILE *               y4m_fp;
+static FILE *               wav_fp;
+static uint32_t             wav_data_size;
+static uint32_t             frames_written;
+static uint32_t             frames_dropped;
+
+// state of emulation thread:
+static uint32_t             cur_seq;
+static uint32_t             cur_start_cycles;
+static uint8_t              cur_start_level;
+static uint8_t              cur_level;
+static uint16_t             cur_n_events;
+static uint32_t             cur_events[CAPTURE_MAX_EVENTS];
+
+// state of writer thread:
+static uint8_t              yuv_palette[16][3];
+static uint8_t              frame_index[ZX_NATIVE_HEIGHT][ZX_NATIVE_WIDTH]; // palette index per pixel
+static uint8_t              frame_planes[3][ZX_NATIVE_HEIGHT * ZX_NATIVE_WIDTH];
+static int16_t              samples[CAPTURE_SAMPLES_PER_FRAME];
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * put_le16/put_le32 - store little endian values for WAV header
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+put_le16 (uint8_t * p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void
+put_le32 (uint8_t * p, uint32_t value)
+{
+    put_le16 (p, value & 0xFFFF);
+    put_le16 (p + 2, value >> 16);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * write_wav_header - write WAV header with current data size
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+write_wav_header (void)
+{
+    uint8_t     hdr[CAPTURE_WAV_HEADER_SIZE];
+
+    memcpy (hdr, "RIFF", 4);
+    put_le32 (hdr + 4, 36 + wav_data_size);
+    memcpy (hdr + 8, "WAVEfmt ", 8);
+    put_le32 (hdr + 16, 16);                                                // size of fmt chunk
+    put_le16 (hdr + 20, 1);                                                 // PCM
+    put_le16 (hdr + 22, 1);                                                 // mono
+    put_le32 (hdr + 24, CAPTURE_SAMPLE_RATE);
+    put_le32 (hdr + 28, CAPTURE_SAMPLE_RATE * 2);                           // bytes per second
+    put_le16 (hdr + 32, 2);                                                 // bytes per sample
+    put_le16 (hdr + 34, 16);                                                // bits per sample
+    memcpy (hdr + 36, "data", 4);
+    put_le32 (hdr + 40, wav_data_size);
+
+    fwrite (hdr, 1, CAPTURE_WAV_HEADER_SIZE, wav_fp);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcapture_render - render 6912 bytes of screen memory plus border into palette indexes of a native frame
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxcapture_render (const uint8_t * screen, uint_fast8_t border_color, uint_fast8_t inverse, uint8_t index[ZX_NATIVE_HEIGHT][ZX_NATIVE_WIDTH])
+{
+    unsigned int    y;
+    unsigned int    x;
+    unsigned int    i;
+
+    memset (index, border_color, ZX_NATIVE_HEIGHT * ZX_NATIVE_WIDTH);
+
+    for (y = 0; y < ZX_SPECTRUM_DISPLAY_ROWS; y++)
+    {
+        const uint8_t * pixels  = screen + (((y & 0xC0) << 5) | ((y & 0x07) << 8) | ((y & 0x38) << 2));
+        const uint8_t * attrs   = screen + 6144 + ((y >> 3) << 5);
+        uint8_t *       dst     = &index[ZX_NATIVE_BORDER + y][ZX_NATIVE_BORDER];
+
+        for (x = 0; x < 32; x++)
+        {
+            uint8_t     attr    = attrs[x];
+            uint8_t     ink     = (attr & INK_MASK);
+            uint8_t     paper   = (attr & PAPER_MASK) >> 3;
+            uint8_t     value   = pixels[x];
+
+            if ((attr & FLASH_MASK) && inverse)
+            {
+                uint8_t tmp = ink;
+                ink     = paper;
+                paper   = tmp;
+            }
+
+            if (attr & BOLD_MASK)
+            {
+                ink     += 8;
+                paper   += 8;
+            }
+
+            for (i = 0; i < 8; i++)
+            {
+                dst[8 * x + i] = ((value << i) & 0x80) ? ink : paper;
+            }
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * convert_frame - convert screen memory of a slot into YUV planes
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+convert_frame (const CAPTURE_SLOT * slot)
+{
+    unsigned int    i;
+
+    lxcapture_render (slot->screen, slot->border_color, slot->inverse, frame_index);
+
+    for (i = 0; i < ZX_NATIVE_HEIGHT * ZX_NATIVE_WIDTH; i++)
+    {
+        uint8_t idx = (&frame_index[0][0])[i];
+
+        frame_planes[0][i] = yuv_palette[idx][0];
+        frame_planes[1][i] = yuv_palette[idx][1];
+        frame_planes[2][i] = yuv_palette[idx][2];
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * convert_audio - convert speaker changes of a slot into PCM samples
+ *
+ * Every sample is the average speaker level over its time span, which is a simple box filter against aliasing.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+convert_audio (const CAPTURE_SLOT * slot)
+{
+    uint32_t    duration = slot->end_cycles - slot->start_cycles;
+    uint32_t    ev = 0;
+    uint32_t    s;
+    uint8_t     level = slot->start_level;
+
+    for (s = 0; s < CAPTURE_SAMPLES_PER_FRAME; s++)
+    {
+        uint32_t    t0      = (uint32_t) ((uint64_t) duration * s / CAPTURE_SAMPLES_PER_FRAME);
+        uint32_t    t1      = (uint32_t) ((uint64_t) duration * (s + 1) / CAPTURE_SAMPLES_PER_FRAME);
+        uint32_t    t       = t0;
+        uint32_t    high    = 0;
+
+        while (ev < slot->n_events)
+        {
+            uint32_t    et = ((slot->events[ev] >> 1) - slot->start_cycles) & 0x7FFFFFFF;
+
+            if (et > duration)                                              // before start of frame, e.g. after reset
+            {
+                et = 0;
+            }
+
+            if (et >= t1)
+            {
+                break;
+            }
+
+            if (et > t)
+            {
+                if (level)
+                {
+                    high += et - t;
+                }
+                t = et;
+            }
+
+            level = slot->events[ev] & 0x01;
+            ev++;
+        }
+
+        if (level)
+        {
+            high += t1 - t;
+        }
+
+        samples[s] = (t1 > t0) ? (int16_t) ((int32_t) (2 * high) * CAPTURE_AMPLITUDE / (int32_t) (t1 - t0) - CAPTURE_AMPLITUDE) :
+                                 (int16_t) (level ? CAPTURE_AMPLITUDE : -CAPTURE_AMPLITUDE);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * write_frame - write converted frame and samples
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+write_frame (void)
+{
+    fputs ("FRAME\n", y4m_fp);
+    fwrite (frame_planes, 1, sizeof (frame_planes), y4m_fp);
+    fwrite (samples, sizeof (int16_t), CAPTURE_SAMPLES_PER_FRAME, wav_fp);  // host is little endian
+    wav_data_size += CAPTURE_SAMPLES_PER_FRAME * sizeof (int16_t);
+    frames_written++;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * capture_writer - writer thread: convert and write filled slots
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void *
+capture_writer (void * arg)
+{
+    const CAPTURE_SLOT *    slot;
+    uint32_t                next_seq = 0;
+    unsigned int            tail;
+    uint32_t                i;
+
+    (void) arg;
+
+    while (1)
+    {
+        sem_wait (&slots_sem);
+
+        tail = atomic_load_explicit (&slots_tail, memory_order_relaxed);
+
+        if (tail == atomic_load_explicit (&slots_head, memory_order_acquire))
+        {
+            if (atomic_load (&writer_stop))
+            {
+                break;
+            }
+            continue;
+        }
+
+        slot = &slots[tail & (CAPTURE_SLOTS - 1)];
+
+        if (next_seq != 0 && next_seq != slot->seq)                         // repeat last frame for dropped frames
+        {
+            for (i = 0; i < CAPTURE_SAMPLES_PER_FRAME; i++)                 // and hold speaker level of next frame
+            {
+                samples[i] = slot->start_level ? CAPTURE_AMPLITUDE : -CAPTURE_AMPLITUDE;
+            }
+
+            while (next_seq != slot->seq)
+            {
+                write_frame ();
+                next_seq++;
+            }
+        }
+
+        convert_frame (slot);
+        convert_audio (slot);
+        next_seq = slot->seq + 1;
+
+        atomic_store_explicit (&slots_tail, tail + 1, memory_order_release);
+
+        write_frame ();
+    }
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcapture_speaker - remember speaker change, called by emulation thread on OUT to port 0xFE
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxcapture_speaker (uint_fast8_t level)
+{
+    level = level ? 1 : 0;
+
+    if (level != cur_level)
+    {
+        if (cur_n_events < CAPTURE_MAX_EVENTS)
+        {
+            cur_events[cur_n_events++] = (z80_get_clockcycles () << 1) | level;
+        }
+        cur_level = level;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcapture_frame - push frame into ring, called by emulation thread every 20 msec, never blocks
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxcapture_frame (uint_fast8_t inverse)
+{
+    unsigned int    head    = atomic_load_explicit (&slots_head, memory_order_relaxed);
+    unsigned int    tail    = atomic_load_explicit (&slots_tail, memory_order_acquire);
+    uint32_t        now     = z80_get_clockcycles ();
+
+    if (head - tail < CAPTURE_SLOTS)
+    {
+        CAPTURE_SLOT *  slot = &slots[head & (CAPTURE_SLOTS - 1)];
+
+        slot->seq           = cur_seq;
+        slot->start_cycles  = cur_start_cycles;
+        slot->end_cycles    = now;
+        slot->start_level   = cur_start_level;
+        slot->border_color  = zx_border_color;
+        slot->inverse       = inverse;
+        slot->n_events      = cur_n_events;
+        memcpy (slot->events, cur_events, cur_n_events * sizeof (uint32_t));
+        memcpy (slot->screen, zx_ram_screen_addr(ZX_SPECTRUM_DISPLAY_START_ADDRESS), CAPTURE_SCREEN_SIZE);
+
+        atomic_store_explicit (&slots_head, head + 1, memory_order_release);
+        sem_post (&slots_sem);
+    }
+    else
+    {
+        frames_dropped++;
+    }
+
+    cur_seq++;
+    cur_start_cycles    = now;
+    cur_start_level     = cur_level;
+    cur_n_events        = 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcapture_start - open basename.y4m and basename.wav and start writer thread
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxcapture_start (const char * basename)
+{
+    char            fname[Z80_MAX_FILENAME_LEN + 1];
+    unsigned int    i;
+    int             err;
+
+    slots = malloc (CAPTURE_SLOTS * sizeof (CAPTURE_SLOT));
+
+    if (! slots)
+    {
+        fprintf (stderr, "capture: cannot allocate ring\n");
+        return -1;
+    }
+
+    snprintf (fname, sizeof (fname), "%s.y4m", basename);
+    y4m_fp = fopen (fname, "wb");
+
+    if (! y4m_fp)
+    {
+        perror (fname);
+        free (slots);
+        return -1;
+    }
+
+    snprintf (fname, sizeof (fname), "%s.wav", basename);
+    wav_fp = fopen (fname, "wb");
+
+    if (! wav_fp)
+    {
+        perror (fname);
+        fclose (y4m_fp);
+        free (slots);
+        return -1;
+    }
+
+    setvbuf (y4m_fp, NULL, _IOFBF, 1024 * 1024);
+
+    for (i = 0; i < 16; i++)                                                // BT.601, limited range
+    {
+        int     r = (zxscr_rgbvalues[i] >> 16) & 0xFF;
+        int     g = (zxscr_rgbvalues[i] >>  8) & 0xFF;
+        int     b = (zxscr_rgbvalues[i] >>  0) & 0xFF;
+
+        yuv_palette[i][0] = (uint8_t) (( 66 * r + 129 * g +  25 * b + 128) / 256 +  16);
+        yuv_palette[i][1] = (uint8_t) ((-38 * r -  74 * g + 112 * b + 128) / 256 + 128);
+        yuv_palette[i][2] = (uint8_t) ((112 * r -  94 * g -  18 * b + 128) / 256 + 128);
+    }
+
+    fprintf (y4m_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", ZX_NATIVE_WIDTH, ZX_NATIVE_HEIGHT, CAPTURE_FPS);
+    write_wav_header ();
+
+    atomic_store (&slots_head, 0);
+    atomic_store (&slots_tail, 0);
+    atomic_store (&writer_stop, 0);
+    sem_init (&slots_sem, 0, 0);
+
+    cur_seq             = 0;
+    cur_start_cycles    = z80_get_clockcycles ();
+    cur_n_events        = 0;
+    frames_written      = 0;
+    frames_dropped      = 0;
+    wav_data_size       = 0;
+
+    err = pthread_create (&writer_tid, NULL, &capture_writer, NULL);
+
+    if (err != 0)
+    {
+        fprintf (stderr, "capture: can't create thread :[%s]\n", strerror (err));
+        fclose (y4m_fp);
+        fclose (wav_fp);
+        free (slots);
+        return -1;
+    }
+
+    lxcapture_active = 1;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcapture_stop - write remaining frames, stop writer thread and close files
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxcapture_stop (void)
+{
+    if (lxcapture_active)
+    {
+        lxcapture_active = 0;
+        atomic_store (&writer_stop, 1);
+        sem_post (&slots_sem);
+        pthread_join (writer_tid, NULL);
+
+        fseek (wav_fp, 0, SEEK_SET);
+        write_wav_header ();
+
+        fclose (y4m_fp);
+        fclose (wav_fp);
+        free (slots);
+        sem_destroy (&slots_sem);
+
+        printf ("capture: %u frames written, %u frames dropped\n", frames_written, frames_dropped);
+    }
+}
@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxcapture.h - capture of frames and audio into Y4M and WAV files
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef LXCAPTURE_H
+#define LXCAPTURE_H
+
+#include "lxdisplay.h"
+
+extern volatile uint_fast8_t    lxcapture_active;
+extern int                      lxcapture_start (const char *);
+extern void                     lxcapture_stop (void);
+extern void                     lxcapture_frame (uint_fast8_t);
+extern void                     lxcapture_speaker (uint_fast8_t);
+extern void                     lxcapture_render (const uint8_t *, uint_fast8_t, uint_fast8_t, uint8_t [ZX_NATIVE_HEIGHT][ZX_NATIVE_WIDTH]);
+
+#endif
@@ -0,0 +1,317 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxcoverage.c - execution and memory access coverage
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "z80.h"
+#include "zxram.h"
+#include "lxcoverage.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * While coverage is active, zxram keeps a flag byte per byte of every ROM and RAM bank, see ZX_RAM_COV_xxx. So the
+ * hot path is a single OR. z80() marks the address of every opcode fetch (including prefixes), zx_ram_get_8() and
+ * zx_ram_set_8() mark data reads and writes. A write to an address which was executed before is marked as
+ * self-modifying code. Operand bytes are fetched without marking them, so executed code shows up as opcode addresses
+ * with gaps of up to 3 bytes. Runahead and the block cache are bypassed while coverage is active.
+ *
+ * The coverage is written to two files:
+ *
+ *   name.cov       LXCOVERAGE_HEADER, then per bank (ROM 0, ROM 1, RAM 0 ... RAM 7) four bitmaps of 2048 bytes each:
+ *                  exec, read, write, smc. Bit n of byte k stands for bank offset 8 * k + n.
+ *   name.txt       summary: counts per bank, executed ranges and self-modified ranges
+ *
+ * In the summary, addresses are shown where the bank is usually paged in: ROM at 0000, RAM 5 at 4000, RAM 2 at 8000,
+ * all other RAM banks at C000.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define COV_BITMAP_SIZE             (STECCY_PAGE_SIZE / 8)
+#define COV_EXEC_GAP                4                                       // max. distance of opcodes in one range
+
+static char                         cov_name[Z80_MAX_FILENAME_LEN + 1];     // file name without extension
+static uint32_t                     frames;                                 // frames since lxcoverage_start()
+
+static const char *                 bank_names[LXCOVERAGE_BANKS] =
+{
+    "ROM0", "ROM1", "RAM0", "RAM1", "RAM2", "RAM3", "RAM4", "RAM5", "RAM6", "RAM7"
+};
+
+static const uint16_t               bank_addr[LXCOVERAGE_BANKS] =
+{
+    0x0000, 0x0000, 0xC000, 0xC000, 0x8000, 0xC000, 0xC000, 0x4000, 0xC000, 0xC000
+};
+
+static const uint8_t                map_flags[LXCOVERAGE_MAPS] =
+{
+    ZX_RAM_COV_EXEC, ZX_RAM_COV_READ, ZX_RAM_COV_WRITE, ZX_RAM_COV_SMC
+};
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * cov_bank - get coverage of bank, 0-1: ROM, 2-9: RAM
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t *
+cov_bank (uint_fast8_t bank)
+{
+    return bank < 2 ? steccy_rombankcov[bank] : steccy_rambankcov[bank - 2];
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * cov_write_ranges - write ranges of addresses with flag to summary, merge addresses which are at most gap apart
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+cov_write_ranges (FILE * fp, uint8_t flag, uint_fast16_t gap)
+{
+    uint8_t *       cov;
+    uint_fast8_t    bank;
+    uint_fast16_t   offset;
+    uint_fast16_t   first;
+    uint_fast16_t   last;
+    uint_fast8_t    in_range;
+
+    for (bank = 0; bank < LXCOVERAGE_BANKS; bank++)
+    {
+        cov         = cov_bank (bank);
+        in_range    = 0;
+        first       = 0;
+        last        = 0;
+
+        for (offset = 0; offset < STECCY_PAGE_SIZE; offset++)
+        {
+            if (cov[offset] & flag)
+            {
+                if (in_range && offset - last > gap)
+                {
+                    fprintf (fp, "%s  %04X-%04X\n", bank_names[bank], (unsigned int) (bank_addr[bank] + first), (unsigned int) (bank_addr[bank] + last));
+                    in_range = 0;
+                }
+
+                if (! in_range)
+                {
+                    first       = offset;
+                    in_range    = 1;
+                }
+
+                last = offset;
+            }
+        }
+
+        if (in_range)
+        {
+            fprintf (fp, "%s  %04X-%04X\n", bank_names[bank], (unsigned int) (bank_addr[bank] + first), (unsigned int) (bank_addr[bank] + last));
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * cov_write_summary - write text summary
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+cov_write_summary (const char * fname)
+{
+    FILE *          fp;
+    uint8_t *       cov;
+    uint32_t        counts[LXCOVERAGE_MAPS];
+    uint_fast8_t    bank;
+    uint_fast8_t    map;
+    uint_fast16_t   offset;
+
+    fp = fopen (fname, "w");
+
+    if (! fp)
+    {
+        perror (fname);
+        return -1;
+    }
+
+    fprintf (fp, "# STECCY coverage, %lu frames, ROM hash %016llX\n\n", (unsigned long) frames, (unsigned long long) z80_get_rom_hash ());
+    fprintf (fp, "bank   exec   read  write    smc\n");
+
+    for (bank = 0; bank < LXCOVERAGE_BANKS; bank++)
+    {
+        cov = cov_bank (bank);
+        memset (counts, 0, sizeof (counts));
+
+        for (offset = 0; offset < STECCY_PAGE_SIZE; offset++)
+        {
+            for (map = 0; map < LXCOVERAGE_MAPS; map++)
+            {
+                if (cov[offset] & map_flags[map])
+                {
+                    counts[map]++;
+                }
+            }
+        }
+
+        fprintf (fp, "%s %6lu %6lu %6lu %6lu\n", bank_names[bank],
+                 (unsigned long) counts[0], (unsigned long) counts[1], (unsigned long) counts[2], (unsigned long) counts[3]);
+    }
+
+    fprintf (fp, "\n# executed code (opcode addresses)\n");
+    cov_write_ranges (fp, ZX_RAM_COV_EXEC, COV_EXEC_GAP);
+
+    fprintf (fp, "\n# self-modified code\n");
+    cov_write_ranges (fp, ZX_RAM_COV_SMC, 1);
+
+    return fclose (fp) == 0 ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcoverage_write - write coverage files, coverage continues
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxcoverage_write (void)
+{
+    char                fname[Z80_MAX_FILENAME_LEN + 5];
+    FILE *              fp;
+    LXCOVERAGE_HEADER   header;
+    uint8_t             bitmap[COV_BITMAP_SIZE];
+    uint8_t *           cov;
+    uint_fast8_t        bank;
+    uint_fast8_t        map;
+    uint_fast16_t       offset;
+    int                 rtc = 0;
+
+    if (! zx_ram_coverage)
+    {
+        return -1;
+    }
+
+    snprintf (fname, sizeof (fname), "%s.cov", cov_name);
+    fp = fopen (fname, "wb");
+
+    if (! fp)
+    {
+        perror (fname);
+        return -1;
+    }
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, LXCOVERAGE_MAGIC, sizeof (header.magic));
+    header.version      = LXCOVERAGE_VERSION;
+    header.banks        = LXCOVERAGE_BANKS;
+    header.maps         = LXCOVERAGE_MAPS;
+    header.bank_size    = STECCY_PAGE_SIZE;
+    header.frames       = frames;
+    header.rom_hash     = z80_get_rom_hash ();
+
+    if (fwrite (&header, sizeof (header), 1, fp) != 1)
+    {
+        rtc = -1;
+    }
+
+    for (bank = 0; rtc == 0 && bank < LXCOVERAGE_BANKS; bank++)
+    {
+        cov = cov_bank (bank);
+
+        for (map = 0; rtc == 0 && map < LXCOVERAGE_MAPS; map++)
+        {
+            memset (bitmap, 0, sizeof (bitmap));
+
+            for (offset = 0; offset < STECCY_PAGE_SIZE; offset++)
+            {
+                if (cov[offset] & map_flags[map])
+                {
+                    bitmap[offset >> 3] |= 1 << (offset & 0x07);
+                }
+            }
+
+            if (fwrite (bitmap, sizeof (bitmap), 1, fp) != 1)
+            {
+                rtc = -1;
+            }
+        }
+    }
+
+    if (fclose (fp) != 0 || rtc < 0)
+    {
+        fprintf (stderr, "coverage: write error on %s\n", fname);
+        return -1;
+    }
+
+    snprintf (fname, sizeof (fname), "%s.txt", cov_name);
+    return cov_write_summary (fname);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcoverage_frame - count frames, called by z80() at end of frame
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxcoverage_frame (void)
+{
+    frames++;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcoverage_start - clear coverage and start it, name is file name without extension
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxcoverage_start (const char * name)
+{
+    uint_fast8_t    bank;
+
+    lxcoverage_stop ();                                                     // write previous coverage
+
+    if (! *name || strlen (name) >= sizeof (cov_name))
+    {
+        fprintf (stderr, "coverage: invalid file name\n");
+        return -1;
+    }
+
+    strcpy (cov_name, name);
+
+    for (bank = 0; bank < LXCOVERAGE_BANKS; bank++)
+    {
+        memset (cov_bank (bank), 0, STECCY_PAGE_SIZE);
+    }
+
+    frames          = 0;
+    zx_ram_coverage = 1;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxcoverage_stop - write coverage files and stop coverage
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxcoverage_stop (void)
+{
+    if (zx_ram_coverage)
+    {
+        if (lxcoverage_write () == 0)
+        {
+            printf ("coverage: %lu frames written to %s.cov and %s.txt\n", (unsigned long) frames, cov_name, cov_name);
+        }
+
+        zx_ram_coverage = 0;
+    }
+}
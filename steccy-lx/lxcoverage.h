@@ -0,0 +1,54 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxcoverage.h - execution and memory access coverage
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef LXCOVERAGE_H
+#define LXCOVERAGE_H
+
+#include <stdint.h>
+
+#define LXCOVERAGE_MAGIC            "STECCYCV"                              // 8 bytes, no terminating NUL in file
+#define LXCOVERAGE_VERSION          1
+#define LXCOVERAGE_BANKS            10                                      // ROM 0-1, RAM 0-7
+#define LXCOVERAGE_MAPS             4                                       // exec, read, write, smc
+
+typedef struct                                                              // file header, host byte order
+{
+    char                            magic[8];
+    uint16_t                        version;
+    uint16_t                        banks;                                  // LXCOVERAGE_BANKS
+    uint16_t                        maps;                                   // LXCOVERAGE_MAPS
+    uint16_t                        reserved;
+    uint32_t                        bank_size;                              // bytes per bank, 16384
+    uint32_t                        frames;                                 // frames covered
+    uint64_t                        rom_hash;
+} LXCOVERAGE_HEADER;
+
+extern int                          lxcoverage_start (const char *);
+extern int                          lxcoverage_write (void);
+extern void                         lxcoverage_stop (void);
+extern void                         lxcoverage_frame (void);
+
+#endif
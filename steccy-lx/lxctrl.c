@@ -0,0 +1,559 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxctrl.c - control socket for scripted automation
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "z80.h"
+#include "zxscr.h"
+#include "zxram.h"
+#include "zxio.h"
+#include "lxctrl.h"
+#include "lxrec.h"
+#include "lxcoverage.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * A client connected to the Unix domain socket sends one command per line and gets one reply per command:
+ *
+ *   LOAD file          load TAP, TZX or Z80 file                   OK
+ *   PRESS idx          press matrix key, see MATRIX_KEY_xxx_IDX    OK
+ *   RELEASE idx        release matrix key                          OK
+ *   FRAMES n           run n frames                                OK after the n-th frame
+ *   PEEK addr len      read memory                                 DATA len + len bytes
+ *   POKE addr len      write memory, followed by len raw bytes     OK
+ *   REGS               read registers                              OK AF=xxxx BC=xxxx ...
+ *   SCREEN             read screen memory                          DATA 6912 + 6912 bytes
+ *   RESET              reset                                       OK
+ *   TURBO 0|1          turbo mode off/on                           OK
+ *   PAUSE 0|1          stop/continue emulation at frame boundary   OK
+ *   COVERAGE name      clear coverage and start it, see lxcoverage OK
+ *   COVERAGE           write name.cov and name.txt                 OK
+ *   COVERAGE 0         write coverage files and stop coverage      OK
+ *   QUIT               exit emulator                               OK
+ *
+ * PEEK, POKE and SCREEN do not change the coverage. Errors are replied as "ERR message". Numbers may be decimal, hex (0x...) or octal (0...).
+ *
+ * Commands are executed by the emulation thread between two instructions: z80_idle_time() waits for input with
+ * lxctrl_wait() instead of sleeping and z80() calls lxctrl_service() if there is input. So the socket costs nothing
+ * per instruction. While FRAMES is running, no further commands are read. While paused, lxctrl_frame() blocks and
+ * executes commands until FRAMES or PAUSE 0 is received or the client disconnects.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define CTRL_LINE_SIZE              256                                     // max. length of a command line
+#define CTRL_SCREEN_SIZE            6912                                    // pixels + attributes
+#define CTRL_MAX_DATA               0x10000                                 // max. length of PEEK and POKE
+
+uint_fast8_t                        lxctrl_active;
+
+static int                          listen_fd   = -1;
+static int                          client_fd   = -1;
+static char                         sock_path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+static char                         line_buf[CTRL_LINE_SIZE];
+static size_t                       line_len;
+static uint32_t                     frames_pending;                         // frames to run until OK is sent
+static uint_fast8_t                 paused;
+static uint16_t                     poke_addr;
+static uint32_t                     poke_len;                               // POKE bytes still expected
+static uint8_t                      data_buf[CTRL_MAX_DATA];
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * ctrl_close_client - close client connection, continue emulation
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ctrl_close_client (void)
+{
+    if (client_fd >= 0)
+    {
+        close (client_fd);
+        client_fd = -1;
+    }
+
+    line_len        = 0;
+    frames_pending  = 0;
+    paused          = 0;
+    poke_len        = 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * ctrl_write - write reply to client
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ctrl_write (const void * buf, size_t len)
+{
+    const uint8_t * p = buf;
+    ssize_t         n;
+
+    while (len > 0 && client_fd >= 0)
+    {
+        n = send (client_fd, p, len, MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno != EINTR)
+            {
+                ctrl_close_client ();
+            }
+        }
+        else
+        {
+            p   += n;
+            len -= n;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * ctrl_reply - write formatted reply line to client
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ctrl_reply (const char * fmt, ...)
+{
+    char        buf[CTRL_LINE_SIZE];
+    va_list     ap;
+    int         len;
+
+    va_start (ap, fmt);
+    len = vsnprintf (buf, sizeof (buf) - 1, fmt, ap);
+    va_end (ap);
+
+    if (len > (int) sizeof (buf) - 2)
+    {
+        len = sizeof (buf) - 2;
+    }
+
+    buf[len++] = '\n';
+    ctrl_write (buf, len);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * ctrl_number - parse next number of argument list, return 0 if there is none
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ctrl_number (char ** argp, unsigned long * value)
+{
+    char *  end;
+
+    *value = strtoul (*argp, &end, 0);
+
+    if (end == *argp || (*end != '\0' && *end != ' '))
+    {
+        return 0;
+    }
+
+    *argp = end;
+    return 1;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * ctrl_key - check key index, see MATRIX_KEY_xxx_IDX
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+ctrl_key (char * arg, unsigned long * idx)
+{
+    return ctrl_number (&arg, idx) && *arg == '\0' && (*idx >> 4) <= 8 && (*idx & 0x0F) <= 4;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * ctrl_command - execute one command line
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+ctrl_command (char * line)
+{
+    unsigned long   addr;
+    unsigned long   len;
+    unsigned long   i;
+    char *          arg;
+
+    arg = strchr (line, ' ');
+
+    if (arg)
+    {
+        *arg++ = '\0';
+    }
+    else
+    {
+        arg = line + strlen (line);
+    }
+
+    if (! strcasecmp (line, "LOAD"))
+    {
+        if (access (arg, R_OK) < 0)
+        {
+            ctrl_reply ("ERR %s: %s", arg, strerror (errno));
+        }
+        else
+        {
+            z80_set_fname_load (arg);
+            ctrl_reply ("OK");
+        }
+    }
+    else if (! strcasecmp (line, "PRESS") || ! strcasecmp (line, "RELEASE"))
+    {
+        if (! ctrl_key (arg, &i))
+        {
+            ctrl_reply ("ERR invalid key index");
+        }
+        else
+        {
+            if (line[0] == 'P' || line[0] == 'p')
+            {
+                zxio_press_key (i);
+            }
+            else
+            {
+                zxio_release_key (i);
+            }
+
+            ctrl_reply ("OK");
+        }
+    }
+    else if (! strcasecmp (line, "FRAMES"))
+    {
+        if (! ctrl_number (&arg, &len) || *arg)
+        {
+            ctrl_reply ("ERR usage: FRAMES n");
+        }
+        else if (len == 0)
+        {
+            ctrl_reply ("OK");
+        }
+        else
+        {
+            frames_pending = len;                                           // OK is sent by lxctrl_frame()
+        }
+    }
+    else if (! strcasecmp (line, "PEEK") || ! strcasecmp (line, "POKE"))
+    {
+        if (! ctrl_number (&arg, &addr) || ! ctrl_number (&arg, &len) || *arg || addr >= CTRL_MAX_DATA || len > CTRL_MAX_DATA)
+        {
+            ctrl_reply ("ERR usage: %s addr len", line);
+        }
+        else if (line[1] == 'E' || line[1] == 'e')                          // PEEK
+        {
+            for (i = 0; i < len; i++)
+            {
+                uint16_t a = UINT16_T (addr + i);
+                data_buf[i] = zx_ram_get_text(a);                           // not counted as read by coverage
+            }
+
+            ctrl_reply ("DATA %lu", len);
+            ctrl_write (data_buf, len);
+        }
+        else if (len == 0)
+        {
+            ctrl_reply ("OK");
+        }
+        else
+        {
+            poke_addr   = addr;                                             // data is read by lxctrl_service()
+            poke_len    = len;
+        }
+    }
+    else if (! strcasecmp (line, "REGS"))
+    {
+        Z80_REGISTERS   regs;
+
+        z80_get_registers (&regs);
+        ctrl_reply ("OK AF=%04X BC=%04X DE=%04X HL=%04X AF'=%04X BC'=%04X DE'=%04X HL'=%04X IX=%04X IY=%04X SP=%04X PC=%04X "
+                    "I=%02X R=%02X IM=%u IFF1=%u IFF2=%u T=%u",
+                    regs.af, regs.bc, regs.de, regs.hl, regs.af_, regs.bc_, regs.de_, regs.hl_, regs.ix, regs.iy, regs.sp, regs.pc,
+                    regs.i, regs.r, regs.im, regs.iff1, regs.iff2, z80_get_clockcycles ());
+    }
+    else if (! strcasecmp (line, "SCREEN"))
+    {
+        ctrl_reply ("DATA %u", CTRL_SCREEN_SIZE);
+        ctrl_write (zx_ram_screen_addr(ZX_SPECTRUM_DISPLAY_START_ADDRESS), CTRL_SCREEN_SIZE);
+    }
+    else if (! strcasecmp (line, "RESET"))
+    {
+        lxrec_event (LXREC_EVENT_RESET, (char *) 0);
+        z80_reset ();
+        ctrl_reply ("OK");
+    }
+    else if (! strcasecmp (line, "TURBO") && (! strcmp (arg, "0") || ! strcmp (arg, "1")))
+    {
+        z80_set_turbo_mode (arg[0] - '0');
+        ctrl_reply ("OK");
+    }
+    else if (! strcasecmp (line, "PAUSE") && (! strcmp (arg, "0") || ! strcmp (arg, "1")))
+    {
+        if (arg[0] == '1' && ! paused)
+        {
+            paused          = 1;
+            frames_pending  = 1;                                            // OK at end of current frame
+        }
+        else
+        {
+            paused = arg[0] - '0';
+            ctrl_reply ("OK");
+        }
+    }
+    else if (! strcasecmp (line, "COVERAGE"))
+    {
+        if (! strcmp (arg, "0"))
+        {
+            lxcoverage_stop ();
+            ctrl_reply ("OK");
+        }
+        else if (! *arg)
+        {
+            ctrl_reply ("%s", lxcoverage_write () == 0 ? "OK" : "ERR coverage not written");
+        }
+        else
+        {
+            ctrl_reply ("%s", lxcoverage_start (arg) == 0 ? "OK" : "ERR invalid file name");
+        }
+    }
+    else if (! strcasecmp (line, "QUIT"))
+    {
+        steccy_exit = 1;
+        ctrl_reply ("OK");
+    }
+    else
+    {
+        ctrl_reply ("ERR unknown command");
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxctrl_service - accept client, execute all complete commands read so far
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxctrl_service (void)
+{
+    ssize_t     n;
+    ssize_t     i;
+    char *      nl;
+
+    if (client_fd < 0 && listen_fd >= 0)
+    {
+        client_fd = accept (listen_fd, (struct sockaddr *) 0, (socklen_t *) 0);
+    }
+
+    while (client_fd >= 0 && ! frames_pending && ! steccy_exit)
+    {
+        if (poke_len && line_len)
+        {
+            uint_fast8_t    coverage = zx_ram_coverage;
+
+            n = line_len < poke_len ? (ssize_t) line_len : (ssize_t) poke_len;
+            zx_ram_coverage = 0;                                            // not counted as write by coverage
+
+            for (i = 0; i < n; i++, poke_addr++)
+            {
+                zx_ram_set_8(poke_addr, (uint8_t) line_buf[i]);
+            }
+
+            zx_ram_coverage = coverage;
+
+            poke_len -= n;
+            line_len -= n;
+            memmove (line_buf, line_buf + n, line_len);
+
+            if (poke_len == 0)
+            {
+                ctrl_reply ("OK");
+            }
+            continue;
+        }
+
+        if (! poke_len && (nl = memchr (line_buf, '\n', line_len)) != (char *) 0)
+        {
+            size_t  len = nl - line_buf;
+
+            *nl = '\0';
+
+            if (len > 0 && line_buf[len - 1] == '\r')
+            {
+                line_buf[len - 1] = '\0';
+            }
+
+            ctrl_command (line_buf);
+
+            line_len -= len + 1;
+            memmove (line_buf, line_buf + len + 1, line_len);
+            continue;
+        }
+
+        if (line_len == sizeof (line_buf))
+        {
+            ctrl_reply ("ERR line too long");
+            line_len = 0;
+        }
+
+        n = recv (client_fd, line_buf + line_len, sizeof (line_buf) - line_len, MSG_DONTWAIT);
+
+        if (n > 0)
+        {
+            line_len += n;
+        }
+        else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            ctrl_close_client ();                                           // client is gone: continue emulation
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxctrl_wait - wait up to usec for input from socket instead of sleeping, return 1 if there is input
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+lxctrl_wait (uint32_t usec)
+{
+    struct timespec ts;
+    fd_set          fds;
+    int             fd = client_fd >= 0 ? client_fd : listen_fd;
+
+    if (client_fd >= 0 && frames_pending)                                   // no commands are read while FRAMES is running
+    {
+        if (usec)
+        {
+            usleep (usec);
+        }
+        return 0;
+    }
+
+    ts.tv_sec   = usec / 1000000;
+    ts.tv_nsec  = (usec % 1000000) * 1000;
+
+    FD_ZERO (&fds);
+    FD_SET (fd, &fds);
+
+    return pselect (fd + 1, &fds, (fd_set *) 0, (fd_set *) 0, &ts, (sigset_t *) 0) > 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxctrl_frame - called after each frame: finish FRAMES, block while paused
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxctrl_frame (void)
+{
+    fd_set  fds;
+
+    if (frames_pending)
+    {
+        frames_pending--;
+
+        if (frames_pending == 0)
+        {
+            ctrl_reply ("OK");
+            lxctrl_service ();                                              // execute commands already received
+        }
+    }
+
+    while (paused && ! frames_pending && ! steccy_exit && client_fd >= 0)
+    {
+        FD_ZERO (&fds);
+        FD_SET (client_fd, &fds);
+
+        if (select (client_fd + 1, &fds, (fd_set *) 0, (fd_set *) 0, (struct timeval *) 0) > 0)
+        {
+            lxctrl_service ();
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxctrl_start - listen on Unix domain socket
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxctrl_start (const char * path)
+{
+    struct sockaddr_un  addr;
+
+    if (strlen (path) >= sizeof (addr.sun_path))
+    {
+        fprintf (stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+
+    listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+    if (listen_fd < 0)
+    {
+        perror ("socket");
+        return -1;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+    unlink (path);                                                          // remove stale socket
+
+    if (bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 || listen (listen_fd, 1) < 0)
+    {
+        perror (path);
+        close (listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    fcntl (listen_fd, F_SETFL, fcntl (listen_fd, F_GETFL) | O_NONBLOCK);
+    strcpy (sock_path, path);
+    lxctrl_active = 1;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxctrl_stop - close sockets
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxctrl_stop (void)
+{
+    if (lxctrl_active)
+    {
+        lxctrl_active = 0;
+        ctrl_close_client ();
+        close (listen_fd);
+        listen_fd = -1;
+        unlink (sock_path);
+    }
+}
@@ -25,52 +25,353 @@
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "z80.h"
 #include "zxscr.h"
 #include "zxram.h"
+#include "lxdisplay.h"
+#include "lxcapture.h"
+#include "lxmenu.h"
 #if defined FRAMEBUFFER
 #include "lxfb.h"
 #elif defined X11
 #include "lxx11.h"
 #endif
-#define FB_RGB(r,g,b)       ((r << 16) | (g << 8) | b)
 
 unsigned int                zx_display_width;
 unsigned int                zx_display_height;
+unsigned int                zx_display_left;                                // position of ZX picture (incl. border) on screen
+unsigned int                zx_display_top;
+unsigned int                zx_display_pic_width;                           // size of ZX picture (incl. border) on screen
+unsigned int                zx_display_pic_height;
+unsigned int                zx_display_frames_skipped;                      // frames not presented during the last second
 
-#define ZOOM                2
-#define TOP_OFFSET          ((zx_display_height - ZOOM * ZX_SPECTRUM_DISPLAY_ROWS - 2 * ZX_SPECTRUM_BORDER_SIZE) / 2)
-#define LEFT_OFFSET         (((zx_display_width - 800) / 2) + 8)
-static uint32_t             top_offset;
-static uint32_t             left_offset;
+/*------------------------------------------------------------------------------------------------------------------------
+ * The ZX picture is first rendered 1:1 into a native frame of 288x224 pixels (16 pixels border on every side).
+ * Only changed native rows are then filtered (Scale2x/Scale3x), scaled to the picture size and copied to the screen.
+ * All kernels are plain row loops on uint32_t pixels, so that the compiler can vectorize them for x86 and ARM.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define MENU_WIDTH          224                                             // width of main menu right of the picture
+#define MIN_SCALE           200                                             // menus need at least 512x384 pixels
+#define SCANLINE(p)         (((p) >> 1) & 0x007F7F7F)                       // half brightness
+
+static uint32_t             native[ZX_NATIVE_HEIGHT][ZX_NATIVE_WIDTH];
+static uint8_t              native_dirty[ZX_NATIVE_HEIGHT];                 // flag: native row changed
+static uint8_t              native_expanded[ZX_NATIVE_HEIGHT];              // flag: native row must be rescaled
+
+static uint_fast8_t         filter_factor = 1;                              // 1, 2 or 3
+static uint32_t *           filtered;                                       // filtered frame, NULL if no filter
+static unsigned int         filtered_width  = ZX_NATIVE_WIDTH;
+static unsigned int         filtered_height = ZX_NATIVE_HEIGHT;
+
+static uint32_t *           pic;                                            // scaled picture
+static uint16_t *           xmap;                                           // picture column -> filtered column
+static uint16_t *           ymap;                                           // picture row -> filtered row
+static uint8_t *            ydark;                                          // flag: picture row is a scanline
+static unsigned int         xzoom;                                          // integer horizontal zoom, 0 if fractional
+
+uint_fast8_t                 z80_display_cached = 0;
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * Frame skipping: the native frame is always updated, but presenting it (scaling and copying to the screen) is skipped
+ * if emulation is behind real time and presenting would add more than FRAME_SKIP_SLACK_USEC to the lag. At most
+ * z80_settings.frame_skip frames are skipped in a row. In turbo mode a frame is presented only every FRAME_USEC, in automatic
+ * turbo (booting, loading tapes) only every AUTO_TURBO_FRAME_USEC.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define FRAME_USEC              20000                                       // 50 Hz
+#define AUTO_TURBO_FRAME_USEC   200000                                      // 5 Hz while in automatic turbo
+#define FRAME_SKIP_SLACK_USEC   10000                                       // tolerated lag incl. presenting
+#define FRAME_SKIP_WINDOW       50                                          // count skipped frames per second
+
+static uint32_t             present_usec_avg;                               // moving average of presenting time
+static uint64_t             last_present_usec;
+static unsigned int         skipped_in_row;
+static unsigned int         skipped_in_window;
+static unsigned int         frames_in_window;
+static uint_fast8_t         last_auto_turbo;
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * scale2x_row - Scale2x (EPX) filter: one native row into two filtered rows
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+scale2x_row (unsigned int y)
+{
+    const uint32_t *    a   = native[y > 0 ? y - 1 : y];
+    const uint32_t *    e   = native[y];
+    const uint32_t *    h   = native[y < ZX_NATIVE_HEIGHT - 1 ? y + 1 : y];
+    uint32_t *          o0  = filtered + (2 * y) * filtered_width;
+    uint32_t *          o1  = o0 + filtered_width;
+    unsigned int        x;
+
+    for (x = 0; x < ZX_NATIVE_WIDTH; x++)
+    {
+        uint32_t    b = a[x];                                               // above
+        uint32_t    d = e[x > 0 ? x - 1 : x];                               // left
+        uint32_t    p = e[x];
+        uint32_t    f = e[x < ZX_NATIVE_WIDTH - 1 ? x + 1 : x];             // right
+        uint32_t    g = h[x];                                               // below
+
+        o0[2 * x]       = (d == b && d != g && b != f) ? b : p;
+        o0[2 * x + 1]   = (b == f && b != d && f != g) ? f : p;
+        o1[2 * x]       = (g == d && g != f && d != b) ? d : p;
+        o1[2 * x + 1]   = (f == g && f != b && g != d) ? g : p;
+    }
+}
 
 /*------------------------------------------------------------------------------------------------------------------------
- * ZX Spectrum colors
+ * scale3x_row - Scale3x filter: one native row into three filtered rows
  *------------------------------------------------------------------------------------------------------------------------
  */
-static uint8_t rgbvalues[16][3] =
+static void
+scale3x_row (unsigned int y)
 {
-    { 0x00, 0x00, 0x00 },                            // black
-    { 0x00, 0x00, 0xF0 },                            // blue
-    { 0xF0, 0x00, 0x00 },                            // red
-    { 0xF0, 0x00, 0xF0 },                            // magenta
-    { 0x00, 0xF0, 0x00 },                            // green
-    { 0x00, 0xF0, 0xF0 },                            // cyan
-    { 0xF0, 0xF0, 0x00 },                            // yellow
-    { 0xF0, 0xF0, 0xF0 },                            // white
-
-    { 0x00, 0x00, 0x00 },                            // black
-    { 0x00, 0x00, 0xFF },                            // blue
-    { 0xFF, 0x00, 0x00 },                            // red
-    { 0xFF, 0x00, 0xFF },                            // magenta
-    { 0x00, 0xFF, 0x00 },                            // green
-    { 0x00, 0xFF, 0xFF },                            // cyan
-    { 0xFF, 0xFF, 0x00 },                            // yellow
-    { 0xFF, 0xFF, 0xFF },                            // white
-};
+    const uint32_t *    r0  = native[y > 0 ? y - 1 : y];
+    const uint32_t *    r1  = native[y];
+    const uint32_t *    r2  = native[y < ZX_NATIVE_HEIGHT - 1 ? y + 1 : y];
+    uint32_t *          o0  = filtered + (3 * y) * filtered_width;
+    uint32_t *          o1  = o0 + filtered_width;
+    uint32_t *          o2  = o1 + filtered_width;
+    unsigned int        x;
+
+    for (x = 0; x < ZX_NATIVE_WIDTH; x++)
+    {
+        unsigned int    xl  = x > 0 ? x - 1 : x;
+        unsigned int    xr  = x < ZX_NATIVE_WIDTH - 1 ? x + 1 : x;
+        uint32_t        a   = r0[xl], b = r0[x], c = r0[xr];
+        uint32_t        d   = r1[xl], e = r1[x], f = r1[xr];
+        uint32_t        g   = r2[xl], h = r2[x], i = r2[xr];
 
-uint_fast8_t                 z80_display_cached = 0;
+        if (b != h && d != f)
+        {
+            o0[3 * x]       = (d == b) ? d : e;
+            o0[3 * x + 1]   = ((d == b && e != c) || (b == f && e != a)) ? b : e;
+            o0[3 * x + 2]   = (b == f) ? f : e;
+            o1[3 * x]       = ((d == b && e != g) || (d == h && e != a)) ? d : e;
+            o1[3 * x + 1]   = e;
+            o1[3 * x + 2]   = ((b == f && e != i) || (h == f && e != c)) ? f : e;
+            o2[3 * x]       = (d == h) ? d : e;
+            o2[3 * x + 1]   = ((d == h && e != i) || (h == f && e != g)) ? h : e;
+            o2[3 * x + 2]   = (h == f) ? f : e;
+        }
+        else
+        {
+            o0[3 * x] = o0[3 * x + 1] = o0[3 * x + 2] = e;
+            o1[3 * x] = o1[3 * x + 1] = o1[3 * x + 2] = e;
+            o2[3 * x] = o2[3 * x + 1] = o2[3 * x + 2] = e;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * scale_row - scale one filtered row horizontally into a picture row
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+scale_row (uint32_t * dst, const uint32_t * src)
+{
+    unsigned int    x;
+    unsigned int    z;
+
+    switch (xzoom)
+    {
+        case 1:
+            memcpy (dst, src, zx_display_pic_width * sizeof (uint32_t));
+            break;
+
+        case 2:
+            for (x = 0; x < filtered_width; x++)
+            {
+                dst[2 * x] = dst[2 * x + 1] = src[x];
+            }
+            break;
+
+        case 3:
+            for (x = 0; x < filtered_width; x++)
+            {
+                dst[3 * x] = dst[3 * x + 1] = dst[3 * x + 2] = src[x];
+            }
+            break;
+
+        case 0:                                                                 // fractional: nearest neighbour
+            for (x = 0; x < zx_display_pic_width; x++)
+            {
+                dst[x] = src[xmap[x]];
+            }
+            break;
+
+        default:
+            for (x = 0; x < filtered_width; x++)
+            {
+                for (z = 0; z < xzoom; z++)
+                {
+                    dst[xzoom * x + z] = src[x];
+                }
+            }
+            break;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxdisplay_flush - filter and scale changed native rows and copy them to the screen
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+lxdisplay_flush (void)
+{
+    const uint32_t *    src_frame = filtered ? filtered : &native[0][0];
+    unsigned int        y;
+    unsigned int        run_start = 0;
+    unsigned int        run_len   = 0;
+
+    for (y = 0; y < ZX_NATIVE_HEIGHT; y++)                                  // filters read the rows above and below
+    {
+        native_expanded[y] = native_dirty[y];
+
+        if (filtered && ! native_dirty[y])
+        {
+            native_expanded[y] = (y > 0 && native_dirty[y - 1]) || (y < ZX_NATIVE_HEIGHT - 1 && native_dirty[y + 1]);
+        }
+    }
+
+    for (y = 0; y < ZX_NATIVE_HEIGHT; y++)
+    {
+        if (native_expanded[y])
+        {
+            if (filter_factor == 2)
+            {
+                scale2x_row (y);
+            }
+            else if (filter_factor == 3)
+            {
+                scale3x_row (y);
+            }
+        }
+    }
+
+    for (y = 0; y < zx_display_pic_height; y++)
+    {
+        uint32_t *  dst = pic + y * zx_display_pic_width;
+
+        if (native_expanded[ymap[y] / filter_factor])
+        {
+            if (run_len > 0 && ymap[y] == ymap[y - 1] && ! ydark[y - 1])
+            {
+                memcpy (dst, dst - zx_display_pic_width, zx_display_pic_width * sizeof (uint32_t));
+            }
+            else
+            {
+                scale_row (dst, src_frame + ymap[y] * filtered_width);
+            }
+
+            if (ydark[y])
+            {
+                unsigned int    x;
+
+                for (x = 0; x < zx_display_pic_width; x++)
+                {
+                    dst[x] = SCANLINE (dst[x]);
+                }
+            }
+
+            if (run_len == 0)
+            {
+                run_start = y;
+            }
+
+            run_len++;
+        }
+        else if (run_len > 0)
+        {
+            put_image (pic + run_start * zx_display_pic_width, zx_display_pic_width,
+                       zx_display_left, zx_display_top + run_start, zx_display_pic_width, run_len);
+            run_len = 0;
+        }
+    }
+
+    if (run_len > 0)
+    {
+        put_image (pic + run_start * zx_display_pic_width, zx_display_pic_width,
+                   zx_display_left, zx_display_top + run_start, zx_display_pic_width, run_len);
+    }
+
+    memset (native_dirty, 0, sizeof (native_dirty));
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxdisplay_usec - monotonic time in usec
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint64_t
+lxdisplay_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return 1000000ULL * ts.tv_sec + ts.tv_nsec / 1000;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxdisplay_present_frame - decide if the current frame should be presented, count skipped frames
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+lxdisplay_present_frame (uint64_t now)
+{
+    uint_fast8_t    present;
+    uint_fast8_t    auto_turbo = z80_get_auto_turbo ();
+
+    if (last_auto_turbo != auto_turbo)                                      // update status line
+    {
+        last_auto_turbo = auto_turbo;
+        menu_update_status ();
+    }
+
+    if (! z80_display_cached)                                               // full redraw requested, e.g. after menu
+    {
+        present = 1;
+    }
+    else if (z80_settings.turbo_mode)                                       // turbo: present with 50 Hz wall clock
+    {
+        present = (now - last_present_usec >= FRAME_USEC);
+    }
+    else if (auto_turbo)                                                    // automatic turbo: present rarely
+    {
+        present = (now - last_present_usec >= AUTO_TURBO_FRAME_USEC);
+    }
+    else
+    {
+        uint32_t    lag = z80_get_lag_usec ();
+
+        present = (skipped_in_row >= z80_settings.frame_skip ||
+                   lag == 0 || lag + present_usec_avg <= FRAME_SKIP_SLACK_USEC);
+
+        if (! present)
+        {
+            skipped_in_window++;
+        }
+    }
+
+    skipped_in_row = present ? 0 : skipped_in_row + 1;
+
+    if (++frames_in_window == FRAME_SKIP_WINDOW)
+    {
+        if (zx_display_frames_skipped != skipped_in_window)
+        {
+            zx_display_frames_skipped = skipped_in_window;
+            menu_update_status ();
+        }
+
+        frames_in_window    = 0;
+        skipped_in_window   = 0;
+    }
+
+    return present;
+}
 
 /*------------------------------------------------------------------------------------------------------------------------
  * zxscr_update_display - update Linux framebuffer or X11 window
@@ -98,6 +399,12 @@ zxscr_update_display (void)
     uint8_t         ink;
     uint8_t         paper;
     uint8_t         video_ram_changed_copy;
+    uint64_t        now;
+
+    if (! pic)
+    {
+        return;
+    }
 
     video_ram_changed_copy = video_ram_changed;                             // use a local value, because other task changes it
     video_ram_changed = 1;
@@ -112,149 +419,223 @@ zxscr_update_display (void)
 
     if (! z80_display_cached || last_zx_border_color != zx_border_color)
     {
-        uint16_t    x1;
-        uint16_t    x2;
-        uint16_t    y1;
-        uint16_t    y2;
-
-        uint32_t    rgb = FB_RGB (rgbvalues[zx_border_color][0], rgbvalues[zx_border_color][1], rgbvalues[zx_border_color][2]);
-
-        // upper border
-        y1 = 0;
-        y2 = ZX_SPECTRUM_BORDER_SIZE - 1;
-        x1 = 0;
-        x2 = ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZOOM * ZX_SPECTRUM_BORDER_SIZE - 1;
-
-        fill_rectangle (x1 + left_offset, y1 + top_offset, x2 + left_offset, y2 + top_offset, rgb);
-
-        // left border
-        y1 = ZX_SPECTRUM_BORDER_SIZE;
-        y2 = ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZX_SPECTRUM_BORDER_SIZE - 1;
-        x1 = 0;
-        x2 = ZX_SPECTRUM_BORDER_SIZE - 1;
-
-        fill_rectangle (x1 + left_offset, y1 + top_offset, x2 + left_offset, y2 + top_offset, rgb);
-
-        // right border
-        y1 = ZX_SPECTRUM_BORDER_SIZE;
-        y2 = ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZX_SPECTRUM_BORDER_SIZE - 1;
-        x1 = ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZX_SPECTRUM_BORDER_SIZE;
-        x2 = x1 + ZX_SPECTRUM_BORDER_SIZE - 1;
-
-        fill_rectangle (x1 + left_offset, y1 + top_offset, x2 + left_offset, y2 + top_offset, rgb);
+        uint32_t        rgb = zxscr_rgbvalues[zx_border_color];
+        unsigned int    y;
+        unsigned int    x;
 
-        // lower border
-        y1 = ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZX_SPECTRUM_BORDER_SIZE;
-        y2 = ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZOOM * ZX_SPECTRUM_BORDER_SIZE - 1;
-        x1 = 0;
-        x2 = ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZOOM * ZX_SPECTRUM_BORDER_SIZE - 1;
-
-        fill_rectangle (x1 + left_offset, y1 + top_offset, x2 + left_offset, y2 + top_offset, rgb);
+        for (y = 0; y < ZX_NATIVE_HEIGHT; y++)
+        {
+            if (y < ZX_NATIVE_BORDER || y >= ZX_NATIVE_BORDER + ZX_SPECTRUM_DISPLAY_ROWS)
+            {
+                for (x = 0; x < ZX_NATIVE_WIDTH; x++)
+                {
+                    native[y][x] = rgb;
+                }
+            }
+            else
+            {
+                for (x = 0; x < ZX_NATIVE_BORDER; x++)
+                {
+                    native[y][x] = rgb;
+                    native[y][ZX_NATIVE_BORDER + ZX_SPECTRUM_DISPLAY_COLUMNS + x] = rgb;
+                }
+            }
+        }
 
+        memset (native_dirty, 1, sizeof (native_dirty));
         last_zx_border_color = zx_border_color;
     }
 
-    if (counter != 0 && ! video_ram_changed_copy)                                       // no flash inverting and no video ram content changed
+    if (! z80_display_cached || counter == 0 || video_ram_changed_copy)     // flash inverting or video ram content changed
     {
-        return;
-    }
-
-    // attr_ram_blocked = 1;
+        addr = ZX_SPECTRUM_DISPLAY_START_ADDRESS;
 
-    addr = ZX_SPECTRUM_DISPLAY_START_ADDRESS;
-
-    for (r = 0; r < ZX_SPECTRUM_DISPLAY_ROWS; r++)
-    {
-        row         = ((addr & 0x0700) >> 8) | ((addr & 0x00E0) >> 2) | ((addr & 0x1800) >> 5);
-        attr_addr   = UINT16_T (ZX_SPECTRUM_ATTRIBUTES_START_ADDR + (((row >> 3) << 5)));
-
-        for (col = 0; col < ZX_SPECTRUM_DISPLAY_COLUMNS; col += 8, addr++, attr_addr++)
+        for (r = 0; r < ZX_SPECTRUM_DISPLAY_ROWS; r++)
         {
-            uint32_t    rgbset;
-            uint32_t    rgbreset;
-            uint16_t    mask = 0x80;
-            uint16_t    idx;
+            row         = ((addr & 0x0700) >> 8) | ((addr & 0x00E0) >> 2) | ((addr & 0x1800) >> 5);
+            attr_addr   = UINT16_T (ZX_SPECTRUM_ATTRIBUTES_START_ADDR + (((row >> 3) << 5)));
 
-            // video_ram_blocked_at = addr;
+            for (col = 0; col < ZX_SPECTRUM_DISPLAY_COLUMNS; col += 8, addr++, attr_addr++)
+            {
+                uint32_t    rgb[2];
+                uint32_t *  p;
+                uint16_t    idx;
 
-            value   = zx_ram_get_screen_8(addr);
-            attr    = zx_ram_get_screen_8(attr_addr);
+                value   = zx_ram_get_screen_8(addr);
+                attr    = zx_ram_get_screen_8(attr_addr);
 
-            if (z80_display_cached &&                                                       // ram initialized?
-                value == shadow_display[addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS] &&        // value not changed?
-                attr  == shadow_attr[attr_addr - ZX_SPECTRUM_ATTRIBUTES_START_ADDR])        // attr not changed?
-            {
-                if (counter != 0 || ! (attr & FLASH_MASK))                                  // no flash inverting
-                {                                                                           // and no flash attribute
-                    continue;                                                               // skip update
+                if (z80_display_cached &&                                                       // ram initialized?
+                    value == shadow_display[addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS] &&        // value not changed?
+                    attr  == shadow_attr[attr_addr - ZX_SPECTRUM_ATTRIBUTES_START_ADDR])        // attr not changed?
+                {
+                    if (counter != 0 || ! (attr & FLASH_MASK))                                  // no flash inverting
+                    {                                                                           // and no flash attribute
+                        continue;                                                               // skip update
+                    }
                 }
-            }
 
-            shadow_display[addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS] = value;
+                shadow_display[addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS] = value;
 
-            if (attr & FLASH_MASK)
-            {
-                if (inverse)
+                if (attr & FLASH_MASK)
                 {
-                    ink     = (attr & PAPER_MASK) >> 3;
-                    paper   = (attr & INK_MASK) >> 0;
+                    if (inverse)
+                    {
+                        ink     = (attr & PAPER_MASK) >> 3;
+                        paper   = (attr & INK_MASK) >> 0;
+                    }
+                    else
+                    {
+                        paper   = (attr & PAPER_MASK) >> 3;
+                        ink     = (attr & INK_MASK) >> 0;
+                    }
                 }
                 else
                 {
                     paper   = (attr & PAPER_MASK) >> 3;
                     ink     = (attr & INK_MASK) >> 0;
                 }
-            }
-            else
-            {
-                paper   = (attr & PAPER_MASK) >> 3;
-                ink     = (attr & INK_MASK) >> 0;
-            }
 
-            if (attr & BOLD_MASK)
-            {
-                paper += 8;
-                ink += 8;
-            }
-
-            rgbset      = FB_RGB(rgbvalues[ink][0], rgbvalues[ink][1], rgbvalues[ink][2]);
-            rgbreset    = FB_RGB(rgbvalues[paper][0], rgbvalues[paper][1], rgbvalues[paper][2]);
-
-            for (idx = 0; idx < 8; idx++)
-            {
-                uint16_t    x1 = ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx);
-                uint16_t    y1 = ZX_SPECTRUM_BORDER_SIZE + ZOOM * row;
-
-                if (value & mask)
+                if (attr & BOLD_MASK)
                 {
-                    fill_rectangle (x1 + left_offset, y1 + top_offset, x1 + left_offset + 1, y1 + top_offset + 1, rgbset);
+                    paper += 8;
+                    ink += 8;
                 }
-                else
+
+                rgb[0]  = zxscr_rgbvalues[paper];
+                rgb[1]  = zxscr_rgbvalues[ink];
+                p       = &native[ZX_NATIVE_BORDER + row][ZX_NATIVE_BORDER + col];
+
+                for (idx = 0; idx < 8; idx++)
                 {
-                    fill_rectangle (x1 + left_offset, y1 + top_offset, x1 + left_offset + 1, y1 + top_offset + 1, rgbreset);
+                    p[idx] = rgb[(value >> (7 - idx)) & 0x01];
                 }
 
-                mask >>= 1;
+                native_dirty[ZX_NATIVE_BORDER + row] = 1;
             }
         }
+
+        memcpy (shadow_attr, zx_ram_screen_addr(ZX_SPECTRUM_ATTRIBUTES_START_ADDR), 768);
     }
 
+    if (lxcapture_active)
+    {
+        lxcapture_frame (inverse);
+    }
+
+    now = lxdisplay_usec ();
+
+    if (lxdisplay_present_frame (now))
+    {
+        lxdisplay_flush ();
+
 #if defined X11
         x11_flush ();
 #endif
 
-    // video_ram_blocked_at = 0x000;
-    memcpy (shadow_attr, zx_ram_screen_addr(ZX_SPECTRUM_ATTRIBUTES_START_ADDR), 768);
+        last_present_usec = lxdisplay_usec ();
+        present_usec_avg += ((int32_t) (last_present_usec - now) - (int32_t) present_usec_avg) / 8;
+    }
 
-    // attr_ram_blocked = 0;
     z80_display_cached = 1;
 }
 
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxdisplay_layout - compute scale and position of ZX picture from settings, allocate buffers
+ *
+ * The picture is centered together with the main menu right of it. Scale 200% gives the classic layout.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxdisplay_layout (void)
+{
+    unsigned int    max_scale;
+    unsigned int    scale;
+    unsigned int    y;
+    unsigned int    x;
+
+    max_scale = (zx_display_width - MENU_WIDTH) * 100 / ZX_NATIVE_WIDTH;
+
+    if (max_scale > zx_display_height * 100 / ZX_NATIVE_HEIGHT)
+    {
+        max_scale = zx_display_height * 100 / ZX_NATIVE_HEIGHT;
+    }
+
+    scale = z80_settings.display_scale;
+
+    if (scale == 0)                                                         // fit to screen: largest integer scale
+    {
+        scale = (max_scale / 100) * 100;
+    }
+
+    if (scale > max_scale)
+    {
+        scale = max_scale;
+    }
+
+    if (scale < MIN_SCALE)
+    {
+        scale = MIN_SCALE;
+    }
+
+    switch (z80_settings.display_filter)
+    {
+        case DISPLAY_FILTER_SCALE2X:    filter_factor = 2;  break;
+        case DISPLAY_FILTER_SCALE3X:    filter_factor = 3;  break;
+        default:                        filter_factor = 1;  break;
+    }
+
+    zx_display_pic_width    = ZX_NATIVE_WIDTH  * scale / 100;
+    zx_display_pic_height   = ZX_NATIVE_HEIGHT * scale / 100;
+    zx_display_left         = (zx_display_width >= zx_display_pic_width + MENU_WIDTH) ? (zx_display_width - zx_display_pic_width - MENU_WIDTH) / 2 + 8 : 0;
+    zx_display_top          = (zx_display_height > zx_display_pic_height) ? (zx_display_height - zx_display_pic_height) / 2 : 0;
+
+    filtered_width          = ZX_NATIVE_WIDTH  * filter_factor;
+    filtered_height         = ZX_NATIVE_HEIGHT * filter_factor;
+    xzoom                   = (zx_display_pic_width % filtered_width) ? 0 : zx_display_pic_width / filtered_width;
+
+    free (filtered);
+    free (pic);
+    free (xmap);
+    free (ymap);
+    free (ydark);
+
+    filtered    = (filter_factor > 1) ? malloc (filtered_width * filtered_height * sizeof (uint32_t)) : (uint32_t *) NULL;
+    pic         = malloc (zx_display_pic_width * zx_display_pic_height * sizeof (uint32_t));
+    xmap        = malloc (zx_display_pic_width * sizeof (uint16_t));
+    ymap        = malloc (zx_display_pic_height * sizeof (uint16_t));
+    ydark       = malloc (zx_display_pic_height * sizeof (uint8_t));
+
+    if ((filter_factor > 1 && ! filtered) || ! pic || ! xmap || ! ymap || ! ydark)
+    {
+        fprintf (stderr, "lxdisplay: cannot allocate %ux%u picture\n", zx_display_pic_width, zx_display_pic_height);
+        free (pic);
+        pic = (uint32_t *) NULL;
+        return;
+    }
+
+    for (x = 0; x < zx_display_pic_width; x++)
+    {
+        xmap[x] = x * filtered_width / zx_display_pic_width;
+    }
+
+    for (y = 0; y < zx_display_pic_height; y++)
+    {
+        ymap[y] = y * filtered_height / zx_display_pic_height;
+    }
+
+    for (y = 0; y < zx_display_pic_height; y++)                             // scanline: last picture row of a native row
+    {
+        ydark[y] = z80_settings.display_scanlines &&
+                   (y + 1 == zx_display_pic_height || ymap[y + 1] / filter_factor != ymap[y] / filter_factor);
+    }
+
+    z80_display_cached = 0;
+}
+
 void
 lxdisplay_init (unsigned int width, unsigned int height)
 {
     zx_display_width    = width;
     zx_display_height   = height;
-    top_offset          = TOP_OFFSET;
-    left_offset         = LEFT_OFFSET;
+    lxdisplay_layout ();
 }
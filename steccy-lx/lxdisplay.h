@@ -27,10 +27,20 @@
 #ifndef LXDISPLAY_H
 #define LXDISPLAY_H
 
+#define ZX_NATIVE_BORDER        16                                          // border of native frame in ZX pixels
+#define ZX_NATIVE_WIDTH         (256 + 2 * ZX_NATIVE_BORDER)                // size of native frame: 288x224
+#define ZX_NATIVE_HEIGHT        (192 + 2 * ZX_NATIVE_BORDER)
+
 extern uint_fast8_t     z80_display_cached;
 extern unsigned int     zx_display_width;
 extern unsigned int     zx_display_height;
+extern unsigned int     zx_display_left;
+extern unsigned int     zx_display_top;
+extern unsigned int     zx_display_pic_width;
+extern unsigned int     zx_display_pic_height;
+extern unsigned int     zx_display_frames_skipped;
 extern void             z80_update_display (void);
+extern void             lxdisplay_layout (void);
 extern void             lxdisplay_init (unsigned int, unsigned int);
 
 #endif
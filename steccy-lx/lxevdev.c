@@ -0,0 +1,817 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxevdev.c - evdev input of keyboards and gamepads
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+#include "z80.h"
+#include "zxio.h"
+#include "lxmapkey.h"
+#include "lxjoystick.h"
+#include "lxevdev.h"
+#include "scancodes.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * An input thread waits with epoll on all keyboards and gamepads in /dev/input and on an inotify watch of this
+ * directory, so pads can be plugged in and out while STECCY is running. Every key, button and stick change is put
+ * with its kernel timestamp (CLOCK_MONOTONIC) into a bounded single producer/single consumer ring.
+ *
+ * The emulation thread takes the events out when the Z80 reads the keyboard or Kempston port and at every frame.
+ * Every 10 msec z80_idle_time() passes with lxevdev_tick() the clock cycle at which the next 10 msec slice starts and
+ * the real time this slice stands for, that is the 10 msec before its deadline. An event is applied at the T-state
+ * matching its timestamp within that slice. So the distance between key presses is kept, and if the emulation is
+ * behind real time, a short tap is not lost or squeezed into a single instruction. Events before or after the slice
+ * are applied at once.
+ *
+ * Sticks and hats are mapped to the 4 directions with a dead zone of half the deflection, all buttons are fire. The
+ * first pad is the joystick selected in the menu, the second one Sinclair joystick 2 (or 1 if the first one is 2).
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define EVDEV_DIR                   "/dev/input"
+#define EVDEV_MAX_DEVICES           16
+#define EVDEV_MAX_PADS              2
+#define EVDEV_QUEUE_SIZE            256                                     // must be a power of 2
+
+#define EVDEV_KIND_KEY              0                                       // code: scancode
+#define EVDEV_KIND_PAD              1                                       // code: pad << 8 | direction
+
+#define PAD_RIGHT                   0x01                                    // same order as Kempston bits
+#define PAD_LEFT                    0x02
+#define PAD_DOWN                    0x04
+#define PAD_UP                      0x08
+#define PAD_FIRE                    0x10
+#define PAD_DIRECTIONS              5
+
+#define BITS_PER_LONG               (8 * sizeof (unsigned long))
+#define NLONGS(n)                   (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bits, n)           (((bits)[(n) / BITS_PER_LONG] >> ((n) % BITS_PER_LONG)) & 1)
+
+typedef struct
+{
+    uint64_t                usec;                                           // kernel timestamp
+    uint16_t                code;
+    uint8_t                 kind;                                           // EVDEV_KIND_xxx
+    uint8_t                 pressed;
+} EVDEV_EVENT;
+
+typedef struct
+{
+    int                     fd;                                             // -1: slot is free
+    int                     number;                                         // N of /dev/input/eventN
+    uint_fast8_t            kind;                                           // LXEVDEV_KEYBOARD or LXEVDEV_GAMEPAD
+    uint_fast8_t            pad;                                            // pad index
+    uint_fast8_t            state;                                          // PAD_xxx bits sent to emulation thread
+    uint_fast8_t            axes;                                           // PAD_xxx bits of stick
+    uint_fast8_t            hat;                                            // PAD_xxx bits of hat
+    uint_fast8_t            dpad;                                           // PAD_xxx bits of D-pad buttons
+    uint32_t                buttons;                                        // pressed fire buttons
+    int                     abs_min[2];                                     // range of ABS_X and ABS_Y
+    int                     abs_max[2];
+} EVDEV_DEVICE;
+
+volatile uint_fast8_t       lxevdev_active;
+
+static EVDEV_EVENT          queue[EVDEV_QUEUE_SIZE];
+static atomic_uint          queue_head;                                     // written by input thread only
+static atomic_uint          queue_tail;                                     // written by emulation thread only
+
+// state of input thread:
+static EVDEV_DEVICE         devices[EVDEV_MAX_DEVICES];
+static uint_fast8_t         wanted_kinds;
+static uint_fast8_t         pads_used;                                      // bit per pad index
+static int                  epoll_fd    = -1;
+static int                  inotify_fd  = -1;
+static atomic_int           input_stop;
+static pthread_t            input_tid;
+
+// state of emulation thread:
+static uint32_t             ref_cycles;                                     // clock cycles at last tick
+static uint64_t             ref_usec;                                       // real time at which they are due, 0: not in real time
+static uint32_t             rate_cycles;                                    // clock cycles ...
+static uint32_t             rate_usec;                                      // ... per usec between the last two ticks
+static uint8_t              pad_pressed[EVDEV_MAX_PADS][PAD_DIRECTIONS];    // matrix index pressed per direction, 0xFF: none
+
+static const uint8_t        pad_keys[N_JOYSTICKS][PAD_DIRECTIONS] =         // right, left, down, up, fire
+{
+    { MATRIX_KEY_8_IDX, MATRIX_KEY_5_IDX, MATRIX_KEY_6_IDX, MATRIX_KEY_7_IDX, MATRIX_KEY_0_IDX },                                // cursor
+    { MATRIX_KEY_7_IDX, MATRIX_KEY_6_IDX, MATRIX_KEY_8_IDX, MATRIX_KEY_9_IDX, MATRIX_KEY_0_IDX },                                // sinclair 1
+    { MATRIX_KEY_2_IDX, MATRIX_KEY_1_IDX, MATRIX_KEY_3_IDX, MATRIX_KEY_4_IDX, MATRIX_KEY_5_IDX },                                // sinclair 2
+    { MATRIX_KEMPSTON_RIGHT_IDX, MATRIX_KEMPSTON_LEFT_IDX, MATRIX_KEMPSTON_DOWN_IDX, MATRIX_KEMPSTON_UP_IDX, MATRIX_KEMPSTON_FIRE_IDX } // kempston
+};
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_now_usec - get current time in usec
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint64_t
+evdev_now_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return 1000000ULL * ts.tv_sec + ts.tv_nsec / 1000;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_scancode - map evdev key code to scancode of console, SCANCODE_NONE if unknown
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast16_t
+evdev_scancode (uint_fast16_t code)
+{
+    if (code <= KEY_F12)
+    {
+        return code;                                                        // codes up to F12 are the scancodes
+    }
+
+    switch (code)
+    {
+        case KEY_KPENTER:       return SCANCODE_KEYPAD_ENTER;
+        case KEY_RIGHTCTRL:     return SCANCODE_RCTRL;
+        case KEY_KPSLASH:       return SCANCODE_KEYPAD_PF2;
+        case KEY_SYSRQ:         return SCANCODE_PRINT;
+        case KEY_RIGHTALT:      return SCANCODE_RALT;
+        case KEY_HOME:          return SCANCODE_HOME;
+        case KEY_UP:            return SCANCODE_U_ARROW;
+        case KEY_PAGEUP:        return SCANCODE_PAGE_UP;
+        case KEY_LEFT:          return SCANCODE_L_ARROW;
+        case KEY_RIGHT:         return SCANCODE_R_ARROW;
+        case KEY_END:           return SCANCODE_END;
+        case KEY_DOWN:          return SCANCODE_D_ARROW;
+        case KEY_PAGEDOWN:      return SCANCODE_PAGE_DOWN;
+        case KEY_INSERT:        return SCANCODE_INSERT;
+        case KEY_DELETE:        return SCANCODE_DELETE;
+        case KEY_PAUSE:         return SCANCODE_PAUSE;
+        case KEY_LEFTMETA:      return SCANCODE_LGUI;
+        case KEY_RIGHTMETA:     return SCANCODE_RGUI;
+        case KEY_COMPOSE:       return SCANCODE_MENU;
+        default:                return SCANCODE_NONE;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_put - put event into queue, drop it if queue is full
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_put (uint64_t usec, uint_fast8_t kind, uint_fast16_t code, uint_fast8_t pressed)
+{
+    unsigned int    head    = atomic_load_explicit (&queue_head, memory_order_relaxed);
+    unsigned int    tail    = atomic_load_explicit (&queue_tail, memory_order_acquire);
+    EVDEV_EVENT *   ev;
+
+    if (head - tail >= EVDEV_QUEUE_SIZE)
+    {
+        return;
+    }
+
+    ev          = queue + (head & (EVDEV_QUEUE_SIZE - 1));
+    ev->usec    = usec;
+    ev->code    = code;
+    ev->kind    = kind;
+    ev->pressed = pressed;
+
+    atomic_store_explicit (&queue_head, head + 1, memory_order_release);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_key - handle key of keyboard, value: 0 = release, 1 = press, 2 = autorepeat
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_key (uint64_t usec, uint_fast16_t code, int value)
+{
+    uint_fast16_t   scancode = evdev_scancode (code);
+
+    if (scancode == SCANCODE_NONE)
+    {
+        return;
+    }
+
+    if (lxmapkey_menu_enabled)                                              // menu reads scancodes directly
+    {
+        if (value)
+        {
+            lxmapkey_menu_scancode = scancode;
+        }
+    }
+    else if (value != 2)                                                    // autorepeat is no key press on the ZX
+    {
+        evdev_put (usec, EVDEV_KIND_KEY, scancode, value);
+    }
+
+    if (value == 1 && scancode == SCANCODE_F12)                             // F12: exit
+    {
+        steccy_exit = 1;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_axis - get PAD_xxx bit of stick axis idx (0 = X, 1 = Y)
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+evdev_axis (const EVDEV_DEVICE * dev, int idx, int value, uint_fast8_t low_bit, uint_fast8_t high_bit)
+{
+    int     range = dev->abs_max[idx] - dev->abs_min[idx];
+
+    if (range > 0)
+    {
+        if (value < dev->abs_min[idx] + range / 4)                          // more than half way from center
+        {
+            return low_bit;
+        }
+
+        if (value > dev->abs_max[idx] - range / 4)
+        {
+            return high_bit;
+        }
+    }
+
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_pad_update - send changed directions of pad to emulation thread
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_pad_update (EVDEV_DEVICE * dev, uint64_t usec)
+{
+    uint_fast8_t    state   = dev->axes | dev->hat | dev->dpad | (dev->buttons ? PAD_FIRE : 0);
+    uint_fast8_t    changed = state ^ dev->state;
+    uint_fast8_t    direction;
+
+    for (direction = 0; direction < PAD_DIRECTIONS; direction++)
+    {
+        if (changed & (1 << direction))
+        {
+            evdev_put (usec, EVDEV_KIND_PAD, (dev->pad << 8) | direction, (state >> direction) & 0x01);
+        }
+    }
+
+    dev->state = state;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_pad_event - handle event of gamepad
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_pad_event (EVDEV_DEVICE * dev, uint64_t usec, const struct input_event * ev)
+{
+    if (ev->type == EV_KEY)
+    {
+        uint_fast8_t    bit = 0;
+
+        if (ev->code >= BTN_JOYSTICK && ev->code < BTN_JOYSTICK + 32)       // joystick and gamepad buttons
+        {
+            if (ev->value)
+            {
+                dev->buttons |= 1UL << (ev->code - BTN_JOYSTICK);
+            }
+            else
+            {
+                dev->buttons &= ~(1UL << (ev->code - BTN_JOYSTICK));
+            }
+        }
+        else
+        {
+            switch (ev->code)
+            {
+                case BTN_DPAD_RIGHT:    bit = PAD_RIGHT;    break;
+                case BTN_DPAD_LEFT:     bit = PAD_LEFT;     break;
+                case BTN_DPAD_DOWN:     bit = PAD_DOWN;     break;
+                case BTN_DPAD_UP:       bit = PAD_UP;       break;
+            }
+
+            if (ev->value)
+            {
+                dev->dpad |= bit;
+            }
+            else
+            {
+                dev->dpad &= ~bit;
+            }
+        }
+    }
+    else if (ev->type == EV_ABS)
+    {
+        switch (ev->code)
+        {
+            case ABS_X:
+                dev->axes = (dev->axes & ~(PAD_LEFT | PAD_RIGHT)) | evdev_axis (dev, 0, ev->value, PAD_LEFT, PAD_RIGHT);
+                break;
+            case ABS_Y:
+                dev->axes = (dev->axes & ~(PAD_UP | PAD_DOWN)) | evdev_axis (dev, 1, ev->value, PAD_UP, PAD_DOWN);
+                break;
+            case ABS_HAT0X:
+                dev->hat = (dev->hat & ~(PAD_LEFT | PAD_RIGHT)) | (ev->value < 0 ? PAD_LEFT : 0) | (ev->value > 0 ? PAD_RIGHT : 0);
+                break;
+            case ABS_HAT0Y:
+                dev->hat = (dev->hat & ~(PAD_UP | PAD_DOWN)) | (ev->value < 0 ? PAD_UP : 0) | (ev->value > 0 ? PAD_DOWN : 0);
+                break;
+        }
+    }
+    else if (ev->type == EV_SYN && ev->code == SYN_REPORT)                  // end of a set of changes
+    {
+        evdev_pad_update (dev, usec);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_open - open /dev/input/eventN if it is a wanted keyboard or gamepad
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_open (int number)
+{
+    unsigned long       evbits[NLONGS (EV_CNT)];
+    unsigned long       keybits[NLONGS (KEY_CNT)];
+    EVDEV_DEVICE *      dev = (EVDEV_DEVICE *) 0;
+    struct epoll_event  event;
+    struct input_absinfo absinfo;
+    char                path[sizeof (EVDEV_DIR) + 16];
+    uint_fast8_t        kind = 0;
+    int                 clockid = CLOCK_MONOTONIC;
+    int                 fd;
+    int                 idx;
+
+    for (idx = 0; idx < EVDEV_MAX_DEVICES; idx++)
+    {
+        if (devices[idx].fd >= 0)
+        {
+            if (devices[idx].number == number)                              // already open
+            {
+                return;
+            }
+        }
+        else if (! dev)
+        {
+            dev = devices + idx;
+        }
+    }
+
+    if (! dev)
+    {
+        return;
+    }
+
+    snprintf (path, sizeof (path), "%s/event%d", EVDEV_DIR, number);
+    fd = open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return;
+    }
+
+    memset (evbits, 0, sizeof (evbits));
+    memset (keybits, 0, sizeof (keybits));
+
+    if (ioctl (fd, EVIOCGBIT (0, sizeof (evbits)), evbits) >= 0 && TEST_BIT (evbits, EV_KEY) &&
+        ioctl (fd, EVIOCGBIT (EV_KEY, sizeof (keybits)), keybits) >= 0)
+    {
+        if ((wanted_kinds & LXEVDEV_KEYBOARD) && TEST_BIT (keybits, KEY_A) && TEST_BIT (keybits, KEY_SPACE))
+        {
+            kind = LXEVDEV_KEYBOARD;
+        }
+        else if ((wanted_kinds & LXEVDEV_GAMEPAD) && (TEST_BIT (keybits, BTN_GAMEPAD) || TEST_BIT (keybits, BTN_JOYSTICK)) &&
+                 pads_used != (1 << EVDEV_MAX_PADS) - 1)
+        {
+            kind = LXEVDEV_GAMEPAD;
+        }
+    }
+
+    if (! kind)
+    {
+        close (fd);
+        return;
+    }
+
+    (void) ioctl (fd, EVIOCSCLOCKID, &clockid);                             // timestamps comparable with z80_idle_time()
+
+    memset (dev, 0, sizeof (EVDEV_DEVICE));
+    dev->fd     = fd;
+    dev->number = number;
+    dev->kind   = kind;
+
+    if (kind == LXEVDEV_GAMEPAD)
+    {
+        while (pads_used & (1 << dev->pad))
+        {
+            dev->pad++;
+        }
+
+        pads_used |= 1 << dev->pad;
+
+        for (idx = 0; idx < 2; idx++)
+        {
+            if (ioctl (fd, EVIOCGABS (idx == 0 ? ABS_X : ABS_Y), &absinfo) >= 0)
+            {
+                dev->abs_min[idx] = absinfo.minimum;
+                dev->abs_max[idx] = absinfo.maximum;
+            }
+        }
+    }
+
+    event.events    = EPOLLIN;
+    event.data.ptr  = dev;
+    epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_close - close device, release all directions of a gamepad
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_close (EVDEV_DEVICE * dev)
+{
+    if (dev->kind == LXEVDEV_GAMEPAD)
+    {
+        dev->axes       = 0;
+        dev->hat        = 0;
+        dev->dpad       = 0;
+        dev->buttons    = 0;
+        evdev_pad_update (dev, evdev_now_usec ());
+        pads_used &= ~(1 << dev->pad);
+    }
+
+    epoll_ctl (epoll_fd, EPOLL_CTL_DEL, dev->fd, (struct epoll_event *) 0);
+    close (dev->fd);
+    dev->fd = -1;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_read - read events of device, close it if it has been unplugged
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_read (EVDEV_DEVICE * dev)
+{
+    struct input_event  ev[64];
+    ssize_t             n;
+    int                 i;
+
+    n = read (dev->fd, ev, sizeof (ev));
+
+    if (n < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR)                              // ENODEV: unplugged
+        {
+            evdev_close (dev);
+        }
+        return;
+    }
+
+    for (i = 0; i < (int) (n / sizeof (ev[0])); i++)
+    {
+        uint64_t    usec = 1000000ULL * ev[i].input_event_sec + ev[i].input_event_usec;
+
+        if (dev->kind == LXEVDEV_KEYBOARD)
+        {
+            if (ev[i].type == EV_KEY)
+            {
+                evdev_key (usec, ev[i].code, ev[i].value);
+            }
+        }
+        else
+        {
+            evdev_pad_event (dev, usec, ev + i);
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_hotplug - open devices which have been created or got new permissions in /dev/input
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_hotplug (void)
+{
+    char                            buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event *    ie;
+    ssize_t                         n;
+    char *                          p;
+    int                             number;
+
+    n = read (inotify_fd, buf, sizeof (buf));
+
+    for (p = buf; n > 0 && p < buf + n; p += sizeof (struct inotify_event) + ie->len)
+    {
+        ie = (const struct inotify_event *) p;
+
+        if (ie->len && sscanf (ie->name, "event%d", &number) == 1)
+        {
+            evdev_open (number);
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_thread - input thread
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void *
+evdev_thread (void * arg)
+{
+    struct epoll_event  events[EVDEV_MAX_DEVICES + 1];
+    int                 n;
+    int                 i;
+
+    (void) arg;
+
+    while (! atomic_load (&input_stop))
+    {
+        n = epoll_wait (epoll_fd, events, EVDEV_MAX_DEVICES + 1, 100);     // timeout: check input_stop
+
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr)
+            {
+                EVDEV_DEVICE * dev = events[i].data.ptr;
+
+                if (dev->fd >= 0)                                           // may have been closed in this loop
+                {
+                    evdev_read (dev);
+                }
+            }
+            else
+            {
+                evdev_hotplug ();
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxevdev_start - open keyboards and/or gamepads and start input thread
+ *
+ * Return value: kinds of devices found (LXEVDEV_KEYBOARD, LXEVDEV_GAMEPAD), -1 on error
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxevdev_start (uint_fast8_t kinds)
+{
+    struct epoll_event  event;
+    struct dirent *     de;
+    DIR *               dir;
+    int                 number;
+    int                 found = 0;
+    int                 idx;
+    int                 err;
+
+    wanted_kinds    = kinds;
+    pads_used       = 0;
+    ref_usec        = 0;
+    rate_usec       = 0;
+    memset (pad_pressed, 0xFF, sizeof (pad_pressed));
+    atomic_store (&queue_tail, atomic_load (&queue_head));
+    atomic_store (&input_stop, 0);
+
+    for (idx = 0; idx < EVDEV_MAX_DEVICES; idx++)
+    {
+        devices[idx].fd = -1;
+    }
+
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+
+    if (epoll_fd < 0)
+    {
+        perror ("epoll_create1");
+        return -1;
+    }
+
+    inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+
+    if (inotify_fd >= 0 && inotify_add_watch (inotify_fd, EVDEV_DIR, IN_CREATE | IN_ATTRIB) >= 0)
+    {
+        event.events    = EPOLLIN;
+        event.data.ptr  = NULL;
+        epoll_ctl (epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event);
+    }
+    else if (inotify_fd >= 0)                                               // no hotplug
+    {
+        close (inotify_fd);
+        inotify_fd = -1;
+    }
+
+    dir = opendir (EVDEV_DIR);
+
+    if (dir)
+    {
+        while ((de = readdir (dir)) != NULL)
+        {
+            if (sscanf (de->d_name, "event%d", &number) == 1)
+            {
+                evdev_open (number);
+            }
+        }
+
+        closedir (dir);
+    }
+
+    for (idx = 0; idx < EVDEV_MAX_DEVICES; idx++)
+    {
+        if (devices[idx].fd >= 0)
+        {
+            found |= devices[idx].kind;
+        }
+    }
+
+    err = pthread_create (&input_tid, NULL, &evdev_thread, NULL);
+
+    if (err != 0)
+    {
+        fprintf (stderr, "can't create thread :[%s]\n", strerror (err));
+        lxevdev_active = 1;                                                 // let lxevdev_stop() close everything
+        atomic_store (&input_stop, 1);
+        input_tid = pthread_self ();
+        lxevdev_stop ();
+        return -1;
+    }
+
+    lxevdev_active = 1;
+    return found;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxevdev_stop - stop input thread and close all devices
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxevdev_stop (void)
+{
+    int     idx;
+
+    if (! lxevdev_active)
+    {
+        return;
+    }
+
+    lxevdev_active = 0;
+    atomic_store (&input_stop, 1);
+
+    if (! pthread_equal (input_tid, pthread_self ()))
+    {
+        pthread_join (input_tid, NULL);
+    }
+
+    for (idx = 0; idx < EVDEV_MAX_DEVICES; idx++)
+    {
+        if (devices[idx].fd >= 0)
+        {
+            close (devices[idx].fd);
+            devices[idx].fd = -1;
+        }
+    }
+
+    if (inotify_fd >= 0)
+    {
+        close (inotify_fd);
+        inotify_fd = -1;
+    }
+
+    close (epoll_fd);
+    epoll_fd = -1;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxevdev_tick - set clock cycle at which the next 10 msec slice starts and the real time it starts at, 0 if not in real time
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxevdev_tick (uint32_t cycles, uint64_t usec)
+{
+    if (usec && ref_usec && usec > ref_usec && usec - ref_usec < 50000)     // plausible distance: take rate
+    {
+        rate_cycles = cycles - ref_cycles;
+        rate_usec   = usec - ref_usec;
+    }
+    else if (! usec)
+    {
+        rate_usec   = 0;
+    }
+
+    ref_cycles  = cycles;
+    ref_usec    = usec;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * evdev_apply_pad - press or release direction of pad
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+evdev_apply_pad (uint_fast8_t pad, uint_fast8_t direction, uint_fast8_t pressed)
+{
+    uint_fast8_t    type;
+
+    if (pad >= EVDEV_MAX_PADS || direction >= PAD_DIRECTIONS)
+    {
+        return;
+    }
+
+    if (pad_pressed[pad][direction] != 0xFF)                                // release key pressed before, joystick may have changed
+    {
+        zxio_release_key (pad_pressed[pad][direction]);
+        pad_pressed[pad][direction] = 0xFF;
+    }
+
+    if (pressed)
+    {
+        if (pad == 0)
+        {
+            type = joystick_type;
+        }
+        else
+        {
+            type = (joystick_type == JOYSTICK_SINCLAIR_P2) ? JOYSTICK_SINCLAIR_P1 : JOYSTICK_SINCLAIR_P2;
+        }
+
+        pad_pressed[pad][direction] = pad_keys[type][direction];
+        zxio_press_key (pad_pressed[pad][direction]);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxevdev_apply - apply all events which are due at the current clock cycle, called by emulation thread
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxevdev_apply (void)
+{
+    unsigned int    tail    = atomic_load_explicit (&queue_tail, memory_order_relaxed);
+    unsigned int    head    = atomic_load_explicit (&queue_head, memory_order_acquire);
+    uint32_t        cycles  = z80_get_clockcycles ();
+    EVDEV_EVENT *   ev;
+
+    while (tail != head)
+    {
+        ev = queue + (tail & (EVDEV_QUEUE_SIZE - 1));
+
+        if (rate_usec && ev->usec > ref_usec && ev->usec - ref_usec < rate_usec)    // within current slice
+        {
+            uint32_t    due = ref_cycles + (uint32_t) ((ev->usec - ref_usec) * rate_cycles / rate_usec);
+
+            if ((int32_t) (cycles - due) < 0)                               // not yet
+            {
+                break;
+            }
+        }
+
+        if (ev->kind == EVDEV_KIND_KEY)
+        {
+            if (ev->pressed)
+            {
+                lxkeypress (ev->code);
+            }
+            else
+            {
+                lxkeyrelease (ev->code);
+            }
+        }
+        else
+        {
+            evdev_apply_pad (ev->code >> 8, ev->code & 0xFF, ev->pressed);
+        }
+
+        tail++;
+        atomic_store_explicit (&queue_tail, tail, memory_order_release);
+    }
+}
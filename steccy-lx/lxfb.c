@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
 #include <fcntl.h>
 #include <linux/fb.h>
@@ -96,6 +97,21 @@ draw_rectangle (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint32_t col
     }
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * put_image - copy image with w x h pixels and stride (in pixels) to position x, y
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+put_image (const uint32_t * image, uint32_t stride, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    uint16_t    row;
+
+    for (row = 0; row < h; row++)
+    {
+        memcpy (fbp + (y + row) * fb_line_length + x, image + row * stride, w * sizeof (uint32_t));
+    }
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * fb_deinit - deinit framebuffer routines
  *-------------------------------------------------------------------------------------------------------------------------------------------
@@ -29,6 +29,7 @@
 
 extern void                 fill_rectangle (uint16_t, uint16_t, uint16_t, uint16_t, uint32_t);
 extern void                 draw_rectangle (uint16_t, uint16_t, uint16_t, uint16_t, uint32_t);
+extern void                 put_image (const uint32_t *, uint32_t, uint16_t, uint16_t, uint16_t, uint16_t);
 extern int                  fb_init (char *);
 extern void                 fb_deinit (void);
 
@@ -0,0 +1,723 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxheadless.c - headless STECCY for regression tests
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "z80.h"
+#include "zxram.h"
+#include "zxscr.h"
+#include "zxio.h"
+#include "lxmenu.h"
+#include "lxcapture.h"
+#include "lxctrl.h"
+#include "lxrec.h"
+#include "lxtrace.h"
+#include "lxcoverage.h"
+#include "lxbench.h"
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * steccy-headless runs the emulation without display, keyboard or sleeping and is driven by frame counts only. At selected frames
+ * it computes an xxHash64 of the 6912 bytes screen memory plus border color and flash state. The hashes are either written to
+ * a golden file or compared against one. The first divergent frame is reported and can be dumped as PPM.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define HASH_INPUT_LEN          (6912 + 2)                                      // screen memory + border color + flash state
+#define KEY_PRESS_FRAMES        4                                               // every key is pressed 4 frames, released 4 frames
+
+typedef struct
+{
+    uint32_t                    frame;
+    uint64_t                    hash;
+} GOLDEN;
+
+static const char *             golden_fname;                                   // compare against this file
+static const char *             write_fname;                                    // write golden file
+static const char *             dump_prefix;                                    // dump frames as <prefix>-<frame>.ppm
+static const char *             load_fname;                                     // tape or snapshot
+static const char *             rom_fname;
+static const char *             keys;                                           // keys to type
+static uint32_t                 keys_start      = 100;                          // frame of first key
+static uint32_t                 max_frames      = 500;
+static uint32_t                 every_frames    = 50;
+static const char *             verify;                                         // core to verify against interpreter
+static const char *             core;                                           // core: interp, block or jit
+static const char *             bench;                                          // microbenchmark result file
+
+static GOLDEN *                 golden;
+static uint32_t                 n_golden;
+static uint32_t                 golden_idx;
+static FILE *                   write_fp;
+
+static uint32_t                 frame;
+static int                      exit_code;
+
+uint_fast8_t                    z80_display_cached;                             // no display: only used by boot cache
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * xxh64 - xxHash64 of a buffer
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define XXH_PRIME64_1           0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2           0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3           0x165667B19E3779F9ULL
+#define XXH_PRIME64_4           0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5           0x27D4EB2F165667C5ULL
+#define XXH_ROTL64(x,r)         (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t
+xxh64_read64 (const uint8_t * p)
+{
+    uint64_t    v;
+
+    memcpy (&v, p, sizeof (v));                                                 // host is little endian
+    return v;
+}
+
+static uint32_t
+xxh64_read32 (const uint8_t * p)
+{
+    uint32_t    v;
+
+    memcpy (&v, p, sizeof (v));
+    return v;
+}
+
+static uint64_t
+xxh64_round (uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc  = XXH_ROTL64 (acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static uint64_t
+xxh64_merge (uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round (0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static uint64_t
+xxh64 (const uint8_t * p, size_t len, uint64_t seed)
+{
+    const uint8_t * end = p + len;
+    uint64_t        h;
+
+    if (len >= 32)
+    {
+        uint64_t    v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t    v2 = seed + XXH_PRIME64_2;
+        uint64_t    v3 = seed;
+        uint64_t    v4 = seed - XXH_PRIME64_1;
+
+        while (p + 32 <= end)
+        {
+            v1 = xxh64_round (v1, xxh64_read64 (p));
+            v2 = xxh64_round (v2, xxh64_read64 (p + 8));
+            v3 = xxh64_round (v3, xxh64_read64 (p + 16));
+            v4 = xxh64_round (v4, xxh64_read64 (p + 24));
+            p += 32;
+        }
+
+        h = XXH_ROTL64 (v1, 1) + XXH_ROTL64 (v2, 7) + XXH_ROTL64 (v3, 12) + XXH_ROTL64 (v4, 18);
+        h = xxh64_merge (h, v1);
+        h = xxh64_merge (h, v2);
+        h = xxh64_merge (h, v3);
+        h = xxh64_merge (h, v4);
+    }
+    else
+    {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += len;
+
+    while (p + 8 <= end)
+    {
+        h ^= xxh64_round (0, xxh64_read64 (p));
+        h  = XXH_ROTL64 (h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= xxh64_read32 (p) * XXH_PRIME64_1;
+        h  = XXH_ROTL64 (h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= *p * XXH_PRIME64_5;
+        h  = XXH_ROTL64 (h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * read_golden - read golden file: one line "<frame> <hash>" per selected frame, frames ascending
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+read_golden (const char * fname)
+{
+    char                buf[128];
+    FILE *              fp;
+    unsigned long       f;
+    unsigned long long  h;
+    uint32_t            size = 0;
+
+    fp = fopen (fname, "r");
+
+    if (! fp)
+    {
+        perror (fname);
+        return -1;
+    }
+
+    while (fgets (buf, sizeof (buf), fp))
+    {
+        if (buf[0] == '#' || sscanf (buf, "%lu %llx", &f, &h) != 2)
+        {
+            continue;
+        }
+
+        if (n_golden > 0 && f <= golden[n_golden - 1].frame)
+        {
+            fprintf (stderr, "%s: frame %lu not ascending\n", fname, f);
+            fclose (fp);
+            return -1;
+        }
+
+        if (n_golden == size)
+        {
+            size = size ? 2 * size : 256;
+            golden = realloc (golden, size * sizeof (GOLDEN));
+
+            if (! golden)
+            {
+                fprintf (stderr, "%s: out of memory\n", fname);
+                fclose (fp);
+                return -1;
+            }
+        }
+
+        golden[n_golden].frame  = (uint32_t) f;
+        golden[n_golden].hash   = (uint64_t) h;
+        n_golden++;
+    }
+
+    fclose (fp);
+
+    if (n_golden == 0)
+    {
+        fprintf (stderr, "%s: no frames found\n", fname);
+        return -1;
+    }
+
+    max_frames = golden[n_golden - 1].frame;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * dump_frame - write native frame as PPM
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+dump_frame (const uint8_t * screen, uint_fast8_t border_color, uint_fast8_t inverse)
+{
+    static uint8_t  index[ZX_NATIVE_HEIGHT][ZX_NATIVE_WIDTH];
+    char            fname[Z80_MAX_FILENAME_LEN + 1];
+    FILE *          fp;
+    unsigned int    y;
+    unsigned int    x;
+
+    snprintf (fname, sizeof (fname), "%s-%06u.ppm", dump_prefix, frame);
+    fp = fopen (fname, "wb");
+
+    if (! fp)
+    {
+        perror (fname);
+        return;
+    }
+
+    lxcapture_render (screen, border_color, inverse, index);
+    fprintf (fp, "P6\n%d %d\n255\n", ZX_NATIVE_WIDTH, ZX_NATIVE_HEIGHT);
+
+    for (y = 0; y < ZX_NATIVE_HEIGHT; y++)
+    {
+        for (x = 0; x < ZX_NATIVE_WIDTH; x++)
+        {
+            uint32_t    rgb = zxscr_rgbvalues[index[y][x]];
+
+            fputc ((rgb >> 16) & 0xFF, fp);
+            fputc ((rgb >>  8) & 0xFF, fp);
+            fputc ((rgb >>  0) & 0xFF, fp);
+        }
+    }
+
+    fclose (fp);
+    printf ("frame %u dumped to %s\n", frame, fname);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * type_key - press and release keys of key string, "\n" is ENTER, '"' is SYMBOL SHIFT + P, uppercase letters use CAPS SHIFT
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+type_key (void)
+{
+    static const uint8_t    letters[26] =
+    {
+        MATRIX_KEY_A_IDX, MATRIX_KEY_B_IDX, MATRIX_KEY_C_IDX, MATRIX_KEY_D_IDX, MATRIX_KEY_E_IDX, MATRIX_KEY_F_IDX, MATRIX_KEY_G_IDX,
+        MATRIX_KEY_H_IDX, MATRIX_KEY_I_IDX, MATRIX_KEY_J_IDX, MATRIX_KEY_K_IDX, MATRIX_KEY_L_IDX, MATRIX_KEY_M_IDX, MATRIX_KEY_N_IDX,
+        MATRIX_KEY_O_IDX, MATRIX_KEY_P_IDX, MATRIX_KEY_Q_IDX, MATRIX_KEY_R_IDX, MATRIX_KEY_S_IDX, MATRIX_KEY_T_IDX, MATRIX_KEY_U_IDX,
+        MATRIX_KEY_V_IDX, MATRIX_KEY_W_IDX, MATRIX_KEY_X_IDX, MATRIX_KEY_Y_IDX, MATRIX_KEY_Z_IDX
+    };
+    static const uint8_t    digits[10] =
+    {
+        MATRIX_KEY_0_IDX, MATRIX_KEY_1_IDX, MATRIX_KEY_2_IDX, MATRIX_KEY_3_IDX, MATRIX_KEY_4_IDX,
+        MATRIX_KEY_5_IDX, MATRIX_KEY_6_IDX, MATRIX_KEY_7_IDX, MATRIX_KEY_8_IDX, MATRIX_KEY_9_IDX
+    };
+    static const char *     p;
+    uint32_t                t;
+    uint_fast8_t            ch;
+    int                     key     = -1;
+    int                     shift   = -1;
+
+    if (! keys || frame < keys_start)
+    {
+        return;
+    }
+
+    t = frame - keys_start;
+
+    if (t == 0)
+    {
+        p = keys;
+    }
+
+    if (! *p)
+    {
+        return;
+    }
+
+    ch = *p;
+
+    if (ch == '\\' && p[1] == 'n')
+    {
+        key = MATRIX_KEY_ENTER_IDX;
+    }
+    else if (ch >= 'a' && ch <= 'z')
+    {
+        key = letters[ch - 'a'];
+    }
+    else if (ch >= 'A' && ch <= 'Z')
+    {
+        key     = letters[ch - 'A'];
+        shift   = MATRIX_KEY_SHIFT_IDX;
+    }
+    else if (ch >= '0' && ch <= '9')
+    {
+        key = digits[ch - '0'];
+    }
+    else if (ch == ' ')
+    {
+        key = MATRIX_KEY_SPACE_IDX;
+    }
+    else if (ch == '"')
+    {
+        key     = MATRIX_KEY_P_IDX;
+        shift   = MATRIX_KEY_SYM_IDX;
+    }
+
+    if (t % (2 * KEY_PRESS_FRAMES) == 0 && key >= 0)
+    {
+        if (shift >= 0)
+        {
+            zxio_press_key (shift);
+        }
+
+        zxio_press_key (key);
+    }
+    else if (t % (2 * KEY_PRESS_FRAMES) == KEY_PRESS_FRAMES)
+    {
+        if (key >= 0)
+        {
+            zxio_release_key (key);
+        }
+
+        if (shift >= 0)
+        {
+            zxio_release_key (shift);
+        }
+    }
+    else if (t % (2 * KEY_PRESS_FRAMES) == 2 * KEY_PRESS_FRAMES - 1)
+    {
+        p += (ch == '\\' && p[1] == 'n') ? 2 : 1;                               // next character
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * zxscr_update_display - called every 20 msec of emulated time: type keys, hash and compare selected frames
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxscr_update_display (void)
+{
+    uint8_t         input[HASH_INPUT_LEN];
+    uint_fast8_t    inverse;
+    uint_fast8_t    selected;
+    uint64_t        hash;
+
+    frame++;
+
+    if (bench)                                                                  // bench mode: no keys, hashes or capture
+    {
+        lxbench_frame ();
+        return;
+    }
+
+    inverse = (frame / 16) & 0x01;                                              // same flash phase as Linux display
+
+    if (lxcapture_active)
+    {
+        lxcapture_frame (inverse);
+    }
+
+    type_key ();
+
+    if (golden)
+    {
+        selected = (golden_idx < n_golden && golden[golden_idx].frame == frame);
+    }
+    else
+    {
+        selected = (frame % every_frames == 0);
+    }
+
+    if (selected)
+    {
+        memcpy (input, zx_ram_screen_addr(ZX_SPECTRUM_DISPLAY_START_ADDRESS), 6912);
+        input[6912] = zx_border_color;
+        input[6913] = inverse;
+        hash = xxh64 (input, HASH_INPUT_LEN, 0);
+
+        if (write_fp)
+        {
+            fprintf (write_fp, "%u %016llx\n", frame, (unsigned long long) hash);
+        }
+
+        if (golden)
+        {
+            if (golden[golden_idx].hash != hash)
+            {
+                printf ("frame %u differs: hash %016llx, expected %016llx\n", frame, (unsigned long long) hash,
+                        (unsigned long long) golden[golden_idx].hash);
+
+                if (dump_prefix)
+                {
+                    dump_frame (input, zx_border_color, inverse);
+                }
+
+                exit_code = 1;
+                steccy_exit = 1;
+            }
+
+            golden_idx++;
+        }
+        else if (dump_prefix)
+        {
+            dump_frame (input, zx_border_color, inverse);
+        }
+    }
+
+    if (max_frames && frame >= max_frames)
+    {
+        steccy_exit = 1;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu functions: no menu in headless mode
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+menu (char * path, uint_fast8_t poke_file_active)
+{
+    (void) path;
+    (void) poke_file_active;
+}
+
+char *
+menu_start_load (char * path)
+{
+    (void) path;
+    return (char *) 0;
+}
+
+void
+menu_update_status (void)
+{
+}
+
+void
+menu_redraw (uint_fast8_t poke_file_active)
+{
+    (void) poke_file_active;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_init - called after ini file is read: override settings by command line
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+menu_init (void)
+{
+    z80_settings.turbo_mode = 1;                                                // never sleep
+    z80_settings.boot_cache = 0;                                                // always cold boot, never write cache
+
+    if (core)
+    {
+        z80_settings.block_cache    = strcmp (core, "interp") != 0;
+        z80_settings.jit            = ! strcmp (core, "jit");
+    }
+
+    if (verify)                                                                 // lockstep: block cache or JIT against interpreter
+    {
+        z80_settings.block_cache    = 1;
+        z80_settings.jit            = ! strcmp (verify, "jit");
+        z80_settings.block_verify   = 1;
+    }
+
+    if (lxrec_mode == LXREC_REPLAY)                                             // ROM and file are in the recording
+    {
+        return;
+    }
+
+    if (rom_fname)
+    {
+        z80_load_rom (rom_fname);
+    }
+
+    if (load_fname)
+    {
+        z80_set_fname_load (load_fname);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * usage - print usage
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+usage (const char * pgm)
+{
+    fprintf (stderr, "usage: %s [options]\n", pgm);
+    fprintf (stderr, "  -n frames    number of frames to run, 0 = until QUIT on control socket (default 500)\n");
+    fprintf (stderr, "  -e frames    hash every n-th frame (default 50)\n");
+    fprintf (stderr, "  -w file      write hashes to golden file\n");
+    fprintf (stderr, "  -g file      compare hashes at frames listed in golden file\n");
+    fprintf (stderr, "  -d prefix    dump divergent frame (or every hashed frame with -w) as <prefix>-<frame>.ppm\n");
+    fprintf (stderr, "  -r file      load ROM file\n");
+    fprintf (stderr, "  -l file      load TAP/TZX/Z80 file\n");
+    fprintf (stderr, "  -k keys      type keys, \\n is ENTER\n");
+    fprintf (stderr, "  -s frame     frame of first key (default 100)\n");
+    fprintf (stderr, "  -c name      capture name.y4m and name.wav\n");
+    fprintf (stderr, "  -u socket    listen for commands on Unix domain socket\n");
+    fprintf (stderr, "  -R file      record input into file\n");
+    fprintf (stderr, "  -P file      replay recorded input, stop at its end\n");
+    fprintf (stderr, "  -t spec      trace instructions: file[,start=pc:addr|frame:n][,stop=pc:addr|frame:n][,ring=n]\n");
+    fprintf (stderr, "  -V core      run core (block or jit) in lockstep with the interpreter, stop at first divergence\n");
+    fprintf (stderr, "  -m name      write coverage of executed code and memory accesses to name.cov and name.txt\n");
+    fprintf (stderr, "  -C core      run core interp, block or jit (default: INI file)\n");
+    fprintf (stderr, "  -B file      run microbenchmarks per opcode group, write CSV (- for stdout) or JSON (file.json)\n");
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * main - main function
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+main (int argc, char ** argv)
+{
+    const char *    capture = (char *) 0;
+    const char *    control = (char *) 0;
+    const char *    record  = (char *) 0;
+    const char *    replay  = (char *) 0;
+    const char *    trace   = (char *) 0;
+    const char *    cover   = (char *) 0;
+    int             opt;
+
+    while ((opt = getopt (argc, argv, "n:e:w:g:d:r:l:k:s:c:u:R:P:t:m:V:C:B:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':   max_frames      = strtoul (optarg, NULL, 10);   break;
+            case 'e':   every_frames    = strtoul (optarg, NULL, 10);   break;
+            case 'w':   write_fname     = optarg;                       break;
+            case 'g':   golden_fname    = optarg;                       break;
+            case 'd':   dump_prefix     = optarg;                       break;
+            case 'r':   rom_fname       = optarg;                       break;
+            case 'l':   load_fname      = optarg;                       break;
+            case 'k':   keys            = optarg;                       break;
+            case 's':   keys_start      = strtoul (optarg, NULL, 10);   break;
+            case 'c':   capture         = optarg;                       break;
+            case 'u':   control         = optarg;                       break;
+            case 'R':   record          = optarg;                       break;
+            case 'P':   replay          = optarg;                       break;
+            case 't':   trace           = optarg;                       break;
+            case 'm':   cover           = optarg;                       break;
+            case 'V':   verify          = optarg;                       break;
+            case 'C':   core            = optarg;                       break;
+            case 'B':   bench           = optarg;                       break;
+            default:    usage (argv[0]);                                return 2;
+        }
+    }
+
+    if (verify && strcmp (verify, "block") && strcmp (verify, "jit"))
+    {
+        usage (argv[0]);
+        return 2;
+    }
+
+    if (core && strcmp (core, "interp") && strcmp (core, "block") && strcmp (core, "jit"))
+    {
+        usage (argv[0]);
+        return 2;
+    }
+
+    if (bench)
+    {
+        if (lxbench_start (bench) < 0)
+        {
+            return 2;
+        }
+
+        max_frames = 0;                                                         // the benchmark stops itself
+    }
+
+    if (every_frames == 0)
+    {
+        every_frames = 1;
+    }
+
+    if (golden_fname && read_golden (golden_fname) < 0)
+    {
+        return 2;
+    }
+
+    if (write_fname)
+    {
+        write_fp = fopen (write_fname, "w");
+
+        if (! write_fp)
+        {
+            perror (write_fname);
+            return 2;
+        }
+
+        fprintf (write_fp, "# steccy golden hashes: frame xxh64\n");
+    }
+
+    if (capture && lxcapture_start (capture) < 0)
+    {
+        return 2;
+    }
+
+    if (control && lxctrl_start (control) < 0)
+    {
+        lxcapture_stop ();
+        return 2;
+    }
+
+    if ((record && lxrec_start_record (record) < 0) || (replay && lxrec_start_replay (replay, 1) < 0))
+    {
+        lxctrl_stop ();
+        lxcapture_stop ();
+        return 2;
+    }
+
+    if ((trace && lxtrace_start (trace) < 0) || (cover && lxcoverage_start (cover) < 0))
+    {
+        lxtrace_stop ();
+        lxrec_stop ();
+        lxctrl_stop ();
+        lxcapture_stop ();
+        return 2;
+    }
+
+    z80_cold_boot   = 1;                                                        // menu_init() is called after first reset
+    z80_unthrottled = 1;                                                        // never sleep, even if a replay switches turbo off
+    zx_spectrum ();
+
+    lxtrace_stop ();
+    lxcoverage_stop ();
+
+    if (lxbench_stop () < 0)
+    {
+        exit_code = 1;
+    }
+
+    if (lxrec_stop () || z80_lockstep_failed)
+    {
+        exit_code = 1;
+    }
+
+    lxctrl_stop ();
+    lxcapture_stop ();
+
+    if (write_fp)
+    {
+        fclose (write_fp);
+    }
+
+    if (golden && exit_code == 0)
+    {
+        if (golden_idx < n_golden)
+        {
+            printf ("only %u of %u frames compared\n", golden_idx, n_golden);
+            exit_code = 1;
+        }
+        else
+        {
+            printf ("%u frames ok\n", n_golden);
+        }
+    }
+
+    return exit_code;
+}
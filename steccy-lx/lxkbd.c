@@ -233,6 +233,8 @@ lxkbd_read (void *arg)
 void
 lxkbd_deinit (void)
 {
+    tcflush (fd, TCIFLUSH);                                                                     // scancodes not read if evdev keyboard was used
+
     if (ioctl (fd, KDSKBMODE, oldkbmode))
     {
         perror("KDSKBMODE");
@@ -39,6 +39,12 @@
 #endif
 
 #include "z80.h"
+#include "lxcapture.h"
+#include "lxctrl.h"
+#include "lxrec.h"
+#include "lxevdev.h"
+#include "lxtrace.h"
+#include "lxcoverage.h"
 
 #if defined FRAMEBUFFER
 #include <pthread.h>
@@ -63,6 +69,13 @@ sigcatch (int sig)
 {
     (void) sig;
 
+    lxcapture_stop ();
+    lxctrl_stop ();
+    lxrec_stop ();
+    lxevdev_stop ();
+    lxtrace_stop ();
+    lxcoverage_stop ();
+
 #if defined FRAMEBUFFER
     lxkbd_deinit ();
     fb_deinit ();
@@ -80,15 +93,80 @@ static int
 x11_main (int argc, char ** argv)
 {
     char *  geometry = (char *) "800x480";
+    char *  capture  = (char *) 0;
+    char *  control  = (char *) 0;
+    int     use_evdev = 1;
 
-    if (argc == 3)
+    while (argc >= 2)
     {
+        if (! strcmp (argv[1], "-b"))                               // cold boot: ignore cached boot state
+        {
+            z80_cold_boot = 1;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (! strcmp (argv[1], "-E"))                               // no evdev input
+        {
+            use_evdev = 0;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (argc < 3)
+        {
+            break;
+        }
+
         if (! strcmp (argv[1], "-g"))
         {
             geometry = argv[2];
-            argc -= 2;
-            argv += 2;
         }
+        else if (! strcmp (argv[1], "-c"))
+        {
+            capture = argv[2];
+        }
+        else if (! strcmp (argv[1], "-u"))
+        {
+            control = argv[2];
+        }
+        else if (! strcmp (argv[1], "-R"))
+        {
+            if (lxrec_start_record (argv[2]) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (! strcmp (argv[1], "-P"))
+        {
+            if (lxrec_start_replay (argv[2], 0) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (! strcmp (argv[1], "-t"))
+        {
+            if (lxtrace_start (argv[2]) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (! strcmp (argv[1], "-m"))
+        {
+            if (lxcoverage_start (argv[2]) < 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        argc -= 2;
+        argv += 2;
     }
 
     if (x11_init (geometry) < 0)
@@ -96,9 +174,33 @@ x11_main (int argc, char ** argv)
         return 1;
     }
 
+    if (capture && lxcapture_start (capture) < 0)
+    {
+        x11_deinit ();
+        return 1;
+    }
+
+    if (control && lxctrl_start (control) < 0)
+    {
+        lxcapture_stop ();
+        x11_deinit ();
+        return 1;
+    }
+
+    if (use_evdev)
+    {
+        lxevdev_start (LXEVDEV_GAMEPAD);                            // keyboard is read by X11
+    }
+
     signal (SIGTERM, sigcatch);
     zx_spectrum ();
 
+    lxevdev_stop ();
+    lxtrace_stop ();
+    lxcoverage_stop ();
+    lxrec_stop ();
+    lxctrl_stop ();
+    lxcapture_stop ();
     x11_deinit ();
     return 0;
 }
@@ -109,16 +211,82 @@ static int
 fb_main (int argc, char ** argv)
 {
     char *  geometry = (char *) 0;
+    char *  capture  = (char *) 0;
+    char *  control  = (char *) 0;
+    int     use_evdev = 1;
+    int     found     = 0;
     int     err;
 
-    if (argc == 3)
+    while (argc >= 2)
     {
+        if (! strcmp (argv[1], "-b"))                               // cold boot: ignore cached boot state
+        {
+            z80_cold_boot = 1;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (! strcmp (argv[1], "-E"))                               // no evdev input
+        {
+            use_evdev = 0;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (argc < 3)
+        {
+            break;
+        }
+
         if (! strcmp (argv[1], "-g"))
         {
             geometry = argv[2];
-            argc -= 2;
-            argv += 2;
         }
+        else if (! strcmp (argv[1], "-c"))
+        {
+            capture = argv[2];
+        }
+        else if (! strcmp (argv[1], "-u"))
+        {
+            control = argv[2];
+        }
+        else if (! strcmp (argv[1], "-R"))
+        {
+            if (lxrec_start_record (argv[2]) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (! strcmp (argv[1], "-P"))
+        {
+            if (lxrec_start_replay (argv[2], 0) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (! strcmp (argv[1], "-t"))
+        {
+            if (lxtrace_start (argv[2]) < 0)
+            {
+                return 1;
+            }
+        }
+        else if (! strcmp (argv[1], "-m"))
+        {
+            if (lxcoverage_start (argv[2]) < 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            break;
+        }
+
+        argc -= 2;
+        argv += 2;
     }
 
     if (lxkbd_init () < 0)
@@ -131,7 +299,38 @@ fb_main (int argc, char ** argv)
         return 1;
     }
 
-    err = pthread_create (&(tid[0]), NULL, &lxkbd_read, NULL);
+    if (capture && lxcapture_start (capture) < 0)
+    {
+        fb_deinit ();
+        return 1;
+    }
+
+    if (control && lxctrl_start (control) < 0)
+    {
+        lxcapture_stop ();
+        fb_deinit ();
+        return 1;
+    }
+
+    if (use_evdev)
+    {
+        found = lxevdev_start (LXEVDEV_KEYBOARD | LXEVDEV_GAMEPAD);
+
+        if (found >= 0 && ! (found & LXEVDEV_KEYBOARD))             // no keyboard accessible: read console
+        {
+            lxevdev_stop ();
+            found = lxevdev_start (LXEVDEV_GAMEPAD);
+        }
+    }
+
+    if (found >= 0 && (found & LXEVDEV_KEYBOARD))
+    {
+        err = 0;                                                    // keyboard is read by evdev thread
+    }
+    else
+    {
+        err = pthread_create (&(tid[0]), NULL, &lxkbd_read, NULL);
+    }
 
     if (err == 0)
     {
@@ -144,6 +343,12 @@ fb_main (int argc, char ** argv)
         return 1;
     }
 
+    lxevdev_stop ();
+    lxtrace_stop ();
+    lxcoverage_stop ();
+    lxrec_stop ();
+    lxctrl_stop ();
+    lxcapture_stop ();
     lxkbd_deinit ();
     fb_deinit ();
 
@@ -30,6 +30,7 @@
 #include "scancodes.h"
 #include "lxjoystick.h"
 #include "lxmapkey.h"
+#include "lxtrace.h"
 
 uint8_t                 lxmapkey_menu_enabled   = 0;
 volatile uint32_t       lxmapkey_menu_scancode  = 0x000;
@@ -783,6 +784,10 @@ lxkeypress (unsigned int scancode)
     {
         z80_next_turbo_mode ();
     }
+    else if (scancode == SCANCODE_F9)                                                   // start or pause trace
+    {
+        lxtrace_toggle ();
+    }
     else
     {
         lxmapkey (scancode);
@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 
 #include "z80.h"
@@ -48,6 +49,7 @@
 #include "lxmenu.h"
 #include "scancodes.h"
 #include "lxjoystick.h"
+#include "lxrec.h"
 
 #define TRUE                    1
 #define FALSE                   0
@@ -70,18 +72,17 @@
 #define MAX_SUBENTRY_LEN        59                                              // max number of characters per sub entry
 #define MENU_MAX_FILENAME_LEN   MAX_SUBENTRY_LEN                                // we can only show MAX_SUBENTRY_LEN chars
 
-#define ZXSCR_ZOOM              2
-#define ZXSCR_TOP_OFFSET        ((zx_display_height - ZXSCR_ZOOM * ZX_SPECTRUM_DISPLAY_ROWS - 2 * ZX_SPECTRUM_BORDER_SIZE) / 2)
-#define ZXSCR_LEFT_OFFSET       (((zx_display_width - 800) / 2) + 8)
+#define SUB_MENU_WIDTH          (2 * ZX_SPECTRUM_DISPLAY_COLUMNS)               // size of sub menu, independent of display scale
+#define SUB_MENU_HEIGHT         (2 * ZX_SPECTRUM_DISPLAY_ROWS)
 
-#define MAIN_MENU_START_X       ((zx_display_width - 800) / 2 + 600)            // rectangle window for main menu
-#define MAIN_MENU_START_Y       ((zx_display_height - (ZXSCR_ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + 2 * 32)) / 2)
+#define MAIN_MENU_START_X       (zx_display_left + zx_display_pic_width + 16)   // rectangle window for main menu
+#define MAIN_MENU_START_Y       (zx_display_top)
 #define MAIN_MENU_END_X         (zx_display_width - 1)                          // MAIN_MENU_END_Y not needed here
 
-#define SUB_MENU_START_X        (ZXSCR_LEFT_OFFSET + ZX_SPECTRUM_BORDER_SIZE)   // rectangle window for sub menu
-#define SUB_MENU_START_Y        (ZXSCR_TOP_OFFSET + ZX_SPECTRUM_BORDER_SIZE)
-#define SUB_MENU_END_X          (ZXSCR_LEFT_OFFSET + ZX_SPECTRUM_BORDER_SIZE + ZXSCR_ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS)
-#define SUB_MENU_END_Y          (ZXSCR_TOP_OFFSET + ZX_SPECTRUM_BORDER_SIZE  + ZXSCR_ZOOM * ZX_SPECTRUM_DISPLAY_ROWS)
+#define SUB_MENU_START_X        (zx_display_left + (zx_display_pic_width - SUB_MENU_WIDTH) / 2)     // rectangle window for sub menu
+#define SUB_MENU_START_Y        (zx_display_top + (zx_display_pic_height - SUB_MENU_HEIGHT) / 2)    // centered in ZX picture
+#define SUB_MENU_END_X          (SUB_MENU_START_X + SUB_MENU_WIDTH)
+#define SUB_MENU_END_Y          (SUB_MENU_START_Y + SUB_MENU_HEIGHT)
 #define SUB_MENU_X_OFFSET       16                                              // x position of first menu entry col
 
 #define STATUS_Y                (zx_display_height - 14)
@@ -108,14 +109,58 @@ static const char *             autostart_entries[2] =
         "Autostart: Yes"
 };
 
-typedef union
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * directory index:
+ *
+ * Scanning a large tape archive with readdir() and reading the tape headers is slow, so every directory gets an index file
+ * MENU_INDEX_FNAME with one line per file:
+ *
+ *      type <TAB> size <TAB> mtime <TAB> program name <TAB> file name
+ *
+ * The first line holds the magic and the mtime of the directory. If the directory mtime has not changed, the index is used as is.
+ * Otherwise the directory is scanned again and only files with changed size or mtime are read. The index is kept in memory, so
+ * opening the menu again only costs a stat() of the directory.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define MENU_INDEX_FNAME        ".steccy-index"                                 // name of index file in directory
+#define MENU_INDEX_MAGIC        "STECCY-INDEX 1"                                // magic in first line of index file
+#define MENU_PROGNAME_LEN       10                                              // length of program name in TAP header
+#define MENU_SEARCH_LEN         16                                              // max length of search prefix
+
+#define FILE_TYPE_NONE          0
+#define FILE_TYPE_TAP           1
+#define FILE_TYPE_TZX           2
+#define FILE_TYPE_Z80           3
+#define FILE_TYPE_ROM           4
+
+#define MENU_VIEW_TAPES         0                                               // view: TAP, TZX and Z80 files
+#define MENU_VIEW_ROMS          1                                               // view: ROM files
+#define N_MENU_VIEWS            2
+
+typedef struct
 {
-    char                        files[MAX_SUB_ENTRIES][MENU_MAX_FILENAME_LEN + 1];
-    long                        positions[MAX_SUB_ENTRIES];
-} SUBENTRIES;
-
-static SUBENTRIES               subentries;
-static uint_fast8_t             n_subentries = 0;
+    char *                      name;                                           // file name, allocated
+    uint_fast8_t                type;                                           // FILE_TYPE_xxx
+    long long                   size;                                           // file size
+    long long                   mtime;                                          // modification time of file
+    char                        progname[MENU_PROGNAME_LEN + 1];                // program name in first header, may be empty
+} MENU_FILE;
+
+typedef struct
+{
+    char                        path[Z80_MAX_FILENAME_LEN + 1];                 // path of indexed directory
+    long long                   mtime;                                          // mtime of directory at last scan
+    MENU_FILE *                 files;                                          // files, sorted by name
+    uint32_t                    n_files;                                        // number of files
+    uint32_t *                  views[N_MENU_VIEWS];                            // indexes into files, one list per view
+    uint32_t                    n_views[N_MENU_VIEWS];                          // number of entries per view
+} MENU_INDEX;
+
+static MENU_INDEX               menu_index;
+
+static long                     subentries_positions[MAX_SUB_ENTRIES];          // positions of poke entries in poke file
+static uint32_t *               subentries_view;                                // current file view, see menu_load()
+static uint32_t                 n_subentries = 0;
 static uint_fast8_t             menu_stop_active = 0;
 
 uint32_t
@@ -306,35 +351,671 @@ draw_menu_poke_entry (FILE * fp, uint_fast8_t idx, long pos, uint_fast8_t actidx
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-draw_sub_menu (FILE * poke_fp, uint_fast8_t offsetidx, uint_fast8_t activeidx)
+draw_sub_menu (FILE * poke_fp, uint32_t offsetidx, uint32_t activeidx)
 {
+    char            buf[MAX_SUBENTRY_LEN + 1];
+    MENU_FILE *     f;
     uint_fast8_t    widx;
-    uint_fast8_t    idx;
+    uint32_t        idx;
 
     if (poke_fp)
     {
         for (idx = offsetidx, widx = 0; idx < n_subentries && widx < SUB_MENU_ENTRIES; idx++, widx++)
         {
-            draw_menu_poke_entry (poke_fp, widx, subentries.positions[idx], activeidx - offsetidx, ENTRY_TYPE_NONE, MENU_LOAD_STEP_Y);
+            draw_menu_poke_entry (poke_fp, widx, subentries_positions[idx], activeidx - offsetidx, ENTRY_TYPE_NONE, MENU_LOAD_STEP_Y);
         }
     }
     else
     {
         for (idx = offsetidx, widx = 0; idx < n_subentries && widx < SUB_MENU_ENTRIES; idx++, widx++)
         {
-            draw_sub_menu_entry (widx, subentries.files[idx], activeidx - offsetidx, ENTRY_TYPE_NONE, MENU_LOAD_STEP_Y);
+            f = menu_index.files + subentries_view[idx];
+
+            if (f->progname[0])                                                 // file name left, program name right
+            {
+                snprintf (buf, MAX_SUBENTRY_LEN + 1, "%-*.*s %s", MAX_SUBENTRY_LEN - MENU_PROGNAME_LEN - 1,
+                          MAX_SUBENTRY_LEN - MENU_PROGNAME_LEN - 1, f->name, f->progname);
+                draw_sub_menu_entry (widx, buf, activeidx - offsetidx, ENTRY_TYPE_NONE, MENU_LOAD_STEP_Y);
+            }
+            else
+            {
+                draw_sub_menu_entry (widx, f->name, activeidx - offsetidx, ENTRY_TYPE_NONE, MENU_LOAD_STEP_Y);
+            }
         }
     }
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * filescmp () - compare filenames to sort
+ * filescmp () - compare files to sort, ignore case first
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static int
 filescmp (const void * p1, const void * p2)
 {
-    return strcasecmp ((const char *) p1, (const char *) p2);
+    const MENU_FILE *   f1 = (const MENU_FILE *) p1;
+    const MENU_FILE *   f2 = (const MENU_FILE *) p2;
+    int                 rtc;
+
+    rtc = strcasecmp (f1->name, f2->name);
+
+    if (rtc == 0)
+    {
+        rtc = strcmp (f1->name, f2->name);
+    }
+
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_file_type () - get file type by extension
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+menu_file_type (const char * name)
+{
+    size_t          len = strlen (name);
+    const char *    p;
+
+    if (len > 4)
+    {
+        p = name + len - 4;
+
+        if (! strcasecmp (p, ".tap"))
+        {
+            return FILE_TYPE_TAP;
+        }
+        else if (! strcasecmp (p, ".tzx"))
+        {
+            return FILE_TYPE_TZX;
+        }
+        else if (! strcasecmp (p, ".z80"))
+        {
+            return FILE_TYPE_Z80;
+        }
+        else if (! strcasecmp (p, ".rom"))
+        {
+            return FILE_TYPE_ROM;
+        }
+    }
+
+    return FILE_TYPE_NONE;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_read_progname () - read program name of first header in TAP or TZX file
+ *
+ * TAP: 2 bytes block length (19), flag 0x00, type, 10 chars name
+ * TZX: "ZXTape!\x1A", version, then blocks. Text (0x30) and archive info (0x32) blocks are skipped, the first standard
+ *      speed data block (0x10) has 2 bytes pause, then the same data as a TAP block.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+menu_read_progname (const char * path, MENU_FILE * f)
+{
+    char            fname[2 * Z80_MAX_FILENAME_LEN + 2];                        // +2: '/' and '\0'
+    uint8_t         buf[512];
+    FILE *          fp;
+    size_t          len;
+    size_t          pos         = 0;
+    uint_fast8_t    i;
+
+    f->progname[0] = '\0';
+
+    if (f->type != FILE_TYPE_TAP && f->type != FILE_TYPE_TZX)
+    {
+        return;
+    }
+
+    snprintf (fname, sizeof (fname), "%s/%s", path, f->name);
+    fp = fopen (fname, "rb");
+
+    if (! fp)
+    {
+        return;
+    }
+
+    len = fread (buf, 1, sizeof (buf), fp);
+    fclose (fp);
+
+    if (f->type == FILE_TYPE_TZX)
+    {
+        if (len < 10 || memcmp (buf, "ZXTape!\x1A", 8) != 0)
+        {
+            return;
+        }
+
+        pos = 10;
+
+        for (i = 0; i < 8 && pos < len; i++)
+        {
+            if (buf[pos] == 0x10)                                               // standard speed data block
+            {
+                pos += 3;                                                       // skip id and pause
+                break;
+            }
+            else if (buf[pos] == 0x30 && pos + 1 < len)                         // text description
+            {
+                pos += 2 + buf[pos + 1];
+            }
+            else if (buf[pos] == 0x32 && pos + 2 < len)                         // archive info
+            {
+                pos += 3 + (buf[pos + 1] | (buf[pos + 2] << 8));
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+
+    if (pos + 14 <= len && buf[pos] == 19 && buf[pos + 1] == 0 && buf[pos + 2] == 0x00)   // header block
+    {
+        for (i = 0; i < MENU_PROGNAME_LEN; i++)
+        {
+            uint8_t ch = buf[pos + 4 + i];
+
+            f->progname[i] = (ch >= 0x20 && ch < 0x7F) ? ch : '?';
+        }
+
+        for (len = MENU_PROGNAME_LEN; len > 0 && f->progname[len - 1] == ' '; len--)
+        {
+            ;
+        }
+
+        f->progname[len] = '\0';
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_stat_mtime () - get mtime in nanoseconds, seconds are too coarse to see changes made in the same second
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static long long
+menu_stat_mtime (const struct stat * st)
+{
+    return (long long) st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_free () - free list of files
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+menu_index_free (MENU_FILE * files, uint32_t n_files)
+{
+    uint32_t    idx;
+
+    for (idx = 0; idx < n_files; idx++)
+    {
+        free (files[idx].name);
+    }
+
+    free (files);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_append () - append a file to list, returns pointer to new entry or NULL
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static MENU_FILE *
+menu_index_append (MENU_FILE ** filesp, uint32_t * n_filesp, uint32_t * max_filesp, const char * name)
+{
+    MENU_FILE * f;
+
+    if (*n_filesp == *max_filesp)
+    {
+        uint32_t    new_max     = *max_filesp ? 2 * *max_filesp : 256;
+        MENU_FILE * new_files   = realloc (*filesp, new_max * sizeof (MENU_FILE));
+
+        if (! new_files)
+        {
+            return (MENU_FILE *) NULL;
+        }
+
+        *filesp = new_files;
+        *max_filesp = new_max;
+    }
+
+    f = *filesp + *n_filesp;
+    f->name = strdup (name);
+
+    if (! f->name)
+    {
+        return (MENU_FILE *) NULL;
+    }
+
+    f->progname[0] = '\0';
+    (*n_filesp)++;
+    return f;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_find () - binary search file in sorted list
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static MENU_FILE *
+menu_index_find (MENU_FILE * files, uint32_t n_files, const char * name)
+{
+    MENU_FILE   key;
+    uint32_t    lo = 0;
+    uint32_t    hi = n_files;
+    uint32_t    mid;
+    int         rtc;
+
+    key.name = (char *) name;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        rtc = filescmp (&key, files + mid);
+
+        if (rtc == 0)
+        {
+            return files + mid;
+        }
+        else if (rtc < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    return (MENU_FILE *) NULL;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_read () - read index file of directory
+ *
+ * Returns the mtime of the directory stored in the index file, -1 if there is no valid index file.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static long long
+menu_index_read (const char * path, MENU_FILE ** filesp, uint32_t * n_filesp)
+{
+    char            buf[2 * Z80_MAX_FILENAME_LEN + 64];
+    char *          field[5];
+    uint32_t        max_files   = 0;
+    long long       dir_mtime   = -1;
+    MENU_FILE *     f;
+    FILE *          fp;
+    char *          p;
+    uint_fast8_t    i;
+
+    *filesp = (MENU_FILE *) NULL;
+    *n_filesp = 0;
+
+    snprintf (buf, sizeof (buf), "%s/%s", path, MENU_INDEX_FNAME);
+    fp = fopen (buf, "r");
+
+    if (! fp)
+    {
+        return -1;
+    }
+
+    if (fgets (buf, sizeof (buf), fp) && ! strncmp (buf, MENU_INDEX_MAGIC " ", sizeof (MENU_INDEX_MAGIC)))
+    {
+        dir_mtime = atoll (buf + sizeof (MENU_INDEX_MAGIC));
+
+        while (fgets (buf, sizeof (buf), fp))
+        {
+            p = strchr (buf, '\n');
+
+            if (! p)                                                            // line too long: index is invalid
+            {
+                dir_mtime = -1;
+                break;
+            }
+
+            *p = '\0';
+            p = buf;
+
+            for (i = 0; i < 5; i++)                                             // split into 5 fields
+            {
+                field[i] = p;
+
+                if (i < 4)
+                {
+                    p = strchr (p, '\t');
+
+                    if (! p)
+                    {
+                        break;
+                    }
+
+                    *p++ = '\0';
+                }
+            }
+
+            if (i < 5 || ! *field[4])
+            {
+                dir_mtime = -1;
+                break;
+            }
+
+            f = menu_index_append (filesp, n_filesp, &max_files, field[4]);
+
+            if (! f)
+            {
+                dir_mtime = -1;
+                break;
+            }
+
+            f->type     = atoi (field[0]);
+            f->size     = atoll (field[1]);
+            f->mtime    = atoll (field[2]);
+            strncpy (f->progname, field[3], MENU_PROGNAME_LEN);
+            f->progname[MENU_PROGNAME_LEN] = '\0';
+        }
+    }
+
+    fclose (fp);
+
+    if (dir_mtime < 0)
+    {
+        menu_index_free (*filesp, *n_filesp);
+        *filesp = (MENU_FILE *) NULL;
+        *n_filesp = 0;
+    }
+
+    return dir_mtime;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_write () - write index file of directory, errors are ignored, e.g. read-only directories
+ *
+ * Creating the index file changes the mtime of the directory itself. So the new mtime is patched into the first line afterwards,
+ * the mtime is written with a fixed width for this purpose.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+menu_index_write (void)
+{
+    char            fname[2 * Z80_MAX_FILENAME_LEN + 2];
+    char            tmpname[2 * Z80_MAX_FILENAME_LEN + 6];
+    struct stat     st;
+    MENU_FILE *     f;
+    FILE *          fp;
+    uint32_t        idx;
+    int             ok;
+
+    snprintf (fname, sizeof (fname), "%s/%s", menu_index.path, MENU_INDEX_FNAME);
+    snprintf (tmpname, sizeof (tmpname), "%s.tmp", fname);
+
+    fp = fopen (tmpname, "w");
+
+    if (! fp)
+    {
+        return;
+    }
+
+    fprintf (fp, "%s %020lld\n", MENU_INDEX_MAGIC, menu_index.mtime);
+
+    for (idx = 0; idx < menu_index.n_files; idx++)
+    {
+        f = menu_index.files + idx;
+
+        if (! strchr (f->name, '\n') && ! strchr (f->name, '\t'))               // such names are listed, but not indexed
+        {
+            fprintf (fp, "%d\t%lld\t%lld\t%s\t%s\n", (int) f->type, f->size, f->mtime, f->progname, f->name);
+        }
+    }
+
+    ok = ! ferror (fp);
+
+    if (fclose (fp) != 0 || ! ok || rename (tmpname, fname) != 0)
+    {
+        unlink (tmpname);
+        return;
+    }
+
+    if (stat (menu_index.path, &st) == 0)
+    {
+        menu_index.mtime = menu_stat_mtime (&st);
+        fp = fopen (fname, "r+");
+
+        if (fp)
+        {
+            fprintf (fp, "%s %020lld\n", MENU_INDEX_MAGIC, menu_index.mtime);
+            fclose (fp);
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_scan () - scan directory, take program names of old list if size and mtime are unchanged
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+menu_index_scan (MENU_FILE * old_files, uint32_t n_old_files)
+{
+    char            fname[2 * Z80_MAX_FILENAME_LEN + 2];
+    uint32_t        max_files   = 0;
+    DIR *           dir;
+    struct dirent * dp;
+    struct stat     st;
+    uint_fast8_t    type;
+    MENU_FILE *     f;
+    MENU_FILE *     old;
+
+    menu_index.files = (MENU_FILE *) NULL;
+    menu_index.n_files = 0;
+
+    dir = opendir (menu_index.path);
+
+    if (dir)
+    {
+        while ((dp = readdir (dir)) != (struct dirent *) NULL)
+        {
+            type = menu_file_type (dp->d_name);
+
+            if (type == FILE_TYPE_NONE)
+            {
+                continue;
+            }
+
+            snprintf (fname, sizeof (fname), "%s/%s", menu_index.path, dp->d_name);
+
+            if (stat (fname, &st) != 0 || ! S_ISREG (st.st_mode))
+            {
+                continue;
+            }
+
+            f = menu_index_append (&menu_index.files, &menu_index.n_files, &max_files, dp->d_name);
+
+            if (! f)
+            {
+                break;
+            }
+
+            f->type     = type;
+            f->size     = st.st_size;
+            f->mtime    = menu_stat_mtime (&st);
+
+            old = menu_index_find (old_files, n_old_files, dp->d_name);
+
+            if (old && old->type == type && old->size == f->size && old->mtime == f->mtime)
+            {
+                strcpy (f->progname, old->progname);
+            }
+            else
+            {
+                menu_read_progname (menu_index.path, f);
+            }
+        }
+
+        closedir (dir);
+    }
+
+    if (menu_index.n_files > 1)
+    {
+        qsort (menu_index.files, menu_index.n_files, sizeof (MENU_FILE), filescmp);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_index_update () - bring index of directory up to date
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+menu_index_update (const char * path)
+{
+    MENU_FILE *     old_files;
+    uint32_t        n_old_files;
+    long long       dir_mtime;
+    long long       mtime       = 0;
+    struct stat     st;
+    uint32_t        idx;
+    uint_fast8_t    v;
+
+    if (stat (path, &st) == 0)
+    {
+        mtime = menu_stat_mtime (&st);
+    }
+
+    if (menu_index.views[0] && ! strcmp (menu_index.path, path))
+    {
+        if (menu_index.mtime == mtime)
+        {
+            return;                                                             // nothing changed since last call
+        }
+
+        old_files   = menu_index.files;                                         // rescan, take old list in memory
+        n_old_files = menu_index.n_files;
+        dir_mtime   = -1;
+    }
+    else
+    {
+        menu_index_free (menu_index.files, menu_index.n_files);
+        dir_mtime = menu_index_read (path, &old_files, &n_old_files);
+    }
+
+    strncpy (menu_index.path, path, Z80_MAX_FILENAME_LEN);
+    menu_index.path[Z80_MAX_FILENAME_LEN] = '\0';
+    menu_index.mtime = mtime;
+
+    if (dir_mtime == mtime)                                                     // index file is up to date
+    {
+        menu_index.files    = old_files;
+        menu_index.n_files  = n_old_files;
+    }
+    else
+    {
+        menu_index_scan (old_files, n_old_files);
+        menu_index_free (old_files, n_old_files);
+        menu_index_write ();
+    }
+
+    for (v = 0; v < N_MENU_VIEWS; v++)
+    {
+        free (menu_index.views[v]);
+        menu_index.views[v] = malloc ((menu_index.n_files + 1) * sizeof (uint32_t));
+        menu_index.n_views[v] = 0;
+    }
+
+    if (! menu_index.views[MENU_VIEW_TAPES] || ! menu_index.views[MENU_VIEW_ROMS])
+    {
+        free (menu_index.views[MENU_VIEW_TAPES]);
+        free (menu_index.views[MENU_VIEW_ROMS]);
+        menu_index.views[MENU_VIEW_TAPES] = (uint32_t *) NULL;
+        menu_index.views[MENU_VIEW_ROMS] = (uint32_t *) NULL;
+        return;
+    }
+
+    for (idx = 0; idx < menu_index.n_files; idx++)
+    {
+        v = (menu_index.files[idx].type == FILE_TYPE_ROM) ? MENU_VIEW_ROMS : MENU_VIEW_TAPES;
+        menu_index.views[v][menu_index.n_views[v]++] = idx;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_search () - find first entry in current view starting with prefix, returns n_subentries if not found
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+menu_search (const char * prefix)
+{
+    size_t      len = strlen (prefix);
+    uint32_t    lo  = 0;
+    uint32_t    hi  = n_subentries;
+    uint32_t    mid;
+
+    while (lo < hi)                                                             // lower bound, view is sorted ignoring case
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (strcasecmp (menu_index.files[subentries_view[mid]].name, prefix) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (lo < n_subentries && ! strncasecmp (menu_index.files[subentries_view[lo]].name, prefix, len))
+    {
+        return lo;
+    }
+
+    return n_subentries;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * menu_scancode_to_char () - map scancode to character of file name, returns '\0' if none
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint_fast8_t
+menu_scancode_to_char (uint32_t scancode)
+{
+    uint_fast8_t    ch = '\0';
+
+    switch (scancode)
+    {
+        case SCANCODE_A:        ch = 'a';   break;
+        case SCANCODE_B:        ch = 'b';   break;
+        case SCANCODE_C:        ch = 'c';   break;
+        case SCANCODE_D:        ch = 'd';   break;
+        case SCANCODE_E:        ch = 'e';   break;
+        case SCANCODE_F:        ch = 'f';   break;
+        case SCANCODE_G:        ch = 'g';   break;
+        case SCANCODE_H:        ch = 'h';   break;
+        case SCANCODE_I:        ch = 'i';   break;
+        case SCANCODE_J:        ch = 'j';   break;
+        case SCANCODE_K:        ch = 'k';   break;
+        case SCANCODE_L:        ch = 'l';   break;
+        case SCANCODE_M:        ch = 'm';   break;
+        case SCANCODE_N:        ch = 'n';   break;
+        case SCANCODE_O:        ch = 'o';   break;
+        case SCANCODE_P:        ch = 'p';   break;
+        case SCANCODE_Q:        ch = 'q';   break;
+        case SCANCODE_R:        ch = 'r';   break;
+        case SCANCODE_S:        ch = 's';   break;
+        case SCANCODE_T:        ch = 't';   break;
+        case SCANCODE_U:        ch = 'u';   break;
+        case SCANCODE_V:        ch = 'v';   break;
+        case SCANCODE_W:        ch = 'w';   break;
+        case SCANCODE_X:        ch = 'x';   break;
+        case SCANCODE_Y:        ch = 'z';   break;
+        case SCANCODE_Z:        ch = 'y';   break;
+        case SCANCODE_0:        ch = '0';   break;
+        case SCANCODE_1:        ch = '1';   break;
+        case SCANCODE_2:        ch = '2';   break;
+        case SCANCODE_3:        ch = '3';   break;
+        case SCANCODE_4:        ch = '4';   break;
+        case SCANCODE_5:        ch = '5';   break;
+        case SCANCODE_6:        ch = '6';   break;
+        case SCANCODE_7:        ch = '7';   break;
+        case SCANCODE_8:        ch = '8';   break;
+        case SCANCODE_9:        ch = '9';   break;
+        case SCANCODE_MINUS:    ch = '-';   break;
+    }
+
+    return ch;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -359,19 +1040,47 @@ menu_erase_rectangle (void)
     zxscr_update_display ();
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * draw_search_field () - draw search prefix in status line, erase it if prefix is NULL
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+draw_search_field (const char * prefix)
+{
+    char            buf[MENU_SEARCH_LEN + 9];                                   // "Search: " + prefix + '\0'
+
+    if (prefix)
+    {
+        snprintf (buf, sizeof (buf), "Search: %-*s", MENU_SEARCH_LEN, prefix);
+    }
+    else
+    {
+        snprintf (buf, sizeof (buf), "%-*s", MENU_SEARCH_LEN + 8, "");
+    }
+
+    draw_string ((unsigned char *) buf, STATUS_Y, SUB_MENU_START_X, COLOR_WHITE, COLOR_BLACK);
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * menu_handle_sub_menu () - handle user input in sub menu
+ *
+ * In file lists typing characters jumps to the first file starting with the typed prefix, BACKSPACE removes the last character.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 static int
 menu_handle_sub_menu (FILE * poke_fp)
 {
+    char            search_buf[MENU_SEARCH_LEN + 1];
+    uint_fast8_t    search_len  = 0;
     uint_fast8_t    do_break    = 0;
-    uint_fast8_t    activeitem  = 0;
-    uint_fast8_t    offsetidx   = 0;
+    uint32_t        activeitem  = 0;
+    uint32_t        offsetidx   = 0;
+    uint32_t        newitem;
     uint_fast16_t   scancode;
+    uint_fast8_t    ch;
     int             entry_idx   = -1;
 
+    search_buf[0] = '\0';
     draw_sub_menu (poke_fp, 0, 0);
 
     while (! do_break && ! steccy_exit)
@@ -393,7 +1102,7 @@ menu_handle_sub_menu (FILE * poke_fp)
             case SCANCODE_D_ARROW:
             case SCANCODE_D_ARROW_EXT:
             {
-                if (activeitem < n_subentries - 1)
+                if (activeitem + 1 < n_subentries)
                 {
                     activeitem++;
 
@@ -410,7 +1119,12 @@ menu_handle_sub_menu (FILE * poke_fp)
             case SCANCODE_R_ARROW_EXT:
             case SCANCODE_PG_DN:
             {
-                uint_fast8_t newitem = activeitem + SUB_MENU_ENTRIES;
+                if (n_subentries == 0)
+                {
+                    break;
+                }
+
+                newitem = activeitem + SUB_MENU_ENTRIES;
 
                 if (newitem >= n_subentries)
                 {
@@ -421,7 +1135,11 @@ menu_handle_sub_menu (FILE * poke_fp)
                 {
                     offsetidx += newitem - activeitem;
 
-                    if (offsetidx > n_subentries - SUB_MENU_ENTRIES)
+                    if (n_subentries <= SUB_MENU_ENTRIES)
+                    {
+                        offsetidx = 0;
+                    }
+                    else if (offsetidx > n_subentries - SUB_MENU_ENTRIES)
                     {
                         offsetidx = n_subentries - SUB_MENU_ENTRIES;
                     }
@@ -451,8 +1169,6 @@ menu_handle_sub_menu (FILE * poke_fp)
             case SCANCODE_L_ARROW_EXT:
             case SCANCODE_PG_UP:
             {
-                uint_fast8_t newitem;
-
                 if (activeitem > SUB_MENU_ENTRIES)
                 {
                     newitem = activeitem - SUB_MENU_ENTRIES;
@@ -479,17 +1195,66 @@ menu_handle_sub_menu (FILE * poke_fp)
                 }
                 break;
             }
+            case SCANCODE_BACKSPACE:
+            {
+                if (search_len > 0)
+                {
+                    search_len--;
+                    search_buf[search_len] = '\0';
+                    draw_search_field (search_buf);
+                }
+                break;
+            }
             case SCANCODE_ENTER:
             case SCANCODE_SPACE:
             {
                 // printf ("activeitem = %d\r\n", activeitem);
-                entry_idx = activeitem;
-                do_break = 1;
+                if (activeitem < n_subentries)
+                {
+                    entry_idx = activeitem;
+                    do_break = 1;
+                }
+                break;
+            }
+            default:
+            {
+                ch = menu_scancode_to_char (scancode);
+
+                if (ch && ! poke_fp && search_len < MENU_SEARCH_LEN)
+                {
+                    search_buf[search_len] = ch;
+                    search_buf[search_len + 1] = '\0';
+                    newitem = menu_search (search_buf);
+
+                    if (newitem < n_subentries)                                 // prefix found: take character
+                    {
+                        search_len++;
+                        activeitem = newitem;
+
+                        if (activeitem < offsetidx || activeitem - offsetidx > SUB_MENU_ENTRIES - 1)
+                        {
+                            offsetidx = activeitem;
+                        }
+
+                        draw_sub_menu (poke_fp, offsetidx, activeitem);
+                    }
+                    else
+                    {
+                        search_buf[search_len] = '\0';
+                    }
+
+                    draw_search_field (search_buf);
+                }
                 break;
             }
         }
     }
 
+    if (search_len > 0)
+    {
+        draw_search_field ((char *) NULL);
+    }
+
     return entry_idx;
 }
 
@@ -500,81 +1265,27 @@ menu_handle_sub_menu (FILE * poke_fp)
 static char *
 menu_load (char * path, uint_fast8_t romfiles)
 {
-    DIR *           dir;
-    struct dirent * dp;
-    uint8_t         len;
+    uint_fast8_t    view        = romfiles ? MENU_VIEW_ROMS : MENU_VIEW_TAPES;
     int             entry_idx;
     char *          fname       = (char *) 0;
 
     menu_draw_rectangle ();
 
-    n_subentries = 0;
-
     if (! *path)
     {
         path = ".";
     }
 
-    dir = opendir (path);
+    menu_index_update (path);
 
-    if (dir)
-    {
-        for (;;)
-        {
-            dp = readdir (dir);
-
-            if (! dp)
-            {
-                break;
-            }
-
-            len = strlen (dp->d_name);
-
-            if (len > 4)
-            {
-                uint_fast8_t    do_display = 0;
-                char *          p = dp->d_name + len - 4;
-
-                if (romfiles)
-                {
-                    if (! strcasecmp (p, ".rom"))
-                    {
-                        do_display = 1;
-                    }
-                }
-                else
-                {
-                    if (! strcasecmp (p, ".tap") || ! strcasecmp (p, ".tzx") || ! strcasecmp (p, ".z80"))
-                    {
-                        do_display = 1;
-                    }
-                }
-
-                if (do_display)
-                {
-                    if (n_subentries < MAX_SUB_ENTRIES)
-                    {
-                        strncpy (subentries.files[n_subentries], dp->d_name, MENU_MAX_FILENAME_LEN);
-                        subentries.files[n_subentries][MENU_MAX_FILENAME_LEN] = '\0';
-                        n_subentries++;
-                    }
-                }
-            }
-        }
-
-        closedir (dir);
-    }
-
-    if (n_subentries > 1)
-    {
-        qsort (subentries.files, n_subentries, MENU_MAX_FILENAME_LEN + 1, filescmp);
-    }
+    subentries_view = menu_index.views[view];
+    n_subentries    = subentries_view ? menu_index.n_views[view] : 0;
 
     entry_idx = menu_handle_sub_menu ((FILE *) NULL);
 
     if (entry_idx >= 0)
     {
-        fname = subentries.files[entry_idx];
+        fname = menu_index.files[subentries_view[entry_idx]].name;
     }
 
     menu_erase_rectangle ();
@@ -708,7 +1419,7 @@ menu_poke (void)
                 {
                     if (n_subentries < MAX_SUB_ENTRIES)
                     {
-                        subentries.positions[n_subentries] = pos + 1;
+                        subentries_positions[n_subentries] = pos + 1;
                         n_subentries++;
                     }
                 }
@@ -791,8 +1502,6 @@ menu_save (uint8_t is_snapshot)
 
     while (! do_break && ! steccy_exit)
     {
-        ch = '\0';
-
         scancode = menu_getscancode();
 
         if (scancode == SCANCODE_ESC || scancode == SCANCODE_REDRAW)
@@ -800,45 +1509,10 @@ menu_save (uint8_t is_snapshot)
             break;
         }
 
+        ch = menu_scancode_to_char (scancode);
+
         switch (scancode)
         {
-            case SCANCODE_A:        ch = 'a';   break;
-            case SCANCODE_B:        ch = 'b';   break;
-            case SCANCODE_C:        ch = 'c';   break;
-            case SCANCODE_D:        ch = 'd';   break;
-            case SCANCODE_E:        ch = 'e';   break;
-            case SCANCODE_F:        ch = 'f';   break;
-            case SCANCODE_G:        ch = 'g';   break;
-            case SCANCODE_H:        ch = 'h';   break;
-            case SCANCODE_I:        ch = 'i';   break;
-            case SCANCODE_J:        ch = 'j';   break;
-            case SCANCODE_K:        ch = 'k';   break;
-            case SCANCODE_L:        ch = 'l';   break;
-            case SCANCODE_M:        ch = 'm';   break;
-            case SCANCODE_N:        ch = 'n';   break;
-            case SCANCODE_O:        ch = 'o';   break;
-            case SCANCODE_P:        ch = 'p';   break;
-            case SCANCODE_Q:        ch = 'q';   break;
-            case SCANCODE_R:        ch = 'r';   break;
-            case SCANCODE_S:        ch = 's';   break;
-            case SCANCODE_T:        ch = 't';   break;
-            case SCANCODE_U:        ch = 'u';   break;
-            case SCANCODE_V:        ch = 'v';   break;
-            case SCANCODE_W:        ch = 'w';   break;
-            case SCANCODE_X:        ch = 'x';   break;
-            case SCANCODE_Y:        ch = 'z';   break;
-            case SCANCODE_Z:        ch = 'y';   break;
-            case SCANCODE_0:        ch = '0';   break;
-            case SCANCODE_1:        ch = '1';   break;
-            case SCANCODE_2:        ch = '2';   break;
-            case SCANCODE_3:        ch = '3';   break;
-            case SCANCODE_4:        ch = '4';   break;
-            case SCANCODE_5:        ch = '5';   break;
-            case SCANCODE_6:        ch = '6';   break;
-            case SCANCODE_7:        ch = '7';   break;
-            case SCANCODE_8:        ch = '8';   break;
-            case SCANCODE_9:        ch = '9';   break;
-            case SCANCODE_MINUS:    ch = '-';   break;
             case SCANCODE_BACKSPACE:
             {
                 if (len > 0)
@@ -892,10 +1566,26 @@ menu_save (uint8_t is_snapshot)
 void
 menu_update_status (void)
 {
+    char    buf[16];
+
+    if (zx_display_frames_skipped)
+    {
+        snprintf (buf, sizeof (buf), "SKIP%2u", zx_display_frames_skipped);
+        draw_string ((unsigned char *) buf, STATUS_Y, MAIN_MENU_END_X - 26 * 8, COLOR_RED, COLOR_BLACK);
+    }
+    else
+    {
+        draw_string ((unsigned char *) "      ", STATUS_Y, MAIN_MENU_END_X - 26 * 8, COLOR_RED, COLOR_BLACK);
+    }
+
     if (z80_get_turbo_mode ())
     {
         draw_string ((unsigned char *) "TURBO", STATUS_Y, MAIN_MENU_END_X - 19 * 8, COLOR_RED, COLOR_BLACK);
     }
+    else if (z80_get_auto_turbo ())
+    {
+        draw_string ((unsigned char *) "AUTO ", STATUS_Y, MAIN_MENU_END_X - 19 * 8, COLOR_RED, COLOR_BLACK);
+    }
     else
     {
         draw_string ((unsigned char *) "     ", STATUS_Y, MAIN_MENU_END_X - 19 * 8, COLOR_RED, COLOR_BLACK);
@@ -1064,6 +1754,7 @@ menu (char * path, uint_fast8_t poke_file_active)
                     }
                     case MENU_ENTRY_RESET:
                     {
+                        lxrec_event (LXREC_EVENT_RESET, (char *) 0);
                         z80_reset ();
                         do_break = 1;
                         break;
@@ -1180,6 +1871,7 @@ menu_redraw (uint_fast8_t poke_file_active)
 void
 menu_init (void)
 {
+    lxdisplay_layout ();                                                        // settings from ini file are known now
     set_font (FONT_08x12);
     draw_main_menu (0xFF, 0);
 }
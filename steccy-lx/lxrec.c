@@ -0,0 +1,513 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxrec.c - deterministic recording and replay of input
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "z80.h"
+#include "zxscr.h"
+#include "zxram.h"
+#include "lxrec.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * A recording is a text file. The first line is "STECCYREC 1 <ROM hash>", each further line is one event:
+ *
+ *   <frame> <T-state> K <8 keyboard rows> <Kempston>   input changed, hex bytes as seen by the Z80
+ *   <frame> <T-state> M <turbo> <ROM hooks> <autostart>
+ *   <frame> <T-state> L <file>                         load tape or snapshot
+ *   <frame> <T-state> R <file>                         load ROM
+ *   <frame> <T-state> X                                reset
+ *   <frame> <T-state> E <hash>                         end: hash of screen and registers
+ *
+ * T-state counts from the start of the emulation. Input is recorded when the Z80 reads the keyboard or Kempston port,
+ * because only then the change becomes visible. While replaying, the Z80 reads the recorded input instead of the
+ * keyboard, so it sees every change at the same T-state. Mode changes are sampled every 10 msec tick, LOAD, ROM and
+ * RESET are recorded when they are issued. Both are replayed by lxrec_sync() after the same tick, i.e. at the same
+ * instruction boundary. A file chosen in the LOAD menu of the ROM hooks is replayed by lxrec_replay_load().
+ * The recording ends at the last frame boundary, so the replay can compare the state there.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define REC_MAGIC                   "STECCYREC 1"
+#define REC_INPUT_SIZE              9                                       // 8 keyboard rows + Kempston
+#define REC_LINE_SIZE               (Z80_MAX_FILENAME_LEN + 64)
+#define REC_SCREEN_SIZE             6912
+
+#define REC_EVENT_INPUT             'K'
+#define REC_EVENT_MODE              'M'
+#define REC_EVENT_END               'E'
+
+uint_fast8_t                        lxrec_mode;
+
+static FILE *                       rec_fp;
+static uint8_t                      input_state[REC_INPUT_SIZE];            // input seen by the Z80
+static uint8_t                      mode_state[3];                          // turbo, ROM hooks, autostart
+static uint32_t                     last_cycles;                            // last value of z80_get_clockcycles()
+static uint64_t                     now_cycles;                             // T-states since lxrec_begin()
+static uint32_t                     frame;                                  // frames since lxrec_begin()
+static uint32_t                     events;
+
+static uint64_t                     frame_cycles;                           // record: state at last frame boundary
+static uint64_t                     frame_hash;
+static long                         frame_pos;
+
+static uint64_t                     rom_hash;                               // replay: ROM hash of recording
+static uint_fast8_t                 exit_at_end;
+static int                          result;                                 // 0: replay matched, 1: diverged
+static uint_fast8_t                 next_valid;                             // replay: next event
+static uint64_t                     next_cycles;
+static char                         next_kind;
+static char                         next_arg[REC_LINE_SIZE];
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * rec_now - get T-states since start, 64 bit
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint64_t
+rec_now (void)
+{
+    uint32_t    cycles = z80_get_clockcycles ();
+
+    now_cycles  += (uint32_t) (cycles - last_cycles);
+    last_cycles = cycles;
+    return now_cycles;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * rec_state_hash - FNV-1a 64 hash of screen memory, border and registers
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static uint64_t
+rec_hash_bytes (uint64_t hash, const uint8_t * p, size_t len)
+{
+    while (len--)
+    {
+        hash ^= *p++;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static uint64_t
+rec_state_hash (void)
+{
+    Z80_REGISTERS   regs;
+    uint64_t        hash = 14695981039346656037ULL;
+
+    memset (&regs, 0, sizeof (regs));
+    z80_get_registers (&regs);
+
+    hash = rec_hash_bytes (hash, zx_ram_screen_addr(ZX_SPECTRUM_DISPLAY_START_ADDRESS), REC_SCREEN_SIZE);
+    hash = rec_hash_bytes (hash, &zx_border_color, 1);
+    return rec_hash_bytes (hash, (const uint8_t *) &regs, sizeof (regs));
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * rec_write - write event
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rec_write (char kind, const char * arg)
+{
+    fprintf (rec_fp, "%u %llu %c%s%s\n", frame, (unsigned long long) rec_now (), kind, *arg ? " " : "", arg);
+    events++;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * rec_read_next - read next event of replay
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rec_read_next (void)
+{
+    char                line[REC_LINE_SIZE];
+    unsigned int        fr;
+    unsigned long long  cycles;
+    int                 pos;
+    size_t              len;
+
+    next_valid = 0;
+
+    if (fgets (line, sizeof (line), rec_fp) && sscanf (line, "%u %llu %c %n", &fr, &cycles, &next_kind, &pos) == 3)
+    {
+        len = strlen (line + pos);
+
+        while (len > 0 && (line[pos + len - 1] == '\n' || line[pos + len - 1] == '\r'))
+        {
+            len--;
+        }
+
+        memcpy (next_arg, line + pos, len);
+        next_arg[len]   = '\0';
+        next_cycles     = cycles;
+        next_valid      = 1;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * rec_replay_end - end of replay: continue with live input
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rec_replay_end (const char * msg)
+{
+    printf ("replay: %s at frame %u after %u events\n", msg, frame, events);
+    fclose (rec_fp);
+    rec_fp      = (FILE *) 0;
+    lxrec_mode  = LXREC_OFF;
+
+    if (exit_at_end)
+    {
+        steccy_exit = 1;
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_input - called on every read of keyboard or Kempston port: return input seen by the Z80
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+const uint8_t *
+lxrec_input (const uint8_t * matrix, uint8_t kempston)
+{
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        uint8_t     cur[REC_INPUT_SIZE];
+
+        memcpy (cur, matrix, REC_INPUT_SIZE - 1);                           // keyboard may change in other thread: copy once
+        cur[REC_INPUT_SIZE - 1] = kempston;
+
+        if (memcmp (cur, input_state, REC_INPUT_SIZE))
+        {
+            char            arg[3 * REC_INPUT_SIZE];
+            unsigned int    i;
+
+            memcpy (input_state, cur, REC_INPUT_SIZE);
+
+            for (i = 0; i < REC_INPUT_SIZE; i++)
+            {
+                sprintf (arg + 3 * i, "%02X ", cur[i]);
+            }
+
+            arg[3 * REC_INPUT_SIZE - 1] = '\0';
+
+            rec_write (REC_EVENT_INPUT, arg);
+        }
+    }
+    else
+    {
+        while (next_valid && next_kind == REC_EVENT_INPUT && next_cycles <= rec_now ())
+        {
+            const char *    p = next_arg;
+            char *          end;
+            unsigned int    i;
+
+            for (i = 0; i < REC_INPUT_SIZE; i++, p = end)
+            {
+                input_state[i] = strtoul (p, &end, 16);
+            }
+
+            events++;
+            rec_read_next ();
+        }
+    }
+
+    return input_state;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * rec_mode - record turbo mode, ROM hooks and autostart if changed
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rec_mode (void)
+{
+    uint8_t     mode[3];
+    char        arg[16];
+
+    mode[0] = z80_get_turbo_mode ();
+    mode[1] = z80_get_rom_hooks ();
+    mode[2] = z80_get_autostart ();
+
+    if (memcmp (mode, mode_state, sizeof (mode)))
+    {
+        memcpy (mode_state, mode, sizeof (mode));
+        sprintf (arg, "%u %u %u", mode[0], mode[1], mode[2]);
+        rec_write (REC_EVENT_MODE, arg);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_tick - called every 10 msec tick: record mode changes, return 1 if lxrec_sync() has to replay events
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+uint_fast8_t
+lxrec_tick (void)
+{
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        rec_mode ();
+        return 0;
+    }
+
+    return ! next_valid || (next_kind != REC_EVENT_INPUT && next_kind != REC_EVENT_END && next_cycles <= rec_now ());
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_frame - called at every frame boundary, before other events: remember or compare state
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxrec_frame (void)
+{
+    frame++;
+
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        frame_cycles    = rec_now ();
+        frame_hash      = rec_state_hash ();
+        frame_pos       = ftell (rec_fp);
+    }
+    else if (next_valid && next_kind == REC_EVENT_END && next_cycles <= rec_now ())
+    {
+        if (next_cycles == rec_now () && strtoull (next_arg, (char **) 0, 16) == rec_state_hash ())
+        {
+            rec_replay_end ("state matches recording");
+        }
+        else
+        {
+            result = 1;
+            rec_replay_end ("state differs from recording");
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_sync - called before the first instruction and after lxrec_tick() returned 1: record initial mode or
+ * replay all events due now
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxrec_sync (void)
+{
+    unsigned int    turbo;
+    unsigned int    hooks;
+    unsigned int    autostart;
+
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        rec_mode ();
+        return;
+    }
+
+    while (lxrec_mode == LXREC_REPLAY && next_valid && next_kind != REC_EVENT_INPUT && next_kind != REC_EVENT_END &&
+           next_cycles <= rec_now ())
+    {
+        switch (next_kind)
+        {
+            case REC_EVENT_MODE:
+            {
+                if (sscanf (next_arg, "%u %u %u", &turbo, &hooks, &autostart) == 3)
+                {
+                    z80_set_turbo_mode (turbo);
+                    z80_set_rom_hooks (hooks);
+                    z80_set_autostart (autostart);
+                }
+                break;
+            }
+            case LXREC_EVENT_LOAD:  z80_set_fname_load (next_arg);  break;
+            case LXREC_EVENT_ROM:   z80_load_rom (next_arg);        break;
+            case LXREC_EVENT_RESET: z80_reset ();                   break;
+        }
+
+        events++;
+        rec_read_next ();
+    }
+
+    if (lxrec_mode == LXREC_REPLAY && ! next_valid)
+    {
+        result = 1;
+        rec_replay_end ("recording ends without end mark");
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_replay_load - replay: return file chosen in LOAD menu while recording, NULL if cancelled
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+const char *
+lxrec_replay_load (void)
+{
+    static char     fname[REC_LINE_SIZE];
+
+    if (next_valid && next_kind == LXREC_EVENT_LOAD && next_cycles == rec_now ())
+    {
+        strcpy (fname, next_arg);
+        events++;
+        rec_read_next ();
+        return fname;
+    }
+
+    return (char *) 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_event - record LOAD, ROM or RESET issued by user, menu or control socket
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxrec_event (char kind, const char * arg)
+{
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        rec_write (kind, arg ? arg : "");
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_begin - called after ROM is loaded and Z80 is reset: write or check header
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxrec_begin (void)
+{
+    if (lxrec_mode == LXREC_OFF)
+    {
+        return;
+    }
+
+    z80_settings.boot_cache = 0;                                            // state after reset must not depend on cache
+    memset (input_state, 0xFF, REC_INPUT_SIZE - 1);                         // keyboard: active low
+    input_state[REC_INPUT_SIZE - 1] = 0x00;                                 // Kempston: active high
+    last_cycles = z80_get_clockcycles ();
+    now_cycles  = 0;
+
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        fprintf (rec_fp, "%s %016llx\n", REC_MAGIC, (unsigned long long) z80_get_rom_hash ());
+        mode_state[0] = 0xFF;                                               // lxrec_sync() writes initial mode
+        frame_pos = ftell (rec_fp);
+    }
+    else
+    {
+        if (rom_hash != z80_get_rom_hash ())
+        {
+            fprintf (stderr, "replay: ROM differs from recording\n");
+        }
+
+        rec_read_next ();
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_start_record - open recording, must be called before zx_spectrum()
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxrec_start_record (const char * fname)
+{
+    rec_fp = fopen (fname, "w");
+
+    if (! rec_fp)
+    {
+        perror (fname);
+        return -1;
+    }
+
+    z80_cold_boot   = 1;
+    lxrec_mode      = LXREC_RECORD;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_start_replay - open recording for replay, must be called before zx_spectrum()
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxrec_start_replay (const char * fname, uint_fast8_t do_exit)
+{
+    char                line[REC_LINE_SIZE];
+    unsigned long long  hash;
+
+    rec_fp = fopen (fname, "r");
+
+    if (! rec_fp)
+    {
+        perror (fname);
+        return -1;
+    }
+
+    if (! fgets (line, sizeof (line), rec_fp) || strncmp (line, REC_MAGIC " ", sizeof (REC_MAGIC)) ||
+        sscanf (line + sizeof (REC_MAGIC), "%llx", &hash) != 1)
+    {
+        fprintf (stderr, "%s: no STECCY recording\n", fname);
+        fclose (rec_fp);
+        return -1;
+    }
+
+    rom_hash        = hash;
+    exit_at_end     = do_exit;
+    z80_cold_boot   = 1;
+    lxrec_mode      = LXREC_REPLAY;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxrec_stop - end recording at last frame boundary or stop replay, return 1 if replay did not match
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxrec_stop (void)
+{
+    char    arg[20];
+
+    if (lxrec_mode == LXREC_RECORD)
+    {
+        lxrec_mode = LXREC_OFF;
+        fflush (rec_fp);
+        fseek (rec_fp, frame_pos, SEEK_SET);                                // drop events after last frame boundary
+        sprintf (arg, "%016llx", (unsigned long long) frame_hash);
+        fprintf (rec_fp, "%u %llu %c %s\n", frame, (unsigned long long) frame_cycles, REC_EVENT_END, arg);
+        fflush (rec_fp);
+
+        if (ftruncate (fileno (rec_fp), ftell (rec_fp)) < 0)
+        {
+            perror ("record");
+        }
+
+        fclose (rec_fp);
+        rec_fp = (FILE *) 0;
+        printf ("record: %u events in %u frames\n", events, frame);
+    }
+    else if (lxrec_mode == LXREC_REPLAY)
+    {
+        rec_replay_end ("stopped before end of recording");
+        result = 1;
+    }
+
+    return result;
+}
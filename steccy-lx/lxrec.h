@@ -0,0 +1,52 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxrec.h - deterministic recording and replay of input
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef LXREC_H
+#define LXREC_H
+
+#include <stdint.h>
+
+#define LXREC_OFF                   0
+#define LXREC_RECORD                1
+#define LXREC_REPLAY                2
+
+#define LXREC_EVENT_LOAD            'L'                                     // load tape or snapshot
+#define LXREC_EVENT_ROM             'R'                                     // load ROM
+#define LXREC_EVENT_RESET           'X'                                     // reset
+
+extern uint_fast8_t                 lxrec_mode;
+extern int                          lxrec_start_record (const char *);
+extern int                          lxrec_start_replay (const char *, uint_fast8_t);
+extern int                          lxrec_stop (void);
+extern void                         lxrec_begin (void);
+extern const uint8_t *              lxrec_input (const uint8_t *, uint8_t);
+extern uint_fast8_t                 lxrec_tick (void);
+extern void                         lxrec_frame (void);
+extern void                         lxrec_sync (void);
+extern const char *                 lxrec_replay_load (void);
+extern void                         lxrec_event (char, const char *);
+
+#endif
@@ -0,0 +1,467 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxtrace.c - binary instruction trace
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "z80.h"
+#include "lxtrace.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * The emulation thread writes a fixed size record of 32 bytes before every instruction: PC, instruction bytes,
+ * registers, T-state, paged banks. The records are collected in chunks of a bounded single producer/single consumer
+ * ring, a writer thread appends full chunks to the file. Unlike capture, a trace must not have gaps: if the ring is
+ * full, the emulation thread waits for the writer.
+ *
+ * With "ring=N" the last N records are kept in memory instead and written when the trace ends. So a long run can be
+ * traced without a huge file, e.g. to see what happened before a crash.
+ *
+ * The trace is given as "file[,start=<trigger>][,stop=<trigger>][,ring=N]", trigger is "pc:<hex address>",
+ * "frame:<n>" or "key" (start only). Without start trigger, tracing starts at once. The hotkey F9 toggles tracing.
+ * steccy-tracedump disassembles and filters the file.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define TRACE_CHUNK_RECORDS         4096                                    // records per chunk, 128 KB
+#define TRACE_CHUNKS                64                                      // must be a power of 2
+
+#define TRACE_TRIGGER_NONE          0
+#define TRACE_TRIGGER_PC            1
+#define TRACE_TRIGGER_FRAME         2
+#define TRACE_TRIGGER_KEY           3
+
+typedef struct
+{
+    uint32_t                n_records;
+    LXTRACE_RECORD          records[TRACE_CHUNK_RECORDS];
+} TRACE_CHUNK;
+
+typedef struct
+{
+    uint_fast8_t            kind;                                           // TRACE_TRIGGER_xxx
+    uint32_t                value;                                          // PC or frame
+} TRACE_TRIGGER;
+
+volatile uint_fast8_t       lxtrace_active;
+
+static FILE *               trace_fp;
+static TRACE_TRIGGER        start_trigger;
+static TRACE_TRIGGER        stop_trigger;
+static uint_fast8_t         running;
+static uint32_t             frame;                                          // frames since lxtrace_start()
+static uint64_t             n_records;                                      // records written by emulation thread
+static atomic_int           toggle_request;                                 // set by hotkey, maybe in keyboard thread
+
+static TRACE_CHUNK *        chunks;                                         // file mode
+static atomic_uint          chunks_head;                                    // written by emulation thread only
+static atomic_uint          chunks_tail;                                    // written by writer thread only
+static sem_t                chunks_sem;                                     // counts filled chunks
+static atomic_int           writer_stop;
+static pthread_t            writer_tid;
+static uint32_t             cur_fill;                                       // records in chunk at head
+
+static LXTRACE_RECORD *     ring;                                           // ring mode
+static uint32_t             ring_size;
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * trace_writer - writer thread: write filled chunks
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void *
+trace_writer (void * arg)
+{
+    const TRACE_CHUNK *     chunk;
+    unsigned int            tail;
+
+    (void) arg;
+
+    while (1)
+    {
+        sem_wait (&chunks_sem);
+
+        tail = atomic_load_explicit (&chunks_tail, memory_order_relaxed);
+
+        if (tail == atomic_load_explicit (&chunks_head, memory_order_acquire))
+        {
+            if (atomic_load (&writer_stop))
+            {
+                break;
+            }
+            continue;
+        }
+
+        chunk = &chunks[tail & (TRACE_CHUNKS - 1)];
+        fwrite (chunk->records, sizeof (LXTRACE_RECORD), chunk->n_records, trace_fp);
+
+        atomic_store_explicit (&chunks_tail, tail + 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * trace_flush - pass chunk at head to writer thread, wait until the next one is free
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+trace_flush (void)
+{
+    unsigned int    head = atomic_load_explicit (&chunks_head, memory_order_relaxed);
+
+    if (cur_fill == 0)
+    {
+        return;
+    }
+
+    chunks[head & (TRACE_CHUNKS - 1)].n_records = cur_fill;
+    atomic_store_explicit (&chunks_head, head + 1, memory_order_release);
+    sem_post (&chunks_sem);
+    cur_fill = 0;
+
+    while (head + 1 - atomic_load_explicit (&chunks_tail, memory_order_acquire) >= TRACE_CHUNKS)
+    {
+        usleep (1000);                                                      // ring is full: wait for writer
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * trace_set_running - start or pause tracing
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+trace_set_running (uint_fast8_t on)
+{
+    if (running && ! on)
+    {
+        if (chunks)
+        {
+            trace_flush ();
+        }
+
+        printf ("trace: paused at frame %u after %llu instructions\n", frame, (unsigned long long) n_records);
+    }
+    else if (! running && on)
+    {
+        printf ("trace: started at frame %u\n", frame);
+    }
+
+    running = on;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxtrace_next - called before every instruction: return record to fill, NULL if not tracing
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+LXTRACE_RECORD *
+lxtrace_next (uint16_t pc)
+{
+    LXTRACE_RECORD *    rec;
+
+    if (! running)
+    {
+        if (start_trigger.kind != TRACE_TRIGGER_PC || pc != start_trigger.value)
+        {
+            return (LXTRACE_RECORD *) 0;
+        }
+
+        start_trigger.kind = TRACE_TRIGGER_NONE;
+        trace_set_running (1);
+    }
+    else if (stop_trigger.kind == TRACE_TRIGGER_PC && pc == stop_trigger.value)
+    {
+        stop_trigger.kind = TRACE_TRIGGER_NONE;
+        trace_set_running (0);
+        return (LXTRACE_RECORD *) 0;
+    }
+
+    if (ring)
+    {
+        rec = ring + (n_records % ring_size);
+    }
+    else
+    {
+        if (cur_fill == TRACE_CHUNK_RECORDS)
+        {
+            trace_flush ();
+        }
+
+        rec = &chunks[atomic_load_explicit (&chunks_head, memory_order_relaxed) & (TRACE_CHUNKS - 1)].records[cur_fill++];
+    }
+
+    rec->frame = frame;
+    n_records++;
+    return rec;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxtrace_frame - called at every frame boundary: check frame triggers and hotkey
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxtrace_frame (void)
+{
+    frame++;
+
+    if (atomic_exchange (&toggle_request, 0))
+    {
+        start_trigger.kind = TRACE_TRIGGER_NONE;
+        trace_set_running (! running);
+    }
+
+    if (! running && start_trigger.kind == TRACE_TRIGGER_FRAME && frame >= start_trigger.value)
+    {
+        start_trigger.kind = TRACE_TRIGGER_NONE;
+        trace_set_running (1);
+    }
+    else if (running && stop_trigger.kind == TRACE_TRIGGER_FRAME && frame >= stop_trigger.value)
+    {
+        stop_trigger.kind = TRACE_TRIGGER_NONE;
+        trace_set_running (0);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxtrace_toggle - start or pause tracing by hotkey, may be called by any thread
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxtrace_toggle (void)
+{
+    if (lxtrace_active)
+    {
+        atomic_store (&toggle_request, 1);
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * trace_parse_trigger - parse "pc:<hex>", "frame:<n>" or "key", return -1 on error
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+trace_parse_trigger (const char * p, TRACE_TRIGGER * trigger)
+{
+    char *  end;
+
+    if (! strncmp (p, "pc:", 3))
+    {
+        trigger->kind   = TRACE_TRIGGER_PC;
+        trigger->value  = strtoul (p + 3, &end, 16);
+    }
+    else if (! strncmp (p, "frame:", 6))
+    {
+        trigger->kind   = TRACE_TRIGGER_FRAME;
+        trigger->value  = strtoul (p + 6, &end, 10);
+    }
+    else if (! strncmp (p, "key", 3))
+    {
+        trigger->kind   = TRACE_TRIGGER_KEY;
+        end             = (char *) p + 3;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return (*end == '\0' || *end == ',') ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * trace_write_header - write file header at current position
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+trace_write_header (void)
+{
+    LXTRACE_HEADER  header;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, LXTRACE_MAGIC, sizeof (header.magic));
+    header.version      = LXTRACE_VERSION;
+    header.record_size  = sizeof (LXTRACE_RECORD);
+    header.rom_hash     = z80_get_rom_hash ();
+    fwrite (&header, sizeof (header), 1, trace_fp);
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxtrace_start - parse trace specification, open file and start writer thread, must be called before zx_spectrum()
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+lxtrace_start (const char * spec)
+{
+    char            fname[Z80_MAX_FILENAME_LEN + 1];
+    const char *    p;
+    size_t          len;
+    int             err;
+
+    p   = strchr (spec, ',');
+    len = p ? (size_t) (p - spec) : strlen (spec);
+
+    if (len == 0 || len >= sizeof (fname))
+    {
+        fprintf (stderr, "trace: invalid file name\n");
+        return -1;
+    }
+
+    memcpy (fname, spec, len);
+    fname[len] = '\0';
+
+    start_trigger.kind  = TRACE_TRIGGER_NONE;
+    stop_trigger.kind   = TRACE_TRIGGER_NONE;
+    ring_size           = 0;
+
+    while (p)
+    {
+        p++;
+
+        if ((! strncmp (p, "start=", 6) && trace_parse_trigger (p + 6, &start_trigger) == 0) ||
+            (! strncmp (p, "stop=", 5) && trace_parse_trigger (p + 5, &stop_trigger) == 0 && stop_trigger.kind != TRACE_TRIGGER_KEY))
+        {
+            ;
+        }
+        else if (! strncmp (p, "ring=", 5) && (ring_size = strtoul (p + 5, (char **) 0, 10)) > 0)
+        {
+            ;
+        }
+        else
+        {
+            fprintf (stderr, "trace: invalid option '%s'\n", p);
+            return -1;
+        }
+
+        p = strchr (p, ',');
+    }
+
+    trace_fp = fopen (fname, "wb");
+
+    if (! trace_fp)
+    {
+        perror (fname);
+        return -1;
+    }
+
+    setvbuf (trace_fp, NULL, _IOFBF, 1024 * 1024);
+    trace_write_header ();                                                  // ROM hash is written again at the end
+
+    if (ring_size)
+    {
+        ring = malloc (ring_size * sizeof (LXTRACE_RECORD));
+    }
+    else
+    {
+        chunks = malloc (TRACE_CHUNKS * sizeof (TRACE_CHUNK));
+    }
+
+    if (! ring && ! chunks)
+    {
+        fprintf (stderr, "trace: cannot allocate buffer\n");
+        fclose (trace_fp);
+        return -1;
+    }
+
+    frame       = 0;
+    n_records   = 0;
+    cur_fill    = 0;
+    running     = 0;
+    atomic_store (&toggle_request, 0);
+
+    if (chunks)
+    {
+        atomic_store (&chunks_head, 0);
+        atomic_store (&chunks_tail, 0);
+        atomic_store (&writer_stop, 0);
+        sem_init (&chunks_sem, 0, 0);
+
+        err = pthread_create (&writer_tid, NULL, &trace_writer, NULL);
+
+        if (err != 0)
+        {
+            fprintf (stderr, "trace: can't create thread :[%s]\n", strerror (err));
+            fclose (trace_fp);
+            free (chunks);
+            chunks = (TRACE_CHUNK *) 0;
+            return -1;
+        }
+    }
+
+    if (start_trigger.kind == TRACE_TRIGGER_NONE)
+    {
+        running = 1;
+    }
+
+    lxtrace_active = 1;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * lxtrace_stop - write remaining records, stop writer thread and close file
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+lxtrace_stop (void)
+{
+    uint64_t    idx;
+
+    if (! lxtrace_active)
+    {
+        return;
+    }
+
+    lxtrace_active = 0;
+
+    if (chunks)
+    {
+        trace_flush ();
+        atomic_store (&writer_stop, 1);
+        sem_post (&chunks_sem);
+        pthread_join (writer_tid, NULL);
+        sem_destroy (&chunks_sem);
+        free (chunks);
+        chunks = (TRACE_CHUNK *) 0;
+    }
+    else
+    {
+        idx = (n_records > ring_size) ? n_records - ring_size : 0;          // oldest record first
+
+        for ( ; idx < n_records; idx++)
+        {
+            fwrite (ring + (idx % ring_size), sizeof (LXTRACE_RECORD), 1, trace_fp);
+        }
+
+        free (ring);
+        ring = (LXTRACE_RECORD *) 0;
+    }
+
+    fseek (trace_fp, 0, SEEK_SET);
+    trace_write_header ();
+    fclose (trace_fp);
+
+    printf ("trace: %llu instructions traced\n", (unsigned long long) n_records);
+}
@@ -0,0 +1,74 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxtrace.h - binary instruction trace
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef LXTRACE_H
+#define LXTRACE_H
+
+#include <stdint.h>
+
+#define LXTRACE_MAGIC               "STECCYTR"                              // 8 bytes, no terminating NUL in file
+#define LXTRACE_VERSION             1
+
+#define LXTRACE_FLAG_IFF1           0x01                                    // interrupts enabled
+#define LXTRACE_FLAG_INT            0x02                                    // interrupt accepted before this instruction
+#define LXTRACE_FLAG_IM_SHIFT       2                                       // bits 2-3: interrupt mode
+
+typedef struct                                                              // file header, host byte order
+{
+    char                            magic[8];
+    uint16_t                        version;
+    uint16_t                        record_size;
+    uint32_t                        reserved;
+    uint64_t                        rom_hash;
+} LXTRACE_HEADER;
+
+typedef struct                                                              // one instruction, 32 bytes
+{
+    uint32_t                        frame;                                  // frames since start of trace
+    uint32_t                        cycles;                                 // z80_get_clockcycles() before instruction
+    uint16_t                        pc;
+    uint16_t                        sp;
+    uint16_t                        af;
+    uint16_t                        bc;
+    uint16_t                        de;
+    uint16_t                        hl;
+    uint16_t                        ix;
+    uint16_t                        iy;
+    uint8_t                         opcode[4];                              // instruction bytes at pc
+    uint8_t                         port_7ffd;                              // last OUT to 0x7FFD: paged banks
+    uint8_t                         flags;                                  // LXTRACE_FLAG_xxx
+    uint8_t                         i;
+    uint8_t                         r;
+} LXTRACE_RECORD;
+
+extern volatile uint_fast8_t        lxtrace_active;
+extern int                          lxtrace_start (const char *);
+extern void                         lxtrace_stop (void);
+extern LXTRACE_RECORD *             lxtrace_next (uint16_t);
+extern void                         lxtrace_frame (void);
+extern void                         lxtrace_toggle (void);
+
+#endif
@@ -0,0 +1,468 @@
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * lxtracedump.c - disassemble and filter binary instruction traces of STECCY
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2020-2021 Frank Meyer - frank(at)fli4l.de
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "lxtrace.h"
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * steccy-tracedump reads a trace written with option -t and prints one line per instruction:
+ *
+ *   <frame> <T-state> <PC> <instruction bytes> <mnemonic> [registers]
+ *
+ * Options select a range of PCs or frames, so e.g. only the code of a game in RAM is shown. The decoder follows the
+ * usual x/y/z scheme of the Z80 opcode bits, including the undocumented IXH/IXL/IYH/IYL and DDCB/FDCB forms.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static const char *         r_names[8]      = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+static const char *         rp_names[4]     = { "BC", "DE", "HL", "SP" };
+static const char *         rp2_names[4]    = { "BC", "DE", "HL", "AF" };
+static const char *         cc_names[8]     = { "NZ", "Z", "NC", "C", "PO", "PE", "P", "M" };
+static const char *         alu_names[8]    = { "ADD  A,", "ADC  A,", "SUB  ", "SBC  A,", "AND  ", "XOR  ", "OR   ", "CP   " };
+static const char *         rot_names[8]    = { "RLC ", "RRC ", "RL  ", "RR  ", "SLA ", "SRA ", "SLL ", "SRL " };
+static const char *         x0z7_names[8]   = { "RLCA", "RRCA", "RLA", "RRA", "DAA", "CPL", "SCF", "CCF" };
+static const char *         ed_x1z7_names[8]= { "LD   I,A", "LD   R,A", "LD   A,I", "LD   A,R", "RRD", "RLD", "NOP*", "NOP*" };
+static const char *         im_names[8]     = { "0", "0/1", "1", "2", "0", "0/1", "1", "2" };
+static const char *         bli_names[4][4] =
+{
+    { "LDI",  "CPI",  "INI",  "OUTI" },
+    { "LDD",  "CPD",  "IND",  "OUTD" },
+    { "LDIR", "CPIR", "INIR", "OTIR" },
+    { "LDDR", "CPDR", "INDR", "OTDR" }
+};
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * Decoder state: index register prefix and displacement
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    const char *    hl;                                                     // "HL", "IX" or "IY"
+    const char *    h;                                                      // "H", "IXH" or "IYH"
+    const char *    l;                                                      // "L", "IXL" or "IYL"
+    int             indexed;                                                // flag: DD or FD prefix
+    int8_t          d;                                                      // displacement
+    const uint8_t * p;                                                      // next byte
+} DECODER;
+
+static const char *
+dec_reg (DECODER * dec, int r, char * buf, size_t size, int use_index_hl)
+{
+    if (r == 6)
+    {
+        if (dec->indexed)
+        {
+            snprintf (buf, size, "(%s%c%02Xh)", dec->hl, dec->d < 0 ? '-' : '+', dec->d < 0 ? -dec->d : dec->d);
+            return buf;
+        }
+        return "(HL)";
+    }
+
+    if (use_index_hl && r == 4)
+    {
+        return dec->h;
+    }
+
+    if (use_index_hl && r == 5)
+    {
+        return dec->l;
+    }
+
+    return r_names[r];
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * disassemble - decode instruction, return mnemonic
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+disassemble (uint16_t pc, const uint8_t * bytes, char * out, size_t size)
+{
+    DECODER         dec;
+    char            b1[16];
+    char            b2[16];
+    uint8_t         op;
+    int             x, y, z, p, q;
+    uint16_t        nn;
+
+    dec.hl      = "HL";
+    dec.h       = "H";
+    dec.l       = "L";
+    dec.indexed = 0;
+    dec.d       = 0;
+    dec.p       = bytes;
+
+    op = *dec.p++;
+
+    if (op == 0xDD || op == 0xFD)
+    {
+        if (*dec.p == 0xDD || *dec.p == 0xED || *dec.p == 0xFD)             // prefix without effect
+        {
+            snprintf (out, size, "NOP*");
+            return;
+        }
+
+        dec.indexed = 1;
+        dec.hl      = (op == 0xDD) ? "IX" : "IY";
+        dec.h       = (op == 0xDD) ? "IXH" : "IYH";
+        dec.l       = (op == 0xDD) ? "IXL" : "IYL";
+        op          = *dec.p++;
+    }
+
+    x = op >> 6;
+    y = (op >> 3) & 7;
+    z = op & 7;
+    p = y >> 1;
+    q = y & 1;
+
+    if (op == 0xCB)
+    {
+        if (dec.indexed)                                                    // DDCB d op
+        {
+            dec.d   = (int8_t) *dec.p++;
+            op      = *dec.p++;
+        }
+        else
+        {
+            op      = *dec.p++;
+        }
+
+        x = op >> 6;
+        y = (op >> 3) & 7;
+        z = op & 7;
+
+        if (dec.indexed)
+        {
+            const char * m = dec_reg (&dec, 6, b1, sizeof (b1), 0);
+
+            if (x == 0)         snprintf (out, size, "%s %s%s%s", rot_names[y], m, z != 6 ? "," : "", z != 6 ? r_names[z] : "");
+            else if (x == 1)    snprintf (out, size, "BIT  %d,%s", y, m);
+            else                snprintf (out, size, "%s  %d,%s%s%s", x == 2 ? "RES" : "SET", y, m, z != 6 ? "," : "", z != 6 ? r_names[z] : "");
+        }
+        else
+        {
+            if (x == 0)         snprintf (out, size, "%s %s", rot_names[y], r_names[z]);
+            else                snprintf (out, size, "%s  %d,%s", x == 1 ? "BIT" : x == 2 ? "RES" : "SET", y, r_names[z]);
+        }
+        return;
+    }
+
+    if (op == 0xED)
+    {
+        op = *dec.p++;
+        x = op >> 6;
+        y = (op >> 3) & 7;
+        z = op & 7;
+        p = y >> 1;
+        q = y & 1;
+
+        if (x == 1)
+        {
+            switch (z)
+            {
+                case 0: snprintf (out, size, y == 6 ? "IN   (C)" : "IN   %s,(C)", r_names[y]);                                  break;
+                case 1: snprintf (out, size, y == 6 ? "OUT  (C),0" : "OUT  (C),%s", r_names[y]);                               break;
+                case 2: snprintf (out, size, "%s  HL,%s", q ? "ADC" : "SBC", rp_names[p]);                                      break;
+                case 3:
+                    nn = (uint16_t) (dec.p[0] | (dec.p[1] << 8));
+                    if (q)  snprintf (out, size, "LD   %s,(%04Xh)", rp_names[p], nn);
+                    else    snprintf (out, size, "LD   (%04Xh),%s", nn, rp_names[p]);
+                    break;
+                case 4: snprintf (out, size, "NEG");                                                                            break;
+                case 5: snprintf (out, size, y == 1 ? "RETI" : "RETN");                                                         break;
+                case 6: snprintf (out, size, "IM   %s", im_names[y]);                                                           break;
+                case 7: snprintf (out, size, "%s", ed_x1z7_names[y]);                                                           break;
+            }
+        }
+        else if (x == 2 && z <= 3 && y >= 4)
+        {
+            snprintf (out, size, "%s", bli_names[y - 4][z]);
+        }
+        else
+        {
+            snprintf (out, size, "NOP*");
+        }
+        return;
+    }
+
+    if (dec.indexed && (op == 0x34 || op == 0x35 || op == 0x36 || (x == 1 && (y == 6 || z == 6) && op != 0x76) || (x == 2 && z == 6)))
+    {
+        dec.d = (int8_t) *dec.p++;                                          // instruction with (IX+d)
+    }
+
+    switch (x)
+    {
+        case 0:
+        {
+            switch (z)
+            {
+                case 0:
+                    if (y == 0)         snprintf (out, size, "NOP");
+                    else if (y == 1)    snprintf (out, size, "EX   AF,AF'");
+                    else
+                    {
+                        uint16_t target = (uint16_t) (pc + 2 + (int8_t) dec.p[0]);
+
+                        if (y == 2)         snprintf (out, size, "DJNZ %04Xh", target);
+                        else if (y == 3)    snprintf (out, size, "JR   %04Xh", target);
+                        else                snprintf (out, size, "JR   %s,%04Xh", cc_names[y - 4], target);
+                    }
+                    break;
+                case 1:
+                    nn = (uint16_t) (dec.p[0] | (dec.p[1] << 8));
+                    if (q)  snprintf (out, size, "ADD  %s,%s", dec.hl, p == 2 ? dec.hl : rp_names[p]);
+                    else    snprintf (out, size, "LD   %s,%04Xh", p == 2 ? dec.hl : rp_names[p], nn);
+                    break;
+                case 2:
+                    nn = (uint16_t) (dec.p[0] | (dec.p[1] << 8));
+                    switch (y)
+                    {
+                        case 0: snprintf (out, size, "LD   (BC),A");                    break;
+                        case 1: snprintf (out, size, "LD   A,(BC)");                    break;
+                        case 2: snprintf (out, size, "LD   (DE),A");                    break;
+                        case 3: snprintf (out, size, "LD   A,(DE)");                    break;
+                        case 4: snprintf (out, size, "LD   (%04Xh),%s", nn, dec.hl);    break;
+                        case 5: snprintf (out, size, "LD   %s,(%04Xh)", dec.hl, nn);    break;
+                        case 6: snprintf (out, size, "LD   (%04Xh),A", nn);             break;
+                        case 7: snprintf (out, size, "LD   A,(%04Xh)", nn);             break;
+                    }
+                    break;
+                case 3:
+                    snprintf (out, size, "%s  %s", q ? "DEC" : "INC", p == 2 ? dec.hl : rp_names[p]);
+                    break;
+                case 4:
+                case 5:
+                    snprintf (out, size, "%s  %s", z == 5 ? "DEC" : "INC", dec_reg (&dec, y, b1, sizeof (b1), 1));
+                    break;
+                case 6:
+                    snprintf (out, size, "LD   %s,%02Xh", dec_reg (&dec, y, b1, sizeof (b1), 1), dec.p[0]);
+                    break;
+                case 7:
+                    snprintf (out, size, "%s", x0z7_names[y]);
+                    break;
+            }
+            break;
+        }
+        case 1:
+        {
+            if (op == 0x76)
+            {
+                snprintf (out, size, "HALT");
+            }
+            else                                                            // LD H,(IX+d) loads H, not IXH
+            {
+                int use_index_hl = (y != 6 && z != 6);
+
+                snprintf (out, size, "LD   %s,%s", dec_reg (&dec, y, b1, sizeof (b1), use_index_hl),
+                          dec_reg (&dec, z, b2, sizeof (b2), use_index_hl));
+            }
+            break;
+        }
+        case 2:
+        {
+            snprintf (out, size, "%s%s", alu_names[y], dec_reg (&dec, z, b1, sizeof (b1), 1));
+            break;
+        }
+        case 3:
+        {
+            nn = (uint16_t) (dec.p[0] | (dec.p[1] << 8));
+
+            switch (z)
+            {
+                case 0: snprintf (out, size, "RET  %s", cc_names[y]);       break;
+                case 1:
+                    if (! q)            snprintf (out, size, "POP  %s", p == 2 ? dec.hl : rp2_names[p]);
+                    else if (p == 0)    snprintf (out, size, "RET");
+                    else if (p == 1)    snprintf (out, size, "EXX");
+                    else if (p == 2)    snprintf (out, size, "JP   (%s)", dec.hl);
+                    else                snprintf (out, size, "LD   SP,%s", dec.hl);
+                    break;
+                case 2: snprintf (out, size, "JP   %s,%04Xh", cc_names[y], nn);   break;
+                case 3:
+                    switch (y)
+                    {
+                        case 0: snprintf (out, size, "JP   %04Xh", nn);         break;
+                        case 2: snprintf (out, size, "OUT  (%02Xh),A", dec.p[0]);   break;
+                        case 3: snprintf (out, size, "IN   A,(%02Xh)", dec.p[0]);   break;
+                        case 4: snprintf (out, size, "EX   (SP),%s", dec.hl);   break;
+                        case 5: snprintf (out, size, "EX   DE,HL");             break;
+                        case 6: snprintf (out, size, "DI");                     break;
+                        case 7: snprintf (out, size, "EI");                     break;
+                    }
+                    break;
+                case 4: snprintf (out, size, "CALL %s,%04Xh", cc_names[y], nn);   break;
+                case 5:
+                    if (! q)            snprintf (out, size, "PUSH %s", p == 2 ? dec.hl : rp2_names[p]);
+                    else                snprintf (out, size, "CALL %04Xh", nn);
+                    break;
+                case 6: snprintf (out, size, "%s%02Xh", alu_names[y], dec.p[0]);  break;
+                case 7: snprintf (out, size, "RST  %02Xh", y * 8);          break;
+            }
+            break;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * parse_range - parse "from[-to]", return -1 on error
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+parse_range (const char * s, int base, unsigned long * from, unsigned long * to)
+{
+    char *  end;
+
+    *from = strtoul (s, &end, base);
+
+    if (*end == '-')
+    {
+        *to = strtoul (end + 1, &end, base);
+    }
+    else
+    {
+        *to = *from;
+    }
+
+    return (*end == '\0' && *from <= *to) ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * usage - print usage
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+usage (const char * pgm)
+{
+    fprintf (stderr, "usage: %s [options] tracefile\n", pgm);
+    fprintf (stderr, "  -p from[-to] only instructions with PC in range, hex\n");
+    fprintf (stderr, "  -f from[-to] only instructions in frames of range\n");
+    fprintf (stderr, "  -n count     stop after count instructions\n");
+    fprintf (stderr, "  -r           show registers\n");
+}
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * main - main function
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+int
+main (int argc, char ** argv)
+{
+    LXTRACE_HEADER  header;
+    LXTRACE_RECORD  rec;
+    FILE *          fp;
+    char            mnemonic[32];
+    unsigned long   pc_from     = 0;
+    unsigned long   pc_to       = 0xFFFF;
+    unsigned long   frame_from  = 0;
+    unsigned long   frame_to    = 0xFFFFFFFFUL;
+    unsigned long   count       = 0;
+    unsigned long   printed     = 0;
+    int             show_regs   = 0;
+    int             opt;
+
+    while ((opt = getopt (argc, argv, "p:f:n:r")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                if (parse_range (optarg, 16, &pc_from, &pc_to) < 0)
+                {
+                    usage (argv[0]);
+                    return 2;
+                }
+                break;
+            case 'f':
+                if (parse_range (optarg, 10, &frame_from, &frame_to) < 0)
+                {
+                    usage (argv[0]);
+                    return 2;
+                }
+                break;
+            case 'n':   count = strtoul (optarg, NULL, 10);     break;
+            case 'r':   show_regs = 1;                          break;
+            default:    usage (argv[0]);                        return 2;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage (argv[0]);
+        return 2;
+    }
+
+    fp = fopen (argv[optind], "rb");
+
+    if (! fp)
+    {
+        perror (argv[optind]);
+        return 2;
+    }
+
+    if (fread (&header, sizeof (header), 1, fp) != 1 || memcmp (header.magic, LXTRACE_MAGIC, sizeof (header.magic)) ||
+        header.version != LXTRACE_VERSION || header.record_size != sizeof (LXTRACE_RECORD))
+    {
+        fprintf (stderr, "%s: no STECCY trace\n", argv[optind]);
+        fclose (fp);
+        return 2;
+    }
+
+    printf ("; ROM hash %016llx\n", (unsigned long long) header.rom_hash);
+
+    while ((! count || printed < count) && fread (&rec, sizeof (rec), 1, fp) == 1)
+    {
+        if (rec.pc < pc_from || rec.pc > pc_to || rec.frame < frame_from || rec.frame > frame_to)
+        {
+            continue;
+        }
+
+        disassemble (rec.pc, rec.opcode, mnemonic, sizeof (mnemonic));
+
+        printf ("%6u %10u %04X  %02X %02X %02X %02X  %-*s", rec.frame, rec.cycles, rec.pc,
+                rec.opcode[0], rec.opcode[1], rec.opcode[2], rec.opcode[3],
+                (show_regs || (rec.flags & LXTRACE_FLAG_INT)) ? 20 : 0, mnemonic);
+
+        if (show_regs)
+        {
+            printf (" AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SP=%04X I=%02X R=%02X IM%d %s 7FFD=%02X",
+                    rec.af, rec.bc, rec.de, rec.hl, rec.ix, rec.iy, rec.sp, rec.i, rec.r,
+                    (rec.flags >> LXTRACE_FLAG_IM_SHIFT) & 0x03, (rec.flags & LXTRACE_FLAG_IFF1) ? "EI" : "DI", rec.port_7ffd);
+        }
+
+        if (rec.flags & LXTRACE_FLAG_INT)
+        {
+            printf (" ; interrupt");
+        }
+
+        putchar ('\n');
+        printed++;
+    }
+
+    fclose (fp);
+    return 0;
+}
@@ -25,6 +25,7 @@
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #define XK_MISCELLANY                                                                                       // enable misc keysym definitions
 #include <X11/keysymdef.h>
 #include <X11/XKBlib.h>
@@ -517,6 +518,29 @@ draw_rectangle (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint32_t col
     XDrawRectangle(display, win, gc, x1, y1, x2 - x1 + 1, y2 - y1 + 1);
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * put_image - copy image with w x h pixels and stride (in pixels) to position x, y
+ *
+ * The XImage only wraps the caller's buffer, so its data pointer is reset before the XImage is destroyed.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+put_image (const uint32_t * image, uint32_t stride, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    int         screen_num = DefaultScreen(display);
+    XImage *    ximage;
+
+    ximage = XCreateImage (display, DefaultVisual(display, screen_num), DefaultDepth(display, screen_num), ZPixmap, 0,
+                           (char *) image, w, h, 32, stride * sizeof (uint32_t));
+
+    if (ximage)
+    {
+        XPutImage (display, win, gc, ximage, 0, 0, x, y, w, h);
+        ximage->data = (char *) NULL;
+        XDestroyImage (ximage);
+    }
+}
+
 void
 x11_flush (void)
 {
@@ -29,6 +29,7 @@
 extern void                 x11_event (void);
 extern void                 fill_rectangle (uint16_t, uint16_t, uint16_t, uint16_t, uint32_t);
 extern void                 draw_rectangle (uint16_t, uint16_t, uint16_t, uint16_t, uint32_t);
+extern void                 put_image (const uint32_t *, uint32_t, uint16_t, uint16_t, uint16_t, uint16_t);
 extern void                 x11_flush (void);
 extern int                  x11_init (char *);
 extern void                 x11_deinit (void);
@@ -41,7 +41,7 @@ MyWidget::MyWidget(QWidget *parent) : QWidget(parent)
     y = (screenGeometry.height() - this->height()) / 2;
     this->move(x, y);
 
-    image = new QImage(image_width, image_height, QImage::Format_RGB888);
+    image = new QImage(image_width, image_height, QImage::Format_RGB32);
     image->fill(QColor(Qt::white).rgb());
 
     keyPress = new KeyPress(this);
@@ -116,15 +116,15 @@ MyWidget::MyWidget(QWidget *parent) : QWidget(parent)
     QObject::connect(snapshot_button, SIGNAL (released()), this, SLOT (save_snapshot ()));
 
     timer = new QTimer(this);
+    timer->setTimerType(Qt::PreciseTimer);
 
-    pixmapLabel = new QLabel (this);
-    pixmapLabel->setGeometry (20, 10, image_width, image_height);
+    image_pos = QPoint (20, 10);
 
     messageLabel = new QLabel("Message", this);
     messageLabel->setGeometry (350, 2 * ZX_SPECTRUM_DISPLAY_ROWS + 2 * ZX_SPECTRUM_BORDER_SIZE + 30, 100, 20);
 
     QObject::connect(timer, SIGNAL(timeout()), this, SLOT(redraw_display()));
-    timer->start(17); // time specified in ms (17 is ~20msec, but why?)
+    timer->start(20);                                                           // 50 Hz, precise timer
 }
 
 void MyWidget::redraw_display ()                                                // 50 Hz
@@ -132,16 +132,8 @@ void MyWidget::redraw_display ()
     static char buf[32];
     static uint32_t counter;
     static uint32_t seconds;
-    static int cnt;
-    cnt++;
 
-    if (cnt == 2)                                                               // update image with 25 Hz
-    {
-        cnt = 0;
-        zxscr_update_display ();
-        pixmapLabel->setPixmap(QPixmap::fromImage(*image));
-        pixmapLabel->show();
-    }
+    zxscr_update_display ();                                                    // calls image_changed() for changed areas
 
     counter++;
 
@@ -154,6 +146,22 @@ void MyWidget::redraw_display ()
     }
 }
 
+void MyWidget::image_changed (const QRect & rect)                             // rect in image coordinates
+{
+    update (rect.translated (image_pos));
+}
+
+void MyWidget::paintEvent(QPaintEvent * event)
+{
+    QRect src = event->rect().translated (-image_pos).intersected (image->rect());
+
+    if (! src.isEmpty())
+    {
+        QPainter painter(this);
+        painter.drawImage (src.topLeft() + image_pos, *image, src);
+    }
+}
+
 void MyWidget::do_reset()
 {
     z80_reset ();
@@ -49,9 +49,11 @@ public:
     MyWidget(QWidget *parent = nullptr);
     QImage *                image;
     KeyPress *              keyPress;
+    void image_changed (const QRect & rect);
 
 protected:
     void closeEvent(QCloseEvent *);
+    void paintEvent(QPaintEvent *);
 
 public slots:
     void redraw_display ();
@@ -71,7 +73,7 @@ private:
     QPushButton *   record_button;
     QPushButton *   pause_button;
     QTimer *        timer;
-    QLabel *        pixmapLabel;
+    QPoint          image_pos;
     QLabel *        messageLabel;
     QCheckBox *     autostartCheckBox;
 };
@@ -6873,6 +6873,7 @@ load_snapshot ()
         ixflags                 = 0;
         iyflags                 = 0;
         clockcycles             = 0;
+        video_ram_changed       = 1;                                    // pages were written without zx_ram_set_8()
 
         fclose (fp);
         z80_interrupt = 0;
@@ -7239,6 +7240,7 @@ z80_idle_time ()
         {
             cnt = 0;
             z80_interrupt = 1;
+            zxscr_publish_frame ();                             // frame end: hand over screen to GUI thread
         }
     }
 
@@ -177,7 +177,7 @@ zx_ram_get_8 (uint16_t addr)
  * zx_ram_set_8 () - store 8 bit value into RAM
  *------------------------------------------------------------------------------------------------------------------------
  */
-#if defined QT_CORE_LIB || defined DEBUG
+#ifdef DEBUG
 void
 zx_ram_set_8 (uint16_t addr, uint8_t value)
 {
@@ -185,29 +185,10 @@ zx_ram_set_8 (uint16_t addr, uint8_t value)
 
     if (addr >= ZX_RAM_BEGIN)
     {
-#ifdef QT_CORE_LIB
-        if (addr < ZX_SPECTRUM_ATTRIBUTES_START_ADDR)
-        {
-            while (video_ram_blocked_at == addr)
-            {
-                // wait
-            }
-            video_ram_changed = 1;
-        }
-        else if (addr < ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR)
+        if (zx_ram_is_screen (addr))
         {
-            while (attr_ram_blocked)
-            {
-                // wait
-            }
             video_ram_changed = 1;
         }
-#else
-        if (addr < ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR)
-        {
-            video_ram_changed = 1;
-        }
-#endif
 
         uint8_t * ptr = steccy_bankptr[addr >> 14] + (addr & 0x3FFF);
         *ptr = value;
@@ -70,6 +70,13 @@ uint8_t                             zx_ram_get_8 (uint16_t addr);
  */
 #define zx_ram_get_screen_8(a)      (*((zx_ram_shadow_display ? steccy_rambankptr[7] : steccy_rambankptr[5]) + ((a) & 0x3FFF)))
 
+/*------------------------------------------------------------------------------------------------------------------------
+ * zx_ram_is_screen () - check if address is in the displayed screen, bank 5 or 7 may also be paged in at 0xC000
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define zx_ram_is_screen(a)         (((a) & 0x3FFF) < ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR - ZX_RAM_BEGIN &&                 \
+                                     steccy_bankptr[(a) >> 14] == (zx_ram_shadow_display ? steccy_rambankptr[7] : steccy_rambankptr[5]))
+
 /*------------------------------------------------------------------------------------------------------------------------
  * zx_ram_get_16 () - get 16 bit data from RAM
  *------------------------------------------------------------------------------------------------------------------------
@@ -80,7 +87,7 @@ uint8_t                             zx_ram_get_8 (uint16_t addr);
  * zx_ram_set_8 () - store 8 bit value into RAM
  *------------------------------------------------------------------------------------------------------------------------
  */
-#if defined QT_CORE_LIB || defined DEBUG
+#ifdef DEBUG
 extern void                         zx_ram_set_8 (uint16_t addr, uint8_t value);
 #else
 #define zx_ram_set_8(a,v)                                               \
@@ -88,7 +95,7 @@ do                                                                      \
 {                                                                       \
     if ((a) >= ZX_RAM_BEGIN)                                            \
     {                                                                   \
-        if ((a) < ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR)                 \
+        if (zx_ram_is_screen (a))                                       \
         {                                                               \
             video_ram_changed = 1;                                      \
         }                                                               \
@@ -33,6 +33,7 @@
 #include "zxscr.h"
 
 #if defined QT_CORE_LIB
+#include <QAtomicInt>
 #include "mywindow.h"
 static MyWidget *                   myw;
 #elif defined STM32F4XX
@@ -41,13 +42,7 @@ static MyWidget *                   myw;
 #include "wii-gamepad.h"
 #endif
 
-#ifdef QT_CORE_LIB
-volatile uint16_t           video_ram_blocked_at    = 0x0000;               // address of video ram currently blocked
-volatile uint8_t            attr_ram_blocked        = 0;                    // flag: attribute ram currently blocked
-volatile uint8_t            video_ram_changed       = 1;                    // flag: video ram changed
-#else
 uint8_t                     video_ram_changed       = 1;                    // flag: video ram changed
-#endif
 
 /*------------------------------------------------------------------------------------------------------------------------
  * Border Color - 3 Bits used
@@ -60,25 +55,25 @@ uint8_t                     zx_border_color;                                // c
  *------------------------------------------------------------------------------------------------------------------------
  */
 #ifdef QT_CORE_LIB
-static uint8_t rgbvalues[16][3] =
+static const QRgb rgbvalues[16] =
 {
-    { 0x00, 0x00, 0x00 },                            // black
-    { 0x00, 0x00, 0xF0 },                            // blue
-    { 0xF0, 0x00, 0x00 },                            // red
-    { 0xF0, 0x00, 0xF0 },                            // magenta
-    { 0x00, 0xF0, 0x00 },                            // green
-    { 0x00, 0xF0, 0xF0 },                            // cyan
-    { 0xF0, 0xF0, 0x00 },                            // yellow
-    { 0xF0, 0xF0, 0xF0 },                            // white
-
-    { 0x00, 0x00, 0x00 },                            // black
-    { 0x00, 0x00, 0xFF },                            // blue
-    { 0xFF, 0x00, 0x00 },                            // red
-    { 0xFF, 0x00, 0xFF },                            // magenta
-    { 0x00, 0xFF, 0x00 },                            // green
-    { 0x00, 0xFF, 0xFF },                            // cyan
-    { 0xFF, 0xFF, 0x00 },                            // yellow
-    { 0xFF, 0xFF, 0xFF },                            // white
+    qRgb (0x00, 0x00, 0x00),                        // black
+    qRgb (0x00, 0x00, 0xF0),                        // blue
+    qRgb (0xF0, 0x00, 0x00),                        // red
+    qRgb (0xF0, 0x00, 0xF0),                        // magenta
+    qRgb (0x00, 0xF0, 0x00),                        // green
+    qRgb (0x00, 0xF0, 0xF0),                        // cyan
+    qRgb (0xF0, 0xF0, 0x00),                        // yellow
+    qRgb (0xF0, 0xF0, 0xF0),                        // white
+
+    qRgb (0x00, 0x00, 0x00),                        // black
+    qRgb (0x00, 0x00, 0xFF),                        // blue
+    qRgb (0xFF, 0x00, 0x00),                        // red
+    qRgb (0xFF, 0x00, 0xFF),                        // magenta
+    qRgb (0x00, 0xFF, 0x00),                        // green
+    qRgb (0x00, 0xFF, 0xFF),                        // cyan
+    qRgb (0xFF, 0xFF, 0x00),                        // yellow
+    qRgb (0xFF, 0xFF, 0xFF),                        // white
 };
 
 /*------------------------------------------------------------------------------------------------------------------------
@@ -87,9 +82,14 @@ static uint8_t rgbvalues[16][3] =
  * screen memory layout:
  * 15 14 13 12 11 10  9  8  7  6  5  4  3  2  1  0
  * 0  1  0  y7 y6 y2 y1 y0 y5 y4 y3 x4 x3 x2 x1 x0
+ *
+ * The image has format RGB32, so pixels are written as whole QRgb rows via scanLine(). Only the rectangle which
+ * really changed is passed to the widget for repainting.
  *------------------------------------------------------------------------------------------------------------------------
  */
-#define ZOOM        2
+#define ZOOM            2
+#define IMAGE_WIDTH     (ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + 2 * ZX_SPECTRUM_BORDER_SIZE)
+#define IMAGE_HEIGHT    (ZOOM * ZX_SPECTRUM_DISPLAY_ROWS    + 2 * ZX_SPECTRUM_BORDER_SIZE)
 
 void
 zxscr_init_display (void)
@@ -98,6 +98,67 @@ zxscr_init_display (void)
     myw->show ();
 }
 
+/*------------------------------------------------------------------------------------------------------------------------
+ * Frames handed over from Z80 thread to GUI thread - triple buffer:
+ *
+ * The Z80 thread writes into the back buffer and exchanges it with the middle buffer at frame end. The GUI thread
+ * exchanges its front buffer with the middle buffer if the middle buffer is fresh. Neither thread ever waits.
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+#define ZXSCR_FRAME_SIZE        (ZX_SPECTRUM_NON_VIDEO_RAM_START_ADDR - ZX_SPECTRUM_DISPLAY_START_ADDRESS)   // 6912
+#define ZXSCR_FRAME_IDX_MASK    0x03
+#define ZXSCR_FRAME_FRESH       0x04                                        // flag: middle buffer not yet taken by GUI
+
+typedef struct
+{
+    uint8_t         screen[ZXSCR_FRAME_SIZE];                               // display and attribute ram
+    uint8_t         border_color;                                           // border color
+} ZXSCR_FRAME;
+
+static ZXSCR_FRAME  zxscr_frames[3];
+static int          zxscr_frame_back    = 0;                                // only used by Z80 thread
+static QAtomicInt   zxscr_frame_middle  (1);                                // index | ZXSCR_FRAME_FRESH
+static int          zxscr_frame_front   = 2;                                // only used by GUI thread
+
+/*------------------------------------------------------------------------------------------------------------------------
+ * zxscr_publish_frame - copy screen into back buffer and publish it, called by Z80 thread at frame end
+ *------------------------------------------------------------------------------------------------------------------------
+ */
+void
+zxscr_publish_frame (void)
+{
+    static uint8_t  last_zx_border_color    = 0xFF;
+    static uint8_t  last_shadow_display     = 0xFF;
+    ZXSCR_FRAME *   frame;
+
+    if (! video_ram_changed && last_zx_border_color == zx_border_color && last_shadow_display == zx_ram_shadow_display)
+    {
+        return;
+    }
+
+    video_ram_changed       = 0;
+    last_zx_border_color    = zx_border_color;
+    last_shadow_display     = zx_ram_shadow_display;
+
+    frame = zxscr_frames + zxscr_frame_back;
+    memcpy (frame->screen, zx_ram_screen_addr (ZX_SPECTRUM_DISPLAY_START_ADDRESS), ZXSCR_FRAME_SIZE);
+    frame->border_color = zx_border_color;
+
+    zxscr_frame_back = zxscr_frame_middle.fetchAndStoreOrdered (zxscr_frame_back | ZXSCR_FRAME_FRESH) & ZXSCR_FRAME_IDX_MASK;
+}
+
+static void
+zxscr_fill_row (uint16_t y, uint16_t x1, uint16_t x2, QRgb rgb)
+{
+    QRgb *      line = reinterpret_cast<QRgb *> (myw->image->scanLine (y));
+    uint16_t    x;
+
+    for (x = x1; x < x2; x++)
+    {
+        line[x] = rgb;
+    }
+}
+
 void
 zxscr_update_display (void)
 {
@@ -115,63 +176,60 @@ zxscr_update_display (void)
     uint8_t         attr;
     uint8_t         ink;
     uint8_t         paper;
-    uint8_t         video_ram_changed_copy;
+    uint8_t         fresh = 0;
+    ZXSCR_FRAME *   frame;
+    int             dirty_x1 = ZX_SPECTRUM_DISPLAY_COLUMNS;                 // changed area in spectrum pixels
+    int             dirty_y1 = ZX_SPECTRUM_DISPLAY_ROWS;
+    int             dirty_x2 = -1;
+    int             dirty_y2 = -1;
     static uint8_t  called;
 
-    video_ram_changed_copy = video_ram_changed;                             // use a local value, because other task changes it
-    video_ram_changed = 1;
+    if (zxscr_frame_middle.loadAcquire () & ZXSCR_FRAME_FRESH)              // new frame published by Z80 thread?
+    {
+        zxscr_frame_front = zxscr_frame_middle.fetchAndStoreOrdered (zxscr_frame_front) & ZXSCR_FRAME_IDX_MASK;
+        fresh = 1;
+    }
+
+    frame = zxscr_frames + zxscr_frame_front;
 
     counter++;
 
-    if (counter == 16)                                                      // change every 16/25 = 32/50 seconds bg and fg
+    if (counter == 32)                                                      // change every 32/50 seconds bg and fg
     {
         inverse = inverse ? 0 : 1;
         counter = 0;
     }
 
-    if (last_zx_border_color != zx_border_color)
+    if (last_zx_border_color != frame->border_color)
     {
         uint16_t    y;
-        uint16_t    x;
-        QRgb        rgb = qRgb(rgbvalues[zx_border_color][0], rgbvalues[zx_border_color][1], rgbvalues[zx_border_color][2]);
+        QRgb        rgb = rgbvalues[frame->border_color];
 
         for (y = 0; y < ZX_SPECTRUM_BORDER_SIZE; y++)
         {
-            for (x = 0; x < ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZOOM * ZX_SPECTRUM_BORDER_SIZE; x++)
-            {
-                myw->image->setPixel(x, y, rgb);
-            }
+            zxscr_fill_row (y, 0, IMAGE_WIDTH, rgb);
         }
 
         for (y = ZX_SPECTRUM_BORDER_SIZE; y < ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZX_SPECTRUM_BORDER_SIZE; y++)
         {
-            for (x = 0; x < ZX_SPECTRUM_BORDER_SIZE; x++)
-            {
-                myw->image->setPixel(x, y, rgb);
-                myw->image->setPixel(x + ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZX_SPECTRUM_BORDER_SIZE, y, rgb);
-            }
+            zxscr_fill_row (y, 0, ZX_SPECTRUM_BORDER_SIZE, rgb);
+            zxscr_fill_row (y, ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZX_SPECTRUM_BORDER_SIZE, IMAGE_WIDTH, rgb);
         }
 
-        for (y = ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZX_SPECTRUM_BORDER_SIZE;
-             y < ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZOOM * ZX_SPECTRUM_BORDER_SIZE;
-             y++)
+        for (y = ZOOM * ZX_SPECTRUM_DISPLAY_ROWS + ZX_SPECTRUM_BORDER_SIZE; y < IMAGE_HEIGHT; y++)
         {
-            for (x = 0; x < ZOOM * ZX_SPECTRUM_DISPLAY_COLUMNS + ZOOM * ZX_SPECTRUM_BORDER_SIZE; x++)
-            {
-                myw->image->setPixel(x, y, rgb);
-            }
+            zxscr_fill_row (y, 0, IMAGE_WIDTH, rgb);
         }
 
-        last_zx_border_color = zx_border_color;
+        last_zx_border_color = frame->border_color;
+        myw->image_changed (QRect (0, 0, IMAGE_WIDTH, IMAGE_HEIGHT));
     }
 
-    if (counter != 0 && ! video_ram_changed_copy)                                       // no flash inverting and no video ram content changed
+    if (counter != 0 && ! fresh)                                                        // no flash inverting and no new frame
     {
         return;
     }
 
-    attr_ram_blocked = 1;
-
     addr = ZX_SPECTRUM_DISPLAY_START_ADDRESS;
 
     for (r = 0; r < ZX_SPECTRUM_DISPLAY_ROWS; r++)
@@ -179,17 +237,18 @@ zxscr_update_display (void)
         row         = ((addr & 0x0700) >> 8) | ((addr & 0x00E0) >> 2) | ((addr & 0x1800) >> 5);
         attr_addr   = UINT16_T (ZX_SPECTRUM_ATTRIBUTES_START_ADDR + (((row >> 3) << 5)));
 
+        QRgb * line = reinterpret_cast<QRgb *> (myw->image->scanLine (ZX_SPECTRUM_BORDER_SIZE + ZOOM * row)) + ZX_SPECTRUM_BORDER_SIZE;
+
         for (col = 0; col < ZX_SPECTRUM_DISPLAY_COLUMNS; col += 8, addr++, attr_addr++)
         {
-            QRgb        rgbset;
-            QRgb        rgbreset;
+            QRgb        rgb[2];
+            QRgb *      p;
             uint16_t    mask = 0x80;
             uint16_t    idx;
+            uint16_t    z;
 
-            video_ram_blocked_at = addr;
-
-            value   = zx_ram_get_screen_8(addr);
-            attr    = zx_ram_get_screen_8(attr_addr);
+            value   = frame->screen[addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS];
+            attr    = frame->screen[attr_addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS];
 
             if (called &&                                                                   // ram initialized?
                 value == shadow_display[addr - ZX_SPECTRUM_DISPLAY_START_ADDRESS] &&        // value not changed?
@@ -228,35 +287,43 @@ zxscr_update_display (void)
                 ink += 8;
             }
 
-            rgbset      = qRgb(rgbvalues[ink][0], rgbvalues[ink][1], rgbvalues[ink][2]);
-            rgbreset    = qRgb(rgbvalues[paper][0], rgbvalues[paper][1], rgbvalues[paper][2]);
+            rgb[0]  = rgbvalues[paper];
+            rgb[1]  = rgbvalues[ink];
+            p       = line + ZOOM * col;
 
-            for (idx = 0; idx < 8; idx++)
+            for (idx = 0; idx < 8; idx++)                                                   // first line of the zoomed row
             {
-                if (value & mask)
-                {
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx),      ZX_SPECTRUM_BORDER_SIZE + ZOOM * row,     rgbset);
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx) + 1,  ZX_SPECTRUM_BORDER_SIZE + ZOOM * row,     rgbset);
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx),      ZX_SPECTRUM_BORDER_SIZE + ZOOM * row + 1, rgbset);
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx) + 1 , ZX_SPECTRUM_BORDER_SIZE + ZOOM * row + 1, rgbset);
-                }
-                else
+                QRgb    pixel = rgb[(value & mask) ? 1 : 0];
+
+                for (z = 0; z < ZOOM; z++)
                 {
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx),      ZX_SPECTRUM_BORDER_SIZE + ZOOM * row,     rgbreset);
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx) + 1,  ZX_SPECTRUM_BORDER_SIZE + ZOOM * row,     rgbreset);
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx),      ZX_SPECTRUM_BORDER_SIZE + ZOOM * row + 1, rgbreset);
-                    myw->image->setPixel(ZX_SPECTRUM_BORDER_SIZE + ZOOM * (col + idx) + 1 , ZX_SPECTRUM_BORDER_SIZE + ZOOM * row + 1, rgbreset);
+                    *p++ = pixel;
                 }
 
                 mask >>= 1;
             }
+
+            for (z = 1; z < ZOOM; z++)                                                      // copy it to the other lines
+            {
+                QRgb * q = reinterpret_cast<QRgb *> (myw->image->scanLine (ZX_SPECTRUM_BORDER_SIZE + ZOOM * row + z)) + ZX_SPECTRUM_BORDER_SIZE;
+                memcpy (q + ZOOM * col, line + ZOOM * col, 8 * ZOOM * sizeof (QRgb));
+            }
+
+            if (dirty_x1 > col)         dirty_x1 = col;
+            if (dirty_x2 < col + 7)     dirty_x2 = col + 7;
+            if (dirty_y1 > row)         dirty_y1 = row;
+            if (dirty_y2 < row)         dirty_y2 = row;
         }
     }
 
-    video_ram_blocked_at = 0x000;
-    memcpy (shadow_attr,  zx_ram_screen_addr(ZX_SPECTRUM_ATTRIBUTES_START_ADDR), 768);
-    attr_ram_blocked = 0;
+    memcpy (shadow_attr, frame->screen + (ZX_SPECTRUM_ATTRIBUTES_START_ADDR - ZX_SPECTRUM_DISPLAY_START_ADDRESS), 768);
     called = 1;
+
+    if (dirty_x2 >= 0)
+    {
+        myw->image_changed (QRect (ZX_SPECTRUM_BORDER_SIZE + ZOOM * dirty_x1, ZX_SPECTRUM_BORDER_SIZE + ZOOM * dirty_y1,
+                                   ZOOM * (dirty_x2 - dirty_x1 + 1), ZOOM * (dirty_y2 - dirty_y1 + 1)));
+    }
 }
 
 #elif defined STM32F4XX
@@ -62,21 +62,16 @@
 #define PAPER_MASK              (0x38)
 #define INK_MASK                (0x07)
 
-#ifdef QT_CORE_LIB
-extern volatile uint16_t        video_ram_blocked_at;                       // address of video ram currently blocked
-extern volatile uint8_t         attr_ram_blocked;                           // flag: attribute ram currently blocked
-extern volatile uint8_t         video_ram_changed;                          // flag: video ram changed
-#else
 extern uint8_t                  video_ram_changed;                          // flag: video ram changed
 #ifdef ILI9341
 extern uint_fast8_t             zxscr_display_cached;
 #endif
-#endif
 
 extern uint8_t                  zx_border_color;                            // current border color - 3 bits used
 
 #ifdef QT_CORE_LIB
 extern void                     zxscr_init_display (void);
+extern void                     zxscr_publish_frame (void);
 #endif
 
 extern void                     zxscr_update_display (void);